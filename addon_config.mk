@@ -50,6 +50,9 @@ common:
 	# they can be specified here
 	# ADDON_SOURCES =
 	
+	# the sim driver is a liboni plugin, not part of the app
+	ADDON_SOURCES_EXCLUDE = libs/onidriver_sim/%
+	
 	# source files that will be included as C files explicitly
 	# ADDON_C_SOURCES = 
 	
@@ -82,15 +85,19 @@ common:
 	# ADDON_LIBS += libs/opencv/lib/linuxarmv6l/libopencv_legacy.a
 	# ADDON_LIBS += libs/opencv/lib/linuxarmv6l/libopencv_calib3d.a
 	# ...
-	ADDON_LIBS += libs/liboni/lib/vs/liboni.lib
-	ADDON_LIBS += libs/liboni/lib/vs/onidriver_riffa.lib
-	ADDON_LIBS += libs/liboni/lib/vs/riffa.lib
 	
 linux64:
 	# linux only, any library that should be included in the project using
 	# pkg-config
 	# ADDON_PKG_CONFIG_LIBRARIES =
+	# liboni is expected to be installed system wide; the sim driver is built
+	# separately (make -C libs/onidriver_sim) and loaded by liboni at runtime
+	ADDON_LDFLAGS = -loni -ldl
+	ADDON_LIBS_EXCLUDE = libs/liboni/lib/vs
 vs:
+	ADDON_LIBS += libs/liboni/lib/vs/liboni.lib
+	ADDON_LIBS += libs/liboni/lib/vs/onidriver_riffa.lib
+	ADDON_LIBS += libs/liboni/lib/vs/riffa.lib
 	# After compiling copy the following dynamic libraries to the executable directory
 	# only windows visual studio
 	# ADDON_DLLS_TO_COPY = 
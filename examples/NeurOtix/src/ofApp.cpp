@@ -4,6 +4,7 @@
 #define ONI_LOG_FU 1
 #include "Context.h"
 #include "ContextInterface.h"
+#include "onidriver_sim.h"
 
 ONI::Context context;
 ONI::Interface::ContextInterface oni;
@@ -155,15 +156,39 @@ void ofApp::setup(){
     ONI::Processor::RecordProcessor* recordProcessor = context.createRecordProcessor();
     recordProcessor->setup();
 
+    ONI::Processor::ArtifactProcessor* artifactProcessor = context.createArtifactProcessor();
+    artifactProcessor->setup(rhs2116StimProcessor); // before the filters so the stim artifact never reaches them
+
     ONI::Processor::FilterProcessor* filterProcessor = context.createFilterProcessor();
-    filterProcessor->setup(rhs2116StimProcessor);
+    filterProcessor->setup(artifactProcessor);
+    filterProcessor->setStimFilterState(ONI::Settings::STIM_FILTER_HOLD);
+
+    ONI::Processor::ReferenceProcessor* referenceProcessor = context.createReferenceProcessor();
+    referenceProcessor->setup(filterProcessor); // after the filters so the reference is taken off the band we look at
 
     ONI::Processor::BufferProcessor* bufferProcessor = context.createBufferProcessor();
-    bufferProcessor->setup(filterProcessor);
+    bufferProcessor->setup(referenceProcessor);
 
     ONI::Processor::SpikeProcessor* spikeProcessor = context.createSpikeProcessor();
     spikeProcessor->setup(bufferProcessor);
 
+    ONI::Processor::SpikeSorterProcessor* spikeSorterProcessor = context.createSpikeSorterProcessor();
+    spikeSorterProcessor->setup(spikeProcessor);
+    recordProcessor->setSpikeSource(&spikeProcessor->getSpikeBroadcast()); // sorted spikes get saved with recordings, off the detection thread
+
+    ONI::Processor::ClosedLoopProcessor* closedLoopProcessor = context.createClosedLoopProcessor();
+    closedLoopProcessor->setup(spikeSorterProcessor); // after the sorter so rules can match units
+
+    // the sim driver can tell us when each TRIGGER write landed on the acquisition clock
+    volatile oni_ctx* ctx = ONI::Global::model.getOnixContext();
+    const oni_driver_info_t* driverInfo = *ctx == nullptr ? nullptr : oni_get_driver_info(*ctx);
+    if(driverInfo != nullptr && std::string(driverInfo->name) == "sim"){
+        closedLoopProcessor->setLandedTimeSource([ctx](uint64_t& landedTime){
+            size_t landedTimeSize = sizeof(landedTime);
+            return oni_get_driver_opt(*ctx, ONI_SIM_OPT_LASTTRIGGERTIME, &landedTime, &landedTimeSize) == ONI_ESUCCESS;
+        });
+    }
+
 
     rhs2116StimProcessor->applyStagedStimuliToDevice();
 
@@ -0,0 +1,41 @@
+#ifndef __ONI_DRIVER_SIM_H__
+#define __ONI_DRIVER_SIM_H__
+
+//
+//  onidriver_sim.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+//  Loopback "sim" ONI driver: presents the same device table as the rig
+//  (heartbeat 0, FMC 1/2, RHS2116 256/257/512/513, stim 258/514) and streams
+//  synthetic or file replayed RHS2116 frames through liboni so the whole
+//  Context -> processor pipeline can run without an FMC host board.
+//
+//  Load it with Context::setup("sim"); liboni looks for libonidriver_sim.so
+//  on the library path. Options can be set with oni_set_driver_opt or, so that
+//  nothing needs to change in the host app, with environment variables:
+//
+//    ONI_SIM_SPEED         stream rate as a multiple of 30.193 kHz (default 1,
+//                          0 streams as fast as the reader can take frames)
+//    ONI_SIM_REPLAY        path to a RecordProcessor data_stream_*.dat file to
+//                          replay instead of generating synthetic data
+//    ONI_SIM_SPIKE_HZ      mean synthetic firing rate per channel (default 5)
+//    ONI_SIM_NOISE_UV      synthetic noise standard deviation (default 8 uV)
+//
+
+#include <stdint.h>
+
+// Driver specific options for oni_set_driver_opt/oni_get_driver_opt
+enum {
+    ONI_SIM_OPT_SPEED = 0,          // double, multiple of the real sample rate, 0 == unpaced
+    ONI_SIM_OPT_REPLAYFILE,         // char*, path to a recorded data stream, empty == synthetic
+    ONI_SIM_OPT_SPIKEHZ,            // double, mean synthetic spike rate per channel
+    ONI_SIM_OPT_NOISEUV,            // double, synthetic noise standard deviation in uV
+    ONI_SIM_OPT_SAMPLECOUNT,        // uint64_t (read only), samples streamed since the acquisition counter reset
+    ONI_SIM_OPT_LASTTRIGGERTIME,    // uint64_t (read only), acquisition clock of the last stim TRIGGER write
+};
+
+#define ONI_SIM_SAMPLE_FREQUENCY_HZ 30193.2367151
+#define ONI_SIM_ACQ_CLOCK_HZ 250000000
+
+#endif
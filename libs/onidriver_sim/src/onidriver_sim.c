@@ -0,0 +1,789 @@
+//
+//  onidriver_sim.c
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+//  Loopback/simulation driver for liboni, see onidriver_sim.h
+//
+//  The driver has no hardware behind it: register traffic is answered from an
+//  in-memory register file through the same COBS framed signal stream that a
+//  real host board uses, and the data stream is synthesised (or replayed from
+//  a recording) one sample tick at a time as the reader pulls blocks from it.
+//
+//  Signal packets are [uint32 type][payload] COBS encoded and 0x00 delimited;
+//  data frames are [uint64 time][uint32 dev_idx][uint32 data_sz][data].
+//
+//  Register access comes in from whichever thread calls oni_write_reg (the gui,
+//  the detection thread for closed loop triggers) while the reader thread is
+//  synthesising, so everything on the ctx is behind ctx->mutex. The reader only
+//  lets go of it to sleep while pacing.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "oni.h"
+#include "onidriver.h"
+#include "onidriver_sim.h"
+
+#define SIM_NUM_DEVICES 9
+#define SIM_NUM_RHS2116 4
+#define SIM_NUM_HEADSTAGES 2
+#define SIM_RHS2116_CHANNELS 16
+#define SIM_NUM_CHANNELS (SIM_NUM_RHS2116 * SIM_RHS2116_CHANNELS)
+
+#define SIM_DEVICE_ID_HEARTBEAT 12
+#define SIM_DEVICE_ID_FMC 23
+#define SIM_DEVICE_ID_RHS2116 31
+#define SIM_DEVICE_ID_RHS2116TRIGGER 32
+
+#define SIM_RHS2116_READ_SIZE 74        // hub clock, 16 x ac, 16 x dc, unused
+#define SIM_HEARTBEAT_READ_SIZE 8       // hub clock
+#define SIM_FRAME_HEADER_SIZE 16
+#define SIM_REPLAY_RECORD_SIZE 90       // packed Rhs2116DataRaw written by RecordProcessor
+#define SIM_REPLAY_DATA_SIZE 74
+
+#define SIM_REG_TABLE_SIZE 8192         // power of two, open addressed
+#define SIM_SIGNAL_QUEUE_SIZE 65536     // power of two
+#define SIM_TICK_BUFFER_SIZE ((SIM_FRAME_HEADER_SIZE + SIM_REPLAY_DATA_SIZE) * (SIM_NUM_DEVICES + 1))
+
+#define SIM_SPIKE_LENGTH 45             // ~1.5 ms synthetic spike
+#define SIM_ARTIFACT_LENGTH 300         // ~10 ms synthetic stimulus artifact
+
+#define SIM_TWO_PI 6.283185307179586
+
+#define SIM_RHS2116_TRIGGER_ADDR 0x8006
+#define SIM_STIM_TRIGGER_ADDR 2          // TRIGGER on the stim trigger device, what Rhs2116StimDevice writes
+#define SIM_HEARTBEAT_ENABLE_ADDR 0
+#define SIM_HEARTBEAT_CLK_DIV_ADDR 1
+#define SIM_HEARTBEAT_CLK_HZ_ADDR 2
+#define SIM_FMC_LINKSTATE_ADDR 5
+
+// Signal packet types, these must match liboni
+typedef enum {
+    NULLSIG = (1u << 0),
+    CONFIGWACK = (1u << 1),
+    CONFIGWNACK = (1u << 2),
+    CONFIGRACK = (1u << 3),
+    CONFIGRNACK = (1u << 4),
+    DEVICETABLEACK = (1u << 5),
+    DEVICEINST = (1u << 6),
+} sim_signal_t;
+
+typedef struct {
+    oni_dev_idx_t dev_idx;
+    oni_reg_addr_t addr;
+    oni_reg_val_t value;
+    int used;
+} sim_reg_t;
+
+typedef struct {
+
+    pthread_mutex_t mutex;  // guards everything below, see the top of the file
+
+    oni_device_t devices[SIM_NUM_DEVICES];
+    sim_reg_t regs[SIM_REG_TABLE_SIZE];
+    oni_reg_val_t config[ONI_CONFIG_CUSTOMBEGIN];
+
+    uint8_t signal[SIM_SIGNAL_QUEUE_SIZE];
+    size_t signal_head;
+    size_t signal_tail;
+
+    uint8_t tick[SIM_TICK_BUFFER_SIZE];
+    size_t tick_len;
+    size_t tick_pos;
+
+    uint64_t sample_count;
+    uint64_t next_heartbeat_time;
+    uint64_t last_trigger_time;
+
+    double speed;
+    double spike_hz;
+    double noise_uv;
+
+    char replay_path[1024];
+    FILE *replay;
+
+    struct timespec pace_start;
+    uint64_t pace_start_sample;
+
+    uint64_t rng;
+    float spike_template[SIM_SPIKE_LENGTH];
+    float spike_amplitude[SIM_NUM_CHANNELS];
+    int spike_phase[SIM_NUM_CHANNELS];          // samples into the current spike, -1 == none
+    int64_t artifact_start[SIM_NUM_HEADSTAGES]; // sample of the last stim trigger, -1 == none
+
+} sim_ctx_t;
+
+static const oni_driver_info_t driverinfo = {.name = "sim", .major = 1, .minor = 0, .patch = 0, .pre_release = NULL};
+
+// The same device table as the rig; RHS2116 and stim devices sit on hubs 1 and 2
+static const oni_device_t sim_device_table[SIM_NUM_DEVICES] = {
+    {.idx = 0,   .id = SIM_DEVICE_ID_HEARTBEAT,      .version = 1, .read_size = SIM_HEARTBEAT_READ_SIZE, .write_size = 0},
+    {.idx = 1,   .id = SIM_DEVICE_ID_FMC,            .version = 1, .read_size = 0,                       .write_size = 0},
+    {.idx = 2,   .id = SIM_DEVICE_ID_FMC,            .version = 1, .read_size = 0,                       .write_size = 0},
+    {.idx = 256, .id = SIM_DEVICE_ID_RHS2116,        .version = 1, .read_size = SIM_RHS2116_READ_SIZE,   .write_size = 0},
+    {.idx = 257, .id = SIM_DEVICE_ID_RHS2116,        .version = 1, .read_size = SIM_RHS2116_READ_SIZE,   .write_size = 0},
+    {.idx = 258, .id = SIM_DEVICE_ID_RHS2116TRIGGER, .version = 1, .read_size = 0,                       .write_size = 0},
+    {.idx = 512, .id = SIM_DEVICE_ID_RHS2116,        .version = 1, .read_size = SIM_RHS2116_READ_SIZE,   .write_size = 0},
+    {.idx = 513, .id = SIM_DEVICE_ID_RHS2116,        .version = 1, .read_size = SIM_RHS2116_READ_SIZE,   .write_size = 0},
+    {.idx = 514, .id = SIM_DEVICE_ID_RHS2116TRIGGER, .version = 1, .read_size = 0,                       .write_size = 0},
+};
+
+static const oni_dev_idx_t sim_rhs2116_order[SIM_NUM_RHS2116] = {256, 257, 512, 513};
+
+// ---------------------------------------------------------------------------
+// helpers
+// ---------------------------------------------------------------------------
+
+static uint64_t sim_acq_time(uint64_t sample)
+{
+    return (uint64_t)((double)sample * ONI_SIM_ACQ_CLOCK_HZ / ONI_SIM_SAMPLE_FREQUENCY_HZ);
+}
+
+static uint64_t sim_rand(sim_ctx_t *ctx)
+{
+    // xorshift64*
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ctx->rng * 2685821657736338717ull;
+}
+
+static double sim_uniform(sim_ctx_t *ctx)
+{
+    return (sim_rand(ctx) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double sim_gaussian(sim_ctx_t *ctx)
+{
+    double u1 = sim_uniform(ctx);
+    double u2 = sim_uniform(ctx);
+    if (u1 < 1e-300) u1 = 1e-300;
+    return sqrt(-2.0 * log(u1)) * cos(SIM_TWO_PI * u2);
+}
+
+static int sim_find_device(const sim_ctx_t *ctx, oni_dev_idx_t dev_idx)
+{
+    for (int i = 0; i < SIM_NUM_DEVICES; i++)
+        if (ctx->devices[i].idx == dev_idx) return i;
+    return -1;
+}
+
+static double sim_env_double(const char *name, double fallback)
+{
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') return fallback;
+    return atof(value);
+}
+
+// ---------------------------------------------------------------------------
+// register file
+// ---------------------------------------------------------------------------
+
+static sim_reg_t *sim_reg_lookup(sim_ctx_t *ctx, oni_dev_idx_t dev_idx, oni_reg_addr_t addr, int create)
+{
+    size_t slot = ((dev_idx * 2654435761u) ^ (addr * 40503u)) & (SIM_REG_TABLE_SIZE - 1);
+    for (size_t i = 0; i < SIM_REG_TABLE_SIZE; i++) {
+        sim_reg_t *reg = &ctx->regs[(slot + i) & (SIM_REG_TABLE_SIZE - 1)];
+        if (reg->used && reg->dev_idx == dev_idx && reg->addr == addr) return reg;
+        if (!reg->used) {
+            if (!create) return NULL;
+            reg->used = 1;
+            reg->dev_idx = dev_idx;
+            reg->addr = addr;
+            reg->value = 0;
+            return reg;
+        }
+    }
+    return NULL; // table full
+}
+
+static void sim_reg_set(sim_ctx_t *ctx, oni_dev_idx_t dev_idx, oni_reg_addr_t addr, oni_reg_val_t value)
+{
+    sim_reg_t *reg = sim_reg_lookup(ctx, dev_idx, addr, 1);
+    if (reg != NULL) reg->value = value;
+}
+
+static oni_reg_val_t sim_reg_get(sim_ctx_t *ctx, oni_dev_idx_t dev_idx, oni_reg_addr_t addr)
+{
+    sim_reg_t *reg = sim_reg_lookup(ctx, dev_idx, addr, 0);
+    return reg == NULL ? 0 : reg->value;
+}
+
+static void sim_reg_defaults(sim_ctx_t *ctx)
+{
+    memset(ctx->regs, 0, sizeof(ctx->regs));
+
+    sim_reg_set(ctx, 0, SIM_HEARTBEAT_ENABLE_ADDR, 1);
+    sim_reg_set(ctx, 0, SIM_HEARTBEAT_CLK_HZ_ADDR, ONI_SIM_ACQ_CLOCK_HZ);
+    sim_reg_set(ctx, 0, SIM_HEARTBEAT_CLK_DIV_ADDR, ONI_SIM_ACQ_CLOCK_HZ / 100); // 100 Hz
+
+    sim_reg_set(ctx, 1, SIM_FMC_LINKSTATE_ADDR, 3); // pass and lock
+    sim_reg_set(ctx, 2, SIM_FMC_LINKSTATE_ADDR, 3);
+
+    for (int i = 0; i < SIM_NUM_RHS2116; i++)
+        sim_reg_set(ctx, sim_rhs2116_order[i], 0x8000, 1); // ENABLE
+}
+
+// ---------------------------------------------------------------------------
+// signal stream
+// ---------------------------------------------------------------------------
+
+static void sim_signal_push_byte(sim_ctx_t *ctx, uint8_t byte)
+{
+    ctx->signal[ctx->signal_head & (SIM_SIGNAL_QUEUE_SIZE - 1)] = byte;
+    ctx->signal_head++;
+}
+
+static void sim_signal_push(sim_ctx_t *ctx, sim_signal_t type, const void *payload, size_t payload_sz)
+{
+    uint8_t packet[sizeof(uint32_t) + sizeof(oni_device_t)];
+    uint32_t t = (uint32_t)type;
+    size_t len = sizeof(t) + payload_sz;
+
+    memcpy(packet, &t, sizeof(t));
+    if (payload_sz > 0) memcpy(packet + sizeof(t), payload, payload_sz);
+
+    // COBS encode straight into the queue
+    size_t code_pos = ctx->signal_head;
+    uint8_t code = 1;
+    sim_signal_push_byte(ctx, 0); // placeholder for the first code byte
+
+    for (size_t i = 0; i < len; i++) {
+        if (packet[i] == 0) {
+            ctx->signal[code_pos & (SIM_SIGNAL_QUEUE_SIZE - 1)] = code;
+            code_pos = ctx->signal_head;
+            sim_signal_push_byte(ctx, 0);
+            code = 1;
+        } else {
+            sim_signal_push_byte(ctx, packet[i]);
+            if (++code == 0xFF) {
+                ctx->signal[code_pos & (SIM_SIGNAL_QUEUE_SIZE - 1)] = code;
+                code_pos = ctx->signal_head;
+                sim_signal_push_byte(ctx, 0);
+                code = 1;
+            }
+        }
+    }
+
+    ctx->signal[code_pos & (SIM_SIGNAL_QUEUE_SIZE - 1)] = code;
+    sim_signal_push_byte(ctx, 0); // packet delimiter
+}
+
+static void sim_push_device_table(sim_ctx_t *ctx)
+{
+    oni_reg_val_t num_devs = SIM_NUM_DEVICES;
+    sim_signal_push(ctx, DEVICETABLEACK, &num_devs, sizeof(num_devs));
+    for (int i = 0; i < SIM_NUM_DEVICES; i++)
+        sim_signal_push(ctx, DEVICEINST, &ctx->devices[i], sizeof(oni_device_t));
+}
+
+// ---------------------------------------------------------------------------
+// data stream
+// ---------------------------------------------------------------------------
+
+static void sim_reset_acquisition(sim_ctx_t *ctx)
+{
+    ctx->sample_count = 0;
+    ctx->next_heartbeat_time = 0;
+    ctx->tick_len = 0;
+    ctx->tick_pos = 0;
+    ctx->pace_start_sample = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ctx->pace_start);
+    for (int i = 0; i < SIM_NUM_CHANNELS; i++) ctx->spike_phase[i] = -1;
+    for (int i = 0; i < SIM_NUM_HEADSTAGES; i++) ctx->artifact_start[i] = -1;
+}
+
+// seconds to wait before the next tick is due, the caller sleeps without holding the ctx
+static double sim_pace_wait(sim_ctx_t *ctx)
+{
+    if (ctx->speed <= 0) return 0;
+
+    double due = (double)(ctx->sample_count - ctx->pace_start_sample) / (ONI_SIM_SAMPLE_FREQUENCY_HZ * ctx->speed);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - ctx->pace_start.tv_sec) + (now.tv_nsec - ctx->pace_start.tv_nsec) * 1e-9;
+
+    return elapsed < due ? due - elapsed : 0;
+}
+
+static void sim_sleep(double wait)
+{
+    struct timespec ts = {.tv_sec = (time_t)wait, .tv_nsec = (long)((wait - (time_t)wait) * 1e9)};
+    nanosleep(&ts, NULL);
+}
+
+static void sim_write_frame(sim_ctx_t *ctx, uint64_t time, oni_dev_idx_t dev_idx, const void *data, uint32_t data_sz)
+{
+    uint8_t *out = ctx->tick + ctx->tick_len;
+    uint32_t idx = dev_idx;
+    memcpy(out, &time, sizeof(time));
+    memcpy(out + 8, &idx, sizeof(idx));
+    memcpy(out + 12, &data_sz, sizeof(data_sz));
+    memcpy(out + SIM_FRAME_HEADER_SIZE, data, data_sz);
+    ctx->tick_len += SIM_FRAME_HEADER_SIZE + data_sz;
+}
+
+static void sim_heartbeat(sim_ctx_t *ctx, uint64_t time)
+{
+    if (!sim_reg_get(ctx, 0, SIM_HEARTBEAT_ENABLE_ADDR)) return;
+    if (time < ctx->next_heartbeat_time) return;
+
+    oni_reg_val_t clk_div = sim_reg_get(ctx, 0, SIM_HEARTBEAT_CLK_DIV_ADDR);
+    if (clk_div == 0) clk_div = ONI_SIM_ACQ_CLOCK_HZ / 100;
+    ctx->next_heartbeat_time = time + clk_div;
+
+    sim_write_frame(ctx, time, 0, &time, SIM_HEARTBEAT_READ_SIZE);
+}
+
+static void sim_synthetic_tick(sim_ctx_t *ctx)
+{
+    const uint64_t time = sim_acq_time(ctx->sample_count);
+    const double spike_p = ctx->spike_hz / ONI_SIM_SAMPLE_FREQUENCY_HZ;
+    const double noise_counts = ctx->noise_uv / 0.195;
+
+    sim_heartbeat(ctx, time);
+
+    for (int d = 0; d < SIM_NUM_RHS2116; d++) {
+
+        uint8_t data[SIM_RHS2116_READ_SIZE];
+        uint16_t ac[SIM_RHS2116_CHANNELS];
+        uint16_t dc[SIM_RHS2116_CHANNELS];
+        uint16_t unused = 0;
+
+        const int headstage = d / 2;
+        const int64_t artifact_sample = ctx->artifact_start[headstage] < 0 ? -1 : (int64_t)ctx->sample_count - ctx->artifact_start[headstage];
+
+        for (int p = 0; p < SIM_RHS2116_CHANNELS; p++) {
+
+            const int channel = d * SIM_RHS2116_CHANNELS + p;
+            double uv = sim_gaussian(ctx) * ctx->noise_uv;
+
+            if (ctx->spike_phase[channel] < 0 && sim_uniform(ctx) < spike_p) ctx->spike_phase[channel] = 0;
+            if (ctx->spike_phase[channel] >= 0) {
+                uv += ctx->spike_template[ctx->spike_phase[channel]] * ctx->spike_amplitude[channel];
+                if (++ctx->spike_phase[channel] == SIM_SPIKE_LENGTH) ctx->spike_phase[channel] = -1;
+            }
+
+            if (artifact_sample >= 0 && artifact_sample < SIM_ARTIFACT_LENGTH) {
+                uv += 3000.0 * exp(-artifact_sample / 30.0) * (artifact_sample < 6 ? -1.0 : 1.0);
+            }
+
+            double counts = 32768.0 + uv / 0.195;
+            if (counts < 0) counts = 0;
+            if (counts > 65535) counts = 65535;
+            ac[p] = (uint16_t)counts;
+
+            double dc_counts = 512.0 + sim_gaussian(ctx) * noise_counts * 0.01;
+            dc[p] = (uint16_t)(dc_counts < 0 ? 0 : dc_counts > 1023 ? 1023 : dc_counts);
+        }
+
+        memcpy(data, &time, sizeof(time)); // hub clock
+        memcpy(data + 8, ac, sizeof(ac));
+        memcpy(data + 8 + sizeof(ac), dc, sizeof(dc));
+        memcpy(data + 8 + sizeof(ac) + sizeof(dc), &unused, sizeof(unused));
+
+        sim_write_frame(ctx, time, sim_rhs2116_order[d], data, SIM_RHS2116_READ_SIZE);
+    }
+
+    for (int h = 0; h < SIM_NUM_HEADSTAGES; h++)
+        if (ctx->artifact_start[h] >= 0 && (int64_t)ctx->sample_count - ctx->artifact_start[h] >= SIM_ARTIFACT_LENGTH)
+            ctx->artifact_start[h] = -1;
+
+    ctx->sample_count++;
+}
+
+static int sim_replay_tick(sim_ctx_t *ctx)
+{
+    // Replays recorded frames until the next frame from the first RHS2116
+    // device, which marks the start of the following sample tick
+    uint8_t record[SIM_REPLAY_RECORD_SIZE];
+    const uint64_t time = sim_acq_time(ctx->sample_count);
+
+    for (;;) {
+
+        long pos = ftell(ctx->replay);
+
+        if (fread(record, SIM_REPLAY_RECORD_SIZE, 1, ctx->replay) != 1) {
+            rewind(ctx->replay); // loop the recording
+            if (fread(record, SIM_REPLAY_RECORD_SIZE, 1, ctx->replay) != 1) return ONI_EREADFAILURE;
+            pos = 0;
+        }
+
+        uint32_t dev_idx, data_sz;
+        memcpy(&dev_idx, record + 8, sizeof(dev_idx));
+        memcpy(&data_sz, record + 12, sizeof(data_sz));
+        if (data_sz > SIM_REPLAY_DATA_SIZE) data_sz = SIM_REPLAY_DATA_SIZE;
+
+        if (dev_idx == sim_rhs2116_order[0] && ctx->tick_len > 0) {
+            fseek(ctx->replay, pos, SEEK_SET); // belongs to the next tick
+            break;
+        }
+
+        sim_write_frame(ctx, time, dev_idx, record + SIM_FRAME_HEADER_SIZE, data_sz);
+        if (ctx->tick_len + SIM_FRAME_HEADER_SIZE + SIM_REPLAY_DATA_SIZE > SIM_TICK_BUFFER_SIZE) break;
+    }
+
+    ctx->sample_count++;
+    return ONI_ESUCCESS;
+}
+
+static int sim_next_tick(sim_ctx_t *ctx)
+{
+    ctx->tick_len = 0;
+    ctx->tick_pos = 0;
+    if (ctx->replay != NULL) return sim_replay_tick(ctx);
+    sim_synthetic_tick(ctx);
+    return ONI_ESUCCESS;
+}
+
+static int sim_open_replay(sim_ctx_t *ctx, const char *path)
+{
+    if (ctx->replay != NULL) fclose(ctx->replay);
+    ctx->replay = NULL;
+    ctx->replay_path[0] = '\0';
+
+    if (path == NULL || *path == '\0') return ONI_ESUCCESS;
+
+    ctx->replay = fopen(path, "rb");
+    if (ctx->replay == NULL) return ONI_EPATHINVALID;
+
+    strncpy(ctx->replay_path, path, sizeof(ctx->replay_path) - 1);
+    return ONI_ESUCCESS;
+}
+
+// ---------------------------------------------------------------------------
+// register access through the config interface
+// ---------------------------------------------------------------------------
+
+static void sim_register_access(sim_ctx_t *ctx)
+{
+    const oni_dev_idx_t dev_idx = ctx->config[ONI_CONFIG_DEV_IDX];
+    const oni_reg_addr_t addr = ctx->config[ONI_CONFIG_REG_ADDR];
+    const int write = ctx->config[ONI_CONFIG_RW] != 0;
+    const int device = sim_find_device(ctx, dev_idx);
+
+    if (device < 0) {
+        sim_signal_push(ctx, write ? CONFIGWNACK : CONFIGRNACK, NULL, 0);
+        return;
+    }
+
+    if (write) {
+
+        const oni_reg_val_t value = ctx->config[ONI_CONFIG_REG_VALUE];
+
+        if (ctx->devices[device].id == SIM_DEVICE_ID_RHS2116TRIGGER && (addr == SIM_RHS2116_TRIGGER_ADDR || addr == SIM_STIM_TRIGGER_ADDR) && value == 1) {
+            // stimulus trigger: remember when it landed and put an artifact on that headstage
+            ctx->last_trigger_time = sim_acq_time(ctx->sample_count);
+            ctx->artifact_start[(dev_idx >> 8) - 1] = (int64_t)ctx->sample_count;
+        } else {
+            sim_reg_set(ctx, dev_idx, addr, value);
+        }
+
+        sim_signal_push(ctx, CONFIGWACK, NULL, 0);
+
+    } else {
+
+        oni_reg_val_t value = sim_reg_get(ctx, dev_idx, addr);
+        sim_signal_push(ctx, CONFIGRACK, &value, sizeof(value));
+
+    }
+}
+
+// ---------------------------------------------------------------------------
+// driver ABI
+// ---------------------------------------------------------------------------
+
+oni_driver_ctx oni_driver_create_ctx()
+{
+    sim_ctx_t *ctx = calloc(1, sizeof(sim_ctx_t));
+    if (ctx == NULL) return NULL;
+
+    if (pthread_mutex_init(&ctx->mutex, NULL) != 0) {
+        free(ctx);
+        return NULL;
+    }
+
+    memcpy(ctx->devices, sim_device_table, sizeof(sim_device_table));
+
+    ctx->speed = sim_env_double("ONI_SIM_SPEED", 1.0);
+    ctx->spike_hz = sim_env_double("ONI_SIM_SPIKE_HZ", 5.0);
+    ctx->noise_uv = sim_env_double("ONI_SIM_NOISE_UV", 8.0);
+    ctx->rng = 0x9E3779B97F4A7C15ull;
+
+    // biphasic extracellular spike shape, trough normalised to -1
+    for (int i = 0; i < SIM_SPIKE_LENGTH; i++) {
+        double t = (double)i;
+        ctx->spike_template[i] = (float)(-exp(-pow((t - 10.0) / 3.0, 2.0)) + 0.35 * exp(-pow((t - 20.0) / 6.0, 2.0)));
+    }
+
+    for (int i = 0; i < SIM_NUM_CHANNELS; i++)
+        ctx->spike_amplitude[i] = 60.0f + (float)((i * 37) % 90); // 60-150 uV
+
+    sim_reg_defaults(ctx);
+    sim_reset_acquisition(ctx);
+
+    if (sim_open_replay(ctx, getenv("ONI_SIM_REPLAY")) != ONI_ESUCCESS)
+        fprintf(stderr, "onidriver_sim: could not open replay file %s, using synthetic data\n", getenv("ONI_SIM_REPLAY"));
+
+    return ctx;
+}
+
+int oni_driver_destroy_ctx(oni_driver_ctx driver_ctx)
+{
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+    if (ctx->replay != NULL) fclose(ctx->replay);
+    pthread_mutex_destroy(&ctx->mutex);
+    free(ctx);
+    return ONI_ESUCCESS;
+}
+
+int oni_driver_init(oni_driver_ctx driver_ctx, int host_idx)
+{
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->config[ONI_CONFIG_HWADDRESS] = (oni_reg_val_t)host_idx;
+    pthread_mutex_unlock(&ctx->mutex);
+    return ONI_ESUCCESS;
+}
+
+int oni_driver_read_stream(oni_driver_ctx driver_ctx, oni_read_stream_t stream, void *data, size_t size)
+{
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+
+    uint8_t *out = (uint8_t *)data;
+
+    if (stream == ONI_READ_STREAM_SIGNAL) {
+        pthread_mutex_lock(&ctx->mutex);
+        if (ctx->signal_head - ctx->signal_tail < size) {
+            pthread_mutex_unlock(&ctx->mutex);
+            return ONI_EREADFAILURE; // nothing pending
+        }
+        for (size_t i = 0; i < size; i++) {
+            out[i] = ctx->signal[ctx->signal_tail & (SIM_SIGNAL_QUEUE_SIZE - 1)];
+            ctx->signal_tail++;
+        }
+        pthread_mutex_unlock(&ctx->mutex);
+        return (int)size;
+    }
+
+    if (stream == ONI_READ_STREAM_DATA) {
+        size_t copied = 0;
+        pthread_mutex_lock(&ctx->mutex);
+        while (copied < size) {
+            if (ctx->tick_pos == ctx->tick_len) {
+                double wait = sim_pace_wait(ctx);
+                if (wait > 0) {
+                    // register writes (eg., stim triggers) land while we wait
+                    pthread_mutex_unlock(&ctx->mutex);
+                    sim_sleep(wait);
+                    pthread_mutex_lock(&ctx->mutex);
+                }
+                int rc = sim_next_tick(ctx);
+                if (rc != ONI_ESUCCESS) {
+                    pthread_mutex_unlock(&ctx->mutex);
+                    return rc;
+                }
+            }
+            size_t n = ctx->tick_len - ctx->tick_pos;
+            if (n > size - copied) n = size - copied;
+            memcpy(out + copied, ctx->tick + ctx->tick_pos, n);
+            ctx->tick_pos += n;
+            copied += n;
+        }
+        pthread_mutex_unlock(&ctx->mutex);
+        return (int)size;
+    }
+
+    return ONI_EINVALARG;
+}
+
+int oni_driver_write_stream(oni_driver_ctx driver_ctx, oni_write_stream_t stream, const char *data, size_t size)
+{
+    // no writable devices in the sim table, so output frames are just accepted and dropped
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+    (void)stream;
+    (void)data;
+    return (int)size;
+}
+
+int oni_driver_read_config(oni_driver_ctx driver_ctx, oni_config_t config, oni_reg_val_t *value)
+{
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+    if (config >= ONI_CONFIG_CUSTOMBEGIN) return ONI_EINVALOPT;
+
+    switch (config) {
+        case ONI_CONFIG_SYSCLKHZ:
+        case ONI_CONFIG_ACQCLKHZ:
+            *value = ONI_SIM_ACQ_CLOCK_HZ;
+            break;
+        case ONI_CONFIG_TRIG:
+            *value = 0; // register access completes synchronously
+            break;
+        default:
+            pthread_mutex_lock(&ctx->mutex);
+            *value = ctx->config[config];
+            pthread_mutex_unlock(&ctx->mutex);
+            break;
+    }
+
+    return ONI_ESUCCESS;
+}
+
+// with ctx->mutex held
+static int sim_write_config(sim_ctx_t *ctx, oni_config_t config, oni_reg_val_t value)
+{
+    switch (config) {
+        case ONI_CONFIG_SYSCLKHZ:
+        case ONI_CONFIG_ACQCLKHZ:
+            return ONI_EREADONLY;
+        case ONI_CONFIG_TRIG:
+            if (value != 0) sim_register_access(ctx);
+            return ONI_ESUCCESS;
+        case ONI_CONFIG_RESET:
+            if (value != 0) {
+                ctx->signal_head = ctx->signal_tail = 0;
+                ctx->config[ONI_CONFIG_RUNNING] = 0;
+                sim_reset_acquisition(ctx);
+                sim_push_device_table(ctx);
+            }
+            return ONI_ESUCCESS;
+        case ONI_CONFIG_RESETACQCOUNTER:
+            if (value != 0) sim_reset_acquisition(ctx);
+            if (value == 2) ctx->config[ONI_CONFIG_RUNNING] = 1; // reset and run
+            return ONI_ESUCCESS;
+        case ONI_CONFIG_RUNNING:
+            if (value != 0 && ctx->config[ONI_CONFIG_RUNNING] == 0) {
+                clock_gettime(CLOCK_MONOTONIC, &ctx->pace_start); // restart pacing from now
+                ctx->pace_start_sample = ctx->sample_count;
+            }
+            ctx->config[config] = value;
+            return ONI_ESUCCESS;
+        default:
+            ctx->config[config] = value;
+            return ONI_ESUCCESS;
+    }
+}
+
+int oni_driver_write_config(oni_driver_ctx driver_ctx, oni_config_t config, oni_reg_val_t value)
+{
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+    if (config >= ONI_CONFIG_CUSTOMBEGIN) return ONI_EINVALOPT;
+
+    pthread_mutex_lock(&ctx->mutex);
+    int rc = sim_write_config(ctx, config, value);
+    pthread_mutex_unlock(&ctx->mutex);
+    return rc;
+}
+
+int oni_driver_set_opt_callback(oni_driver_ctx driver_ctx, int oni_option, const void *value, size_t option_len)
+{
+    // block sizes etc are handled by liboni; nothing to adjust here
+    (void)driver_ctx;
+    (void)oni_option;
+    (void)value;
+    (void)option_len;
+    return ONI_ESUCCESS;
+}
+
+// with ctx->mutex held
+static int sim_set_opt(sim_ctx_t *ctx, int driver_option, const void *value, size_t option_len)
+{
+    switch (driver_option) {
+        case ONI_SIM_OPT_SPEED:
+            if (option_len != sizeof(double)) return ONI_EBUFFERSIZE;
+            ctx->speed = *(const double *)value;
+            clock_gettime(CLOCK_MONOTONIC, &ctx->pace_start);
+            ctx->pace_start_sample = ctx->sample_count;
+            return ONI_ESUCCESS;
+        case ONI_SIM_OPT_REPLAYFILE:
+            return sim_open_replay(ctx, (const char *)value);
+        case ONI_SIM_OPT_SPIKEHZ:
+            if (option_len != sizeof(double)) return ONI_EBUFFERSIZE;
+            ctx->spike_hz = *(const double *)value;
+            return ONI_ESUCCESS;
+        case ONI_SIM_OPT_NOISEUV:
+            if (option_len != sizeof(double)) return ONI_EBUFFERSIZE;
+            ctx->noise_uv = *(const double *)value;
+            return ONI_ESUCCESS;
+        case ONI_SIM_OPT_SAMPLECOUNT:
+        case ONI_SIM_OPT_LASTTRIGGERTIME:
+            return ONI_EREADONLY;
+        default:
+            return ONI_EINVALOPT;
+    }
+}
+
+int oni_driver_set_opt(oni_driver_ctx driver_ctx, int driver_option, const void *value, size_t option_len)
+{
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+
+    pthread_mutex_lock(&ctx->mutex);
+    int rc = sim_set_opt(ctx, driver_option, value, option_len);
+    pthread_mutex_unlock(&ctx->mutex);
+    return rc;
+}
+
+// with ctx->mutex held
+static int sim_get_opt(sim_ctx_t *ctx, int driver_option, void *value, size_t *option_len)
+{
+    switch (driver_option) {
+        case ONI_SIM_OPT_SPEED:
+        case ONI_SIM_OPT_SPIKEHZ:
+        case ONI_SIM_OPT_NOISEUV: {
+            if (*option_len < sizeof(double)) return ONI_EBUFFERSIZE;
+            double v = driver_option == ONI_SIM_OPT_SPEED ? ctx->speed : driver_option == ONI_SIM_OPT_SPIKEHZ ? ctx->spike_hz : ctx->noise_uv;
+            memcpy(value, &v, sizeof(v));
+            *option_len = sizeof(v);
+            return ONI_ESUCCESS;
+        }
+        case ONI_SIM_OPT_REPLAYFILE: {
+            size_t len = strlen(ctx->replay_path) + 1;
+            if (*option_len < len) return ONI_EBUFFERSIZE;
+            memcpy(value, ctx->replay_path, len);
+            *option_len = len;
+            return ONI_ESUCCESS;
+        }
+        case ONI_SIM_OPT_SAMPLECOUNT:
+        case ONI_SIM_OPT_LASTTRIGGERTIME: {
+            if (*option_len < sizeof(uint64_t)) return ONI_EBUFFERSIZE;
+            uint64_t v = driver_option == ONI_SIM_OPT_SAMPLECOUNT ? ctx->sample_count : ctx->last_trigger_time;
+            memcpy(value, &v, sizeof(v));
+            *option_len = sizeof(v);
+            return ONI_ESUCCESS;
+        }
+        default:
+            return ONI_EINVALOPT;
+    }
+}
+
+int oni_driver_get_opt(oni_driver_ctx driver_ctx, int driver_option, void *value, size_t *option_len)
+{
+    sim_ctx_t *ctx = (sim_ctx_t *)driver_ctx;
+    if (ctx == NULL) return ONI_ENULLCTX;
+
+    pthread_mutex_lock(&ctx->mutex);
+    int rc = sim_get_opt(ctx, driver_option, value, option_len);
+    pthread_mutex_unlock(&ctx->mutex);
+    return rc;
+}
+
+const oni_driver_info_t *oni_driver_info()
+{
+    return &driverinfo;
+}
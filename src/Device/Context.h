@@ -19,12 +19,14 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <syncstream>
 
 #include "../Type/GlobalTypes.h"
 #include "../Type/FrameTypes.h"
 #include "../Type/RegisterTypes.h"
 #include "../Type/SettingTypes.h"
+#include "../Type/RingBuffer.h"
 #include "../Type/Log.h"
 
 #include "../Device/BaseDevice.h"
@@ -37,8 +39,12 @@
 #include "../Processor/ChannelMapProcessor.h"
 #include "../Processor/RecordProcessor.h"
 #include "../Processor/SpikeProcessor.h"
+#include "../Processor/SpikeSorterProcessor.h"
+#include "../Processor/ClosedLoopProcessor.h"
 #include "../Processor/Rhs2116MultiProcessor.h"
 #include "../Processor/Rhs2116StimProcessor.h"
+#include "../Processor/ArtifactProcessor.h"
+#include "../Processor/ReferenceProcessor.h"
 #include "../Processor/FilterProcessor.h"
 #include "../Processor/AudioProcessor.h"
 
@@ -204,13 +210,35 @@ public:
 
 	}
 
-	bool setup(const std::string& driverName = "riffa", const uint32_t& blockReadBytes = 2048, const uint32_t& blockWriteBytes = 2048){
+	bool setup(const std::string& driverName = "riffa", const uint32_t& blockReadBytes = 2048, const uint32_t& blockWriteBytes = 2048, const size_t& frameRingSize = 65536){
 		this->driverName = driverName;
 		this->blockReadBytes = blockReadBytes;
 		this->blockWriteBytes = blockWriteBytes;
+		this->frameRingSize = frameRingSize;
 		return setupContext();
 	}
 
+	// frame ring between the hardware read thread and the dispatch thread
+	inline size_t getFrameRingSize(){
+		return frameRing.capacity();
+	}
+
+	inline size_t getFrameRingDepth(){
+		return frameRing.size();
+	}
+
+	inline size_t getFrameRingHighWaterMark(){
+		return frameRing.getHighWaterMark();
+	}
+
+	inline size_t getFrameRingOverflowCount(){
+		return frameRing.getOverflowCount();
+	}
+
+	inline size_t getFrameRingPushCount(){
+		return frameRing.getPushCount();
+	}
+
 	
 
 	ONI::Device::BaseDevice* getDevice(const uint32_t& idx){
@@ -329,6 +357,7 @@ public:
 		}
 		ONI::Global::model.getProcessors().clear();
 		ONI::Global::model.getDevices().clear();
+		ONI::Global::model.rebuildDeviceTable();
 	}
 
 	inline const bool& isAcquiring(){
@@ -368,6 +397,16 @@ public:
 		return reinterpret_cast<ProcessorType*>(processors[typeID]);
 	}
 
+	ONI::Processor::ArtifactProcessor* createArtifactProcessor(){
+		ONI::Global::model.artifactProcessor = createProcessor<ONI::Processor::ArtifactProcessor>();
+		return ONI::Global::model.artifactProcessor;
+	}
+
+	ONI::Processor::ReferenceProcessor* createReferenceProcessor(){
+		ONI::Global::model.referenceProcessor = createProcessor<ONI::Processor::ReferenceProcessor>();
+		return ONI::Global::model.referenceProcessor;
+	}
+
 	ONI::Processor::FilterProcessor* createFilterProcessor(){
 		ONI::Global::model.filterProcessor = createProcessor<ONI::Processor::FilterProcessor>();
 		return ONI::Global::model.filterProcessor;
@@ -393,6 +432,16 @@ public:
 		return ONI::Global::model.spikeProcessor;
 	}
 
+	ONI::Processor::SpikeSorterProcessor* createSpikeSorterProcessor(){
+		ONI::Global::model.spikeSorterProcessor = createProcessor<ONI::Processor::SpikeSorterProcessor>();
+		return ONI::Global::model.spikeSorterProcessor;
+	}
+
+	ONI::Processor::ClosedLoopProcessor* createClosedLoopProcessor(){
+		ONI::Global::model.closedLoopProcessor = createProcessor<ONI::Processor::ClosedLoopProcessor>();
+		return ONI::Global::model.closedLoopProcessor;
+	}
+
 	ONI::Processor::AudioProcessor* createAudioProcessor(){
 		ONI::Global::model.audioProcessor = createProcessor<ONI::Processor::AudioProcessor>();
 		return ONI::Global::model.audioProcessor;
@@ -428,6 +477,26 @@ public:
 		return ONI::Global::model.getSpikeProcessor();
 	}
 
+	ONI::Processor::SpikeSorterProcessor* getSpikeSorterProcessor(){
+		assert(ONI::Global::model.getSpikeSorterProcessor() != nullptr, "User must create the SpikeSorterProcessor first!");
+		return ONI::Global::model.getSpikeSorterProcessor();
+	}
+
+	ONI::Processor::ClosedLoopProcessor* getClosedLoopProcessor(){
+		assert(ONI::Global::model.getClosedLoopProcessor() != nullptr, "User must create the ClosedLoopProcessor first!");
+		return ONI::Global::model.getClosedLoopProcessor();
+	}
+
+	ONI::Processor::ArtifactProcessor* getArtifactProcessor(){
+		assert(ONI::Global::model.getArtifactProcessor() != nullptr, "User must create the ArtifactProcessor first!");
+		return ONI::Global::model.getArtifactProcessor();
+	}
+
+	ONI::Processor::ReferenceProcessor* getReferenceProcessor(){
+		assert(ONI::Global::model.getReferenceProcessor() != nullptr, "User must create the ReferenceProcessor first!");
+		return ONI::Global::model.getReferenceProcessor();
+	}
+
 	ONI::Processor::Rhs2116MultiProcessor* getRhs2116MultiProcessor(){
 		assert(ONI::Global::model.getRhs2116MultiProcessor() != nullptr, "User must create the Rhs2116MultiProcessor first!");
 		return  ONI::Global::model.getRhs2116MultiProcessor();
@@ -469,6 +538,8 @@ private:
 		bThread = true;
 		for(auto& device : ONI::Global::model.getDevices()) device.second->reset();
 		ONI::Global::model.resetAcquireTimeStart();
+		resetFrameRing();
+		dispatchThread = std::thread(&Context::dispatchFrames, this);
 		thread = std::thread(&Context::readFrames, this);
 	}
 
@@ -477,7 +548,23 @@ private:
 		if(!bThread) return;
 		bThread = false;
 		if(thread.joinable()) thread.join();
+		wakeDispatch();
+		if(dispatchThread.joinable()) dispatchThread.join();
+		ONI::Processor::Rhs2116MultiProcessor* multiProcessor = ONI::Global::model.getRhs2116MultiProcessor();
+		if(multiProcessor != nullptr) multiProcessor->flush(); // the last part block
 		ONI::Global::model.bIsAcquiring = false;
+		LOGINFO("Frame ring stats: %zu frames, high water mark %zu of %zu, %zu overflows", 
+				frameRing.getPushCount(), frameRing.getHighWaterMark(), frameRing.capacity(), frameRing.getOverflowCount());
+	}
+
+	void resetFrameRing(){
+		if(frameRing.capacity() != frameRingSize){
+			frameRingSize = frameRing.resize(frameRingSize);
+			ONI::Frame::RingFrame* slots = frameRing.getSlots();
+			for(size_t i = 0; i < frameRing.capacity(); ++i) slots[i].data = slots[i].payload; // point each slot at it's own payload once
+		}
+		while(frameRing.front() != nullptr) frameRing.pop(); // only safe while both threads are stopped
+		frameRing.resetStats();
 	}
 
 	bool setupContext(){
@@ -621,6 +708,8 @@ private:
 			}
 		}
 
+		ONI::Global::model.rebuildDeviceTable();
+
 	}
 
 	bool enumerateOnixDeviceTypes(){
@@ -672,6 +761,10 @@ private:
 
 	void readFrames(){
 
+		// this thread only drains the hardware into the frame ring; all the
+		// recording and processing happens on the dispatch thread so that a
+		// slow processor can never stall oni_read_frame and overrun the FIFO
+
 		while(bThread){
 
 			ONI::Processor::RecordProcessor* recordProcessor = ONI::Global::model.getRecordProcessor();
@@ -681,7 +774,6 @@ private:
 				}
 			}
 
-
 			int rc = ONI_ESUCCESS;
 
 			oni_frame_t *frame = NULL;
@@ -693,31 +785,84 @@ private:
 				bContextNeedsReset = true;
 			}else{
 
-				std::map<uint32_t, ONI::Device::BaseDevice*>& devices = ONI::Global::model.getDevices();
+				if(frame->data_sz > ONI_RING_FRAME_MAX_DATA){
+					LOGERROR("Frame too large for frame ring: %i bytes from device idx: %i", frame->data_sz, frame->dev_idx);
+				}else{
+					ONI::Frame::RingFrame* slot = frameRing.claim(); // nullptr if the dispatch thread has fallen a full ring behind
+					if(slot != nullptr){
+						slot->time = frame->time;
+						slot->dev_idx = frame->dev_idx;
+						slot->data_sz = frame->data_sz;
+						std::memcpy(slot->payload, frame->data, frame->data_sz);
+						frameRing.publish();
+						std::atomic_thread_fence(std::memory_order_seq_cst); // the publish before we look for a parked dispatch thread
+						if(bDispatchWaiting.load(std::memory_order_relaxed)) wakeDispatch();
+					}
+				}
 
-				auto it = devices.find((uint32_t)frame->dev_idx);
+			}
 
-				if(it == devices.end()){
-					LOGERROR("ONIDevice doesn't exist with idx: %i", frame->dev_idx);
-				}else{
+			oni_destroy_frame(frame);
 
-					auto device = it->second;
+		}
+
+	}
+
+	// spins a while when the ring runs dry, frames usually follow each other within
+	// microseconds, then parks until the read thread wakes it (or a millisecond goes
+	// by, in case a wake up is missed) so an idle acquisition doesn't hold a core
+	void dispatchFrames(){
 
-					ONI::Global::model.getRecordProcessor()->recordFrame(frame);
-					device->process(frame);	
+		using namespace std::chrono;
+
+		size_t idleSpins = 0;
+
+		while(bThread){
 
-					recordProcessor->sendHeartBeat();
+			ONI::Frame::RingFrame* slot = frameRing.front();
 
+			if(slot == nullptr){
+				if(++idleSpins < DISPATCH_SPIN_COUNT){
+					std::this_thread::yield();
+				}else{
+					std::unique_lock<std::mutex> lock(dispatchMutex);
+					bDispatchWaiting.store(true, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst); // saying we're parked before we look at the ring again
+					dispatchCondition.wait_for(lock, milliseconds(1), [&]{ return !bThread || frameRing.front() != nullptr; });
+					bDispatchWaiting.store(false, std::memory_order_relaxed);
 				}
+				continue;
+			}
+
+			idleSpins = 0;
+
+			oni_frame_t* frame = reinterpret_cast<oni_frame_t*>(slot); // RingFrame shares oni_frame_t's layout
+
+			ONI::Device::BaseDevice* device = ONI::Global::model.findDevice((uint32_t)frame->dev_idx);
+
+			if(device == nullptr){
+				LOGERROR("ONIDevice doesn't exist with idx: %i", frame->dev_idx);
+			}else{
+
+				ONI::Processor::RecordProcessor* recordProcessor = ONI::Global::model.getRecordProcessor();
+				recordProcessor->recordFrame(frame);
+				device->process(frame);	
+
+				recordProcessor->sendHeartBeat();
 
 			}
 
-			oni_destroy_frame(frame);
+			frameRing.pop();
 
 		}
 
 	}
 
+	inline void wakeDispatch(){
+		const std::lock_guard<std::mutex> lock(dispatchMutex);
+		dispatchCondition.notify_one();
+	}
+
 
 private:
 
@@ -727,8 +872,17 @@ private:
 	std::atomic_bool bThread = false;
 
 	std::thread thread;
+	std::thread dispatchThread;
 	std::mutex mutex;
 
+	ONI::SpscRingBuffer<ONI::Frame::RingFrame> frameRing;
+	size_t frameRingSize = 65536;
+
+	static constexpr size_t DISPATCH_SPIN_COUNT = 1024; // empty polls before the dispatch thread parks
+	std::atomic_bool bDispatchWaiting = false;
+	std::mutex dispatchMutex;
+	std::condition_variable dispatchCondition;
+
 	std::vector<oni_device_t> onixDeviceTypes = {};
 
 	int host_idx = -1;
@@ -56,19 +56,19 @@ public:
 
 	inline void process(oni_frame_t* frame){
 		//const std::lock_guard<std::mutex> lock(mutex);
-		if(postProcessors.size() > 0){
+		if(getPostProcessorList().size() > 0){
 			ONI::Frame::HeartBeatFrame processedFrame(frame, (uint64_t)ONI::Global::model.getAcquireDeltaTimeMicros(frame->time));
 			process(processedFrame);
 		}
-		for(auto& it : preProcessors){
-			it.second->process(frame);
+		for(auto& processor : getPreProcessorList()){
+			processor->process(frame);
 		}
 	}
 
 	inline void process(ONI::Frame::BaseFrame& frame){
 		//const std::lock_guard<std::mutex> lock(mutex);
-		for(auto& it : postProcessors){
-			it.second->process(frame);
+		for(auto& processor : getPostProcessorList()){
+			processor->process(frame);
 		}
 	}
 
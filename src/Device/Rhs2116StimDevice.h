@@ -85,6 +85,12 @@ public:
 		return false;
 	}
 
+	// same again for the closed loop path, without the debug log line (TRIGGER is never read back anyway)
+	inline bool triggerStimulusFast(){
+		if(settings.bTriggerDevice) return ONI::Device::BaseDevice::writeRegister(ONI::Register::Rhs2116Stimulus::TRIGGER, 1, true);
+		return false;
+	}
+
 	unsigned int readRegister(const ONI::Register::Rhs2116StimulusRegister& reg){
 		return ONI::Device::BaseDevice::readRegister(reg);
 	}
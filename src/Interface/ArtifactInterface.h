@@ -0,0 +1,108 @@
+//
+//  ArtifactInterface.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+#include "../Interface/BaseInterface.h"
+
+#include "ofxImGui.h"
+#include "ofxImPlot.h"
+#include "ofxFutilities.h"
+
+#pragma once
+
+namespace ONI{
+namespace Interface{
+
+class ArtifactInterface : public ONI::Interface::BaseInterface{
+
+public:
+
+	~ArtifactInterface(){};
+
+	void reset(){};
+	inline void process(oni_frame_t* frame){}; // nothing
+	inline void process(ONI::Frame::BaseFrame& frame){}; // nothing
+
+	inline void gui(ONI::Processor::BaseProcessor& processor){
+
+		ONI::Processor::ArtifactProcessor& ap = *reinterpret_cast<ONI::Processor::ArtifactProcessor*>(&processor);
+
+		numProbes = ap.numProbes;
+
+		ImGui::PushID(ap.getName().c_str());
+		ImGui::Text(ap.getName().c_str());
+
+		static char * suppressionOptions = "None\0Blank\0Hold\0Interpolate\0Template";
+
+		// read a field at a time by the frame thread, none of them depend on each other
+		ImGui::SetNextItemWidth(200);
+		int suppressionItem = ap.settings.suppressionType;
+		if(ImGui::Combo("Suppression", &suppressionItem, suppressionOptions, 5)) ap.settings.suppressionType = (ONI::Settings::ArtifactSuppressionType)suppressionItem;
+
+		if(ap.settings.suppressionType == ONI::Settings::ARTIFACT_TEMPLATE){
+
+			const float maxTemplateMs = ONI::MAX_ARTIFACT_TEMPLATE_SAMPLES / RHS2116_SAMPLES_PER_MS;
+
+			float templateMs = ap.settings.templateMs;
+			float templateLearningRate = ap.settings.templateLearningRate;
+
+			if(ImGui::SliderFloat("Template (ms)", &templateMs, 0.0f, maxTemplateMs)) ap.settings.templateMs = std::clamp(templateMs, 0.0f, maxTemplateMs);
+			if(ImGui::SliderFloat("Learning Rate", &templateLearningRate, 0.0f, 1.0f)) ap.settings.templateLearningRate = std::clamp(templateLearningRate, 0.0f, 1.0f);
+
+			if(ImGui::Button("Clear Templates")) ap.clearTemplates();
+			ImGui::SameLine();
+			ImGui::Text("Learnt from %llu windows", ap.getTemplateWindowCount());
+
+			plotTemplates(ap);
+
+		}
+
+		ImGui::Text("Stim windows: %llu suppressed: %0.1f ms", ap.getWindowCount(), ap.getSuppressedSampleCount() / RHS2116_SAMPLES_PER_MS);
+
+		ImGui::PopID();
+
+	}
+
+protected:
+
+	// templates for the selected probes overlaid in one plot
+	void plotTemplates(ONI::Processor::ArtifactProcessor& ap){
+
+		const size_t templateLength = ap.getTemplateLength();
+		if(templateLength == 0) return;
+
+		std::vector<bool>& channelSelect = ONI::Global::model.getChannelSelect();
+
+		if(ImPlot::BeginPlot("##artifacttemplates", ImVec2(-1, 200))){
+
+			ImPlot::SetupAxes("samples", "uV", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+
+			for(size_t probe = 0; probe < numProbes; ++probe){
+				if(channelSelect.size() == numProbes && !channelSelect[probe]) continue;
+				ImGui::PushID(probe);
+				ImPlot::SetNextLineStyle(ImPlot::GetColormapColor(probe));
+				ImPlot::PlotLine("##template", ap.getTemplate(probe), templateLength);
+				ImGui::PopID();
+			}
+
+			ImPlot::EndPlot();
+
+		}
+
+	}
+
+};
+
+} // namespace Interface
+} // namespace ONI
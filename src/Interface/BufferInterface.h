@@ -19,6 +19,7 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
 #include <syncstream>
 
 #include "../Interface/BaseInterface.h"
@@ -107,6 +108,8 @@ public:
 		double interfaceTimeMs =  (double)duration_cast<milliseconds>(duration<double>(1)).count() / (double)duration_cast<nanoseconds>(duration<double>(1)).count() * interfaceTimeNs;
 
 		ImGui::Text("Interface Time %0.3f (mS)", interfaceTimeMs);
+		ImGui::Text("Buffer Reads %llu Retries %llu Dropped Writes %llu", 
+					(unsigned long long)bp.getReadCount(), (unsigned long long)bp.getReadRetryCount(), (unsigned long long)bp.getDroppedWriteCount());
 
 		ImGui::Separator();
 		ImGui::InputFloat("AC Voltage Range", &acVoltageRange); 
@@ -114,6 +117,8 @@ public:
 		if(ImGui::Button("Force Calculate Std")) bp.calculateThresholds();
 		ImGui::SameLine();
 		ImGui::Checkbox("Auto Calculate Std", &bp.settings.bUseAutoThreshold);
+		ImGui::SameLine();
+		if(ImGui::Button("Benchmark Noise Estimators")) bp.benchmarkNoiseEstimators();
 		int t = bp.settings.autoThresholdMs;
 		ImGui::InputInt("Auto Refresh Time (ms)", &t); if(t < 0) t = 1;
 		bp.settings.autoThresholdMs = t;
@@ -194,6 +199,8 @@ private:
 
 		if(frameCount == 0) return;
 
+		std::shared_lock<std::shared_mutex> lock(bp.bufferMutex);
+
 		//ONI::Processor::Rhs2116StimProcessor* stim = ONI::Global::model.getRhs2116StimProcessor();
 
 
@@ -228,10 +235,9 @@ private:
 		for(size_t probe = 0; probe < numProbes; ++probe) {
 			size_t col = probe % 8;
 			size_t row = std::floor(probe / 8);
-			bp.dataMutex[SPARSE_MUTEX].lock();
-			float* voltages = bp.sparseBuffer.getAcuVFloatRaw(probe, bp.sparseBuffer.getCurrentIndex() - 1);
-			hm[row][col] = voltages[0];
-			bp.dataMutex[SPARSE_MUTEX].unlock();
+			bp.sparseBuffer.read(1, [&](const int& from){
+				hm[row][col] = bp.sparseBuffer.getAcuVFloatRaw(probe, from)[0];
+			});
 		}
 
 		float voltageRange = acVoltageRange;
@@ -252,10 +258,9 @@ private:
 		for(size_t probe = 0; probe < numProbes; ++probe) {
 			size_t col = probe % 8;
 			size_t row = std::floor(probe / 8);
-			bp.dataMutex[SPARSE_MUTEX].lock();
-			float* voltages = bp.sparseBuffer.getDcmVFloatRaw(probe, bp.sparseBuffer.getCurrentIndex() - 1);
-			hm[row][col] = voltages[0];
-			bp.dataMutex[SPARSE_MUTEX].unlock();
+			bp.sparseBuffer.read(1, [&](const int& from){
+				hm[row][col] = bp.sparseBuffer.getDcmVFloatRaw(probe, from)[0];
+			});
 		}
 
 		voltageRange = 5.0f;
@@ -315,7 +320,8 @@ private:
 		static ImGuiTableFlags flags = ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_RowBg;
 
 		static int offset = 0;
-		bp.dataMutex[SPARSE_MUTEX].lock();
+		std::shared_lock<std::shared_mutex> lock(bp.bufferMutex);
+		snapshotSparseBuffer(bp, plotType, frameCount);
 		if(ImGui::BeginTable("##probetable", 3, flags, ImVec2(-1, 0))){
 
 			ImGui::TableSetupColumn("Probe", ImGuiTableColumnFlags_WidthFixed, 75.0f);
@@ -338,13 +344,15 @@ private:
 				ImGui::TableSetColumnIndex(1);
 				//bp.dataMutex[SPARSE_MUTEX].unlock();
 				if(plotType == PLOT_AC_DATA){
-					ImGui::Text("%.3f avg \n%.3f dev \n%i N", bp.getProbeStatsUnlocked()[probe].mean, bp.getProbeStatsUnlocked()[probe].deviation, frameCount);
+					ONI::Frame::ProbeStatistics stats;
+					ONI::Processor::BufferProcessor::ProbeStatsSnapshot probeStats = bp.getProbeStatsUnlocked();
+					if(probe < probeStats->size()) stats = (*probeStats)[probe];
+					ImGui::Text("%.3f avg \n%.3f dev \n%.3f mad dev \n%i N", stats.mean, stats.deviation, stats.robustDeviation, frameCount);
 					ImGui::PushID(probe);
 					bool bUseProbe = ONI::Global::model.getBufferProcessor()->getActiveProbes()[probe];
 					if(ImGui::Checkbox("use", &bUseProbe)){
 						LOGDEBUG("Use: %i %d", (int)bUseProbe, probe);
-						ONI::Global::model.getBufferProcessor()->getActiveProbes()[probe] = bUseProbe;
-						ONI::Global::model.getBufferProcessor()->saveActiveProbes();
+						ONI::Global::model.getBufferProcessor()->setActiveProbe(probe, bUseProbe);
 					}
 					ImGui::PopID();
 				}
@@ -361,9 +369,7 @@ private:
 				ImGui::PushID(probe);
 				
 				//bp.dataMutex[SPARSE_MUTEX].lock();
-				float* voltages = nullptr;
-				if(plotType == PLOT_AC_DATA) voltages = bp.sparseBuffer.getAcuVFloatRaw(probe, bp.sparseBuffer.getCurrentIndex());
-				if(plotType == PLOT_DC_DATA) voltages = bp.sparseBuffer.getDcmVFloatRaw(probe, bp.sparseBuffer.getCurrentIndex());
+				float* voltages = &snapshotVoltages[probe * frameCount];
 
 				ONI::Processor::Rhs2116StimProcessor* stim = ONI::Global::model.getRhs2116StimProcessor();
 				ImPlot::PushStyleVar(ImPlotStyleVar_PlotPadding, ImVec2(0, 0));
@@ -387,7 +393,7 @@ private:
 					ImPlot::SetNextFillStyle(col, 0.6);
 
 					if(stim->isStimulusOnDevice(probe)){
-						float* stimV = bp.sparseBuffer.getStimFloatRaw(probe, bp.sparseBuffer.getCurrentIndex());
+						float* stimV = &snapshotStim[probe * frameCount];
 						ImPlot::PlotDigital("##stim", &bp.sparseTimeStamps[0], stimV, frameCount, ImPlotLineFlags_None, offset);
 					}
 
@@ -417,7 +423,7 @@ private:
 
 			ImGui::EndTable();
 		}
-		bp.dataMutex[SPARSE_MUTEX].unlock();
+		lock.unlock();
 		ImGui::PopID();
 		ImGui::End();
 
@@ -490,7 +496,8 @@ private:
 
 		ImGui::Begin(plotName.c_str());
 		ImGui::PushID("##CombinedProbePlot");
-		bp.dataMutex[SPARSE_MUTEX].lock();
+		std::shared_lock<std::shared_mutex> lock(bp.bufferMutex);
+		snapshotSparseBuffer(bp, plotType, frameCount);
 		if(ImPlot::BeginPlot("Probe Voltages", ImVec2(-1, -1))){
 
 			ImPlot::SetupAxes("mS", unitStr.c_str());
@@ -508,9 +515,7 @@ private:
 				ImPlot::SetupAxesLimits(0, bp.sparseTimeStamps[frameCount - 1] - 1, -voltageRange, voltageRange, ImGuiCond_Always);
 
 				//bp.dataMutex[SPARSE_MUTEX].lock();
-				float* voltages = nullptr;
-				if(plotType == PLOT_AC_DATA) voltages = bp.sparseBuffer.getAcuVFloatRaw(probe, bp.sparseBuffer.getCurrentIndex());
-				if(plotType == PLOT_DC_DATA) voltages = bp.sparseBuffer.getDcmVFloatRaw(probe, bp.sparseBuffer.getCurrentIndex());
+				float* voltages = &snapshotVoltages[probe * frameCount];
 
 				ImPlot::SetNextLineStyle(col);
 				ImPlot::PlotLine("##probe", &bp.sparseTimeStamps[0], voltages, frameCount, ImPlotLineFlags_None, offset);
@@ -535,7 +540,7 @@ private:
 					ImPlot::SetNextLineStyle(col, 0.0);
 					ImPlot::SetNextFillStyle(col, 0.6);
 					//bp.dataMutex[SPARSE_MUTEX].lock();
-					float * stim = bp.sparseBuffer.getStimFloatRaw(probe, bp.sparseBuffer.getCurrentIndex());
+					float * stim = &snapshotStim[probe * frameCount];
 					ImPlot::PlotDigital("##stim", &bp.sparseTimeStamps[0], &stim[0], frameCount, ImPlotLineFlags_None, offset);
 					//bp.dataMutex[SPARSE_MUTEX].unlock();
 
@@ -549,14 +554,40 @@ private:
 			ImPlot::EndPlot();
 
 		}
-		bp.dataMutex[SPARSE_MUTEX].unlock();
+		lock.unlock();
 		ImGui::PopID();
 		ImGui::End();
 
 	}
 
+	// copy the sparse buffer (oldest sample first) so we can take our time plotting it
+	// without racing the writer, if we keep getting lapped we just draw the last copy
+	inline void snapshotSparseBuffer(ONI::Processor::BufferProcessor& bp, const ONI::Interface::PlotType& plotType, const size_t& frameCount){
+
+		const size_t numProbes = bp.numProbes;
+
+		if(snapshotVoltages.size() != numProbes * frameCount){
+			snapshotVoltages.assign(numProbes * frameCount, 0.0f);
+			snapshotStim.assign(numProbes * frameCount, 0.0f);
+		}
+
+		ONI::Processor::Rhs2116StimProcessor* stim = ONI::Global::model.getRhs2116StimProcessor();
+
+		bp.sparseBuffer.read(frameCount, [&](const int& from){
+			for(size_t probe = 0; probe < numProbes; ++probe){
+				float* voltages = plotType == PLOT_AC_DATA ? bp.sparseBuffer.getAcuVFloatRaw(probe, from) : bp.sparseBuffer.getDcmVFloatRaw(probe, from);
+				std::memcpy(&snapshotVoltages[probe * frameCount], voltages, sizeof(float) * frameCount);
+				if(stim->isStimulusOnDevice(probe)) std::memcpy(&snapshotStim[probe * frameCount], bp.sparseBuffer.getStimFloatRaw(probe, from), sizeof(float) * frameCount);
+			}
+		});
+
+	}
+
 protected:
 
+	std::vector<float> snapshotVoltages;
+	std::vector<float> snapshotStim;
+
 	bool bShowStdDev = true;
 
 	std::atomic_uint64_t interfaceTimeNs = 0;
@@ -0,0 +1,165 @@
+//
+//  ClosedLoopInterface.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+#include "../Interface/BaseInterface.h"
+
+#include "ofxImGui.h"
+#include "ofxImPlot.h"
+#include "ofxFutilities.h"
+
+#pragma once
+
+namespace ONI{
+namespace Interface{
+
+class ClosedLoopInterface : public ONI::Interface::BaseInterface{
+
+public:
+
+	~ClosedLoopInterface(){};
+
+	void reset(){};
+	inline void process(oni_frame_t* frame){}; // nothing
+	inline void process(ONI::Frame::BaseFrame& frame){}; // nothing
+
+	inline void gui(ONI::Processor::BaseProcessor& processor){
+
+		ONI::Processor::ClosedLoopProcessor& clp = *reinterpret_cast<ONI::Processor::ClosedLoopProcessor*>(&processor);
+
+		ImGui::PushID(clp.getName().c_str());
+		ImGui::Text(clp.getName().c_str());
+
+		static bool bNeedsUpdate = false;
+		static bool bFirstLoad = true;
+		if(bFirstLoad){
+			nextSettings = clp.getSettings();
+			bFirstLoad = false;
+		}
+
+		if(ImGui::Checkbox("Armed", &nextSettings.bArmed)) bNeedsUpdate = true;
+
+		int ruleToRemove = -1;
+
+		for(size_t i = 0; i < nextSettings.rules.size(); ++i){
+
+			ONI::Settings::ClosedLoopRule& rule = nextSettings.rules[i];
+
+			ImGui::PushID((int)i);
+			ImGui::Separator();
+			ImGui::Text("Rule %i", (int)i);
+
+			if(ImGui::Checkbox("Enabled", &rule.bEnabled)) bNeedsUpdate = true;
+			ImGui::SameLine();
+			if(ImGui::Checkbox("Ignore Stim Spikes", &rule.bIgnoreStimSpikes)) bNeedsUpdate = true;
+
+			if(ImGui::Button("Use Selected Channels")){
+				rule.probes.clear();
+				std::vector<bool>& channelSelect = ONI::Global::model.getChannelSelect();
+				for(size_t probe = 0; probe < channelSelect.size(); ++probe) if(channelSelect[probe]) rule.probes.push_back(probe);
+				bNeedsUpdate = true;
+			}
+			ImGui::SameLine();
+			if(rule.probes.size() == 0){
+				ImGui::Text("Any probe");
+			}else{
+				ImGui::Text("%i probes", (int)rule.probes.size());
+			}
+
+			if(ImGui::InputInt("Unit ID", &rule.unitID)) bNeedsUpdate = true;
+			if(ImGui::SliderInt("Min Spikes", &rule.minSpikes, 1, ONI::MAX_CLOSED_LOOP_SPIKES)) bNeedsUpdate = true;
+			if(ImGui::InputFloat("Window (ms)", &rule.windowMs)) bNeedsUpdate = true;
+			if(ImGui::InputFloat("Refractory (ms)", &rule.refractoryMs)) bNeedsUpdate = true;
+			if(ImGui::InputInt("Stim Device IDX", &rule.stimDeviceIDX)) bNeedsUpdate = true;
+
+			rule.unitID = std::max(rule.unitID, -1);
+			rule.minSpikes = std::clamp(rule.minSpikes, 1, (int)ONI::MAX_CLOSED_LOOP_SPIKES);
+			rule.windowMs = std::max(rule.windowMs, 0.0f);
+			rule.refractoryMs = std::max(rule.refractoryMs, 0.0f);
+			rule.stimDeviceIDX = std::max(rule.stimDeviceIDX, -1);
+
+			if(ImGui::Button("Remove Rule")) ruleToRemove = i;
+
+			ImGui::PopID();
+
+		}
+
+		if(ruleToRemove != -1){
+			nextSettings.rules.erase(nextSettings.rules.begin() + ruleToRemove);
+			bNeedsUpdate = true;
+		}
+
+		ImGui::Separator();
+
+		const bool bRulesFull = nextSettings.rules.size() >= ONI::MAX_CLOSED_LOOP_RULES;
+		if(bRulesFull) ImGui::BeginDisabled();
+		if(ImGui::Button("Add Rule")){
+			nextSettings.rules.push_back(ONI::Settings::ClosedLoopRule());
+			bNeedsUpdate = true;
+		}
+		if(bRulesFull) ImGui::EndDisabled();
+
+		ImGui::SameLine();
+
+		const bool bBenchmarkRunning = clp.isBenchmarkRunning();
+		const bool bApplyDisabled = !bNeedsUpdate || bBenchmarkRunning; // the benchmark puts its own rules in and the old ones back after
+		if(bApplyDisabled) ImGui::BeginDisabled();
+
+		if(ImGui::Button("Apply Settings")){
+			if(clp.setSettings(nextSettings)) bNeedsUpdate = false; // staged for the detection thread to swap in
+		}
+
+		if(bApplyDisabled) ImGui::EndDisabled();
+
+		ONI::LatencyHistogram& triggerLatency = clp.getTriggerLatency();
+		ONI::LatencyHistogram& landedLatency = clp.getLandedLatency();
+
+		ImGui::Text("Triggers: %llu failed: %llu", clp.getTriggerCount(), clp.getFailedTriggerCount());
+		ImGui::Text("Crossing to trigger p50: %0.3f p99: %0.3f max: %0.3f ms",
+					triggerLatency.getPercentileNs(50) / 1000000.0, triggerLatency.getPercentileNs(99) / 1000000.0, triggerLatency.getMaxNs() / 1000000.0);
+		ImGui::Text("Crossing to landed  p50: %0.3f p99: %0.3f max: %0.3f ms",
+					landedLatency.getPercentileNs(50) / 1000000.0, landedLatency.getPercentileNs(99) / 1000000.0, landedLatency.getMaxNs() / 1000000.0);
+
+		if(ImGui::Button("Reset Stats")) clp.resetStats();
+		ImGui::SameLine();
+		if(!bBenchmarkRunning){
+			if(ImGui::Button("Benchmark Trigger Latency")) clp.startTriggerLatencyBenchmark();
+		}else{
+			if(ImGui::Button("Cancel Benchmark")) clp.cancelTriggerLatencyBenchmark();
+			ImGui::SameLine();
+			ImGui::ProgressBar(clp.getBenchmarkProgress(), ImVec2(-1, 0));
+		}
+
+		static bool bWasBenchmarkRunning = false;
+		if(bWasBenchmarkRunning && !bBenchmarkRunning) nextSettings = clp.getSettings(); // the rules it put back
+		bWasBenchmarkRunning = bBenchmarkRunning;
+
+		if(clp.hasBenchmarkResults()){
+			ImGui::Text("Benchmark over %llu triggers", clp.getBenchmarkTriggerCount());
+			ImGui::Text("Crossing to trigger p50: %0.3f p99: %0.3f max: %0.3f ms", clp.getBenchmarkTriggerP50Ms(), clp.getBenchmarkTriggerP99Ms(), clp.getBenchmarkTriggerMaxMs());
+			ImGui::Text("Crossing to landed  p50: %0.3f p99: %0.3f max: %0.3f ms", clp.getBenchmarkLandedP50Ms(), clp.getBenchmarkLandedP99Ms(), clp.getBenchmarkLandedMaxMs());
+		}
+
+		ImGui::PopID();
+
+	}
+
+protected:
+
+	ONI::Settings::ClosedLoopSettings nextSettings;
+
+};
+
+} // namespace Interface
+} // namespace ONI
@@ -33,6 +33,10 @@
 #include "../Interface/Rhs2116StimInterface.h"
 #include "../Interface/RecordInterface.h"
 #include "../Interface/SpikeInterface.h"
+#include "../Interface/SpikeSorterInterface.h"
+#include "../Interface/ClosedLoopInterface.h"
+#include "../Interface/ArtifactInterface.h"
+#include "../Interface/ReferenceInterface.h"
 #include "../Interface/FilterInterface.h"
 #include "../Interface/AudioInterface.h"
 
@@ -91,6 +95,9 @@ public:
 				}
 			}
 
+			ImGui::Text("Frame Ring: %zu / %zu (peak %zu) overflows: %zu",
+						context.getFrameRingDepth(), context.getFrameRingSize(), context.getFrameRingHighWaterMark(), context.getFrameRingOverflowCount());
+
 			ImGui::NewLine();
 
 			static ImGuiTableFlags flags = ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_Resizable | ImGuiTableFlags_Reorderable | ImGuiTableFlags_Hideable;
@@ -215,16 +222,36 @@ public:
 			if(ImGui::CollapsingHeader("AudioProcessor", true)) audioProcessorInterface.gui(*ONI::Global::model.getAudioProcessor());
 		}
 
+		if(ONI::Global::model.getArtifactProcessor() != nullptr){
+			if(bOpenOnFirstStart) ImGui::SetNextItemOpen(bOpenOnFirstStart);
+			if(ImGui::CollapsingHeader("ArtifactProcessor", true)) artifactProcessorInterface.gui(*ONI::Global::model.getArtifactProcessor());
+		}
+
 		if(ONI::Global::model.getFilterProcessor() != nullptr){
 			if(bOpenOnFirstStart) ImGui::SetNextItemOpen(bOpenOnFirstStart);
 			if(ImGui::CollapsingHeader("FilterProcessor", true)) filterProcessorInterface.gui(*ONI::Global::model.getFilterProcessor());
 		}
 
+		if(ONI::Global::model.getReferenceProcessor() != nullptr){
+			if(bOpenOnFirstStart) ImGui::SetNextItemOpen(bOpenOnFirstStart);
+			if(ImGui::CollapsingHeader("ReferenceProcessor", true)) referenceProcessorInterface.gui(*ONI::Global::model.getReferenceProcessor());
+		}
+
 		if (ONI::Global::model.getSpikeProcessor() != nullptr) {
 			if (bOpenOnFirstStart) ImGui::SetNextItemOpen(bOpenOnFirstStart);
 			if (ImGui::CollapsingHeader("SpikeProcessor", true)) spikeProcessorInterface.gui(*ONI::Global::model.getSpikeProcessor());
 		}
 
+		if(ONI::Global::model.getSpikeSorterProcessor() != nullptr){
+			if(bOpenOnFirstStart) ImGui::SetNextItemOpen(bOpenOnFirstStart);
+			if(ImGui::CollapsingHeader("SpikeSorterProcessor", true)) spikeSorterProcessorInterface.gui(*ONI::Global::model.getSpikeSorterProcessor());
+		}
+
+		if(ONI::Global::model.getClosedLoopProcessor() != nullptr){
+			if(bOpenOnFirstStart) ImGui::SetNextItemOpen(bOpenOnFirstStart);
+			if(ImGui::CollapsingHeader("ClosedLoopProcessor", true)) closedLoopProcessorInterface.gui(*ONI::Global::model.getClosedLoopProcessor());
+		}
+
 		if(ONI::Global::model.getBufferProcessor() != nullptr){
 			if(bOpenOnFirstStart) ImGui::SetNextItemOpen(bOpenOnFirstStart);
 			if(ImGui::CollapsingHeader("BufferProcessor", true)) bufferProcessorInterface.gui(*ONI::Global::model.getBufferProcessor());
@@ -257,6 +284,10 @@ protected:
 	ONI::Interface::Rhs2116StimulusInterface stimInterface;
 	ONI::Interface::RecordInterface recordProcessorInterface;
 	ONI::Interface::SpikeInterface spikeProcessorInterface;
+	ONI::Interface::SpikeSorterInterface spikeSorterProcessorInterface;
+	ONI::Interface::ClosedLoopInterface closedLoopProcessorInterface;
+	ONI::Interface::ArtifactInterface artifactProcessorInterface;
+	ONI::Interface::ReferenceInterface referenceProcessorInterface;
 	ONI::Interface::FilterInterface filterProcessorInterface;
 	ONI::Interface::AudioInterface audioProcessorInterface;
 
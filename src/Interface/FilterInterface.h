@@ -54,24 +54,21 @@ public:
 		ImGui::PushID(fp.getName().c_str());
 		ImGui::Text(fp.getName().c_str());
 		
+		// edit a copy, the processor recompiles its cascade when it changes
+		ONI::Settings::FilterSettings nextSettings = fp.getSettings();
+		bool bInteractive = false; // ramps the coefficients in while a value is being changed
+
 		///////////////////////////////////////////////
 		/// BAND STOP FILTER
 		///////////////////////////////////////////////
 
-		ImGui::Checkbox("Use Band Stop", &fp.settings.bUseBandStopFilter);
-
-		int bandStopFrequency = fp.settings.bandStopFrequency;
-		int bandStopWidth = fp.settings.bandStopWidth;
+		ImGui::Checkbox("Use Band Stop", &nextSettings.bUseBandStopFilter);
 
-		ImGui::InputInt("Band Frequency", &bandStopFrequency);
-		ImGui::InputInt("Width", &bandStopWidth);
+		ImGui::InputInt("Band Frequency", &nextSettings.bandStopFrequency); bInteractive |= ImGui::IsItemActive();
+		ImGui::InputInt("Width", &nextSettings.bandStopWidth); bInteractive |= ImGui::IsItemActive();
 
-		if(bandStopFrequency < 1) bandStopFrequency = 1;
-		if(bandStopWidth < 1) bandStopWidth = 1;
-
-		if(fp.settings.lowBandPassFrequency != bandStopFrequency || fp.settings.highBandPassFrequency != bandStopWidth){
-			fp.setBandStop(bandStopFrequency, bandStopWidth);
-		}
+		if(nextSettings.bandStopFrequency < 1) nextSettings.bandStopFrequency = 1;
+		if(nextSettings.bandStopWidth < 1) nextSettings.bandStopWidth = 1;
 
 		
 		///////////////////////////////////////////////
@@ -80,22 +77,14 @@ public:
 
 		ImGui::PushID("LowShelf");
 
-		ImGui::Checkbox("Use Low Shelf", &fp.settings.bUseLowShelf);
+		ImGui::Checkbox("Use Low Shelf", &nextSettings.bUseLowShelf);
 
-		int lowShelfFrequency = fp.settings.lowShelfFrequency;
-		float lowShelfGain = fp.settings.lowShelfGain;
-		float lowShelfRipple = fp.settings.lowShelfRipple;
+		ImGui::InputInt("Frequency", &nextSettings.lowShelfFrequency); bInteractive |= ImGui::IsItemActive();
+		ImGui::InputFloat("Gain", &nextSettings.lowShelfGain); bInteractive |= ImGui::IsItemActive();
+		ImGui::InputFloat("Ripple", &nextSettings.lowShelfRipple); bInteractive |= ImGui::IsItemActive();
 
-		ImGui::InputInt("Frequency", &lowShelfFrequency);
-		ImGui::InputFloat("Gain", &lowShelfGain);
-		ImGui::InputFloat("Ripple", &lowShelfRipple);
-
-		if(lowShelfFrequency < 1) lowShelfFrequency = 1;
-		if(lowShelfRipple < 0.01) lowShelfRipple = 0.01;
-
-		if(fp.settings.lowShelfFrequency != lowShelfFrequency || fp.settings.lowShelfGain != lowShelfGain || fp.settings.lowShelfRipple != lowShelfRipple){
-			fp.setLowShelf(lowShelfFrequency, lowShelfGain, lowShelfRipple);
-		}
+		if(nextSettings.lowShelfFrequency < 1) nextSettings.lowShelfFrequency = 1;
+		if(nextSettings.lowShelfRipple < 0.01) nextSettings.lowShelfRipple = 0.01;
 		
 		ImGui::PopID();
 
@@ -105,22 +94,14 @@ public:
 
 		ImGui::PushID("HighShelf");
 
-		ImGui::Checkbox("Use High Shelf", &fp.settings.bUseHighShelf);
-
-		int highPassFrequency = fp.settings.highShelfFrequency;
-		float highShelfGain = fp.settings.highShelfGain;
-		float highShelfRipple = fp.settings.highShelfRipple;
+		ImGui::Checkbox("Use High Shelf", &nextSettings.bUseHighShelf);
 
-		ImGui::InputInt("Frequency", &highPassFrequency);
-		ImGui::InputFloat("Gain", &highShelfGain);
-		ImGui::InputFloat("Ripple", &highShelfRipple);
+		ImGui::InputInt("Frequency", &nextSettings.highShelfFrequency); bInteractive |= ImGui::IsItemActive();
+		ImGui::InputFloat("Gain", &nextSettings.highShelfGain); bInteractive |= ImGui::IsItemActive();
+		ImGui::InputFloat("Ripple", &nextSettings.highShelfRipple); bInteractive |= ImGui::IsItemActive();
 
-		if(highPassFrequency < 1) highPassFrequency = 1;
-		if(highShelfRipple < 0.01) highShelfRipple = 0.01;
-
-		if(fp.settings.highShelfFrequency != highPassFrequency || fp.settings.highShelfGain != highShelfGain || fp.settings.highShelfRipple != highShelfRipple){
-			fp.setHighShelf(highPassFrequency, highShelfGain, highShelfRipple);
-		}
+		if(nextSettings.highShelfFrequency < 1) nextSettings.highShelfFrequency = 1;
+		if(nextSettings.highShelfRipple < 0.01) nextSettings.highShelfRipple = 0.01;
 		
 		ImGui::PopID();
 
@@ -128,23 +109,77 @@ public:
 		/// BAND PASS FILTER
 		///////////////////////////////////////////////
 
-		ImGui::Checkbox("Use Band Pass", &fp.settings.bUseBandPassFilter);
+		ImGui::Checkbox("Use Band Pass", &nextSettings.bUseBandPassFilter);
+
+		ImGui::InputInt("Low Cut", &nextSettings.lowBandPassFrequency); bInteractive |= ImGui::IsItemActive();
+		ImGui::InputInt("High Cut", &nextSettings.highBandPassFrequency); bInteractive |= ImGui::IsItemActive();
+
+		if(nextSettings.lowBandPassFrequency < 1) nextSettings.lowBandPassFrequency = 1;
+		if(nextSettings.highBandPassFrequency < 1) nextSettings.highBandPassFrequency = 1;
+
+		nextSettings.highBandPassFrequency = std::max(nextSettings.lowBandPassFrequency + 1, nextSettings.highBandPassFrequency);
+
+		///////////////////////////////////////////////
+		/// STIM WINDOWS
+		///////////////////////////////////////////////
+
+		static char * stimFilterStateOptions = "Filter Through\0Hold State\0Reset State";
+
+		ImGui::SetNextItemWidth(200);
+		int stimFilterStateItem = nextSettings.stimFilterState;
+		if(ImGui::Combo("During Stimulation", &stimFilterStateItem, stimFilterStateOptions, 3)){
+			nextSettings.stimFilterState = (ONI::Settings::StimFilterStateType)stimFilterStateItem;
+		}
+
+		///////////////////////////////////////////////
+		/// FIR MODE
+		///////////////////////////////////////////////
 
-		int lowBandPassFrequency = fp.settings.lowBandPassFrequency;
-		int highBandPassFrequency = fp.settings.highBandPassFrequency;
+		static char * filterModeOptions = "IIR (Butterworth)\0FIR (Linear Phase)";
 
-		ImGui::InputInt("Low Cut", &lowBandPassFrequency);
-		ImGui::InputInt("High Cut", &highBandPassFrequency);
+		ImGui::SetNextItemWidth(200);
+		int filterModeItem = nextSettings.filterMode;
+		if(ImGui::Combo("Mode", &filterModeItem, filterModeOptions, 2)){
+			nextSettings.filterMode = (ONI::Settings::FilterModeType)filterModeItem;
+		}
 
-		if(lowBandPassFrequency < 1) lowBandPassFrequency = 1;
-		if(highBandPassFrequency < 1) highBandPassFrequency = 1;
+		if(nextSettings.filterMode == ONI::Settings::FILTER_FIR){
 
-		highBandPassFrequency = std::max(lowBandPassFrequency + 1, highBandPassFrequency);
+			ImGui::SetNextItemWidth(200);
+			ImGui::InputInt("Taps", &nextSettings.firTaps, 2, 64);
+			nextSettings.firTaps = std::clamp(nextSettings.firTaps, (int)ONI::Processor::FilterProcessor::FIR_MIN_TAPS, (int)ONI::Processor::FilterProcessor::FIR_MAX_TAPS) | 1;
+
+			static char * blockSizeOptions = "512\0""1024\0""2048\0""4096\0""8192";
+
+			ImGui::SetNextItemWidth(200);
+			int blockSizeItem = std::clamp((int)std::log2(std::max(nextSettings.firBlockSize, 1)) - 9, 0, 4);
+			if(ImGui::Combo("FFT Size", &blockSizeItem, blockSizeOptions, 5)){
+				nextSettings.firBlockSize = 512 << blockSizeItem;
+			}
+
+			ImGui::Text("Latency: %0.2f ms + %0.2f ms group delay (stim windows are filtered through)",
+						(double)(fp.getFIRLatencySamples() / RHS2116_SAMPLES_PER_MS), (double)(fp.getFIRGroupDelaySamples() / RHS2116_SAMPLES_PER_MS));
+
+			// too few taps for a narrow notch or a low corner and the FIR just doesn't have them
+			if(fp.getFIRResponseError() > ONI::Processor::FilterProcessor::FIR_RESPONSE_TOLERANCE){
+				ImGui::TextColored(ImVec4(1.0f, 0.5f, 0.0f, 1.0f), "Magnitude is up to %0.3f off the IIR response, more taps or IIR mode (Verify Filters for how many)",
+								   fp.getFIRResponseError());
+			}
 
-		if(fp.settings.lowBandPassFrequency != lowBandPassFrequency || fp.settings.highBandPassFrequency != highBandPassFrequency){
-			fp.setBandPass(lowBandPassFrequency, highBandPassFrequency);
 		}
 
+		fp.setSettings(nextSettings, bInteractive);
+
+		ONI::BiquadDesignCache& designCache = fp.getDesignCache();
+		ImGui::Text("%i sections over %i probes", (int)fp.getNumFilterStages(), (int)fp.numProbes);
+		ImGui::Text("Designs cached: %i hits: %llu designed: %llu", (int)designCache.size(), designCache.getHitCount(), designCache.getMissCount());
+
+		if(ImGui::Button("Verify Filters")) fp.verifyFilters();
+		ImGui::SameLine();
+		if(ImGui::Button("Benchmark Filters")) fp.benchmarkFilters();
+		ImGui::SameLine();
+		if(ImGui::Button("Benchmark FIR")) fp.benchmarkFIR();
+
 		ImGui::PopID();
 
 	};
@@ -0,0 +1,74 @@
+//
+//  ReferenceInterface.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+#include "../Interface/BaseInterface.h"
+
+#include "ofxImGui.h"
+#include "ofxImPlot.h"
+#include "ofxFutilities.h"
+
+#pragma once
+
+namespace ONI{
+namespace Interface{
+
+class ReferenceInterface : public ONI::Interface::BaseInterface{
+
+public:
+
+	~ReferenceInterface(){};
+
+	void reset(){};
+	inline void process(oni_frame_t* frame){}; // nothing
+	inline void process(ONI::Frame::BaseFrame& frame){}; // nothing
+
+	inline void gui(ONI::Processor::BaseProcessor& processor){
+
+		ONI::Processor::ReferenceProcessor& rp = *reinterpret_cast<ONI::Processor::ReferenceProcessor*>(&processor);
+
+		ImGui::PushID(rp.getName().c_str());
+		ImGui::Text(rp.getName().c_str());
+
+		static char * referenceOptions = "None\0Common Average\0Common Median\0Laplacian (4 neighbours)\0Laplacian (8 neighbours)";
+
+		// read a field at a time by the frame thread, none of them depend on each other
+		ImGui::SetNextItemWidth(200);
+		int referenceItem = rp.settings.referenceType;
+		if(ImGui::Combo("Reference", &referenceItem, referenceOptions, 5)) rp.settings.referenceType = (ONI::Settings::ReferenceType)referenceItem;
+
+		if(rp.settings.referenceType == ONI::Settings::REFERENCE_LAPLACIAN_4 || rp.settings.referenceType == ONI::Settings::REFERENCE_LAPLACIAN_8){
+			ImGui::SetNextItemWidth(200);
+			int gridColumns = rp.settings.gridColumns;
+			if(ImGui::InputInt("Grid Columns", &gridColumns)) rp.settings.gridColumns = std::clamp(gridColumns, 1, (int)std::max(rp.numProbes, (size_t)1));
+		}
+
+		ImGui::Checkbox("Only Active Probes", &rp.settings.bUseActiveProbes);
+		ImGui::SameLine();
+		ImGui::Text("(%i of %i)", (int)rp.getNumActiveProbes(), (int)rp.numProbes);
+
+		ONI::LatencyHistogram& blockCost = rp.getBlockCost();
+		ImGui::Text("Per block p50: %0.1f p99: %0.1f max: %0.1f us", blockCost.getPercentileNs(50) / 1000.0, blockCost.getPercentileNs(99) / 1000.0, blockCost.getMaxNs() / 1000.0);
+		ImGui::Text("%0.3f%% of real time", rp.getRealTimeFraction() * 100.0);
+
+		if(ImGui::Button("Reset Stats")) rp.resetStats();
+
+		ImGui::PopID();
+
+	}
+
+};
+
+} // namespace Interface
+} // namespace ONI
@@ -69,6 +69,8 @@ public:
 
 		if(rhsm.settings != nextSettings) rhsm.settings = nextSettings;
 
+		if(ImGui::Button("Benchmark Conversion")) rhsm.benchmarkConversion();
+
 		ImGui::PopID();
 		
 
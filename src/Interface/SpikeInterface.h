@@ -93,8 +93,11 @@ public:
 		static char* spikeDetectionTypes = "FALLING EDGE\0RISING EDGE\0BOTH EDGES\0EITHER EDGE";
 		if(ImGui::Combo("Detection Type", (int*)&nextSettings.spikeEdgeDetectionType, spikeDetectionTypes, 3)) bNeedsUpdate = true;
 
+		static char* spikeNoiseEstimatorTypes = "STANDARD DEVIATION\0MEDIAN ABSOLUTE DEVIATION";
+		if(ImGui::Combo("Noise Estimator", (int*)&nextSettings.spikeNoiseEstimatorType, spikeNoiseEstimatorTypes, 2)) bNeedsUpdate = true;
+
 		if(ImGui::InputFloat("Spike Wave Length (ms)", &nextSettings.spikeWaveformLengthMs)) bNeedsUpdate = true;;
-		nextSettings.spikeWaveformLengthMs = std::clamp(nextSettings.spikeWaveformLengthMs, 0.02f, 1000.0f);
+		nextSettings.spikeWaveformLengthMs = std::clamp(nextSettings.spikeWaveformLengthMs, 0.02f, (float)(ONI::MAX_SPIKE_WAVEFORM_SAMPLES / RHS2116_SAMPLES_PER_MS));
 		nextSettings.spikeWaveformLengthSamples = nextSettings.spikeWaveformLengthMs * RHS2116_SAMPLES_PER_MS;
 
 		if(ImGui::InputInt("Spike Detection Buffer Size", &nextSettings.shortSpikeBufferSize)) bNeedsUpdate = true;
@@ -103,6 +106,10 @@ public:
 		if(ImGui::Checkbox("Align Falling Edges to Peak", &nextSettings.bFallingAlignMax)) bNeedsUpdate = true;
 		if(ImGui::Checkbox("Align Rising Edges to Trough", &nextSettings.bRisingAlignMin)) bNeedsUpdate = true;
 
+		if(ImGui::SliderInt("Detection Shards", &nextSettings.numDetectionShards, 1, std::max((int)std::thread::hardware_concurrency(), 1))) bNeedsUpdate = true;
+		if(ImGui::SliderInt("PCA Features", &nextSettings.numSpikeFeatures, 1, ONI::MAX_SPIKE_FEATURES)) bNeedsUpdate = true;
+		if(ImGui::InputInt("Detection Lag (samples)", &nextSettings.detectionLagSamples)) bNeedsUpdate = true;
+
 		ImGui::InputFloat("Voltage Range", &voltageRange);
 
 		if(!bNeedsUpdate) ImGui::BeginDisabled();
@@ -125,6 +132,29 @@ public:
 			sp.reset();
 		}
 
+		uint64_t acquired = sp.getSamplesAcquired();
+		uint64_t scanned = sp.getSamplesScanned();
+		ImGui::Text("Scanned %llu of %llu samples (%0.3f%%) skipped: %llu lapped: %llu", scanned, acquired, acquired == 0 ? 100.0 : 100.0 * scanned / acquired, sp.getSamplesSkipped(), sp.getSamplesLapped());
+		ImGui::Text("Detection shards: %i dropped spikes: %llu", sp.getNumDetectionShards(), sp.getDroppedSpikeCount());
+		ImGui::SameLine();
+		if(ImGui::Button("Benchmark Shards")){
+			sp.benchmarkDetectionShards();
+		}
+
+		ONI::LatencyHistogram& latency = sp.getTotalLatencyHistogram();
+		ImGui::Text("Sample to event latency (ms) p50: %0.3f p99: %0.3f p99.9: %0.3f max: %0.3f (detection lag %0.3f + filter latency %0.3f)",
+					latency.getPercentileNs(50) / 1e6, latency.getPercentileNs(99) / 1e6, latency.getPercentileNs(99.9) / 1e6, latency.getMaxNs() / 1e6,
+					sp.detectionLagSamples / (float)RHS2116_SAMPLES_PER_MS, sp.getFilterLatencySamples() / (float)RHS2116_SAMPLES_PER_MS);
+		if(!sp.getClockSync().isSynced()) ImGui::Text("Waiting for frames to sync the acquisition clock");
+		if(ImGui::Button("Save Latency")) sp.saveLatencyHistograms();
+		ImGui::SameLine();
+		if(ImGui::Button("Reset Latency")) sp.resetLatencyHistograms();
+
+		for(ONI::BroadcastRing<ONI::Spike>::Subscriber* subscriber : sp.getSpikeBroadcast().getSubscribers()){
+			ImGui::Text("Subscriber %s lag: %llu max lag: %llu dropped: %llu", subscriber->name.c_str(),
+						sp.getSpikeBroadcast().getLag(subscriber), subscriber->maxLag.load(), subscriber->droppedCount.load());
+		}
+
 		plotCombinedBursts(sp);
 
 		ImGui::Begin("SpikeDetection");
@@ -152,15 +182,15 @@ public:
 					if(b) ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, cell_bg_color);
 				}
 
-				ImGui::Text("P: %02d || Bursts/spsa: %0.5f", probe, sp.burstBuffer.getCurrentBurstRatePSA(probe, 30000));
+				ImGui::Text("P: %02d || Bursts/spsa 0.1s: %0.1f 1s: %0.1f 30s: %0.3f", probe, sp.burstBuffer.getBurstRatePSA(probe, 100),
+							sp.burstBuffer.getBurstRatePSA(probe, 1000), sp.burstBuffer.getBurstRatePSA(probe, 30000));
 
 				ImGui::PushID(probe);
 				ImGui::SameLine();
 				bool bUseProbe = ONI::Global::model.getBufferProcessor()->getActiveProbes()[probe];
 				if(ImGui::Checkbox("use", &bUseProbe)){
 					LOGDEBUG("Use: %i %d", (int)bUseProbe, probe);
-					ONI::Global::model.getBufferProcessor()->getActiveProbes()[probe] = bUseProbe;
-					ONI::Global::model.getBufferProcessor()->saveActiveProbes();
+					ONI::Global::model.getBufferProcessor()->setActiveProbe(probe, bUseProbe);
 				}
 				ImGui::PopID();
 
@@ -232,6 +262,7 @@ public:
 		}
 
 		plotCombinedSpikes(sp);
+		plotSpikeFeatures(sp);
 
 		ImGui::PopID();
 		ImGui::End();
@@ -310,6 +341,63 @@ public:
 
 	}
 
+	// Scatter the first two principal component scores of the buffered spikes
+	inline void plotSpikeFeatures(ONI::Processor::SpikeProcessor& sp){
+
+		size_t numProbes = sp.numProbes;
+		ONI::SpikeFeatureExtractor& features = sp.getSpikeFeatures();
+
+		ImGui::Begin("Spike Features");
+		ImGui::PushID("##SpikeFeaturePlot");
+
+		ImGui::Text("Components: %i refresh: %0.3f ms dropped: %i", features.getNumComponents(), features.getLastRefreshMs(), features.getDroppedSpikeCount());
+
+		if(features.getNumComponents() > 1 && ImPlot::BeginPlot("PC1 vs PC2", ImVec2(-1, -1))){
+
+			ImPlot::SetupAxes("PC1", "PC2", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+
+			static std::vector<float> pc1;
+			static std::vector<float> pc2;
+
+			std::vector<bool>& selected = ONI::Global::model.getChannelSelect();
+			bool bAnySelected = std::find(selected.begin(), selected.end(), true) != selected.end();
+
+			for(size_t probe = 0; probe < numProbes; ++probe){
+
+				if(bAnySelected && !selected[probe]) continue; // only show selected probes if there are any
+
+				pc1.clear();
+				pc2.clear();
+
+				sp.spikeMutex.lock();
+				size_t count = sp.spikeBuffer.getMinCount(probe, sp.spikeBuffer.size());
+				for(size_t j = 0; j < count; ++j){
+					const ONI::Spike& spike = sp.spikeBuffer.getSpikeAt(probe, (int)sp.spikeBuffer.getLastIndex(probe) - (int)j);
+					if(spike.numFeatures < 2) continue;
+					pc1.push_back(spike.features[0]);
+					pc2.push_back(spike.features[1]);
+				}
+				sp.spikeMutex.unlock();
+
+				if(pc1.size() == 0) continue;
+
+				ImGui::PushID(probe);
+				ImVec4 col = ImPlot::GetColormapColor(probe);
+				ImPlot::SetNextMarkerStyle(ImPlotMarker_Circle, 3, col, -1, col);
+				ImPlot::PlotScatter("##features", &pc1[0], &pc2[0], pc1.size());
+				ImGui::PopID();
+
+			}
+
+			ImPlot::EndPlot();
+
+		}
+
+		ImGui::PopID();
+		ImGui::End();
+
+	}
+
 	// Plot Combined AC or DC probe data
 	inline void plotCombinedBursts(ONI::Processor::SpikeProcessor& sp){
 
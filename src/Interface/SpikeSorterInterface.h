@@ -0,0 +1,189 @@
+//
+//  SpikeSorterInterface.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "../Interface/BaseInterface.h"
+
+#include "ofxImGui.h"
+#include "ofxImPlot.h"
+#include "ofxFutilities.h"
+
+#pragma once
+
+namespace ONI{
+namespace Interface{
+
+class SpikeSorterInterface : public ONI::Interface::BaseInterface{
+
+public:
+
+	~SpikeSorterInterface(){};
+
+	void reset(){};
+	inline void process(oni_frame_t* frame){}; // nothing
+	inline void process(ONI::Frame::BaseFrame& frame){}; // nothing
+
+	inline void gui(ONI::Processor::BaseProcessor& processor){
+
+		ONI::Processor::SpikeSorterProcessor& ssp = *reinterpret_cast<ONI::Processor::SpikeSorterProcessor*>(&processor);
+
+		numProbes = ssp.numProbes;
+
+		ImGui::PushID(ssp.getName().c_str());
+		ImGui::Text(ssp.getName().c_str());
+
+		static bool bNeedsUpdate = false;
+		static bool bFirstLoad = true;
+		if(bFirstLoad){
+			nextSettings = ssp.settings;
+			bFirstLoad = false;
+		}
+
+		if(ImGui::Checkbox("Learn Templates", &nextSettings.bLearnTemplates)) bNeedsUpdate = true;
+		if(ImGui::SliderInt("Max Units Per Probe", &nextSettings.maxUnitsPerProbe, 1, ONI::MAX_SPIKE_UNITS)) bNeedsUpdate = true;
+		if(ImGui::InputFloat("Max Residual Deviations", &nextSettings.maxResidualDeviations)) bNeedsUpdate = true;
+		if(ImGui::InputFloat("Learning Rate", &nextSettings.learningRate)) bNeedsUpdate = true;
+		if(ImGui::InputInt("Min Unit Spikes", &nextSettings.minUnitSpikes)) bNeedsUpdate = true;
+		if(ImGui::InputInt("Latency Budget (ns)", &nextSettings.latencyBudgetNs)) bNeedsUpdate = true;
+
+		nextSettings.maxResidualDeviations = std::max(nextSettings.maxResidualDeviations, 0.0f);
+		nextSettings.learningRate = std::clamp(nextSettings.learningRate, 0.0f, 1.0f);
+		nextSettings.minUnitSpikes = std::max(nextSettings.minUnitSpikes, 1);
+		nextSettings.latencyBudgetNs = std::max(nextSettings.latencyBudgetNs, 0);
+
+		if(!bNeedsUpdate) ImGui::BeginDisabled();
+
+		bool bAppliedSettings = false;
+		if(ImGui::Button("Apply Settings")){
+			ssp.settings = nextSettings; // read a field at a time by the detection thread, none of them depend on each other
+			bNeedsUpdate = false;
+			bAppliedSettings = true;
+		}
+
+		if(!bNeedsUpdate && !bAppliedSettings) ImGui::EndDisabled();
+
+		ImGui::SameLine();
+		if(ImGui::Button("Clear Templates")) ssp.clearTemplates();
+		ImGui::SameLine();
+		if(ImGui::Button("Save Templates")) ssp.saveTemplates();
+		ImGui::SameLine();
+		if(ImGui::Button("Load Templates")) ssp.loadTemplates();
+
+		uint64_t sorted = ssp.getSortedCount();
+		uint64_t total = sorted + ssp.getUnsortedCount();
+		ImGui::Text("Sorted %llu of %llu spikes (%0.1f%%) over budget: %llu", sorted, total, total == 0 ? 0.0 : 100.0 * sorted / total, ssp.getOverrunCount());
+		ImGui::Text("Latency mean: %0.0f ns max: %llu ns", ssp.getMeanLatencyNs(), ssp.getMaxLatencyNs());
+		ImGui::SameLine();
+		if(ImGui::Button("Benchmark Sorting")){
+			ssp.benchmarkAssignments();
+		}
+
+		const ONI::Processor::SpikeSorterProcessor::TemplatesSnapshot snapshot = ssp.getTemplates(); // held while we read it
+		const ONI::Processor::SpikeSorterProcessor::SpikeTemplates& templates = *snapshot;
+
+		if(templates.numUnits.size() == numProbes){
+			std::ostringstream os;
+			for(size_t probe = 0; probe < numProbes; ++probe){
+				os << std::setw(2) << std::setfill('0') << probe << ": " << templates.numUnits[probe] << (probe % 8 == 7 ? "\n" : "  ");
+			}
+			ImGui::Text("Templates per probe\n%s", os.str().c_str());
+		}
+
+		plotTemplates(ssp);
+
+		ImGui::PopID();
+
+	}
+
+protected:
+
+	// template waveforms for the selected probes, or all of them if none are selected
+	void plotTemplates(ONI::Processor::SpikeSorterProcessor& ssp){
+
+		const ONI::Processor::SpikeSorterProcessor::TemplatesSnapshot snapshot = ssp.getTemplates(); // held while we draw
+		const ONI::Processor::SpikeSorterProcessor::SpikeTemplates& templates = *snapshot;
+		const size_t& L = templates.waveformLength;
+
+		if(L == 0 || templates.numUnits.size() != numProbes) return;
+
+		std::vector<size_t> probes;
+		std::vector<bool>& channelSelect = ONI::Global::model.getChannelSelect();
+		for(size_t probe = 0; probe < numProbes; ++probe){
+			if(channelSelect.size() == numProbes && !channelSelect[probe]) continue;
+			probes.push_back(probe);
+		}
+		if(probes.size() == 0) for(size_t probe = 0; probe < numProbes; ++probe) probes.push_back(probe);
+
+		ImGui::Begin("Spike Templates");
+		ImGui::PushID("##SpikeTemplates");
+
+		static ImGuiTableFlags flags = ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_RowBg;
+
+		if(ImGui::BeginTable("##templatetable", 8, flags, ImVec2(-1, 0))){
+
+			for(size_t i = 0; i < probes.size(); ++i){
+
+				const size_t& probe = probes[i];
+
+				if(i % 8 == 0) ImGui::TableNextRow();
+				ImGui::TableSetColumnIndex(i % 8);
+
+				ImGui::Text("P: %02d", probe);
+
+				ImGui::PushID(probe);
+
+				ImPlot::PushStyleVar(ImPlotStyleVar_PlotPadding, ImVec2(0, 0));
+
+				if(ImPlot::BeginPlot("##templates", ImVec2(-1, 160), ImPlotFlags_CanvasOnly)){
+
+					static ImPlotAxisFlags axisFlags = ImPlotAxisFlags_NoLabel | ImPlotAxisFlags_NoTickLabels;
+					ImPlot::SetupAxes(nullptr, nullptr, axisFlags, axisFlags);
+					ImPlot::SetupAxesLimits(0, L, -voltageRange, voltageRange, ImGuiCond_Always);
+
+					for(int unit = 0; unit < templates.numUnits[probe]; ++unit){
+						const size_t idx = probe * ONI::MAX_SPIKE_UNITS + unit;
+						bool bIsUnit = templates.spikeCounts[idx] >= (uint64_t)ssp.settings.minUnitSpikes;
+						ImVec4 col = ImPlot::GetColormapColor(unit);
+						if(!bIsUnit) col.w = 0.25f; // still a candidate
+						ImPlot::SetNextLineStyle(col);
+						ImPlot::PlotLine("##template", &templates.waveforms[idx * L], L);
+					}
+
+					ImPlot::EndPlot();
+				}
+
+				ImPlot::PopStyleVar();
+				ImGui::PopID();
+
+			}
+
+			ImGui::EndTable();
+
+		}
+
+		ImGui::PopID();
+		ImGui::End();
+
+	}
+
+	float voltageRange = 100.0f;
+
+	ONI::Settings::SpikeSorterSettings nextSettings;
+
+};
+
+} // namespace Interface
+} // namespace ONI
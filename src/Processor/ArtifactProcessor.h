@@ -0,0 +1,319 @@
+//
+//  ArtifactProcessor.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+
+#include "../Type/Log.h"
+#include "../Type/SettingTypes.h"
+#include "../Type/GlobalTypes.h"
+#include "../Type/FrameTypes.h"
+
+#include "../Processor/BaseProcessor.h"
+
+#pragma once
+
+namespace ONI{
+
+namespace Interface{
+class ArtifactInterface;
+};
+
+namespace Processor{
+
+// Stimulation artifact suppression
+//
+// Sits between the Rhs2116StimProcessor and the FilterProcessor and rewrites each
+// probe's ac samples in place wherever the stim processor has flagged the stim window,
+// so the artifact never reaches the filters, thresholds or waveform buffers. Windows
+// are followed across blocks; what the block path can't do is look ahead, so:
+//
+//  - INTERPOLATE ramps to the first sample after the window over the part of the window
+//    in the block it ends in, anything in earlier blocks has already gone out held
+//  - TEMPLATE learns the artifact from the first window (which is held) and subtracts
+//    the running average from then on. Each window is learnt relative to its baseline,
+//    the mean of the BASELINE_SAMPLES before it, so the template is only the artifact
+//    and not whatever dc offset the probe had. It lines windows up on their first
+//    flagged sample, so it only works as well as the stimulus lands at a fixed offset
+//    into them
+//
+// Use the FilterProcessor's stim filter state setting as well to keep the filters from
+// ringing on whatever's left at the window edges.
+
+class ArtifactProcessor : public BaseProcessor{
+
+public:
+
+    friend class ONI::Interface::ArtifactInterface;
+
+    static constexpr size_t BASELINE_SAMPLES = 8; // before each window, averaged for the TEMPLATE baseline
+
+    ArtifactProcessor(){
+        BaseProcessor::processorTypeID = ONI::Processor::TypeID::ARTIFACT_PROCESSOR;
+        BaseProcessor::processorName = toString(processorTypeID);
+    }
+
+    ~ArtifactProcessor(){
+        LOGDEBUG("ArtifactProcessor DTOR");
+    };
+
+    void setup(ONI::Processor::BaseProcessor* source){
+
+        LOGDEBUG("Setting up ArtifactProcessor");
+
+        this->source = source;
+        this->source->subscribeProcessor("ArtifactProcessor", ONI::Processor::SubscriptionType::POST_PROCESSOR, this);
+
+        BaseProcessor::numProbes = source->getNumProbes();
+
+        preWindowSamples.assign(numProbes * BASELINE_SAMPLES, 0.0f);
+        baselines.assign(numProbes, 0.0f);
+        templates.assign(numProbes * ONI::MAX_ARTIFACT_TEMPLATE_SAMPLES, 0.0f);
+
+        reset();
+
+    }
+
+    void reset(){
+        std::fill(preWindowSamples.begin(), preWindowSamples.end(), 0.0f);
+        std::fill(baselines.begin(), baselines.end(), 0.0f);
+        bInWindow = false;
+        windowSample = 0;
+        bClearTemplates = true;
+    };
+
+    inline void process(oni_frame_t* frame){};
+
+    inline void process(ONI::Frame::BaseFrame& frame){
+
+        ONI::Frame::Rhs2116MultiFrame* multiFrame = reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame);
+
+        const ONI::Settings::ArtifactSuppressionType suppressionType = settings.suppressionType;
+
+        if(suppressionType != ONI::Settings::ARTIFACT_NONE){
+
+            if(bClearTemplates.exchange(false)) clearTemplatesNow();
+
+            if(multiFrame->stimulation){
+                if(!bInWindow) startWindow(); // last samples were already kept from the previous frame
+                for(size_t probe = 0; probe < numProbes; ++probe){
+                    suppress(probe, &multiFrame->ac_uV[probe], 1, suppressionType, false, 0.0f); // one at a time there's nothing to interpolate to
+                }
+                windowSample += 1;
+            }else{
+                if(bInWindow) endWindow(suppressionType);
+                for(size_t probe = 0; probe < numProbes; ++probe) keepPreWindow(probe, &multiFrame->ac_uV[probe], 1);
+            }
+
+        }
+
+        for(auto& processor : getPostProcessorList()){
+            processor->process(frame);
+        }
+
+    }
+
+    inline void process(ONI::Frame::MultiFrameBlock& block){
+
+        const ONI::Settings::ArtifactSuppressionType suppressionType = settings.suppressionType;
+        const size_t numSamples = block.size();
+
+        if(suppressionType != ONI::Settings::ARTIFACT_NONE && numSamples > 0){
+
+            if(bClearTemplates.exchange(false)) clearTemplatesNow();
+
+            const uint8_t* stimulation = block.stimulation.data();
+
+            // walk the block in runs of stim/no stim samples, each probe's run is contiguous in its lane
+            size_t i = 0;
+            size_t clearStart = 0; // where the last run without stim started
+            while(i < numSamples){
+
+                const size_t start = i;
+                const bool bStimulation = stimulation[i] != 0;
+                while(i < numSamples && (stimulation[i] != 0) == bStimulation) ++i;
+
+                if(!bStimulation){
+                    if(bInWindow) endWindow(suppressionType); // the last block ended on the window's last sample
+                    clearStart = start;
+                    continue;
+                }
+
+                if(!bInWindow){
+                    if(start > 0) for(size_t probe = 0; probe < numProbes; ++probe) keepPreWindow(probe, block.ac(probe) + clearStart, start - clearStart);
+                    startWindow();
+                }
+
+                const bool bEndsInBlock = i < numSamples;
+
+                for(size_t probe = 0; probe < numProbes; ++probe){
+                    float* samples = block.ac(probe);
+                    suppress(probe, samples + start, i - start, suppressionType, bEndsInBlock, bEndsInBlock ? samples[i] : 0.0f);
+                }
+
+                windowSample += i - start;
+
+                if(bEndsInBlock) endWindow(suppressionType);
+
+            }
+
+            if(!bInWindow) for(size_t probe = 0; probe < numProbes; ++probe) keepPreWindow(probe, block.ac(probe) + clearStart, numSamples - clearStart);
+
+        }
+
+        for(auto& processor : getPostProcessorList()){
+            processor->process(block);
+        }
+
+    }
+
+    // safe from any thread, the frame thread clears them before it next uses them
+    void clearTemplates(){
+        bClearTemplates = true;
+    }
+
+    // live template for a probe, MAX_ARTIFACT_TEMPLATE_SAMPLES long; for display only
+    inline const float* getTemplate(const size_t& probe){
+        assert(probe < numProbes);
+        return templates.data() + probe * ONI::MAX_ARTIFACT_TEMPLATE_SAMPLES;
+    }
+
+    inline size_t getTemplateLength(){
+        return std::min((size_t)ONI::rhs2116MillisToSamples(std::max(settings.templateMs, 0.0f)), ONI::MAX_ARTIFACT_TEMPLATE_SAMPLES);
+    }
+
+    inline uint64_t getTemplateWindowCount(){
+        return templateWindowCount.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t getWindowCount(){
+        return windowCount.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t getSuppressedSampleCount(){
+        return suppressedSampleCount.load(std::memory_order_relaxed);
+    }
+
+protected:
+
+    inline void startWindow(){
+        bInWindow = true;
+        windowSample = 0;
+        templateLength = getTemplateLength();
+        templateLearningRate = templateWindowCount == 0 ? 1.0f : std::clamp(settings.templateLearningRate, 0.0f, 1.0f); // first window is the template
+        for(size_t probe = 0; probe < numProbes; ++probe){
+            const float* history = preWindowSamples.data() + probe * BASELINE_SAMPLES;
+            float sum = 0.0f;
+            for(size_t i = 0; i < BASELINE_SAMPLES; ++i) sum += history[i];
+            baselines[probe] = sum / BASELINE_SAMPLES;
+        }
+    }
+
+    // shifts the last (up to BASELINE_SAMPLES) of a probe's samples outside a window into its pre window history
+    inline void keepPreWindow(const size_t& probe, const float* samples, const size_t& numSamples){
+        float* history = preWindowSamples.data() + probe * BASELINE_SAMPLES;
+        const size_t count = std::min(numSamples, BASELINE_SAMPLES);
+        std::copy(history + count, history + BASELINE_SAMPLES, history);
+        std::copy(samples + numSamples - count, samples + numSamples, history + BASELINE_SAMPLES - count);
+    }
+
+    inline void endWindow(const ONI::Settings::ArtifactSuppressionType& suppressionType){
+        bInWindow = false;
+        if(suppressionType == ONI::Settings::ARTIFACT_TEMPLATE) templateWindowCount.fetch_add(1, std::memory_order_relaxed);
+        windowCount.fetch_add(1, std::memory_order_relaxed);
+        suppressedSampleCount.fetch_add(windowSample, std::memory_order_relaxed);
+    }
+
+    // rewrites numSamples of one probe that start windowSample samples into the window;
+    // next is the first sample after the window when bEndsHere
+    inline void suppress(const size_t& probe, float* samples, const size_t& numSamples,
+                         const ONI::Settings::ArtifactSuppressionType& suppressionType, const bool& bEndsHere, const float& next){
+
+        const float& last = preWindowSamples[probe * BASELINE_SAMPLES + BASELINE_SAMPLES - 1];
+
+        switch(suppressionType){
+        case ONI::Settings::ARTIFACT_BLANK:
+        {
+            std::fill(samples, samples + numSamples, 0.0f);
+            break;
+        }
+        case ONI::Settings::ARTIFACT_HOLD:
+        {
+            std::fill(samples, samples + numSamples, last);
+            break;
+        }
+        case ONI::Settings::ARTIFACT_INTERPOLATE:
+        {
+            if(!bEndsHere){
+                std::fill(samples, samples + numSamples, last);
+                break;
+            }
+            const float step = (next - last) / (numSamples + 1);
+            for(size_t i = 0; i < numSamples; ++i) samples[i] = last + step * (i + 1);
+            break;
+        }
+        case ONI::Settings::ARTIFACT_TEMPLATE:
+        {
+            // the template is the artifact above each window's baseline, so taking it off leaves the baseline in
+            float* artifact = templates.data() + probe * ONI::MAX_ARTIFACT_TEMPLATE_SAMPLES;
+            const bool bHasTemplate = templateWindowCount.load(std::memory_order_relaxed) > 0;
+            const float baseline = baselines[probe];
+            for(size_t i = 0; i < numSamples; ++i){
+                const size_t k = windowSample + i;
+                if(k >= templateLength){
+                    samples[i] = last;
+                    continue;
+                }
+                const float raw = samples[i];
+                samples[i] = bHasTemplate ? raw - artifact[k] : last;
+                artifact[k] += templateLearningRate * (raw - baseline - artifact[k]);
+            }
+            break;
+        }
+        case ONI::Settings::ARTIFACT_NONE:
+        default:
+        {
+            break;
+        }
+        }
+
+    }
+
+    inline void clearTemplatesNow(){
+        std::fill(templates.begin(), templates.end(), 0.0f);
+        templateWindowCount = 0;
+        if(bInWindow) templateLearningRate = 1.0f;
+    }
+
+    ONI::Settings::ArtifactSettings settings;
+    ONI::Processor::BaseProcessor* source = nullptr;
+
+    // frame thread only
+    std::vector<float> preWindowSamples;	// numProbes x BASELINE_SAMPLES, the last samples before the current (or next) window
+    std::vector<float> baselines;			// per probe, the mean of preWindowSamples when the current window started
+    std::vector<float> templates;			// numProbes x MAX_ARTIFACT_TEMPLATE_SAMPLES
+    bool bInWindow = false;
+    size_t windowSample = 0;				// samples into the current window
+    size_t templateLength = 0;
+    float templateLearningRate = 1.0f;
+
+    std::atomic_bool bClearTemplates = true;
+
+    std::atomic<uint64_t> templateWindowCount = 0;
+    std::atomic<uint64_t> windowCount = 0;
+    std::atomic<uint64_t> suppressedSampleCount = 0;
+
+};
+
+
+} // namespace Processor
+} // namespace ONI
@@ -19,6 +19,8 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <syncstream>
 
 #include "../Type/Log.h"
@@ -36,13 +38,77 @@ class BaseProcessor{
 
 public:
 
-	virtual ~BaseProcessor(){};
+	virtual ~BaseProcessor(){
+		ProcessorList* list = preProcessorList.exchange(&emptyPreProcessorList);
+		if(list != &emptyPreProcessorList) delete list;
+		list = postProcessorList.exchange(&emptyPostProcessorList);
+		if(list != &emptyPostProcessorList) delete list;
+	};
+
+	typedef std::vector<BaseProcessor*> ProcessorList;
+
+	// Holds on to the subscriber list it was handed for as long as it's in scope (a
+	// range for keeps it for the whole loop), counted so retired lists are only freed
+	// once nobody can still be walking them
+	class ProcessorListReader{
+
+	public:
+
+		ProcessorListReader(const std::atomic<ProcessorList*>& source, std::atomic<size_t>& readers) : readers(readers){
+			readers.fetch_add(1, std::memory_order_seq_cst);
+			list = source.load(std::memory_order_seq_cst);
+		}
+
+		~ProcessorListReader(){
+			readers.fetch_sub(1, std::memory_order_release);
+		}
+
+		ProcessorListReader(const ProcessorListReader&) = delete;
+		ProcessorListReader& operator=(const ProcessorListReader&) = delete;
+
+		inline ProcessorList::const_iterator begin() const{
+			return list->begin();
+		}
+
+		inline ProcessorList::const_iterator end() const{
+			return list->end();
+		}
+
+		inline size_t size() const{
+			return list->size();
+		}
+
+	private:
+
+		const ProcessorList* list = nullptr;
+		std::atomic<size_t>& readers;
+
+	};
 
 	virtual void reset() = 0; // processor specific for setup/reset
 
 	virtual inline void process(oni_frame_t* frame) = 0;
 	virtual inline void process(ONI::Frame::BaseFrame& frame) = 0;
 
+	// batched path for a block of multi frames; the default unpacks the block one
+	// frame at a time through process(BaseFrame&) (writing back anything the processor
+	// changed) so processors that don't override this keep working, while those that
+	// do can work directly on the block's per probe lanes
+	virtual inline void process(ONI::Frame::MultiFrameBlock& block){
+		ONI::Frame::Rhs2116MultiFrame frame;
+		for(size_t i = 0; i < block.size(); ++i){
+			block.getFrame(i, frame);
+			process(frame);
+			block.setFrame(i, frame);
+		}
+	}
+
+	// detected spikes, in order, for processors subscribed to the SpikeProcessor (or
+	// to another spike processor down the chain). Called on the detection thread with
+	// the spike still in hand, so anything set on it shows up in the spike and burst
+	// buffers. Most processors don't care about spikes so the default ignores them
+	virtual inline void process(ONI::Spike& spike){}
+
 	inline void subscribeProcessor(const std::string& processorName, const SubscriptionType& type, BaseProcessor * processor){
 		const std::lock_guard<std::mutex> lock(mutex);
 		std::map<std::string, BaseProcessor*>& processors = (type == PRE_PROCESSOR ? preProcessors : postProcessors);
@@ -50,6 +116,7 @@ public:
 		if(it == processors.end()){
 			LOGINFO("Adding processor %s", processorName.c_str());
 			processors[processorName] = processor;
+			publishProcessorList(type);
 		}else{
 			//LOGALERT("Processor %s already exists", processorName.c_str());
 		}
@@ -64,9 +131,22 @@ public:
 		}else{
 			LOGINFO("Deleting processor %s", processorName.c_str());
 			processors.erase(it);
+			publishProcessorList(type);
 		}
 	}
 
+	// flat subscriber lists for the dispatch path: these are immutable snapshots of the
+	// maps above, swapped in atomically whenever a subscription changes, so iterating
+	// them never needs the subscription mutex and never races with (un)subscribe calls
+
+	inline ProcessorListReader getPreProcessorList(){
+		return ProcessorListReader(preProcessorList, listReaders);
+	}
+
+	inline ProcessorListReader getPostProcessorList(){
+		return ProcessorListReader(postProcessorList, listReaders);
+	}
+
 	inline const ONI::Processor::TypeID& getProcessorTypeID(){
 		return processorTypeID;
 	}
@@ -91,8 +171,44 @@ protected:
 
 private:
 
+	inline void publishProcessorList(const SubscriptionType& type){ // call with mutex locked
+		std::map<std::string, BaseProcessor*>& processors = (type == PRE_PROCESSOR ? preProcessors : postProcessors);
+		std::atomic<ProcessorList*>& list = (type == PRE_PROCESSOR ? preProcessorList : postProcessorList);
+		ProcessorList* nextList = new ProcessorList;
+		nextList->reserve(processors.size());
+		for(auto& it : processors) nextList->push_back(it.second);
+		ProcessorList* lastList = list.exchange(nextList, std::memory_order_seq_cst);
+		// a dispatch thread may still be walking the last list, so it's retired until
+		// there's a moment with no readers
+		if(lastList != &emptyPreProcessorList && lastList != &emptyPostProcessorList){
+			retiredProcessorLists.push_back(std::unique_ptr<ProcessorList>(lastList));
+		}
+		freeRetiredProcessorLists();
+	}
+
+	// call with mutex locked: readers that came in after the exchange got the new list,
+	// so once none are reading none of the retired lists can still be held. Readers are
+	// only in for as long as a process() call takes, so we give them a little while to
+	// clear and otherwise leave the lists for the next (un)subscribe
+	inline void freeRetiredProcessorLists(){
+		for(size_t i = 0; i < 1000 && retiredProcessorLists.size() > 0; ++i){
+			if(listReaders.load(std::memory_order_seq_cst) == 0){
+				retiredProcessorLists.clear();
+				return;
+			}
+			std::this_thread::yield();
+		}
+	}
+
 	std::mutex mutex;
 
+	ProcessorList emptyPreProcessorList;
+	ProcessorList emptyPostProcessorList;
+	std::atomic<ProcessorList*> preProcessorList = &emptyPreProcessorList;
+	std::atomic<ProcessorList*> postProcessorList = &emptyPostProcessorList;
+	std::atomic<size_t> listReaders = 0;
+	std::vector<std::unique_ptr<ProcessorList>> retiredProcessorLists;
+
 };
 
 
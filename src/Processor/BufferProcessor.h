@@ -19,10 +19,13 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <random>
+#include <shared_mutex>
 #include <syncstream>
 
 #include "../Type/Log.h"
 #include "../Type/FrameBuffer.h"
+#include "../Type/Snapshot.h"
 #include "../Type/RegisterTypes.h"
 #include "../Type/SettingTypes.h"
 #include "../Type/FrameTypes.h"
@@ -39,9 +42,6 @@
 #define FRONT_BUFFER 0
 #define BACK_BUFFER 1
 
-#define DENSE_MUTEX 0
-#define SPARSE_MUTEX 1
-
 namespace ONI{
 
 namespace Interface{
@@ -53,6 +53,7 @@ namespace Processor{
 
 class SpikeProcessor;
 class AudioProcessor;
+class ReferenceProcessor;
 
 class BufferProcessor : public BaseProcessor{
 
@@ -60,9 +61,13 @@ public:
 
     friend class SpikeProcessor;
     friend class AudioProcessor;
+    friend class ReferenceProcessor;
     friend class ONI::Interface::SpikeInterface;
     friend class ONI::Interface::BufferInterface;
 
+    typedef ONI::Snapshot<std::vector<ONI::Frame::ProbeStatistics>>::Pointer ProbeStatsSnapshot;
+    typedef ONI::Snapshot<std::vector<bool>>::Pointer ActiveProbesSnapshot;
+
     BufferProcessor(){
         BaseProcessor::processorTypeID = ONI::Processor::TypeID::BUFFER_PROCESSOR;
         BaseProcessor::processorName = toString(processorTypeID);
@@ -97,31 +102,51 @@ public:
 
     void reset(){
         LOGINFO("Reset Buffer Processor");
-        bThread = false;
-        if(thread.joinable()) thread.join();
         resetBuffers();
         resetProbeData();
-        bThread = true;
-        thread = std::thread(&ONI::Processor::BufferProcessor::processBuffers, this);
     }
 
 	inline void process(oni_frame_t* frame){}; // nothing
     
     float phase = 0;
     std::vector<bool> sparseSpikes;
+
+    inline void process(ONI::Frame::MultiFrameBlock& block){
+
+        // readers don't block us (see FrameBuffer), the only thing we can't write
+        // through is a resize, and then the samples are about to be cleared anyway
+        std::shared_lock<std::shared_mutex> lock(bufferMutex, std::try_to_lock);
+
+        if(lock.owns_lock()){
+            denseBuffer.push(block);
+            sparseBuffer.push(block);
+            publishThresholds();
+            lock.unlock();
+        }else{
+            droppedWriteCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        for(auto& processor : getPostProcessorList()){
+            processor->process(block);
+        }
+
+    }
+
 	inline void process(ONI::Frame::BaseFrame& frame){
 
         ONI::Frame::Rhs2116MultiFrame* multi_frame = reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame);
 
 
-        dataMutex[DENSE_MUTEX].lock();
-        denseBuffer.push(*multi_frame);
-        dataMutex[DENSE_MUTEX].unlock();
-
+        std::shared_lock<std::shared_mutex> lock(bufferMutex, std::try_to_lock);
 
-        dataMutex[SPARSE_MUTEX].lock();
-        sparseBuffer.push(*multi_frame);
-        dataMutex[SPARSE_MUTEX].unlock();
+        if(lock.owns_lock()){
+            denseBuffer.push(*multi_frame);
+            sparseBuffer.push(*multi_frame);
+            publishThresholds();
+            lock.unlock();
+        }else{
+            droppedWriteCount.fetch_add(1, std::memory_order_relaxed);
+        }
 
         /*
         // check for spike flag --> this means marking the frame *after* the 
@@ -162,140 +187,239 @@ public:
         //std::this_thread::yield(); // ????
         */
 
-        for(auto& it : postProcessors){
-            it.second->process(frame);
+        for(auto& processor : getPostProcessorList()){
+            processor->process(frame);
         }
 
 	}
 
     void resetBuffers(){ // const bool& bUseSamplesForSize = true // Should we give user the choice?
-        lockAll();
+        std::unique_lock<std::shared_mutex> lock(bufferMutex);
         using namespace std::chrono;
         lastThresholdTime = duration_cast<milliseconds>(high_resolution_clock::now().time_since_epoch()).count();
         denseBuffer.clear();
         sparseBuffer.clear();
         denseBuffer.resizeBySamples(settings.getBufferSizeSamples(), 1, numProbes);
         sparseBuffer.resizeByMillis(settings.getBufferSizeMillis(), settings.getSparseStepMillis(), numProbes);
-        unlockAll();
+        sparseBuffer.setTrackStatistics(true);
+        droppedWriteCount = 0;
+        lock.unlock();
+        LOGINFO("Dense buffer %i samples (%s), sparse buffer %i samples (%s)", 
+                denseBuffer.size(), denseBuffer.isMirrored() ? "mirrored" : "triple written",
+                sparseBuffer.size(), sparseBuffer.isMirrored() ? "mirrored" : "triple written");
         resetProbeData();
     }
 
     void resetProbeData(){
-        lockAll();
-        probeStats[FRONT_BUFFER].clear();
-        probeStats[BACK_BUFFER].clear();
-        probeStats[FRONT_BUFFER].resize(BaseProcessor::numProbes);
-        probeStats[BACK_BUFFER].resize(BaseProcessor::numProbes);
+        std::unique_lock<std::shared_mutex> lock(bufferMutex);
+        probeStats.publish(std::vector<ONI::Frame::ProbeStatistics>(BaseProcessor::numProbes));
         activeProbes.resize(BaseProcessor::numProbes);
         if(!fu::Serializer.loadClass("activeProbes.conf", *this, ARCHIVE_TEXT)){
             for(size_t probe = 0; probe < numProbes; ++probe){
                 activeProbes[probe] = true;
             }
         }
+        publishedActiveProbes.publish(activeProbes);
         sparseTimeStamps.resize(sparseBuffer.size());
         sparseCountStamps.resize(sparseBuffer.size());
         for(size_t frame = 0; frame < sparseTimeStamps.size(); ++frame){
             sparseCountStamps[frame] = frame;
             sparseTimeStamps[frame] = frame * sparseBuffer.getMillisPerStep();
         }
-        unlockAll();
     }
 
-    inline void lockAll() {
-        dataMutex[DENSE_MUTEX].lock();
-        dataMutex[SPARSE_MUTEX].lock();
+    // writes dropped because a resize held the buffers
+    inline uint64_t getDroppedWriteCount(){
+        return droppedWriteCount.load(std::memory_order_relaxed);
     }
 
-    inline void unlockAll() {
-        dataMutex[DENSE_MUTEX].unlock();
-        dataMutex[SPARSE_MUTEX].unlock();
+    // reads that had to be retried because the writer lapped them
+    inline uint64_t getReadRetryCount(){
+        return denseBuffer.getReadRetryCount() + sparseBuffer.getReadRetryCount();
     }
 
-    void close(){
-        bThread = false;
-        if(thread.joinable()) thread.join();
-        denseBuffer.clear();
-        sparseBuffer.clear();
-        probeStats[FRONT_BUFFER].clear();
-        probeStats[BACK_BUFFER].clear();
+    inline uint64_t getReadCount(){
+        return denseBuffer.getReadCount() + sparseBuffer.getReadCount();
     }
-    
-private:
-    
 
-    inline void processBuffers(){
+    // times the running std-dev stats on their own and with the MAD histogram on top against
+    // the full recompute over the buffer they replaced, over gaussian noise with spikes
+    // riding on it, and how close each gets to the real noise. The recompute is also given
+    // per sample, spread over the samples that come in between recomputes (autoThresholdMs)
+    void benchmarkNoiseEstimators(const size_t& numSamples = 300000, const size_t& blockSize = 32){
+
+        const size_t numBenchProbes = std::max((size_t)numProbes, (size_t)1);
+        const float noiseDeviation = 10.0f; // uV, like the headstage noise
+        const float spikeAmplitude = -120.0f; // uV
+        const size_t spikeLength = 30;
+        const float spikeProbability = 20.0f / RHS2116_SAMPLE_FREQUENCY_HZ; // ~20 Hz
+
+        // make a second of synthetic data up front and loop it, so we only time the stats
+        const size_t numBlocks = std::max((size_t)(RHS2116_SAMPLE_FREQUENCY_HZ / blockSize), (size_t)1);
+        std::vector<ONI::Frame::MultiFrameBlock> blocks;
+        std::mt19937 rng(1234);
+        std::normal_distribution<float> noise(0.0f, noiseDeviation);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        std::vector<size_t> spikeRemaining(numBenchProbes, 0);
+        ONI::Frame::Rhs2116MultiFrame frame;
+
+        for(size_t b = 0; b < numBlocks; ++b){
+            blocks.emplace_back(blockSize, numBenchProbes);
+            for(size_t i = 0; i < blockSize; ++i){
+                for(size_t probe = 0; probe < numBenchProbes; ++probe){
+                    if(spikeRemaining[probe] == 0 && uniform(rng) < spikeProbability) spikeRemaining[probe] = spikeLength;
+                    float v = noise(rng);
+                    if(spikeRemaining[probe] > 0){
+                        v += spikeAmplitude * std::sin(3.14159f * (float)(spikeLength - spikeRemaining[probe]) / spikeLength);
+                        --spikeRemaining[probe];
+                    }
+                    frame.ac_uV[probe] = v;
+                }
+                blocks[b].push(frame);
+            }
+        }
 
-        using namespace std::chrono;
+        const size_t bufferSamples = settings.getBufferSizeSamples();
+        const size_t numPushes = std::max(numSamples / blockSize, (size_t)1);
+
+        const char* names[3] = {"NONE", "STD", "STD+MAD"};
+        double nanos[3] = {0, 0, 0};
+        std::vector<ONI::Frame::ProbeStatistics> stats;
+
+        fu::Timer timer;
+
+        for(size_t mode = 0; mode < 3; ++mode){
+
+            ONI::FrameBuffer buffer;
+            buffer.resizeBySamples(bufferSamples, 1, numBenchProbes);
+            buffer.setTrackStatistics(mode > 0, mode > 1);
+
+            // round the ring once first so no mode's timing includes faulting its pages in
+            for(size_t i = 0; i <= buffer.size() / blockSize; ++i) buffer.push(blocks[i % numBlocks]);
+
+            timer.start();
+            for(size_t i = 0; i < numPushes; ++i) buffer.push(blocks[i % numBlocks]);
+            nanos[mode] = timer.stop();
+
+            if(mode == 0){
+
+                // what calculateThresholds used to do every autoThresholdMs: a mean pass
+                // and a deviation pass over every sample in the buffer for every probe
+                const size_t N = std::min(buffer.getBufferCount(), buffer.size());
+                stats.resize(numBenchProbes);
+                timer.start();
+                for(size_t probe = 0; probe < numBenchProbes; ++probe){
+                    ONI::Frame::ProbeStatistics& s = stats[probe];
+                    const float* acProbeVoltages = buffer.getAcuVFloatRaw(probe, 0);
+                    s.sum = 0;
+                    for(size_t frame = 0; frame < N; ++frame) s.sum += acProbeVoltages[frame];
+                    s.mean = s.sum / N;
+                    s.std = 0;
+                    for(size_t frame = 0; frame < N; ++frame){
+                        const float acdiff = acProbeVoltages[frame] - s.mean;
+                        s.std += acdiff * acdiff;
+                    }
+                    s.variance = s.std / N;
+                    s.deviation = std::sqrt(s.variance);
+                }
+                const double recomputeNanos = timer.stop();
 
-        while(bThread){
+                double meanDeviation = 0;
+                for(size_t probe = 0; probe < numBenchProbes; ++probe) meanDeviation += stats[probe].deviation / numBenchProbes;
 
-            if(settings.bUseAutoThreshold && (ONI::Global::model.isAquiring() || ONI::Global::model.getRecordProcessor()->isPlaying())){
-                uint64_t tnow = duration_cast<milliseconds>(high_resolution_clock::now().time_since_epoch()).count();
-                if(tnow - lastThresholdTime > settings.autoThresholdMs){
-                    calculateThresholds();
-                    lastThresholdTime = duration_cast<milliseconds>(high_resolution_clock::now().time_since_epoch()).count();
-                }
-            }
+                const double samplesPerRecompute = std::max(settings.autoThresholdMs * RHS2116_SAMPLES_PER_MS, (long double)1);
+                LOGINFO("Noise %-8s %6.2f ns/sample/probe at one recompute per %i ms, %8.0f ns to recompute all probes over %i samples",
+                        "RECOMPUTE", recomputeNanos / (samplesPerRecompute * numBenchProbes), settings.autoThresholdMs, recomputeNanos, (int)N);
+                LOGINFO("Noise %-8s deviation %0.5f (%+0.1f%%)", "RECOMPUTE", meanDeviation, 100.0 * (meanDeviation - noiseDeviation) / noiseDeviation);
 
-        }
+                continue;
 
-    }
+            }
 
-    inline void calculateThresholds(){
+            timer.start();
+            buffer.getStatistics(stats);
+            double queryNanos = timer.stop();
 
-        //LOGDEBUG("Check thresholds");
+            double meanDeviation = 0, meanRobustDeviation = 0;
+            for(size_t probe = 0; probe < numBenchProbes; ++probe){
+                meanDeviation += stats[probe].deviation / numBenchProbes;
+                meanRobustDeviation += stats[probe].robustDeviation / numBenchProbes;
+            }
 
-        dataMutex[SPARSE_MUTEX].lock();
+            const double perSample = (nanos[mode] - nanos[0]) / ((double)numPushes * blockSize * numBenchProbes);
+            LOGINFO("Noise %-8s %6.2f ns/sample/probe over the push, %8.0f ns to read all probes", names[mode], perSample, queryNanos);
+            LOGINFO("Noise %-8s deviation %0.5f (%+0.1f%%)", names[mode], meanDeviation, 100.0 * (meanDeviation - noiseDeviation) / noiseDeviation);
+            if(mode == 2) LOGINFO("Noise %-8s robust deviation %0.5f (%+0.1f%%)", names[mode], meanRobustDeviation, 100.0 * (meanRobustDeviation - noiseDeviation) / noiseDeviation);
 
-        size_t N = std::min(sparseBuffer.getCurrentIndex(), sparseBuffer.size());
+        }
 
-        for(size_t probe = 0; probe < numProbes; ++probe){
+    }
 
-            probeStats[BACK_BUFFER][probe].sum = 0;
+    void close(){
+        denseBuffer.clear();
+        sparseBuffer.clear();
+        probeStats.publish(std::vector<ONI::Frame::ProbeStatistics>());
+    }
+    
+private:
+    
 
-            float* acProbeVoltages = sparseBuffer.getAcuVFloatRaw(probe, 0);
+    // the sparse buffer keeps running stats as samples go in and out, so this
+    // is just a copy into a new snapshot of them every autoThresholdMs
+    inline void publishThresholds(){
 
-            for(size_t frame = 0; frame < N; ++frame){
-                probeStats[BACK_BUFFER][probe].sum += acProbeVoltages[frame];
-            }
+        using namespace std::chrono;
 
-            probeStats[BACK_BUFFER][probe].mean = probeStats[BACK_BUFFER][probe].sum / N;
-            probeStats[BACK_BUFFER][probe].std = 0;
+        const bool bForce = bForceThresholds.exchange(false, std::memory_order_relaxed);
+        if(!settings.bUseAutoThreshold && !bForce) return;
 
-            for(size_t frame = 0; frame < N; ++frame){
-                float acdiff = acProbeVoltages[frame] - probeStats[BACK_BUFFER][probe].mean;
-                probeStats[BACK_BUFFER][probe].std += acdiff * acdiff;
-            }
+        uint64_t tnow = duration_cast<milliseconds>(high_resolution_clock::now().time_since_epoch()).count();
+        if(!bForce && tnow - lastThresholdTime < settings.autoThresholdMs) return;
 
-            probeStats[BACK_BUFFER][probe].variance = probeStats[BACK_BUFFER][probe].std / (N);  // use population (N) or sample (n-1) deviation?
-            probeStats[BACK_BUFFER][probe].deviation = sqrt(probeStats[BACK_BUFFER][probe].variance);
+        sparseBuffer.getStatistics(probeStats.back());
+        probeStats.publish();
 
-        }
-        
-        dataMutex[SPARSE_MUTEX].unlock();
+        lastThresholdTime = tnow;
 
-        //probeDataMutex.lock();
-        //std::swap(probeStats[FRONT_BUFFER], probeStats[BACK_BUFFER]);
-        //probeDataMutex.unlock();
+    }
 
+    // stats are published from the processing thread, this just asks for the next block to do it
+    inline void calculateThresholds(){
+        bForceThresholds = true;
     }
 
-    inline const std::vector<ONI::Frame::ProbeStatistics>& getProbeStatsUnlocked(){
-        //const std::lock_guard<std::mutex> lock(dataMutex[SPARSE_MUTEX]);
-        //return probeStats[FRONT_BUFFER];
-        return probeStats[BACK_BUFFER]; // unsafe, but who cares.....until you do!!!???? causes lots of locks in the interface
+    inline ProbeStatsSnapshot getProbeStatsUnlocked(){
+        return getProbeStats();
     }
 
-    inline const std::vector<ONI::Frame::ProbeStatistics>& getProbeStats(){
-        const std::lock_guard<std::mutex> lock(dataMutex[SPARSE_MUTEX]);
-        //return probeStats[FRONT_BUFFER];
-        return probeStats[BACK_BUFFER]; // unsafe, but who cares.....until you do!!!???? causes lots of locks in the interface
+    // no lock, the stats stay as they are for as long as the snapshot is held
+    inline ProbeStatsSnapshot getProbeStats(){
+        return probeStats.get();
     }
 
+    // gui thread, processing threads want getActiveProbesSnapshot
     inline std::vector<bool>& getActiveProbes(){
         return activeProbes;
     }
 
+    // gui thread: switches a probe on or off, publishes it for the processing threads and saves it
+    void setActiveProbe(const size_t& probe, const bool& bActive){
+        if(probe >= activeProbes.size()) return;
+        activeProbes[probe] = bActive;
+        publishedActiveProbes.publish(activeProbes);
+        saveActiveProbes();
+    }
+
+    // any thread, stays as it is for as long as it's held
+    inline ActiveProbesSnapshot getActiveProbesSnapshot(){
+        return publishedActiveProbes.get();
+    }
+
+    // any thread, moves on every time the active probes are published
+    inline uint64_t getActiveProbesGeneration(){
+        return publishedActiveProbes.getGeneration();
+    }
+
     void saveActiveProbes(){
         fu::Serializer.saveClass("activeProbes.conf", *this, ARCHIVE_TEXT);
     }
@@ -306,23 +430,23 @@ protected:
 
     std::vector<float> sparseTimeStamps;
     std::vector<float> sparseCountStamps;
-    std::vector<ONI::Frame::ProbeStatistics> probeStats[2];
+    ONI::Snapshot<std::vector<ONI::Frame::ProbeStatistics>> probeStats; // one writer at a time: publishThresholds holds bufferMutex shared, the resets hold it exclusive
+    std::atomic<bool> bForceThresholds = false;
 
     ONI::FrameBuffer denseBuffer;   // contains all frames at full sample rate
     ONI::FrameBuffer sparseBuffer; // contains a sparse buffer sampled every N samples
-    std::mutex dataMutex[2];
+    std::shared_mutex bufferMutex;  // exclusive only to resize, everything else holds it shared
     std::mutex probeDataMutex;
 
-    std::vector<bool> activeProbes;
+    std::atomic<uint64_t> droppedWriteCount = 0;
+
+    std::vector<bool> activeProbes; // gui thread
+    ONI::Snapshot<std::vector<bool>> publishedActiveProbes;
 
     ONI::Processor::BaseProcessor* source = nullptr;
 
     ONI::Settings::BufferProcessorSettings settings;
 
-    std::atomic_bool bThread = false;
-
-    std::thread thread;
-
     friend class boost::serialization::access;
     template<class Archive>
     void serialize(Archive& ar, const unsigned int version){
@@ -99,6 +99,7 @@ public:
 				}
 
 			}
+			updateGatherOffsets();
 		}else{
 			LOGERROR("Channel map size doesn't equal number of probes");
 		}
@@ -112,6 +113,12 @@ public:
 		return inverseChannelMap;
 	}
 
+	// byte offset of each mapped probe's ac sample in an array of Rhs2116DataExtended
+	// frames ordered by device, so Rhs2116MultiFrame can convert and map in one gather
+	const std::vector<int32_t>& getGatherOffsets(){
+		return gatherOffsets;
+	}
+
 	void updateChannelMaps(){
 
 		if(channelMapBoolMatrix.size() == 0) return;
@@ -133,6 +140,8 @@ public:
 			inverseChannelMap[settings.channelMap[i]] = i;
 		}
 
+		updateGatherOffsets();
+
 	}
 
 	void setChannelMapFromBoolMatrix(const std::vector< std::vector<bool> >& matrix){
@@ -148,8 +157,17 @@ public:
 
 protected:
 
+	void updateGatherOffsets(){
+		gatherOffsets.resize(numProbes);
+		for(size_t probe = 0; probe < inverseChannelMap.size(); ++probe){
+			const size_t channel = inverseChannelMap[probe];
+			gatherOffsets[probe] = (int32_t)((channel / 16) * sizeof(ONI::Frame::Rhs2116DataExtended) + ONI::Frame::RHS2116_AC_BYTE_OFFSET + (channel % 16) * sizeof(uint16_t));
+		}
+	}
+
 	std::vector< std::vector<bool> > channelMapBoolMatrix;
 	std::vector<size_t> inverseChannelMap;
+	std::vector<int32_t> gatherOffsets;
 
 	ONI::Settings::ChannelMapProcessorSettings settings;
 
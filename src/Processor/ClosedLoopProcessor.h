@@ -0,0 +1,444 @@
+//
+//  ClosedLoopProcessor.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <bitset>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <limits>
+
+#include "../Type/Log.h"
+#include "../Type/SettingTypes.h"
+#include "../Type/GlobalTypes.h"
+#include "../Type/FrameTypes.h"
+#include "../Type/ClockSync.h"
+#include "../Type/LatencyHistogram.h"
+
+#include "../Processor/BaseProcessor.h"
+#include "../Processor/SpikeProcessor.h"
+#include "../Processor/Rhs2116StimProcessor.h"
+
+#pragma once
+
+namespace ONI{
+
+namespace Interface{
+class ClosedLoopInterface;
+};
+
+namespace Processor{
+
+// Spike triggered stimulation
+//
+// Subscribe it to the SpikeProcessor (or the SpikeSorterProcessor if rules need unit
+// ids) and it checks every spike against a handful of rules on the detection thread,
+// triggering the stim devices straight from there. The SpikeProcessor hands spikes on
+// as it drains them from the detection shards, before it takes spikeMutex for the gui
+// buffers, so a trigger never waits on a redraw. Don't subscribe anything that blocks
+// alongside it (file writers etc. belong on the spike broadcast, see the RecordProcessor).
+// Rules themselves don't lock or allocate: they live in fixed arrays, new rules go
+// through a triple buffer (like the BiquadCascade's sections) that the detection
+// thread swaps in between spikes, and the trigger is a bare TRIGGER write.
+//
+// Every trigger records the time from the sample that crossed threshold to the TRIGGER
+// write returning (host clock, via the SpikeProcessor's ClockSync) and, given a landed
+// time source (eg., the sim driver's last trigger time), the acquisition clock time the
+// write actually landed at.
+
+class ClosedLoopProcessor : public BaseProcessor{
+
+public:
+
+    friend class ONI::Interface::ClosedLoopInterface;
+
+    ClosedLoopProcessor(){
+        BaseProcessor::processorTypeID = ONI::Processor::TypeID::CLOSED_LOOP_PROCESSOR;
+        BaseProcessor::processorName = toString(processorTypeID);
+    }
+
+    ~ClosedLoopProcessor(){
+        LOGDEBUG("ClosedLoopProcessor DTOR");
+        bBenchmarkCancel = true;
+        if(benchmarkThread.joinable()) benchmarkThread.join();
+    };
+
+    // source is whichever processor hands on the spikes, the SpikeProcessor or the SpikeSorterProcessor
+    void setup(ONI::Processor::BaseProcessor* source){
+
+        LOGDEBUG("Setting up ClosedLoopProcessor Processor");
+
+        assert(source != nullptr);
+
+        spikeProcessor = ONI::Global::model.getSpikeProcessor();
+        stimProcessor = ONI::Global::model.getRhs2116StimProcessor();
+
+        assert(spikeProcessor != nullptr && stimProcessor != nullptr, "User must create the SpikeProcessor and Rhs2116StimProcessor first!");
+
+        source->subscribeProcessor("ClosedLoopProcessor", ONI::Processor::SubscriptionType::POST_PROCESSOR, this);
+
+        BaseProcessor::numProbes = spikeProcessor->getNumProbes();
+
+        reset();
+
+    }
+
+    void reset(){
+        LOGINFO("ClosedLoopProcessor RESET");
+        resetStats();
+    };
+
+    inline void process(oni_frame_t* frame){};
+    inline void process(ONI::Frame::BaseFrame& frame){};
+
+    // called from the spike detection thread for every spike
+    inline void process(ONI::Spike& spike){
+
+        if(middleIDX.load(std::memory_order_relaxed) & NEW_RULES){ // new rules, swapped in between spikes
+            frontIDX = middleIDX.exchange(frontIDX, std::memory_order_acq_rel) & ~NEW_RULES;
+        }
+
+        RuleSet& active = ruleSets[frontIDX];
+
+        if(active.bArmed && active.sequence > disarmedSequence.load(std::memory_order_acquire)){
+            for(size_t i = 0; i < active.numRules; ++i){
+                RuleState& rule = active.rules[i];
+                if(!rule.bEnabled || !rule.probes[spike.probe]) continue;
+                if(rule.unitID != -1 && spike.unitID != rule.unitID) continue;
+                if(rule.bIgnoreStimSpikes && spike.bStimFrame) continue;
+                if(checkRule(rule, spike.crossingTimeHardware)) fire(rule, spike);
+            }
+        }
+
+        for(ONI::Processor::BaseProcessor* processor : getPostProcessorList()) processor->process(spike);
+
+    }
+
+    // Validates and compiles the rules for the detection thread, which swaps them in at
+    // its next spike. Never waits on it: rules it hasn't picked up yet are replaced
+    bool setSettings(const ONI::Settings::ClosedLoopSettings& nextSettings){
+
+        if(nextSettings.rules.size() > ONI::MAX_CLOSED_LOOP_RULES){
+            LOGERROR("Closed loop rules are limited to %i", ONI::MAX_CLOSED_LOOP_RULES);
+            return false;
+        }
+
+        const std::lock_guard<std::mutex> lock(settingsMutex); // the gui and the benchmark thread can both write
+
+        const double ticksPerMs = spikeProcessor->getClockSync().getTicksPerSecond() / 1000.0;
+
+        RuleSet& staged = ruleSets[backIDX];
+
+        for(size_t i = 0; i < nextSettings.rules.size(); ++i){
+            const ONI::Settings::ClosedLoopRule& r = nextSettings.rules[i];
+            RuleState& rule = staged.rules[i];
+            rule = RuleState();
+            rule.bEnabled = r.bEnabled;
+            for(const int& probe : r.probes){
+                if(probe >= 0 && probe < MAX_NUM_MULTIPROBES) rule.probes[probe] = true;
+            }
+            if(r.probes.size() == 0) rule.probes.set(); // no probes listed means any probe
+            rule.unitID = r.unitID;
+            rule.minSpikes = std::clamp(r.minSpikes, 1, (int)ONI::MAX_CLOSED_LOOP_SPIKES);
+            rule.windowTicks = std::max(r.windowMs, 0.0f) * ticksPerMs;
+            rule.refractoryTicks = std::max(r.refractoryMs, 0.0f) * ticksPerMs;
+            rule.stimDeviceIDX = r.stimDeviceIDX;
+            rule.bIgnoreStimSpikes = r.bIgnoreStimSpikes;
+        }
+
+        staged.numRules = nextSettings.rules.size();
+        staged.bArmed = nextSettings.bArmed;
+        staged.sequence = ++settingsSequence;
+
+        // hand the set over, getting back whichever one the detection thread isn't using
+        backIDX = middleIDX.exchange(backIDX | NEW_RULES, std::memory_order_acq_rel) & ~NEW_RULES;
+
+        settings = nextSettings;
+        return true;
+
+    }
+
+    // Stops everything staged so far from firing, including rules the detection thread
+    // hasn't swapped in yet. The next setSettings arms again as usual
+    void disarm(){
+        const std::lock_guard<std::mutex> lock(settingsMutex);
+        disarmedSequence.store(settingsSequence, std::memory_order_release);
+        settings.bArmed = false;
+    }
+
+    ONI::Settings::ClosedLoopSettings getSettings(){
+        const std::lock_guard<std::mutex> lock(settingsMutex);
+        return settings;
+    }
+
+    void resetStats(){
+        triggerLatency.reset();
+        landedLatency.reset();
+        triggerCount = 0;
+        failedTriggerCount = 0;
+    }
+
+    // threshold crossing to the TRIGGER write returning, on the host clock
+    inline ONI::LatencyHistogram& getTriggerLatency(){
+        return triggerLatency;
+    }
+
+    // threshold crossing to when the sim driver saw the TRIGGER write, on the acquisition clock
+    inline ONI::LatencyHistogram& getLandedLatency(){
+        return landedLatency;
+    }
+
+    inline uint64_t getTriggerCount(){
+        return triggerCount.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t getFailedTriggerCount(){
+        return failedTriggerCount.load(std::memory_order_relaxed);
+    }
+
+    // Where the acquisition clock time of the last TRIGGER write comes from, for the
+    // landed latency (the sim driver can read it back, see the example app). Returns false
+    // if it can't be read. Set before starting a benchmark
+    void setLandedTimeSource(const std::function<bool(uint64_t&)>& source){
+        landedTimeSource = source;
+    }
+
+    // Arms a single rule that fires on any spike (with a refractory period so the
+    // stimulus artifact can settle) and measures the trigger latency over numTriggers
+    // on its own thread, then puts the current rules back. Progress and results are
+    // read with the getBenchmark* functions while it runs
+    bool startTriggerLatencyBenchmark(const size_t& numTriggers = 50, const size_t& timeoutMs = 60000){
+        if(bBenchmarkRunning.load(std::memory_order_acquire)){
+            LOGALERT("Closed loop trigger latency benchmark already running");
+            return false;
+        }
+        if(benchmarkThread.joinable()) benchmarkThread.join();
+        bBenchmarkCancel = false;
+        bBenchmarkRunning = true;
+        benchmarkNumTriggers = numTriggers;
+        benchmarkThread = std::thread(&ONI::Processor::ClosedLoopProcessor::benchmarkTriggerLatency, this, numTriggers, timeoutMs);
+        return true;
+    }
+
+    void cancelTriggerLatencyBenchmark(){
+        bBenchmarkCancel = true;
+    }
+
+    inline bool isBenchmarkRunning(){
+        return bBenchmarkRunning.load(std::memory_order_acquire);
+    }
+
+    // triggers seen so far out of the number asked for
+    inline float getBenchmarkProgress(){
+        const size_t numTriggers = benchmarkNumTriggers.load(std::memory_order_relaxed);
+        return numTriggers == 0 ? 0.0f : std::min(getTriggerCount() / (float)numTriggers, 1.0f);
+    }
+
+    // results of the last finished benchmark, in ms
+    inline float getBenchmarkTriggerP50Ms(){ return benchmarkTriggerP50Ms.load(std::memory_order_relaxed); }
+    inline float getBenchmarkTriggerP99Ms(){ return benchmarkTriggerP99Ms.load(std::memory_order_relaxed); }
+    inline float getBenchmarkTriggerMaxMs(){ return benchmarkTriggerMaxMs.load(std::memory_order_relaxed); }
+    inline float getBenchmarkLandedP50Ms(){ return benchmarkLandedP50Ms.load(std::memory_order_relaxed); }
+    inline float getBenchmarkLandedP99Ms(){ return benchmarkLandedP99Ms.load(std::memory_order_relaxed); }
+    inline float getBenchmarkLandedMaxMs(){ return benchmarkLandedMaxMs.load(std::memory_order_relaxed); }
+    inline uint64_t getBenchmarkTriggerCount(){ return benchmarkTriggerCount.load(std::memory_order_relaxed); }
+    inline bool hasBenchmarkResults(){ return bBenchmarkResults.load(std::memory_order_acquire); }
+
+protected:
+
+    // benchmark thread, see startTriggerLatencyBenchmark
+    void benchmarkTriggerLatency(const size_t numTriggers, const size_t timeoutMs){
+
+        using namespace std::chrono;
+
+        const bool bLanded = landedTimeSource != nullptr;
+        if(!bLanded) LOGALERT("No landed time source, only host side trigger latency will be measured");
+
+        ONI::Settings::ClosedLoopSettings lastSettings = getSettings();
+
+        ONI::Settings::ClosedLoopRule rule;
+        for(size_t probe = 0; probe < numProbes; ++probe) rule.probes.push_back(probe);
+        rule.minSpikes = 1;
+        rule.windowMs = 1;
+        rule.refractoryMs = 200;
+
+        ONI::Settings::ClosedLoopSettings benchmarkSettings;
+        benchmarkSettings.bArmed = true;
+        benchmarkSettings.rules.push_back(rule);
+
+        if(!setSettings(benchmarkSettings)){
+            bBenchmarkRunning.store(false, std::memory_order_release);
+            return;
+        }
+        resetStats();
+
+        uint64_t lastLandedTime = 0;
+        const steady_clock::time_point start = steady_clock::now();
+
+        while(!bBenchmarkCancel && getTriggerCount() < numTriggers && steady_clock::now() - start < milliseconds(timeoutMs)){
+
+            std::this_thread::sleep_for(milliseconds(5)); // well inside the refractory period so we see every trigger
+
+            if(!bLanded) continue;
+
+            uint64_t landedTime = 0;
+            if(!landedTimeSource(landedTime)) continue;
+
+            const uint64_t crossingTime = lastTriggerCrossingTime.load(std::memory_order_acquire);
+            if(landedTime != lastLandedTime && landedTime >= crossingTime && crossingTime != 0){
+                landedLatency.record((landedTime - crossingTime) * 1000000000.0 / spikeProcessor->getClockSync().getTicksPerSecond());
+                lastLandedTime = landedTime;
+            }
+
+        }
+
+        // the benchmark rule would keep stimulating, and setSettings can't fail on rules that were already accepted
+        setSettings(lastSettings);
+
+        benchmarkTriggerCount.store(getTriggerCount(), std::memory_order_relaxed);
+        benchmarkTriggerP50Ms.store(triggerLatency.getPercentileNs(50) / 1e6, std::memory_order_relaxed);
+        benchmarkTriggerP99Ms.store(triggerLatency.getPercentileNs(99) / 1e6, std::memory_order_relaxed);
+        benchmarkTriggerMaxMs.store(triggerLatency.getMaxNs() / 1e6, std::memory_order_relaxed);
+        benchmarkLandedP50Ms.store(landedLatency.getPercentileNs(50) / 1e6, std::memory_order_relaxed);
+        benchmarkLandedP99Ms.store(landedLatency.getPercentileNs(99) / 1e6, std::memory_order_relaxed);
+        benchmarkLandedMaxMs.store(landedLatency.getMaxNs() / 1e6, std::memory_order_relaxed);
+        bBenchmarkResults.store(true, std::memory_order_release);
+
+        LOGINFO("Closed loop trigger latency over %i triggers (%i failed), detection lag %0.3f ms + filter latency %0.3f ms", getTriggerCount(), getFailedTriggerCount(),
+                spikeProcessor->getDetectionLagSamples() / (float)RHS2116_SAMPLES_PER_MS, spikeProcessor->getFilterLatencySamples() / (float)RHS2116_SAMPLES_PER_MS);
+        LOGINFO("Crossing to TRIGGER write (host) ms p50: %0.3f p99: %0.3f max: %0.3f",
+                triggerLatency.getPercentileNs(50) / 1e6, triggerLatency.getPercentileNs(99) / 1e6, triggerLatency.getMaxNs() / 1e6);
+        if(bLanded){
+            LOGINFO("Crossing to TRIGGER landed (acquisition clock) ms p50: %0.3f p99: %0.3f max: %0.3f (%i seen)",
+                    landedLatency.getPercentileNs(50) / 1e6, landedLatency.getPercentileNs(99) / 1e6, landedLatency.getMaxNs() / 1e6, landedLatency.getCount());
+        }
+
+        bBenchmarkRunning.store(false, std::memory_order_release);
+
+    }
+
+    // a compiled rule and the times of the last minSpikes spikes that matched it
+    struct RuleState{
+        bool bEnabled = false;
+        std::bitset<MAX_NUM_MULTIPROBES> probes;
+        int unitID = -1;
+        size_t minSpikes = 1;
+        uint64_t windowTicks = 0;
+        uint64_t refractoryTicks = 0;
+        int stimDeviceIDX = -1;
+        bool bIgnoreStimSpikes = true;
+
+        uint64_t spikeTimes[ONI::MAX_CLOSED_LOOP_SPIKES] = {};
+        size_t numSpikes = 0;
+        size_t nextSpike = 0;
+        uint64_t lastFireTime = 0;
+        bool bHasFired = false;
+    };
+
+    // Spikes from different probes in the same detection chunk don't arrive in time
+    // order, so the window is the spread of the last minSpikes times rather than the
+    // newest less the oldest to arrive
+    inline bool checkRule(RuleState& rule, const uint64_t& time){
+
+        if(rule.bHasFired && time < rule.lastFireTime + rule.refractoryTicks) return false;
+
+        rule.spikeTimes[rule.nextSpike] = time;
+        rule.nextSpike = (rule.nextSpike + 1) % rule.minSpikes;
+        if(rule.numSpikes < rule.minSpikes) ++rule.numSpikes;
+        if(rule.numSpikes < rule.minSpikes) return false;
+
+        uint64_t earliest = std::numeric_limits<uint64_t>::max();
+        uint64_t latest = 0;
+        for(size_t i = 0; i < rule.minSpikes; ++i){
+            earliest = std::min(earliest, rule.spikeTimes[i]);
+            latest = std::max(latest, rule.spikeTimes[i]);
+        }
+
+        return latest - earliest <= rule.windowTicks;
+
+    }
+
+    inline void fire(RuleState& rule, const ONI::Spike& spike){
+
+        const bool bTriggered = stimProcessor->triggerStimulusFast(rule.stimDeviceIDX);
+        const int64_t writtenNs = ONI::ClockSync::getHostNs();
+
+        rule.lastFireTime = spike.crossingTimeHardware;
+        rule.bHasFired = true;
+        rule.numSpikes = 0;
+        rule.nextSpike = 0;
+
+        if(!bTriggered){
+            failedTriggerCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        ONI::ClockSync& clockSync = spikeProcessor->getClockSync();
+        if(clockSync.isSynced()) triggerLatency.record(writtenNs - clockSync.toHostNs(spike.crossingTimeHardware));
+        lastTriggerCrossingTime.store(spike.crossingTimeHardware, std::memory_order_release);
+        triggerCount.fetch_add(1, std::memory_order_relaxed);
+
+    }
+
+    ONI::Processor::SpikeProcessor* spikeProcessor = nullptr;
+    ONI::Processor::Rhs2116StimProcessor* stimProcessor = nullptr;
+
+    ONI::Settings::ClosedLoopSettings settings;
+
+    struct RuleSet{
+        RuleState rules[ONI::MAX_CLOSED_LOOP_RULES];
+        size_t numRules = 0;
+        bool bArmed = false;
+        uint64_t sequence = 0;
+    };
+
+    // triple buffer: the detection thread runs ruleSets[frontIDX], setSettings fills
+    // ruleSets[backIDX] and swaps it into the middle, where the detection thread takes it
+    static constexpr size_t NEW_RULES = 4;
+    RuleSet ruleSets[3];
+    size_t frontIDX = 0;				// detection thread only
+    size_t backIDX = 2;					// setSettings only
+    std::atomic<size_t> middleIDX = 1;	// plus NEW_RULES when there's a set the detection thread hasn't taken
+
+    // every setSettings gets the next sequence number, rules at or below disarmedSequence don't fire
+    std::mutex settingsMutex;
+    uint64_t settingsSequence = 0;
+    std::atomic<uint64_t> disarmedSequence = 0;
+
+    ONI::LatencyHistogram triggerLatency;
+    ONI::LatencyHistogram landedLatency;
+    std::atomic<uint64_t> triggerCount = 0;
+    std::atomic<uint64_t> failedTriggerCount = 0;
+    std::atomic<uint64_t> lastTriggerCrossingTime = 0;
+
+    std::function<bool(uint64_t&)> landedTimeSource;
+
+    std::thread benchmarkThread;
+    std::atomic_bool bBenchmarkRunning = false;
+    std::atomic_bool bBenchmarkCancel = false;
+    std::atomic_bool bBenchmarkResults = false;
+    std::atomic<size_t> benchmarkNumTriggers = 0;
+    std::atomic<uint64_t> benchmarkTriggerCount = 0;
+    std::atomic<float> benchmarkTriggerP50Ms = 0;
+    std::atomic<float> benchmarkTriggerP99Ms = 0;
+    std::atomic<float> benchmarkTriggerMaxMs = 0;
+    std::atomic<float> benchmarkLandedP50Ms = 0;
+    std::atomic<float> benchmarkLandedP99Ms = 0;
+    std::atomic<float> benchmarkLandedMaxMs = 0;
+
+};
+
+
+} // namespace Processor
+} // namespace ONI
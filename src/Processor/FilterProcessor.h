@@ -19,6 +19,9 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <random>
+#include <cmath>
 #include <syncstream>
 
 #include "../Type/Log.h"
@@ -26,6 +29,10 @@
 #include "../Type/SettingTypes.h"
 #include "../Type/FrameTypes.h"
 #include "../Type/GlobalTypes.h"
+#include "../Type/SimdTypes.h"
+#include "../Type/BiquadCascade.h"
+#include "../Type/OverlapSaveFIR.h"
+#include "../Type/WorkerPool.h"
 
 #include "../Processor/BaseProcessor.h"
 
@@ -50,6 +57,9 @@ public:
 	friend class ONI::Interface::FilterInterface;
 	friend class ONI::Context;
 
+	static constexpr size_t FIR_MIN_TAPS = 15;
+	static constexpr size_t FIR_MAX_TAPS = 4095;
+	static constexpr float FIR_RESPONSE_TOLERANCE = 0.05f; // of the magnitude response, a gain of 1 in the pass band
 
 	FilterProcessor(){
 		BaseProcessor::processorTypeID = ONI::Processor::TypeID::FILTER_PROCESSOR;
@@ -67,181 +77,723 @@ public:
 
 		BaseProcessor::numProbes = source->getNumProbes();
 
-		bandstopFilters.resize(numProbes);
+		// the enabled filters' sections end to end, with every probe's state interleaved
+		filterCascade.setup(numProbes);
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			bandstopFilters[probe] = new Dsp::SmoothedFilterDesign<Dsp::Butterworth::Design::BandStop    // design type
-																  <4>,                                   // order
-																  1,                                     // number of channels (must be const)
-																  Dsp::DirectFormII>(1);                 // realization
+		// FIR blocks go out to a few workers on bigger machines, none on small ones
+		firWorkerPool.start(std::min((size_t)3, std::max((size_t)std::thread::hardware_concurrency(), (size_t)2) / 2 - 1));
+
+		stimHistory.assign(STIM_HISTORY_SIZE, 0);
+		stimHistoryCount = 0;
+
+		settings.bandStopFrequency = 1300;
+		settings.bandStopWidth = 1000;
+		settings.lowShelfFrequency = 100;
+		settings.lowShelfGain = -6;
+		settings.lowShelfRipple = 0.1;
+		settings.highShelfFrequency = 1000;
+		settings.highShelfGain = -12;
+		settings.highShelfRipple = 0.1;
+		settings.lowBandPassFrequency = 100;
+		settings.highBandPassFrequency = 3000;
+
+		compileFilters();
+
+    }
+
+	void reset(){};
+
+
+	inline void process(oni_frame_t* frame){};
+	inline void process(ONI::Frame::BaseFrame& frame){
+		ONI::Frame::Rhs2116MultiFrame* multiFrame = reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame);
+		const ONI::Settings::StimFilterStateType stimFilterState = updateFIR() ? ONI::Settings::STIM_FILTER_CONTINUE : settings.stimFilterState;
+		if(multiFrame->stimulation && stimFilterState != ONI::Settings::STIM_FILTER_CONTINUE){
+			beginStimWindow();
+		}else{
+			endStimWindow(stimFilterState);
+		}
+		filter(multiFrame->ac_uV, 1, 1); // probes side by side, so a stride of 1 and one sample
+		const size_t latency = latencySamples.load(std::memory_order_relaxed);
+		if(latency > 0) multiFrame->stimulation = delayStimulation(multiFrame->stimulation, latency);
+		for(auto& processor : getPostProcessorList()){
+			processor->process(frame);
 		}
+	}
 
-		setBandStop(1300, 1000);
+	inline void process(ONI::Frame::MultiFrameBlock& block){
 
-		lowshelfFilters.resize(numProbes);
+		// the FIR's output is late by its latency, skipping stim windows would only knock it further out of line
+		const ONI::Settings::StimFilterStateType stimFilterState = updateFIR() ? ONI::Settings::STIM_FILTER_CONTINUE : settings.stimFilterState;
+		const size_t numSamples = block.size();
+		const size_t stride = block.getStride();
+		const uint8_t* stimulation = block.stimulation.data();
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			lowshelfFilters[probe] = new Dsp::SmoothedFilterDesign<Dsp::Butterworth::Design::LowShelf     // design type
-																 <4>,                                   // order
-																 1,                                     // number of channels (must be const)
-																 Dsp::DirectFormII>(1);                 // realization
+		const bool bHasStimulation = stimFilterState != ONI::Settings::STIM_FILTER_CONTINUE &&
+									 std::any_of(stimulation, stimulation + numSamples, [](const uint8_t& s){ return s != 0; });
+
+		if(!bHasStimulation){
+
+			endStimWindow(stimFilterState);
+
+			// every probe's lane in one go, the cascades run across probes a stage at a time
+			filter(block.ac(0), stride, numSamples);
+
+		}else{
+
+			// a run at a time so the state can be put back at the end of each stim window
+			size_t i = 0;
+			while(i < numSamples){
+				const size_t start = i;
+				const bool bStimulation = stimulation[i] != 0;
+				while(i < numSamples && (stimulation[i] != 0) == bStimulation) ++i;
+				if(bStimulation){
+					beginStimWindow();
+				}else{
+					endStimWindow(stimFilterState);
+				}
+				filter(block.ac(0) + start, stride, i - start);
+			}
+
+		}
+
+		const size_t latency = latencySamples.load(std::memory_order_relaxed);
+		if(latency > 0){
+			uint8_t* delayedStimulation = block.stimulation.data();
+			for(size_t i = 0; i < numSamples; ++i) delayedStimulation[i] = delayStimulation(delayedStimulation[i], latency);
 		}
 
-		setLowShelf(100, -6, 0.1);
+		for(auto& processor : getPostProcessorList()){
+			processor->process(block);
+		}
+
+	}
+
+	// numSamples of every probe in place, probe p's samples start at samples + p * stride;
+	// whichever filters are enabled go in the one pass
+	inline void filter(float* samples, const size_t& stride, const size_t& numSamples){
+		if(fir != nullptr){
+			fir->process(samples, stride, numSamples, &firWorkerPool);
+		}else{
+			filterCascade.process(samples, stride, numSamples);
+		}
+	}
+
+	inline void resetFilters(){
+		filterCascade.reset();
+		if(fir != nullptr) fir->reset();
+	}
+
+	// Stim windows (HOLD and RESET) are filtered like everything else, so whatever the
+	// ArtifactProcessor left of them goes out, but the state they leave in the cascade
+	// is thrown away when they end: HOLD puts back the state from before the window and
+	// RESET clears it. Only the IIR cascade, the FIR always filters straight through
+	inline void beginStimWindow(){
+		if(!bInStimWindow) filterCascade.holdState();
+		bInStimWindow = true;
+	}
+
+	inline void endStimWindow(const ONI::Settings::StimFilterStateType& stimFilterState){
+		if(!bInStimWindow) return;
+		if(stimFilterState == ONI::Settings::STIM_FILTER_HOLD) filterCascade.restoreState();
+		if(stimFilterState == ONI::Settings::STIM_FILTER_RESET) resetFilters();
+		bInStimWindow = false;
+	}
+
+	// How many samples late the filters we're running put their output, 0 for the IIR
+	// sections. The stim flags we hand on are held back to match, but acquisition times
+	// aren't (the clock sync downstream pairs them with when the frames arrived), so
+	// anything that times samples has to take this off (see SpikeProcessor)
+	inline size_t getLatencySamples(){
+		return latencySamples.load(std::memory_order_acquire);
+	}
+
+	// as last compiled, 0 when running the IIR sections
+	inline float getFIRResponseError(){
+		return firResponseError;
+	}
+
+	inline size_t getFIRLatencySamples(){
+		return firLatencySamples;
+	}
+
+	inline size_t getFIRGroupDelaySamples(){
+		return firGroupDelaySamples;
+	}
+
+	// recompiles the cascade if any of the filters changed; bInteractive while a setting
+	// is being dragged so the new coefficients ramp in rather than step
+	void setSettings(const ONI::Settings::FilterSettings& nextSettings, const bool& bInteractive = false){
+		if(nextSettings == settings) return;
+		settings = nextSettings;
+		compileFilters(bInteractive ? FILTER_TRANSITION_SAMPLES : 0);
+	}
+
+	const ONI::Settings::FilterSettings& getSettings(){
+		return settings;
+	}
+
+	// as last compiled, the processing thread may not have picked them up yet
+	inline size_t getNumFilterStages(){
+		return numFilterStages;
+	}
+
+	inline ONI::BiquadDesignCache& getDesignCache(){
+		return designCache;
+	}
+
+	void setStimFilterState(const ONI::Settings::StimFilterStateType& stimFilterState){
+		settings.stimFilterState = stimFilterState;
+	}
+
+	void setBandStop(const int& frequency, const int& width){
+		settings.bandStopFrequency = frequency;
+		settings.bandStopWidth = width;
+		compileFilters();
+	}
+
+	void setLowShelf(const int& frequency, const float& gain, const float& ripple){
+		settings.lowShelfFrequency = frequency;
+		settings.lowShelfGain = gain;
+		settings.lowShelfRipple = ripple;
+		compileFilters();
+	}
+
+	void setHighShelf(const int& frequency, const float& gain, const float& ripple){
+		settings.highShelfFrequency = frequency;
+		settings.highShelfGain = gain;
+		settings.highShelfRipple = ripple;
+		compileFilters();
+	}
+
+	void setBandPass(const int& lowCutFrequency, const int& highCutFrequency){
+		settings.lowBandPassFrequency = lowCutFrequency;
+		settings.highBandPassFrequency = highCutFrequency;
+		compileFilters();
+	}
 
+	// Runs each filter, and the cascade of whichever are enabled, at the current settings
+	// over a few seconds of noise and sines with both the cascades (in blocks, at each
+	// instruction set the cpu has) and DSPFilters (a channel at a time, as this processor
+	// used to) and logs the largest difference relative to the largest DSPFilters output.
+	// They differ by float vs double rounding, which is worst for narrow low notches (poles
+	// right up against z = 1): the default 45 Hz / 10 Hz band stop is out by ~0.4%, under
+	// a uV, below the headstage noise
+	bool verifyFilters(const size_t& numChannels = 64, const float& tolerance = 1e-2f){
 
-		highshelfFilters.resize(numProbes);
+		bool bPassed = true;
+
+		for(int set = ONI::Simd::SCALAR; set <= (int)ONI::Simd::detectInstructionSet(); ++set){
+
+			const ONI::Simd::InstructionSet instructionSet = (ONI::Simd::InstructionSet)set;
+			const std::string setName = ONI::Simd::toString(instructionSet);
+
+			for(size_t filter = 0; filter < FILTER_COUNT; ++filter){
+				bPassed &= verifyCascade(std::string(getFilterName((FilterType)filter)) + " " + setName, {(FilterType)filter}, numChannels, tolerance, instructionSet);
+			}
+
+			if(getEnabledFilters().size() > 1) bPassed &= verifyCascade("Enabled " + setName, getEnabledFilters(), numChannels, tolerance, instructionSet);
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			highshelfFilters[probe] = new Dsp::SmoothedFilterDesign<Dsp::Butterworth::Design::HighShelf    // design type
-																  <4>,                                   // order
-																  1,                                     // number of channels (must be const)
-																  Dsp::DirectFormII>(1);                 // realization
 		}
 
-		setHighShelf(1000, -12, 0.1);
+		bPassed &= verifyFIR(numChannels);
+
+		return bPassed;
 
+	}
 
-		bandpassFilters.resize(numProbes);
+	// The FIR for the enabled filters at the current settings, overlap-save (in odd sized
+	// blocks, on the worker pool) against straight convolution with the same taps, and how
+	// far its magnitude response is from the sections it was designed from. Fails if
+	// either is out, and says how many taps it would take to follow the sections
+	bool verifyFIR(const size_t& numChannels = 64, const float& tolerance = 1e-4f, const float& responseTolerance = FIR_RESPONSE_TOLERANCE){
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			bandpassFilters[probe] = new Dsp::SmoothedFilterDesign<Dsp::Butterworth::Design::BandPass    // design type
-																  <4>,                                   // order
-																  1,                                     // number of channels (must be const)
-																  Dsp::DirectFormII>(1);                 // realization
+		std::vector<ONI::BiquadCascade::Stage> stages;
+		for(const FilterType& filter : getEnabledFilters()){
+			const std::vector<ONI::BiquadCascade::Stage> filterStages = getFilterStages(filter);
+			stages.insert(stages.end(), filterStages.begin(), filterStages.end());
 		}
 
-		setBandPass(100, 3000);
+		if(stages.size() == 0){
+			LOGINFO("Verify FIR skipped, no filters enabled");
+			return true;
+		}
 
-    }
+		const std::vector<float> taps = getFIRTaps(stages);
 
-	void reset(){};
+		ONI::OverlapSaveFIR overlapSave;
+		overlapSave.setup(numChannels, taps, std::clamp(settings.firBlockSize, 64, 65536));
 
+		ONI::WorkerPool workerPool; // as many workers as the processing thread's, which only it can run
+		workerPool.start(firWorkerPool.size());
 
-	inline void process(oni_frame_t* frame){};
-	inline void process(ONI::Frame::BaseFrame& frame){
-		
-		ONI::Frame::Rhs2116MultiFrame* f = reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame);
+		const size_t numSamples = (size_t)RHS2116_SAMPLE_FREQUENCY_HZ / 2;
+		const size_t blockSize = 61; // odd so hops land part way through blocks
+		const size_t latency = overlapSave.getBlockLatencySamples();
 
+		std::mt19937 rng(42);
+		std::normal_distribution<float> noise(0.0f, 50.0f);
 
-		if(settings.bUseBandStopFilter){
-			for(size_t probe = 0; probe < numProbes; ++probe){
-				float* ptr = &f->ac_uV[probe];
-				bandstopFilters[probe]->process(1, &ptr);
+		std::vector<float> input(numChannels * numSamples);
+		for(float& v : input) v = noise(rng);
+
+		std::vector<float> actual = input;
+		for(size_t offset = 0; offset < numSamples; offset += blockSize){
+			overlapSave.process(actual.data() + offset, numSamples, std::min(blockSize, numSamples - offset), &workerPool);
+		}
+
+		float maxError = 0;
+		float maxOutput = 0;
+		for(size_t channel = 0; channel < numChannels; ++channel){
+			const float* x = input.data() + channel * numSamples;
+			for(size_t n = latency; n < numSamples; ++n){
+				const size_t t = n - latency;
+				double expected = 0;
+				for(size_t k = 0; k < taps.size() && k <= t; ++k) expected += (double)taps[k] * x[t - k];
+				maxError = std::max(maxError, (float)std::abs(actual[channel * numSamples + n] - expected));
+				maxOutput = std::max(maxOutput, (float)std::abs(expected));
 			}
 		}
 
-		if(settings.bUseLowShelf){
-			for(size_t probe = 0; probe < numProbes; ++probe){
-				float* ptr = &f->ac_uV[probe];
-				lowshelfFilters[probe]->process(1, &ptr);
+		const float relativeError = maxOutput > 0 ? maxError / maxOutput : maxError;
+		const bool bConvolutionPassed = relativeError <= tolerance;
+		LOGINFO("Verify FIR %i taps fft %i latency %0.2f ms + %0.2f ms group delay, max error %g (%g relative) %s",
+				taps.size(), overlapSave.getFFTSize(), (double)(latency / RHS2116_SAMPLES_PER_MS), (double)(overlapSave.getGroupDelaySamples() / RHS2116_SAMPLES_PER_MS),
+				maxError, relativeError, bConvolutionPassed ? "OK" : "FAILED");
+
+		// narrow features (a notch, a low corner) need taps on the order of the sample rate
+		// over their width, past the most we allow they just aren't there in the FIR
+		const float responseError = measureFIRResponseError(taps, stages);
+		const bool bResponsePassed = responseError <= responseTolerance;
+		LOGINFO("Verify FIR magnitude within %0.4f of the IIR response (tolerance %0.4f) %s", responseError, responseTolerance, bResponsePassed ? "OK" : "FAILED");
+		if(!bResponsePassed){
+			size_t numTaps = taps.size();
+			float error = responseError;
+			while(error > responseTolerance && numTaps < FIR_MAX_TAPS){
+				numTaps = std::min(numTaps * 2 + 1, FIR_MAX_TAPS);
+				error = measureFIRResponseError(getFIRTaps(stages, numTaps), stages);
 			}
+			if(error <= responseTolerance){
+				LOGALERT("The FIR needs about %i taps to follow the IIR response within %0.4f", numTaps, responseTolerance);
+			}else{
+				LOGALERT("The FIR can't follow the IIR response within %0.4f at %i taps (%0.4f), use IIR mode for these filters", responseTolerance, FIR_MAX_TAPS, error);
+			}
+		}
+
+		return bConvolutionPassed && bResponsePassed;
+
+	}
+
+	// The FIR for all four filters at 64, 128 and 256 channels: straight convolution a
+	// channel at a time, then overlap-save on this thread and on the worker pool
+	void benchmarkFIR(const size_t& blockSize = 64){
+
+		std::vector<ONI::BiquadCascade::Stage> stages;
+		for(size_t filter = 0; filter < FILTER_COUNT; ++filter){
+			const std::vector<ONI::BiquadCascade::Stage> filterStages = getFilterStages((FilterType)filter);
+			stages.insert(stages.end(), filterStages.begin(), filterStages.end());
 		}
+		const std::vector<float> taps = getFIRTaps(stages);
+
+		ONI::WorkerPool workerPool; // as many workers as the processing thread's, which only it can run
+		workerPool.start(firWorkerPool.size());
+
+		std::mt19937 rng(42);
+		std::normal_distribution<float> noise(0.0f, 50.0f);
 
-		if(settings.bUseHighShelf){
-			for(size_t probe = 0; probe < numProbes; ++probe){
-				float* ptr = &f->ac_uV[probe];
-				highshelfFilters[probe]->process(1, &ptr);
+		for(const size_t& numChannels : {(size_t)64, (size_t)128, (size_t)256}){
+
+			const size_t numSamples = (size_t)RHS2116_SAMPLE_FREQUENCY_HZ / blockSize * blockSize;
+			const size_t numDirectSamples = numSamples / 10; // it's slow
+			const size_t stride = (blockSize + 7) & ~(size_t)7;
+
+			std::vector<float> input(numChannels * numSamples);
+			for(float& v : input) v = noise(rng);
+			std::vector<float> block(numChannels * stride);
+
+			fu::Timer timer;
+			timer.start();
+			for(size_t channel = 0; channel < numChannels; ++channel){
+				const float* x = input.data() + channel * numSamples;
+				for(size_t n = taps.size(); n < numDirectSamples; ++n){
+					float sum = 0;
+					for(size_t k = 0; k < taps.size(); ++k) sum += taps[k] * x[n - k];
+					block[channel * stride + n % blockSize] = sum;
+				}
 			}
+			const double directPerSample = timer.stop() / ((numDirectSamples - taps.size()) * numChannels);
+			LOGINFO("FIR %i taps %3i channels direct        %8.3f ns/sample/channel", taps.size(), numChannels, directPerSample);
+
+			for(const bool& bUsePool : {false, true}){
+
+				ONI::OverlapSaveFIR overlapSave;
+				overlapSave.setup(numChannels, taps, std::clamp(settings.firBlockSize, 64, 65536));
+
+				timer.start();
+				for(size_t offset = 0; offset < numSamples; offset += blockSize){
+					for(size_t channel = 0; channel < numChannels; ++channel){
+						std::copy(input.begin() + channel * numSamples + offset, input.begin() + channel * numSamples + offset + blockSize, block.begin() + channel * stride);
+					}
+					overlapSave.process(block.data(), stride, blockSize, bUsePool ? &workerPool : nullptr);
+				}
+				const double perSample = timer.stop() / (numSamples * numChannels);
+
+				LOGINFO("FIR %i taps %3i channels fft %5i %s %8.3f ns/sample/channel (x%0.2f)", taps.size(), numChannels, overlapSave.getFFTSize(),
+						bUsePool ? "pool" : "    ", perSample, directPerSample / perSample);
+				if(workerPool.size() == 0) break; // no workers, the pool run is the same run again
+
+			}
+
 		}
 
-		if(settings.bUseBandPassFilter){
-			for(size_t probe = 0; probe < numProbes; ++probe){
-				float* ptr = &f->ac_uV[probe];
-				bandpassFilters[probe]->process(1, &ptr);
+	}
+
+	// All four filters over a second of samples at 64, 128 and 256 channels: DSPFilters a
+	// channel at a time, then at each instruction set the cpu has a pass per filter and
+	// all of them compiled into the one cascade
+	void benchmarkFilters(const size_t& blockSize = 64){
+
+		const size_t numSamples = (size_t)RHS2116_SAMPLE_FREQUENCY_HZ / blockSize * blockSize;
+
+		std::mt19937 rng(42);
+		std::normal_distribution<float> noise(0.0f, 50.0f);
+
+		for(const size_t& numChannels : {(size_t)64, (size_t)128, (size_t)256}){
+
+			const size_t stride = (blockSize + 7) & ~(size_t)7;
+			std::vector<float> input(numChannels * numSamples);
+			for(float& v : input) v = noise(rng);
+			std::vector<float> block(numChannels * stride);
+
+			auto copyBlock = [&](const size_t& offset){
+				for(size_t channel = 0; channel < numChannels; ++channel){
+					std::copy(input.begin() + channel * numSamples + offset, input.begin() + channel * numSamples + offset + blockSize, block.begin() + channel * stride);
+				}
+			};
+
+			std::vector<std::unique_ptr<Dsp::Filter>> references;
+			for(size_t channel = 0; channel < numChannels; ++channel){
+				for(size_t filter = 0; filter < FILTER_COUNT; ++filter) references.push_back(makeReference((FilterType)filter));
+			}
+
+			fu::Timer timer;
+			timer.start();
+			for(size_t offset = 0; offset < numSamples; offset += blockSize){
+				copyBlock(offset);
+				for(size_t channel = 0; channel < numChannels; ++channel){
+					float* lane = block.data() + channel * stride;
+					for(size_t filter = 0; filter < FILTER_COUNT; ++filter) references[channel * FILTER_COUNT + filter]->process(blockSize, &lane);
+				}
+			}
+			const double referencePerSample = timer.stop() / (numSamples * numChannels);
+			LOGINFO("Filters %3i channels %-8s          %8.3f ns/sample/channel", numChannels, "DSPF", referencePerSample);
+
+			for(int set = ONI::Simd::SCALAR; set <= (int)ONI::Simd::detectInstructionSet(); ++set){
+
+				const ONI::Simd::InstructionSet instructionSet = (ONI::Simd::InstructionSet)set;
+				const std::string setName = ONI::Simd::toString(instructionSet);
+
+				ONI::BiquadCascade cascades[FILTER_COUNT];
+				std::vector<ONI::BiquadCascade::Stage> stages;
+				for(size_t filter = 0; filter < FILTER_COUNT; ++filter){
+					cascades[filter].setup(numChannels);
+					cascades[filter].setStages(getFilterStages((FilterType)filter));
+					const std::vector<ONI::BiquadCascade::Stage> filterStages = getFilterStages((FilterType)filter);
+					stages.insert(stages.end(), filterStages.begin(), filterStages.end());
+				}
+
+				ONI::BiquadCascade fused;
+				fused.setup(numChannels);
+				fused.setStages(stages);
+
+				timer.start();
+				for(size_t offset = 0; offset < numSamples; offset += blockSize){
+					copyBlock(offset);
+					for(size_t filter = 0; filter < FILTER_COUNT; ++filter) cascades[filter].process(block.data(), stride, blockSize, instructionSet);
+				}
+				const double separatePerSample = timer.stop() / (numSamples * numChannels);
+
+				timer.start();
+				for(size_t offset = 0; offset < numSamples; offset += blockSize){
+					copyBlock(offset);
+					fused.process(block.data(), stride, blockSize, instructionSet);
+				}
+				const double fusedPerSample = timer.stop() / (numSamples * numChannels);
+
+				LOGINFO("Filters %3i channels %-8s separate %8.3f ns/sample/channel (x%0.2f)", numChannels, setName.c_str(), separatePerSample, referencePerSample / separatePerSample);
+				LOGINFO("Filters %3i channels %-8s fused    %8.3f ns/sample/channel (x%0.2f)", numChannels, setName.c_str(), fusedPerSample, referencePerSample / fusedPerSample);
+
 			}
+
 		}
 
-		for(auto& it : postProcessors){
-			it.second->process(frame);
+	}
+
+
+private:
+
+protected:
+
+	enum FilterType{
+		BANDSTOP = 0,
+		LOWSHELF,
+		HIGHSHELF,
+		BANDPASS,
+		FILTER_COUNT
+	};
+
+	static inline const char* getFilterName(const FilterType& filter){
+		switch(filter){
+		case BANDSTOP: {return "BandStop"; break;}
+		case LOWSHELF: {return "LowShelf"; break;}
+		case HIGHSHELF: {return "HighShelf"; break;}
+		case BANDPASS: {return "BandPass"; break;}
+		default: {return "Unknown"; break;}
 		}
+	}
 
+	// in the order they're applied
+	std::vector<FilterType> getEnabledFilters(){
+		std::vector<FilterType> filters;
+		if(settings.bUseBandStopFilter) filters.push_back(BANDSTOP);
+		if(settings.bUseLowShelf) filters.push_back(LOWSHELF);
+		if(settings.bUseHighShelf) filters.push_back(HIGHSHELF);
+		if(settings.bUseBandPassFilter) filters.push_back(BANDPASS);
+		return filters;
 	}
 
-	void setBandStop(const int& frequency, const int& width){
+	// the enabled filters' sections end to end, each filter's sections keep their state
+	// through the swap as long as they stay enabled
+	void compileFilters(const size_t& transitionSamples = 0){
+		std::vector<ONI::BiquadCascade::Stage> stages;
+		for(const FilterType& filter : getEnabledFilters()){
+			const std::vector<ONI::BiquadCascade::Stage> filterStages = getFilterStages(filter);
+			stages.insert(stages.end(), filterStages.begin(), filterStages.end());
+		}
+		filterCascade.setStages(stages, transitionSamples);
+		numFilterStages = stages.size();
+		compileFIR(stages);
+	}
 
-		settings.bandStopFrequency = frequency;
-		settings.bandStopWidth = width;
+	// in FIR mode a linear phase FIR with the magnitude response of the sections, handed
+	// to the processing thread to pick up at the start of its next block (see updateFIR)
+	void compileFIR(const std::vector<ONI::BiquadCascade::Stage>& stages){
 
-		Dsp::Params params;
-		params[0] = RHS2116_SAMPLE_FREQUENCY_HZ;	// sample rate
-		params[1] = 4;								// order
-		params[2] = frequency;						// center frequency
-		params[3] = width;							// band width
+		std::unique_ptr<ONI::OverlapSaveFIR> nextFIR;
+
+		float responseError = 0;
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			bandstopFilters[probe]->setParams(params);
+		if(settings.filterMode == ONI::Settings::FILTER_FIR && stages.size() > 0){
+			const std::vector<float> taps = getFIRTaps(stages);
+			nextFIR = std::make_unique<ONI::OverlapSaveFIR>();
+			nextFIR->setup(numProbes, taps, std::clamp(settings.firBlockSize, 64, 65536));
+			responseError = measureFIRResponseError(taps, stages);
 		}
 
+		firLatencySamples = nextFIR != nullptr ? nextFIR->getBlockLatencySamples() : 0;
+		firGroupDelaySamples = nextFIR != nullptr ? nextFIR->getGroupDelaySamples() : 0;
+		firResponseError = responseError;
+
+		const std::lock_guard<std::mutex> lock(firMutex);
+		stagedFIR = std::move(nextFIR); // frees whatever the processing thread left here last time, on this thread
+		bFIRStaged.store(true, std::memory_order_release);
+
 	}
 
-	void setLowShelf(const int& frequency, const float& gain, const float& ripple){
+	std::vector<float> getFIRTaps(const std::vector<ONI::BiquadCascade::Stage>& stages){
+		return getFIRTaps(stages, settings.firTaps);
+	}
 
-		settings.lowShelfFrequency = frequency;
-		settings.lowShelfGain = gain;
-		settings.lowShelfRipple = ripple;
+	std::vector<float> getFIRTaps(const std::vector<ONI::BiquadCascade::Stage>& stages, const size_t& firTaps){
+		const size_t numTaps = std::clamp(firTaps, FIR_MIN_TAPS, FIR_MAX_TAPS) | 1; // odd so there's a middle tap
+		const size_t designSize = ONI::FFT::nextPowerOfTwo(std::max(numTaps * 8, (size_t)8192));
+		return ONI::OverlapSaveFIR::designLinearPhase(ONI::BiquadCascade::getMagnitudeResponse(stages, designSize / 2 + 1), numTaps);
+	}
 
-		Dsp::Params params;
-		params[0] = RHS2116_SAMPLE_FREQUENCY_HZ;	// sample rate
-		params[1] = 4;								// order
-		params[2] = frequency;						// corner frequency
-		params[3] = gain;							// shelf gain
-		params[4] = ripple;							// passband ripple
+	// largest difference between the taps' magnitude response and the sections', on a
+	// grid fine enough (under 0.5 Hz) that a narrow notch can't fall between the bins
+	float measureFIRResponseError(const std::vector<float>& taps, const std::vector<ONI::BiquadCascade::Stage>& stages){
+		const size_t responseSize = ONI::FFT::nextPowerOfTwo(std::max(taps.size() * 8, (size_t)65536));
+		ONI::FFT responseFFT;
+		responseFFT.setup(responseSize);
+		std::vector<ONI::FFT::Complex> response(responseSize, ONI::FFT::Complex(0, 0));
+		for(size_t i = 0; i < taps.size(); ++i) response[i] = ONI::FFT::Complex(taps[i], 0);
+		responseFFT.forward(response.data());
+		const std::vector<float> target = ONI::BiquadCascade::getMagnitudeResponse(stages, responseSize / 2 + 1);
+		float maxResponseError = 0;
+		for(size_t k = 0; k <= responseSize / 2; ++k) maxResponseError = std::max(maxResponseError, std::abs(std::abs(response[k]) - target[k]));
+		return maxResponseError;
+	}
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			lowshelfFilters[probe]->setParams(params);
+	// processing thread: takes up a newly compiled FIR, carrying on from the old one's
+	// samples when it's the same shape. True if we're running a FIR
+	inline bool updateFIR(){
+		if(bFIRStaged.load(std::memory_order_acquire) && firMutex.try_lock()){
+			if(stagedFIR != nullptr && fir != nullptr) stagedFIR->adoptState(*fir);
+			std::swap(fir, stagedFIR); // the old one waits in the staged slot for compileFIR to free it
+			bFIRStaged.store(false, std::memory_order_relaxed);
+			latencySamples.store(fir != nullptr ? fir->getBlockLatencySamples() + fir->getGroupDelaySamples() : 0, std::memory_order_release);
+			firMutex.unlock();
 		}
+		return fir != nullptr;
+	}
 
+	// processing thread: the stim flag from latency samples ago, for the sample the FIR is putting out now
+	inline uint8_t delayStimulation(const uint8_t& stimulation, const size_t& latency){
+		stimHistory[stimHistoryCount & (STIM_HISTORY_SIZE - 1)] = stimulation;
+		const uint8_t delayed = stimHistoryCount >= latency ? stimHistory[(stimHistoryCount - latency) & (STIM_HISTORY_SIZE - 1)] : 0;
+		++stimHistoryCount;
+		return delayed;
 	}
 
-	void setHighShelf(const int& frequency, const float& gain, const float& ripple){
+	// designed once per distinct setting, see designCache
+	std::vector<ONI::BiquadCascade::Stage> getFilterStages(const FilterType& filter){
+		ONI::BiquadDesignCache::Stages stages;
+		switch(filter){
+		case BANDSTOP: {stages = designCache.getStages<Dsp::Butterworth::Design::BandStop<4>>(filter, getBandStopParams()); break;}
+		case LOWSHELF: {stages = designCache.getStages<Dsp::Butterworth::Design::LowShelf<4>>(filter, getLowShelfParams()); break;}
+		case HIGHSHELF: {stages = designCache.getStages<Dsp::Butterworth::Design::HighShelf<4>>(filter, getHighShelfParams()); break;}
+		case BANDPASS: {stages = designCache.getStages<Dsp::Butterworth::Design::BandPass<4>>(filter, getBandPassParams()); break;}
+		default: {return std::vector<ONI::BiquadCascade::Stage>(); break;}
+		}
+		return *stages;
+	}
 
-		settings.highShelfFrequency = frequency;
-		settings.highShelfGain = gain;
-		settings.highShelfRipple = ripple;
+	// the single channel DSPFilters filter this processor used to run per probe
+	std::unique_ptr<Dsp::Filter> makeReference(const FilterType& filter){
+		switch(filter){
+		case BANDSTOP: {return makeReference<Dsp::Butterworth::Design::BandStop<4>>(getBandStopParams()); break;}
+		case LOWSHELF: {return makeReference<Dsp::Butterworth::Design::LowShelf<4>>(getLowShelfParams()); break;}
+		case HIGHSHELF: {return makeReference<Dsp::Butterworth::Design::HighShelf<4>>(getHighShelfParams()); break;}
+		case BANDPASS: {return makeReference<Dsp::Butterworth::Design::BandPass<4>>(getBandPassParams()); break;}
+		default: {return nullptr; break;}
+		}
+	}
 
+	Dsp::Params getBandStopParams(){
 		Dsp::Params params;
 		params[0] = RHS2116_SAMPLE_FREQUENCY_HZ;	// sample rate
 		params[1] = 4;								// order
-		params[2] = frequency;						// corner frequency
-		params[3] = gain;							// shelf gain
-		params[4] = ripple;							// passband ripple
-
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			highshelfFilters[probe]->setParams(params);
-		}
-
+		params[2] = settings.bandStopFrequency;		// center frequency
+		params[3] = settings.bandStopWidth;			// band width
+		return params;
 	}
 
-	void setBandPass(const int& lowCutFrequency, const int& highCutFrequency){
+	Dsp::Params getLowShelfParams(){
+		Dsp::Params params;
+		params[0] = RHS2116_SAMPLE_FREQUENCY_HZ;	// sample rate
+		params[1] = 4;								// order
+		params[2] = settings.lowShelfFrequency;		// corner frequency
+		params[3] = settings.lowShelfGain;			// shelf gain
+		params[4] = settings.lowShelfRipple;		// passband ripple
+		return params;
+	}
 
-		settings.lowBandPassFrequency = lowCutFrequency;
-		settings.highBandPassFrequency = highCutFrequency;
+	Dsp::Params getHighShelfParams(){
+		Dsp::Params params;
+		params[0] = RHS2116_SAMPLE_FREQUENCY_HZ;	// sample rate
+		params[1] = 4;								// order
+		params[2] = settings.highShelfFrequency;	// corner frequency
+		params[3] = settings.highShelfGain;			// shelf gain
+		params[4] = settings.highShelfRipple;		// passband ripple
+		return params;
+	}
 
+	Dsp::Params getBandPassParams(){
 		Dsp::Params params;
 		params[0] = RHS2116_SAMPLE_FREQUENCY_HZ;    // sample rate
 		params[1] = 4;								// order
-		params[2] = (highCutFrequency + lowCutFrequency) / 2;			// center frequency
-		params[3] = highCutFrequency - lowCutFrequency;				// bandwidth
+		params[2] = (settings.highBandPassFrequency + settings.lowBandPassFrequency) / 2;	// center frequency
+		params[3] = settings.highBandPassFrequency - settings.lowBandPassFrequency;		// bandwidth
+		return params;
+	}
+
+	template<typename DesignType>
+	std::unique_ptr<Dsp::Filter> makeReference(const Dsp::Params& params){
+		std::unique_ptr<Dsp::Filter> reference = std::make_unique<Dsp::FilterDesign<DesignType, 1, Dsp::DirectFormII>>();
+		reference->setParams(params);
+		return reference;
+	}
+
+	// filters applied one after the other by DSPFilters against the same filters as one cascade
+	bool verifyCascade(const std::string& name, const std::vector<FilterType>& filters, const size_t& numChannels, const float& tolerance, const ONI::Simd::InstructionSet& instructionSet){
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			bandpassFilters[probe]->setParams(params);
+		const size_t numSamples = (size_t)RHS2116_SAMPLE_FREQUENCY_HZ * 2;
+		const size_t blockSize = 61; // odd so the tail paths get used too
+
+		std::mt19937 rng(42);
+		std::normal_distribution<float> noise(0.0f, 20.0f);
+
+		std::vector<float> input(numChannels * numSamples);
+		for(size_t channel = 0; channel < numChannels; ++channel){
+			const double frequency = 50.0 + channel * 97.0;
+			for(size_t i = 0; i < numSamples; ++i){
+				input[channel * numSamples + i] = 100.0f * std::sin(2.0 * 3.14159265358979 * frequency * i / RHS2116_SAMPLE_FREQUENCY_HZ) + noise(rng);
+			}
 		}
 
-	}
+		std::vector<float> expected = input;
+		std::vector<ONI::BiquadCascade::Stage> stages;
+		for(const FilterType& filter : filters){
+			for(size_t channel = 0; channel < numChannels; ++channel){
+				std::unique_ptr<Dsp::Filter> reference = makeReference(filter);
+				float* lane = expected.data() + channel * numSamples;
+				reference->process(numSamples, &lane);
+			}
+			const std::vector<ONI::BiquadCascade::Stage> filterStages = getFilterStages(filter);
+			stages.insert(stages.end(), filterStages.begin(), filterStages.end());
+		}
 
+		ONI::BiquadCascade cascade;
+		cascade.setup(numChannels);
+		cascade.setStages(stages);
 
-private:
+		std::vector<float> actual = input;
+		for(size_t offset = 0; offset < numSamples; offset += blockSize){
+			cascade.process(actual.data() + offset, numSamples, std::min(blockSize, numSamples - offset), instructionSet);
+		}
 
-protected:
+		float maxError = 0;
+		float maxOutput = 0;
+		for(size_t i = 0; i < actual.size(); ++i){
+			maxError = std::max(maxError, std::abs(actual[i] - expected[i]));
+			maxOutput = std::max(maxOutput, std::abs(expected[i]));
+		}
+
+		const float relativeError = maxOutput > 0 ? maxError / maxOutput : maxError;
+		const bool bPassed = relativeError <= tolerance;
+		LOGINFO("Verify %-20s %2i stages max error %g (%g relative) %s", name.c_str(), cascade.getNumStages(), maxError, relativeError, bPassed ? "OK" : "FAILED");
+		return bPassed;
+
+	}
 
 	ONI::Settings::FilterSettings settings;
 	ONI::Processor::BaseProcessor* source;
 
-	std::vector<Dsp::Filter*> bandstopFilters;
-	std::vector<Dsp::Filter*> lowshelfFilters;
-	std::vector<Dsp::Filter*> highshelfFilters;
-	std::vector<Dsp::Filter*> bandpassFilters;
+	bool bInStimWindow = false; // frame thread only, whether the last run we filtered was in a stim window
+
+	ONI::BiquadCascade filterCascade; // the enabled filters, see compileFilters
+	size_t numFilterStages = 0;
+
+	ONI::BiquadDesignCache designCache;
+
+	std::unique_ptr<ONI::OverlapSaveFIR> fir;			// processing thread
+	std::unique_ptr<ONI::OverlapSaveFIR> stagedFIR;
+	std::atomic_bool bFIRStaged = false;
+	std::mutex firMutex;
+	ONI::WorkerPool firWorkerPool;
+	size_t firLatencySamples = 0;
+	size_t firGroupDelaySamples = 0;
+	float firResponseError = 0;	// max magnitude difference from the sections, see getFIRResponseError
+	std::atomic<size_t> latencySamples = 0;	// of the FIR the processing thread is running
+
+	// the last stim flags in, so they can go out as late as the FIR's samples; big enough
+	// for the largest hop (65536) plus the largest group delay (2047)
+	static constexpr size_t STIM_HISTORY_SIZE = 131072;
+	std::vector<uint8_t> stimHistory;	// processing thread
+	uint64_t stimHistoryCount = 0;
+
+	static constexpr size_t FILTER_TRANSITION_SAMPLES = (size_t)(RHS2116_SAMPLE_FREQUENCY_HZ / 100); // 10 ms
 
 };
 
@@ -21,14 +21,17 @@
 #include <mutex>
 #include <syncstream>
 #include <filesystem>
+#ifdef _WIN32
 #include <windows.h>
 #include <timeapi.h>
+#endif
 
 #include "../Type/Log.h"
 #include "../Type/RegisterTypes.h"
 #include "../Type/SettingTypes.h"
 #include "../Type/FrameTypes.h"
 #include "../Type/GlobalTypes.h"
+#include "../Type/BroadcastRing.h"
 
 #include "../Processor/BaseProcessor.h"
 #include "../Processor/Rhs2116MultiProcessor.h"
@@ -126,6 +129,14 @@ public:
 
 	}
 
+	// Spikes go in the spike stream while recording, read from the SpikeProcessor's
+	// broadcast ring on our own thread so the file writes never hold up detection. The
+	// broadcast carries the spikes after the SpikeSorterProcessor has set their unit ids.
+	// Set it before recording starts and keep the SpikeProcessor alive while recording
+	inline void setSpikeSource(ONI::BroadcastRing<ONI::Spike>* source){
+		spikeSource = source;
+	}
+
 	inline const std::atomic_uint& getState(){
 		return state;
 	}
@@ -182,6 +193,19 @@ public:
 		if(bThread){
 			bThread = false;
 			if(thread.joinable()) thread.join();
+			ONI::Processor::Rhs2116MultiProcessor* multiProcessor = ONI::Global::model.getRhs2116MultiProcessor();
+			if(multiProcessor != nullptr) multiProcessor->flush(); // the last part block played back
+		}
+
+		if(bSpikeThread){
+			bSpikeThread = false;
+			if(spikeThread.joinable()) spikeThread.join();
+		}
+
+		if(spikeSubscriber != nullptr){
+			if(spikeSubscriber->droppedCount > 0) LOGALERT("Spike recording fell behind and lost %i spikes", (int)spikeSubscriber->droppedCount.load());
+			spikeSource->unsubscribe(spikeSubscriber);
+			spikeSubscriber = nullptr;
 		}
 
 		//const std::lock_guard<std::mutex> lock(mutex); // ??
@@ -190,6 +214,7 @@ public:
 		contextTimeStream.close();
 		contextStimStream.close();
 		contextStimTypes.close();
+		contextSpikeStream.close();
 		streamMutex.unlock();
 	}
 
@@ -308,11 +333,13 @@ public:
 			std::ostringstream osT; osT << settings.recordFolder << "\\time_stream_" << settings.fileTimeStamp << ".dat";
 			std::ostringstream osS; osS << settings.recordFolder << "\\stim_stream_" << settings.fileTimeStamp << ".dat";
 			std::ostringstream osP; osP << settings.recordFolder << "\\stim_types_" << settings.fileTimeStamp << ".dat";
+			std::ostringstream osK; osK << settings.recordFolder << "\\spike_stream_" << settings.fileTimeStamp << ".dat";
 
 			settings.dataFileName = osD.str();
 			settings.timeFileName = osT.str();
 			settings.stimFileName = osS.str();
 			settings.stimTypesFileName = osP.str();
+			settings.spikeFileName = osK.str(); // only there if the recording had a spike sorter
 
 			// always check version at the end so we can just redo saving 
 			// a new file metadata header with already loaded values
@@ -554,12 +581,14 @@ private:
 		std::ostringstream osT; osT << settings.recordFolder << "\\time_stream_" << settings.fileTimeStamp << ".dat";
 		std::ostringstream osS; osS << settings.recordFolder << "\\stim_stream_" << settings.fileTimeStamp << ".dat";
 		std::ostringstream osP; osP << settings.recordFolder << "\\stim_types_" << settings.fileTimeStamp << ".dat";
+		std::ostringstream osK; osK << settings.recordFolder << "\\spike_stream_" << settings.fileTimeStamp << ".dat";
 		std::ostringstream osI; osI << settings.recordFolder << "\\info_" << settings.fileTimeStamp << ".txt";
 
 		settings.dataFileName = osD.str();
 		settings.timeFileName = osT.str();
 		settings.stimFileName = osS.str();
 		settings.stimTypesFileName = osP.str();
+		settings.spikeFileName = osK.str();
 		settings.infoFileName = osI.str();
 
 		bool bFolder = std::filesystem::create_directories(settings.recordFolder.c_str());
@@ -579,6 +608,7 @@ private:
 		contextStimTypes = std::fstream(settings.stimTypesFileName, std::ios::binary | std::ios::out);
 		contextDataStream = std::fstream(settings.dataFileName, std::ios::binary | std::ios::out);
 		contextTimeStream = std::fstream(settings.timeFileName, std::ios::binary | std::ios::out);
+		contextSpikeStream = std::fstream(settings.spikeFileName, std::ios::binary | std::ios::out);
 
 		
 		contextStimStream.seekg(0, ::std::ios::beg);
@@ -604,6 +634,41 @@ private:
 
 		state = RECORDING;
 
+		if(spikeSource != nullptr){
+			spikeSubscriber = spikeSource->subscribe("RecordProcessor", ONI::BroadcastDropPolicy::DROP_OVERWRITTEN);
+			bSpikeThread = true;
+			spikeThread = std::thread(&RecordProcessor::recordSpikes, this);
+		}
+
+	}
+
+	void recordSpikes(){
+
+		using namespace std::chrono;
+
+		ONI::Spike spike;
+
+		while(bSpikeThread){
+			bool bIdle = true;
+			while(spikeSource->pop(spikeSubscriber, spike)){
+
+				ONI::SpikeRecord record;
+				record.acquisitionTimeHardware = spike.acquisitionTimeHardware;
+				record.acquisitionTimeWallNs = spike.acquisitionTimeWallNs;
+				record.probe = spike.probe;
+				record.unitID = spike.unitID;
+
+				const std::lock_guard<std::mutex> lock(streamMutex);
+				contextSpikeStream.write(reinterpret_cast<char*>(&record), sizeof(ONI::SpikeRecord));
+				if(contextSpikeStream.bad()){
+					LOGERROR("Bad spike write");
+				}
+
+				bIdle = false;
+			}
+			if(bIdle) std::this_thread::sleep_for(milliseconds(1));
+		}
+
 	}
 
 	
@@ -737,11 +802,9 @@ private:
 				frame->data = new char[74];
 				memcpy(frame->data, frame_in->data, 74);
 
-				std::map<uint32_t, ONI::Device::BaseDevice*>& devices = ONI::Global::model.getDevices();
-				
-				auto it = devices.find((uint32_t)frame->dev_idx);
+				ONI::Device::BaseDevice* device = ONI::Global::model.findDevice((uint32_t)frame->dev_idx);
 
-				if(it == devices.end()){
+				if(device == nullptr){
 					LOGERROR("ONI Device doesn't exist with idx: %i", frame->dev_idx);
 				}else{
 
@@ -764,7 +827,6 @@ private:
 						//LOGDEBUG("Heartbeat Acq: %I64u %0.3f %0.3f", frame->time, realHeartBeatAvg, mFactor);
 					}
 					
-					auto device = it->second;
 					device->process(frame);	
 
 					sendHeartBeat();
@@ -949,6 +1011,7 @@ protected:
 	std::fstream contextTimeStream;
 	std::fstream contextStimTypes;
 	std::fstream contextStimStream;
+	std::fstream contextSpikeStream;
 
 	uint64_t systemAcquisitionTimeStamp = 0;
 	uint64_t lastAcquireTimeStamp = 0;
@@ -967,6 +1030,11 @@ protected:
 	std::thread thread;
 	std::mutex streamMutex;
 
+	ONI::BroadcastRing<ONI::Spike>* spikeSource = nullptr;
+	ONI::BroadcastRing<ONI::Spike>::Subscriber* spikeSubscriber = nullptr;
+	std::atomic_bool bSpikeThread = false;
+	std::thread spikeThread;
+
 };
 
 
@@ -0,0 +1,305 @@
+//
+//  ReferenceProcessor.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+
+#include "../Type/Log.h"
+#include "../Type/SettingTypes.h"
+#include "../Type/GlobalTypes.h"
+#include "../Type/FrameTypes.h"
+#include "../Type/SimdTypes.h"
+#include "../Type/LatencyHistogram.h"
+
+#include "../Processor/BaseProcessor.h"
+#include "../Processor/BufferProcessor.h"
+
+#pragma once
+
+namespace ONI{
+
+namespace Interface{
+class ReferenceInterface;
+};
+
+namespace Processor{
+
+// Spatial re-referencing
+//
+// Sits after the FilterProcessor and takes a reference off each probe's ac samples in
+// place: the common average or median of the active probes, or a Laplacian, the mean
+// of each probe's active neighbours on the grid the channel map lays the probes out on
+// (probe p at row p / gridColumns, column p % gridColumns). Probes switched off in the
+// BufferProcessor (dead electrodes) don't go into any reference and are passed through
+// as they are. References are built and taken off a probe's lane MAX_CHUNK_SAMPLES at
+// a time with Simd::scaleAdd, the median is worked out a sample at a time across the
+// probes. Everything the processing thread works in is allocated in setup.
+//
+// How long each block takes is kept in a histogram so it can be checked against the
+// time the block covers.
+
+class ReferenceProcessor : public BaseProcessor{
+
+public:
+
+    static constexpr size_t MAX_CHUNK_SAMPLES = 256; // longer blocks are referenced this much at a time
+
+    friend class ONI::Interface::ReferenceInterface;
+
+    ReferenceProcessor(){
+        BaseProcessor::processorTypeID = ONI::Processor::TypeID::REFERENCE_PROCESSOR;
+        BaseProcessor::processorName = toString(processorTypeID);
+    }
+
+    ~ReferenceProcessor(){
+        LOGDEBUG("ReferenceProcessor DTOR");
+    };
+
+    void setup(ONI::Processor::BaseProcessor* source){
+
+        LOGDEBUG("Setting up ReferenceProcessor");
+
+        this->source = source;
+        this->source->subscribeProcessor("ReferenceProcessor", ONI::Processor::SubscriptionType::POST_PROCESSOR, this);
+
+        BaseProcessor::numProbes = source->getNumProbes();
+
+        activeProbes.assign(numProbes, true);
+        activeList.reserve(numProbes);
+        neighbours.assign(numProbes * 8, 0);
+        neighbourCounts.assign(numProbes, 0);
+        medianValues.assign(numProbes, 0.0f);
+        commonReference.assign(MAX_CHUNK_SAMPLES, 0.0f);
+        originalSamples.assign(numProbes * MAX_CHUNK_SAMPLES, 0.0f);
+
+        reset();
+
+    }
+
+    void reset(){
+        bLayoutChanged = true;
+        resetStats();
+    };
+
+    inline void process(oni_frame_t* frame){};
+
+    inline void process(ONI::Frame::BaseFrame& frame){
+        ONI::Frame::Rhs2116MultiFrame* multiFrame = reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame);
+        reference(multiFrame->ac_uV, 1, 1); // probes side by side, so a stride of 1 and one sample
+        for(auto& processor : getPostProcessorList()){
+            processor->process(frame);
+        }
+    }
+
+    inline void process(ONI::Frame::MultiFrameBlock& block){
+
+        const size_t numSamples = block.size();
+
+        if(numSamples > 0){
+            fu::Timer timer;
+            timer.start();
+            reference(block.ac(0), block.getStride(), numSamples);
+            const double nanos = timer.stop();
+            blockCost.record((int64_t)nanos);
+            totalNs.fetch_add((uint64_t)nanos, std::memory_order_relaxed);
+            totalSamples.fetch_add(numSamples, std::memory_order_relaxed);
+        }
+
+        for(auto& processor : getPostProcessorList()){
+            processor->process(block);
+        }
+
+    }
+
+    // numSamples of every probe in place, probe p's samples start at samples + p * stride
+    inline void reference(float* samples, const size_t& stride, const size_t& numSamples){
+
+        const ONI::Settings::ReferenceType referenceType = settings.referenceType;
+        if(referenceType == ONI::Settings::REFERENCE_NONE) return;
+
+        updateLayout(referenceType);
+
+        if(activeList.size() < 2) return; // nothing to reference against
+
+        for(size_t offset = 0; offset < numSamples; offset += MAX_CHUNK_SAMPLES){
+            referenceChunk(referenceType, samples + offset, stride, std::min(MAX_CHUNK_SAMPLES, numSamples - offset));
+        }
+
+    }
+
+    inline ONI::LatencyHistogram& getBlockCost(){
+        return blockCost;
+    }
+
+    // how much of the time the processed samples cover went on referencing them
+    inline double getRealTimeFraction(){
+        const uint64_t samples = totalSamples.load(std::memory_order_relaxed);
+        if(samples == 0) return 0;
+        return totalNs.load(std::memory_order_relaxed) / (samples * 1000000000.0 / RHS2116_SAMPLE_FREQUENCY_HZ);
+    }
+
+    // from the last layout the processing thread built
+    inline size_t getNumActiveProbes(){
+        return numActiveProbes.load(std::memory_order_relaxed);
+    }
+
+    void resetStats(){
+        blockCost.reset();
+        totalNs = 0;
+        totalSamples = 0;
+    }
+
+protected:
+
+    // numSamples (up to MAX_CHUNK_SAMPLES) of every probe in place
+    inline void referenceChunk(const ONI::Settings::ReferenceType& referenceType, float* samples, const size_t& stride, const size_t& numSamples){
+
+        const size_t numActive = activeList.size();
+
+        switch(referenceType){
+        case ONI::Settings::REFERENCE_COMMON_AVERAGE:
+        {
+            std::fill(commonReference.begin(), commonReference.begin() + numSamples, 0.0f);
+            const float scale = 1.0f / numActive;
+            for(const size_t& probe : activeList) ONI::Simd::scaleAdd(commonReference.data(), samples + probe * stride, scale, numSamples);
+            for(const size_t& probe : activeList) ONI::Simd::scaleAdd(samples + probe * stride, commonReference.data(), -1.0f, numSamples);
+            break;
+        }
+        case ONI::Settings::REFERENCE_COMMON_MEDIAN:
+        {
+            const size_t mid = numActive / 2;
+            for(size_t i = 0; i < numSamples; ++i){
+                for(size_t k = 0; k < numActive; ++k) medianValues[k] = samples[activeList[k] * stride + i];
+                std::nth_element(medianValues.begin(), medianValues.begin() + mid, medianValues.begin() + numActive);
+                float median = medianValues[mid];
+                if(numActive % 2 == 0) median = 0.5f * (median + *std::max_element(medianValues.begin(), medianValues.begin() + mid));
+                commonReference[i] = median;
+            }
+            for(const size_t& probe : activeList) ONI::Simd::scaleAdd(samples + probe * stride, commonReference.data(), -1.0f, numSamples);
+            break;
+        }
+        case ONI::Settings::REFERENCE_LAPLACIAN_4:
+        case ONI::Settings::REFERENCE_LAPLACIAN_8:
+        {
+            // neighbours have to be taken off as they were before any of them were referenced
+            for(const size_t& probe : activeList) std::copy(samples + probe * stride, samples + probe * stride + numSamples, originalSamples.begin() + probe * numSamples);
+            for(const size_t& probe : activeList){
+                const size_t count = neighbourCounts[probe];
+                if(count == 0) continue;
+                const float scale = -1.0f / count;
+                for(size_t n = 0; n < count; ++n){
+                    ONI::Simd::scaleAdd(samples + probe * stride, originalSamples.data() + neighbours[probe * 8 + n] * numSamples, scale, numSamples);
+                }
+            }
+            break;
+        }
+        case ONI::Settings::REFERENCE_NONE:
+        default:
+        {
+            break;
+        }
+        }
+
+    }
+
+    // processing thread: rebuilds the active probes and grid neighbours when the settings or active probes change
+    inline void updateLayout(const ONI::Settings::ReferenceType& referenceType){
+
+        const int gridColumns = std::max(settings.gridColumns, 1);
+        const bool bUseActiveProbes = settings.bUseActiveProbes;
+
+        // the gui switches probes on and off in the BufferProcessor, we only pick up its published copy when it changes
+        ONI::Processor::BufferProcessor* bufferProcessor = ONI::Global::model.getBufferProcessor();
+        if(bUseActiveProbes && bufferProcessor != nullptr){
+            const uint64_t generation = bufferProcessor->getActiveProbesGeneration();
+            if(bufferActiveProbes == nullptr || generation != bufferActiveProbesGeneration){
+                bufferActiveProbes = bufferProcessor->getActiveProbesSnapshot();
+                bufferActiveProbesGeneration = generation;
+            }
+        }
+
+        const bool bHasActiveProbes = bUseActiveProbes && bufferActiveProbes != nullptr && bufferActiveProbes->size() == numProbes;
+
+        if(bHasActiveProbes){
+            for(size_t probe = 0; probe < numProbes; ++probe){
+                if(activeProbes[probe] != (*bufferActiveProbes)[probe]){
+                    activeProbes[probe] = (*bufferActiveProbes)[probe];
+                    bLayoutChanged = true;
+                }
+            }
+        }else if(std::find(activeProbes.begin(), activeProbes.end(), false) != activeProbes.end()){
+            std::fill(activeProbes.begin(), activeProbes.end(), true);
+            bLayoutChanged = true;
+        }
+
+        if(!bLayoutChanged && referenceType == lastReferenceType && gridColumns == lastGridColumns) return;
+
+        bLayoutChanged = false;
+        lastReferenceType = referenceType;
+        lastGridColumns = gridColumns;
+
+        activeList.clear();
+        for(size_t probe = 0; probe < numProbes; ++probe) if(activeProbes[probe]) activeList.push_back(probe);
+        numActiveProbes.store(activeList.size(), std::memory_order_relaxed);
+
+        const int rows = (numProbes + gridColumns - 1) / gridColumns;
+        const bool bDiagonals = referenceType == ONI::Settings::REFERENCE_LAPLACIAN_8;
+
+        for(size_t probe = 0; probe < numProbes; ++probe){
+            const int row = probe / gridColumns;
+            const int column = probe % gridColumns;
+            size_t count = 0;
+            for(int dy = -1; dy <= 1; ++dy){
+                for(int dx = -1; dx <= 1; ++dx){
+                    if(dx == 0 && dy == 0) continue;
+                    if(!bDiagonals && dx != 0 && dy != 0) continue;
+                    const int r = row + dy;
+                    const int c = column + dx;
+                    if(r < 0 || r >= rows || c < 0 || c >= gridColumns) continue;
+                    const size_t neighbour = r * gridColumns + c;
+                    if(neighbour >= numProbes || !activeProbes[neighbour]) continue;
+                    neighbours[probe * 8 + count++] = neighbour;
+                }
+            }
+            neighbourCounts[probe] = count;
+        }
+
+    }
+
+    ONI::Settings::ReferenceSettings settings;
+    ONI::Processor::BaseProcessor* source = nullptr;
+
+    // processing thread
+    std::vector<bool> activeProbes;
+    std::vector<size_t> activeList;
+    std::vector<size_t> neighbours;			// numProbes x 8, the first neighbourCounts[probe] are used
+    std::vector<size_t> neighbourCounts;
+    std::vector<float> medianValues;
+    std::vector<float> commonReference;		// a chunk of the common reference
+    std::vector<float> originalSamples;		// numProbes lanes of a chunk before the Laplacian
+    ONI::Processor::BufferProcessor::ActiveProbesSnapshot bufferActiveProbes;
+    uint64_t bufferActiveProbesGeneration = 0;
+    ONI::Settings::ReferenceType lastReferenceType = ONI::Settings::REFERENCE_NONE;
+    int lastGridColumns = 0;
+    bool bLayoutChanged = true;
+
+    std::atomic<size_t> numActiveProbes = 0;
+
+    ONI::LatencyHistogram blockCost;
+    std::atomic<uint64_t> totalNs = 0;
+    std::atomic<uint64_t> totalSamples = 0;
+
+};
+
+
+} // namespace Processor
+} // namespace ONI
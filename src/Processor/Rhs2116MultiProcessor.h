@@ -56,6 +56,7 @@ public:
 	Rhs2116MultiProcessor(){
 		BaseProcessor::processorTypeID = ONI::Processor::TypeID::RHS2116_MULTI_PROCESSOR;
 		BaseProcessor::processorName = toString(processorTypeID);
+		setBlockSize(blockSize);
 	};
 	
 	~Rhs2116MultiProcessor(){
@@ -71,6 +72,7 @@ public:
 
 	void reset(){
 		for(auto& it : devices) numProbes += it.second->getNumProbes();
+		setBlockSize(blockSize);
 		getStepSize(true);
 		getDspCutOff(true);
 		getAnalogLowCutoff(true);
@@ -99,6 +101,7 @@ public:
 		//expectDevceIDOrdered = {257, 256, 513, 512};
 		multiFrameBuffer.resize(multiFrameBuffer.size() + 1);
 		multiFrameBufferRaw.resize(multiFrameBufferRaw.size() + 1);
+		setBlockSize(blockSize);
 		settings = device->getSettings(); // TODO: this is terrible; the devices could be diferent
 	}
 	
@@ -212,13 +215,26 @@ public:
 		return settings.stepSize;
 	}
 
+	// number of multi frames gathered before they are handed to the post processors as
+	// one block: 32 frames is ~1ms at 30kHz, larger blocks trade latency for throughput
+	void setBlockSize(const size_t& size){
+		blockSize = std::max(size, (size_t)1);
+		multiFrameBlock.resize(blockSize, devices.size() * 16);
+		multiFrameBlockRaw.resize(blockSize * std::max(devices.size(), (size_t)1));
+		multiFrameBlockCount = 0;
+	}
+
+	inline const size_t& getBlockSize(){
+		return blockSize;
+	}
+
 	uint64_t numberOfDroppedFrames = 0;
 
 	inline void process(oni_frame_t* frame) override {
 
 		//const std::lock_guard<std::mutex> lock(mutex);
 
-		if(postProcessors.size() > 0){
+		if(getPostProcessorList().size() > 0){
 
 			size_t nextDeviceIndex = nextDeviceCounter % devices.size();
 			//LOGDEBUG("Dev-IDX: %i", frame->dev_idx);
@@ -239,16 +255,15 @@ public:
 					
 					//lastMultiFrameRawMap = multiFrameRawMap;
 
-					// order the frames by ascending device idx
+					// stage the frames ordered by ascending device idx as the next row of the block
+					ONI::Frame::Rhs2116DataExtended* row = &multiFrameBlockRaw[multiFrameBlockCount * devices.size()];
 					for(size_t i = 0; i < devices.size(); ++i){
-						multiFrameBufferRaw[i] = std::move(multiFrameRawMap[ONI::Global::model.getRhs2116DeviceOrderIDX()[i]]);
+						row[i] = multiFrameRawMap[ONI::Global::model.getRhs2116DeviceOrderIDX()[i]];
 					}
+					++multiFrameBlockCount;
 
-					// process the multi frame
-					ONI::Frame::Rhs2116MultiFrame processedFrame(multiFrameBufferRaw, ONI::Global::model.getChannelMapProcessor()->getChannelMap());
-					for(auto& it : postProcessors){
-						it.second->process(processedFrame);
-					}
+					// once the block is full convert it into channel major lanes in one pass and dispatch it
+					if(multiFrameBlockCount == blockSize) processBlock();
 
 					// clear the map to keep tracking device idx
 					multiFrameRawMap.clear();
@@ -310,6 +325,12 @@ public:
 
 
 
+	// hands on a part filled block, so the last samples before acquisition or playback
+	// stops aren't left behind; only call it once frames have stopped coming
+	void flush(){
+		if(multiFrameBlockCount > 0) processBlock();
+	}
+
 	inline void process(ONI::Frame::BaseFrame& frame) override {
 
 		//const std::lock_guard<std::mutex> lock(mutex);
@@ -326,8 +347,8 @@ public:
 				// process the multi frame
 				ONI::Frame::Rhs2116MultiFrame processedFrame(multiFrameBuffer, ONI::Global::model.getChannelMapProcessor()->getChannelMap());
 
-				for(auto& it : postProcessors){
-					it.second->process(processedFrame);
+				for(auto& processor : getPostProcessorList()){
+					processor->process(processedFrame);
 				}
 
 			}
@@ -336,6 +357,91 @@ public:
 
 	}
 
+	// times the scalar reference conversion against the gather kernel for each
+	// instruction set the cpu supports, using random frames and the current channel map.
+	// Each kernel is called with its instruction set, live conversion carries on as it was
+	void benchmarkConversion(const size_t& numMultiFrames = 30000){
+
+		const size_t numDevices = std::max(devices.size(), (size_t)1);
+		const std::vector<size_t>& channelMap = ONI::Global::model.getChannelMapProcessor()->getChannelMap();
+		const std::vector<int32_t>& gatherOffsets = ONI::Global::model.getChannelMapProcessor()->getGatherOffsets();
+
+		if(channelMap.size() != numDevices * 16 || gatherOffsets.size() != numDevices * 16){
+			LOGERROR("Channel map not set up for %i devices", numDevices);
+			return;
+		}
+
+		std::vector<ONI::Frame::Rhs2116DataExtended> frames(numMultiFrames * numDevices);
+		for(auto& frame : frames){
+			for(size_t probe = 0; probe < 16; ++probe){
+				frame.ac[probe] = (uint16_t)(rand() & 0xFFFF);
+				frame.dc[probe] = (uint16_t)(rand() & 0x3FF);
+			}
+			frame.acqTime = 0;
+			frame.deltaTime = 0;
+			frame.devIdx = 0;
+		}
+
+		std::vector<ONI::Frame::Rhs2116DataExtended> multiFrameRaw(numDevices);
+		ONI::Frame::Rhs2116MultiFrame reference;
+		ONI::Frame::Rhs2116MultiFrame gathered;
+
+		fu::Timer timer;
+		timer.start();
+		for(size_t i = 0; i < numMultiFrames; ++i){
+			std::copy(frames.begin() + i * numDevices, frames.begin() + (i + 1) * numDevices, multiFrameRaw.begin());
+			reference.convert(multiFrameRaw, channelMap);
+		}
+		double referenceNanos = timer.stop();
+		LOGINFO("Conversion %-8s %8.2f ns/frame", "REF", referenceNanos / numMultiFrames);
+
+		for(int set = ONI::Simd::SCALAR; set <= (int)ONI::Simd::detectInstructionSet(); ++set){
+
+			const ONI::Simd::InstructionSet instructionSet = (ONI::Simd::InstructionSet)set;
+
+			timer.start();
+			for(size_t i = 0; i < numMultiFrames; ++i){
+				std::copy(frames.begin() + i * numDevices, frames.begin() + (i + 1) * numDevices, multiFrameRaw.begin());
+				gathered.convert(multiFrameRaw.data(), numDevices, gatherOffsets, instructionSet);
+			}
+			double nanos = timer.stop();
+
+			// check the last frame against the reference path (dc differs slightly as it's no longer done in double)
+			float maxError = 0;
+			for(size_t probe = 0; probe < numDevices * 16; ++probe){
+				maxError = std::max(maxError, std::abs(gathered.ac_uV[probe] - reference.ac_uV[probe]));
+				maxError = std::max(maxError, std::abs(gathered.dc_mV[probe] - reference.dc_mV[probe]));
+			}
+
+			LOGINFO("Conversion %-8s %8.2f ns/frame (x%0.2f) max error %g", ONI::Simd::toString(instructionSet).c_str(), nanos / numMultiFrames, referenceNanos / nanos, maxError);
+
+			// and the whole block path straight into channel major lanes
+			ONI::Frame::MultiFrameBlock block(blockSize, numDevices * 16);
+			const size_t numBlocks = numMultiFrames / blockSize;
+			if(numBlocks == 0) continue;
+			timer.start();
+			for(size_t b = 0; b < numBlocks; ++b){
+				block.convert(frames.data() + b * blockSize * numDevices, numDevices, blockSize, gatherOffsets, instructionSet);
+			}
+			nanos = timer.stop();
+			LOGINFO("Conversion %-8s %8.2f ns/frame (x%0.2f) block of %i", ONI::Simd::toString(instructionSet).c_str(), nanos / (numBlocks * blockSize), referenceNanos / numMultiFrames / (nanos / (numBlocks * blockSize)), blockSize);
+
+		}
+
+	}
+
+protected:
+
+	inline void processBlock(){
+		multiFrameBlock.convert(multiFrameBlockRaw.data(), devices.size(), multiFrameBlockCount, ONI::Global::model.getChannelMapProcessor()->getGatherOffsets());
+		for(auto& processor : getPostProcessorList()){
+			processor->process(multiFrameBlock);
+		}
+		multiFrameBlockCount = 0;
+	}
+
+public:
+
 	ONI::Device::Rhs2116Device* getDevice(const uint32_t& deviceTableIDX){
 		auto& it = devices.find(deviceTableIDX);
 		if(it == devices.end()){
@@ -371,6 +477,11 @@ private:
 
 	uint64_t nextDeviceCounter = 0;
 
+	ONI::Frame::MultiFrameBlock multiFrameBlock;
+	std::vector<ONI::Frame::Rhs2116DataExtended> multiFrameBlockRaw;
+	size_t multiFrameBlockCount = 0;
+	size_t blockSize = 32;
+
 	bool bEnabled = false;
 
 	ONI::Settings::Rhs2116Format format;
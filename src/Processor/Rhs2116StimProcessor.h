@@ -84,6 +84,7 @@ public:
         if(it == rhs2116StimDevices.end()){
             LOGINFO("Adding stim device %s", device->getName().c_str());
             rhs2116StimDevices[device->getOnixDeviceTableIDX()] = device;
+            fastTriggerDevices.push_back({device->getOnixDeviceTableIDX(), device});
         }else{
             LOGERROR("Stim device already added: %s", device->getName().c_str());
         }
@@ -97,18 +98,43 @@ public:
         stagedSettings.stepSize = ONI::Settings::Step10nA;
         deviceSettings.stimuli = defaultStimuli;
         deviceSettings.stepSize = ONI::Settings::Step10nA;
+        fastTriggerLengthSamples = ONI::rhs2116MillisToSamples(100);
     }
     bool bAnnoyingMe = false;
     inline void process(oni_frame_t* frame){};
     inline void process(ONI::Frame::BaseFrame& frame){
+        if(markStimulation()) reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame)->stimulation = true;
+        for(auto& processor : getPostProcessorList()){
+            processor->process(frame);
+        }
+    };
+
+    inline void process(ONI::Frame::MultiFrameBlock& block){
+        for(size_t i = 0; i < block.size(); ++i){
+            if(markStimulation()) block.stimulation[i] = 1;
+        }
+        for(auto& processor : getPostProcessorList()){
+            processor->process(block);
+        }
+    };
+
+    // advances the stimulus by one sample; true if that sample is part of a stimulus
+    inline bool markStimulation(){
+
+        bool bStimulation = false;
 
         ONI::Processor::RecordProcessor* recordProcessor = ONI::Global::model.getRecordProcessor();
 
+        // the closed loop trigger leaves this to us so it doesn't have to take the record lock
+        if(bFastTriggered.exchange(false, std::memory_order_acquire) && recordProcessor->isRecording()){
+            recordProcessor->setStimTriggerDevices(stagedSettings);
+        }
+
         if(recordProcessor->isPlaying()){
             const int& stimulusID = recordProcessor->getStimID();
             const std::vector<ONI::Settings::Rhs2116StimulusSettings>& allStimSettings = recordProcessor->getAllStimulusSettings();
             if(stimulusID != -1){
-                reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame)->stimulation = true;
+                bStimulation = true;
                 if(stagedSettings != allStimSettings[stimulusID]){ //  // is this too inefficient
                     //reset();
                     stagedSettings = allStimSettings[stimulusID]; // don't apply them??
@@ -119,14 +145,13 @@ public:
 
         }
         if(stimulusSampleCountRemaining > 0) {
-            reinterpret_cast<ONI::Frame::Rhs2116MultiFrame*>(&frame)->stimulation = true;
+            bStimulation = true;
             if(recordProcessor->isRecording()) recordProcessor->setStimRecording(true);
             --stimulusSampleCountRemaining;
             if(recordProcessor->isRecording() && stimulusSampleCountRemaining <= 0) recordProcessor->setStimRecording(false);
         }
-        for(auto& it : postProcessors){
-            it.second->process(frame);
-        }
+
+        return bStimulation;
     };
 
 
@@ -386,10 +411,29 @@ public:
 
         }
 
+        fastTriggerLengthSamples = getMaxLengthSamples() + ONI::rhs2116MillisToSamples(100);
+
         return true;
 
     }
 
+    // Closed loop trigger for the spike detection thread: just the TRIGGER writes, no
+    // logging, register read back, locks or allocation. The stimulus length is worked
+    // out when the sequence is applied to the devices, and telling the RecordProcessor
+    // which sequence played is left to markStimulation on the frame thread
+    inline bool triggerStimulusFast(const int& stimDeviceIDX = -1){
+        bool bTriggered = false;
+        for(std::pair<uint32_t, ONI::Device::Rhs2116StimDevice*>& it : fastTriggerDevices){
+            if(stimDeviceIDX != -1 && it.first != (uint32_t)stimDeviceIDX) continue;
+            bTriggered |= it.second->triggerStimulusFast();
+        }
+        if(bTriggered){
+            stimulusSampleCountRemaining = stimulusSampleCountTotal = fastTriggerLengthSamples.load(std::memory_order_relaxed);
+            bFastTriggered.store(true, std::memory_order_release);
+        }
+        return bTriggered;
+    }
+
     inline bool isStimulusPlaying(){
         return stimulusSampleCountRemaining > 0;
     }
@@ -686,6 +730,10 @@ protected:
     std::map<uint32_t, ONI::Device::Rhs2116Device*> rhs2116Devices;
     std::map<uint32_t, ONI::Device::Rhs2116StimDevice*> rhs2116StimDevices;
 
+    std::vector<std::pair<uint32_t, ONI::Device::Rhs2116StimDevice*>> fastTriggerDevices; // flat copy of the stim devices for the closed loop trigger
+    std::atomic<uint64_t> fastTriggerLengthSamples = 0;
+    std::atomic_bool bFastTriggered = false;
+
     ONI::Rhs2116StimulusData defaultStimulus;
     std::vector<ONI::Rhs2116StimulusData> defaultStimuli;
 
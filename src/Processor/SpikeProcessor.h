@@ -3,7 +3,6 @@
 //
 //  Created by Matt Gingold on 13.09.2024.
 //
-#include <Eigen/Dense>
 #include "oni.h"
 #include "onix.h"
 
@@ -14,14 +13,18 @@
 #include <cstdio>
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <iomanip>
 #include <algorithm>
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <memory>
 #include <syncstream>
 
 #include "../Type/Log.h"
+#include "../Type/BitTypes.h"
 #include "../Type/RegisterTypes.h"
 #include "../Type/SettingTypes.h"
 #include "../Type/FrameTypes.h"
@@ -29,10 +32,17 @@
 #include "../Type/BurstBuffer.h"
 #include "../Type/SpikeBuffer.h"
 #include "../Type/SpikeFrameBuffer.h"
+#include "../Type/RingBuffer.h"
+#include "../Type/BroadcastRing.h"
+#include "../Type/ClockSync.h"
+#include "../Type/LatencyHistogram.h"
+#include "../Type/WorkerPool.h"
+#include "../Type/SpikeFeatures.h"
 
 #include "../Processor/BaseProcessor.h"
 #include "../Processor/Rhs2116MultiProcessor.h"
 #include "../Processor/Rhs2116StimProcessor.h"
+#include "../Processor/FilterProcessor.h"
 
 #pragma once
 
@@ -51,6 +61,17 @@ public:
 
     friend class ONI::Interface::SpikeInterface;
 
+    // a contiguous range of probes detected together on one worker, with its own
+    // scratch masks and a queue the detection thread drains once the chunk is done
+    struct DetectionShard{
+        size_t firstProbe = 0;
+        size_t endProbe = 0;
+        std::vector<uint64_t> belowMask;
+        std::vector<uint64_t> aboveMask;
+        std::vector< std::bitset<MAX_NUM_MULTIPROBES> > chunkSpikes;
+        ONI::SpscRingBuffer<ONI::Spike> spikeQueue;
+    };
+
     SpikeProcessor(){
         BaseProcessor::processorTypeID = ONI::Processor::TypeID::SPIKE_PROCESSOR;
         BaseProcessor::processorName = toString(processorTypeID);
@@ -60,6 +81,8 @@ public:
         LOGDEBUG("SpikeProcessor DTOR");
         bThread = false;
         if(thread.joinable()) thread.join();
+        bEventThread = false;
+        if(eventThread.joinable()) eventThread.join();
     };
 
     void setup(ONI::Processor::BufferProcessor* source){
@@ -82,6 +105,13 @@ public:
         settings.spikeWaveformLengthSamples = settings.spikeWaveformLengthMs * RHS2116_SAMPLES_PER_MS;
         settings.shortSpikeBufferSize = 10;
 
+        // ACQCLKHZ is in Hz whatever the name says, it's unset if we're only playing back
+        const uint32_t& acquireClockHz = ONI::Global::model.getAcquireClockKHZ();
+        clockSync.setup(acquireClockHz == (uint32_t)-1 ? 250000000 : acquireClockHz);
+
+        latencyHistograms.clear();
+        for(size_t probe = 0; probe < numProbes; ++probe) latencyHistograms.push_back(std::make_unique<ONI::LatencyHistogram>());
+
         reset();
 
     }
@@ -93,15 +123,42 @@ public:
 
         bThread = false;
         if (thread.joinable()) thread.join();
+        bEventThread = false;
+        if(eventThread.joinable()) eventThread.join();
 
         nextPeekDetectBufferCount.clear();
         nextPeekDetectBufferCount.assign(numProbes, 0);
 
+        // waveforms are stored inline in each spike so can't be longer than that
+        settings.spikeWaveformLengthSamples = std::clamp(settings.spikeWaveformLengthSamples, 1, (int)ONI::MAX_SPIKE_WAVEFORM_SAMPLES);
+
+        // look far enough behind the head to search for a peak and capture half a waveform after
+        // it, or further if asked to, as long as the writer can't lap a whole chunk behind that
+        const size_t minDetectionLagSamples = 2 * settings.spikeWaveformLengthSamples + 1;
+        const size_t bufferSize = bufferProcessor->denseBuffer.size();
+        const size_t maxDetectionLagSamples = bufferSize > 2 * minDetectionLagSamples + maxDetectionChunkSamples ? bufferSize - minDetectionLagSamples - maxDetectionChunkSamples - 1 : minDetectionLagSamples;
+        detectionLagSamples = std::clamp((size_t)std::max(settings.detectionLagSamples, 0), minDetectionLagSamples, maxDetectionLagSamples);
+        settings.detectionLagSamples = detectionLagSamples;
+        configureShards(settings.numDetectionShards);
+        spikeFeatures.setup(numProbes, settings.spikeWaveformLengthSamples, settings.numSpikeFeatures);
+
+        scanCount = scanStartCount = lastPublishedCount = bufferProcessor->denseBuffer.beginRead();
+        samplesScanned = 0;
+        samplesSkipped = 0;
+        samplesLapped = 0;
+
         spikeBuffer.resizeByNSpikes(10, numProbes);
         burstBuffer.resizeByMillis(600000, 10, numProbes);
 
         spikeFrameBuffer.resizeBySamples(bufferProcessor->sparseBuffer.size(), bufferProcessor->sparseBuffer.getStep(), 64);
 
+        // only sized once so other subscribers' cursors stay valid across resets
+        if(spikeBroadcast.capacity() != spikeBroadcastSize) spikeBroadcast.resize(spikeBroadcastSize);
+        if(spikeEventSubscriber == nullptr) spikeEventSubscriber = spikeBroadcast.subscribe("SpikeEvent", ONI::BroadcastDropPolicy::DROP_OVERWRITTEN);
+
+        bEventThread = true;
+        eventThread = std::thread(&ONI::Processor::SpikeProcessor::notifySpikes, this);
+
         bThread = true;
         thread = std::thread(&ONI::Processor::SpikeProcessor::processSpikes, this);
 
@@ -110,311 +167,398 @@ public:
 	inline void process(oni_frame_t* frame){};
 	inline void process(ONI::Frame::BaseFrame& frame){
         burstBuffer.updateClock();
+        clockSync.update(frame.getAcquisitionTime(), ONI::ClockSync::getHostNs());
+    }
+
+    inline void process(ONI::Frame::MultiFrameBlock& block){
+        for(size_t i = 0; i < block.size(); ++i) burstBuffer.updateClock();
+        if(block.size() > 0) clockSync.update(block.getAcquisitionTime(block.size() - 1), ONI::ClockSync::getHostNs()); // the block arrives with its last sample
     }
 
+    // Scans every sample in the dense buffer exactly once, a chunk at a time, from a
+    // read cursor that trails the write head by detectionLagSamples (enough to search
+    // for the peak and capture the waveform after a crossing). Crossings for a whole
+    // channel chunk come from a SIMD compare, we only go sample by sample at the hits
     void processSpikes() {
 
         using namespace std::chrono;
-        
-        while(bThread) {
 
-            //spikeMutex.lock();
+        while(bThread) {
 
-            // get a reference to the dense buffer (ie., all samples)
-            bufferProcessor->dataMutex[DENSE_MUTEX].lock();
-            //bufferProcessor->dataMutex[SPARSE_MUTEX].lock();
+            // the shared lock only stops the buffer being resized under us, the writer never waits on it
+            std::shared_lock<std::shared_mutex> lock(bufferProcessor->bufferMutex);
 
             ONI::FrameBuffer& denseBuffer = bufferProcessor->denseBuffer;
-            //ONI::FrameBuffer& sparseBuffer = bufferProcessor->sparseBuffer;
-
-            if(denseBuffer.isFrameNew()){ // remember that atm only one consumer will get the correct new frame as it's auto reset to false
-
-                // get the buffer count which is the global counter for frames going into the buffer
-                uint64_t bufferCount = denseBuffer.getBufferCount();
-                /*(buffer.getCurrentIndex() + buffer.size() - 30000) % buffer.size()*/
-                // we are going to search for spikes from the 'central' time point in the frame buffer
-                size_t centralSampleIDX = (denseBuffer.getCurrentIndex() + denseBuffer.size() - 30000) % denseBuffer.size(); // denseBuffer.getCurrentIndex();//% buffer.size();// size_t(std::floor(buffer.getCurrentIndex() + buffer.size() / 2.0)) % buffer.size();
-                
-
-                // get a reference to the central "current" frame
-                ONI::Frame::Rhs2116MultiFrame& frame = denseBuffer.getFrameAt(centralSampleIDX);
-                frame.spikes.assign(numProbes, false);
-
-                // check each probe to see if there's a spike...
-                for(size_t probe = 0; probe < numProbes; ++probe) {
-                    bool bUseProbe = ONI::Global::model.getBufferProcessor()->getActiveProbes()[probe];
-                    if(!bUseProbe) continue;
-                    //if(probe == 1 || probe == 4 || probe == 10 || probe == 25 || probe == 28 || probe == 32 || probe == 33 || probe == 34 || probe == 40 || probe == 46 || probe == 50 || probe == 59 || probe == 63) continue; // HACKING IGNORE PROBE SPIKE PROCESSING TODO: make this a checkbox somewhere
-                    float deviation = bufferProcessor->getProbeStats()[probe].deviation;
-
-                    // after we discover a spike on a probe channel we suppress detection till after the waveform capture TODO: what about overlapping spikes?
-                    if(bufferCount < nextPeekDetectBufferCount[probe]) continue;
-
-                    using ONI::Settings::SpikeEdgeDetectionType;
-
-                    //if(abs(frame.ac_uV[probe]) > abs(deviation * 6)) continue;
-
-                    if(frame.ac_uV[probe] < -deviation * settings.negativeDeviationMultiplier &&
-                       (settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::FALLING ||
-                       settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::EITHER ||
-                       settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::BOTH)){
-
-
-                       // search forward for first peak index minSampleOffset forces the search to start a 
-                       // //little bit after the initial detection to avoid false positive min/max post detection
-                        size_t peakOffsetIndex = 0; float peakVoltage = 0;
-                        for(size_t offset = settings.minSampleOffset + 1; offset < settings.spikeWaveformLengthSamples; ++offset){
-                            float previous = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX + offset - 1)[0];
-                            float current = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX + offset)[0];
-                            if(previous > current){ // the next value is less than the last we are starting to fall
-                                peakOffsetIndex = offset - 1;
-                                peakVoltage = previous;
-                                break; // stop searching!
-                            }
-                        }
 
-                        if((settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::FALLING || settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::EITHER) ||
-                           (settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::BOTH && peakVoltage > deviation * settings.positiveDeviationMultiplier)){ // ...reject if max voltage is not over the threshold
-
-                            size_t halfLength = std::floor(settings.spikeWaveformLengthSamples / 2);
-
-                            ONI::Spike spike;
-                            spike.probe = probe;
-                            spike.rawWaveform.resize(settings.spikeWaveformLengthSamples);
-                            spike.bStimFrame = frame.stimulation;
-
-                            //spike.rawWaveform.resize(settings.spikeWaveformLengthSamples);
-                            if(settings.bFallingAlignMax){ // by default align to the peaks
-                                spike.minVoltage = frame.ac_uV[probe];
-                                spike.minSampleIndex = halfLength - peakOffsetIndex;
-                                spike.maxVoltage = peakVoltage;
-                                spike.maxSampleIndex = halfLength;
-                                spike.acquisitionTimeHardware = denseBuffer.getFrameAt(centralSampleIDX + peakOffsetIndex).getAcquisitionTime();
-                                spike.acquisitionTimeHiResNs = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();
-                                spike.acquisitionTimeWallNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
-                                float* rawAcUv = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX - halfLength + peakOffsetIndex);
-                                std::memcpy(&spike.rawWaveform[0], &rawAcUv[0], sizeof(float) * settings.spikeWaveformLengthSamples);
-                                processSpike(spike);
-                            } else{
-                                spike.minVoltage = frame.ac_uV[probe];
-                                spike.minSampleIndex = halfLength;
-                                spike.maxVoltage = peakVoltage;
-                                spike.maxSampleIndex = halfLength + peakOffsetIndex;
-                                spike.acquisitionTimeHardware = denseBuffer.getFrameAt(centralSampleIDX).getAcquisitionTime();
-                                spike.acquisitionTimeHiResNs = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();
-                                spike.acquisitionTimeWallNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
-                                float* rawAcUv = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX - halfLength);
-                                std::memcpy(&spike.rawWaveform[0], &rawAcUv[0], sizeof(float) * settings.spikeWaveformLengthSamples);
-                                processSpike(spike);
-                            }
+            const size_t bufferSize = denseBuffer.size();
+            const size_t waveformLength = settings.spikeWaveformLengthSamples;
+            const uint64_t publishedCount = denseBuffer.beginRead();
 
-                            frame.spikes[probe] = true;
-                            
-                            // cache this spike detection buffer count (so we can suppress re-detecting the same spike)
-                            nextPeekDetectBufferCount[probe] = bufferCount + settings.spikeWaveformLengthSamples;// halfLength + peakOffsetIndex; // is this reasonable?
-                            //burstSpikeCounts[probe]++;
+            if(publishedCount < lastPublishedCount){ // the buffer was reset, start again from the top
+                scanCount = scanStartCount = publishedCount;
+            }
+            lastPublishedCount = publishedCount;
 
-                        }
+            if(bufferSize == 0 || publishedCount < scanCount + detectionLagSamples){ // caught up
+                lock.unlock();
+                std::this_thread::sleep_for(milliseconds(1));
+                continue;
+            }
 
+            // the filters' output can be late (a FIR's is), so a crossing's acquisition time is
+            // read from the frame that came in when the sample it was filtered around did
+            chunkFilterLatencySamples = std::min(getFilterLatencySamples(), bufferSize / 2);
+
+            // we read back as far as a trough search and half a waveform before a crossing (and
+            // the filter latency further for its time), if the writer is about to lap that we've
+            // fallen too far behind and have to jump ahead
+            const uint64_t backLength = 2 * waveformLength + 1 + chunkFilterLatencySamples;
+            if(publishedCount + backLength + maxDetectionChunkSamples > bufferSize + scanCount){
+                const uint64_t safeCount = publishedCount + backLength + maxDetectionChunkSamples - bufferSize;
+                samplesSkipped.fetch_add(safeCount - scanCount, std::memory_order_relaxed);
+                scanCount = safeCount;
+                if(publishedCount < scanCount + detectionLagSamples) continue;
+            }
 
+            const size_t numSamples = std::min((size_t)(publishedCount - detectionLagSamples - scanCount), maxDetectionChunkSamples);
+
+            chunkFrom = (int)(scanCount % bufferSize);
+            chunkScanCount = scanCount;
+            chunkNumSamples = numSamples;
+            detectChunk();
+
+            // only hand the spikes on if the writer didn't lap anything we read
+            if(denseBuffer.endRead(publishedCount, publishedCount - scanCount + backLength)){
+                // everything downstream (sorting, closed loop, subscribers) sees the spikes before
+                // we take spikeMutex, which only covers the buffers the gui draws from
+                drainedSpikes.clear();
+                for(std::unique_ptr<DetectionShard>& shard : shards){
+                    for(ONI::Spike* spike = shard->spikeQueue.front(); spike != nullptr; spike = shard->spikeQueue.front()){
+                        processSpike(*spike);
+                        drainedSpikes.push_back(*spike);
+                        shard->spikeQueue.pop();
                     }
+                }
+                spikeMutex.lock();
+                for(const ONI::Spike& spike : drainedSpikes) spikeBuffer.push(spike);
+                for(size_t i = 0; i < numSamples; ++i){
+                    std::bitset<MAX_NUM_MULTIPROBES> spikes;
+                    for(std::unique_ptr<DetectionShard>& shard : shards) spikes |= shard->chunkSpikes[i];
+                    spikeFrameBuffer.push(spikes);
+                }
+                spikeMutex.unlock();
+                samplesScanned.fetch_add(numSamples, std::memory_order_relaxed);
+            }else{
+                for(std::unique_ptr<DetectionShard>& shard : shards){
+                    while(shard->spikeQueue.front() != nullptr) shard->spikeQueue.pop();
+                }
+                samplesLapped.fetch_add(numSamples, std::memory_order_relaxed);
+            }
 
+            scanCount += numSamples;
 
-                    if(frame.ac_uV[probe] > deviation * settings.positiveDeviationMultiplier &&
-                       (settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::RISING ||
-                       settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::EITHER ||
-                       settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::BOTH)){
+        }
 
+    }
 
-                       // search backward for first trough index
-                        size_t troughOffsetIndex = 0; float troughVoltage = 0;
-                        for(size_t offset = settings.minSampleOffset + 1; offset < settings.spikeWaveformLengthSamples; ++offset){
-                            float previous = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX - offset - 1)[0];
-                            float current = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX - offset)[0];
-                            if(previous > current){ // the next value is less than the last we are starting to rise
-                                troughOffsetIndex = offset - 1;
-                                troughVoltage = current;
-                                break; // stop searching!
-                            }
-                        }
+    // (re)builds the shards and the worker pool, one worker per shard with the
+    // detection thread doing the first shard itself. Only call with the thread stopped
+    void configureShards(const size_t& numShards){
+
+        const size_t shardCount = std::clamp(numShards, (size_t)1, std::max((size_t)numProbes, (size_t)1));
+
+        workerPool.start(shardCount - 1);
+
+        // enough room for every probe in a shard to fire on both edges once per waveform length, for a whole chunk
+        const size_t waveformLength = std::max(settings.spikeWaveformLengthSamples, 1);
+        const size_t maxSpikesPerProbe = 2 * (maxDetectionChunkSamples / waveformLength + 1);
+
+        shards.clear();
+        size_t maxDrainedSpikes = 0;
+        for(size_t s = 0; s < shardCount; ++s){
+            std::unique_ptr<DetectionShard> shard = std::make_unique<DetectionShard>();
+            shard->firstProbe = s * numProbes / shardCount;
+            shard->endProbe = (s + 1) * numProbes / shardCount;
+            shard->belowMask.assign((maxDetectionChunkSamples + 63) / 64, 0);
+            shard->aboveMask.assign((maxDetectionChunkSamples + 63) / 64, 0);
+            shard->chunkSpikes.assign(maxDetectionChunkSamples, 0);
+            shard->spikeQueue.resize(std::clamp((shard->endProbe - shard->firstProbe) * maxSpikesPerProbe, (size_t)1, maxQueuedSpikesPerShard));
+            maxDrainedSpikes += shard->spikeQueue.capacity();
+            shards.push_back(std::move(shard));
+        }
+        drainedSpikes.reserve(maxDrainedSpikes);
 
+        LOGINFO("Spike detection using %i shards", shards.size());
 
-                        if((settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::RISING || settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::EITHER) ||
-                           (settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::BOTH && troughVoltage < -deviation * settings.negativeDeviationMultiplier)){ // ...reject if min voltage is not under the threshold
-
-                            size_t halfLength = std::floor(settings.spikeWaveformLengthSamples / 2);
-
-                            ONI::Spike spike;
-                            spike.probe = probe;
-                            spike.rawWaveform.resize(settings.spikeWaveformLengthSamples);
-                            spike.bStimFrame = frame.stimulation;
-
-                            // store the spike data and waveform
-                            if(!settings.bRisingAlignMin){ // by default align to the peaks
-                                spike.minVoltage = troughVoltage;
-                                spike.minSampleIndex = halfLength - troughOffsetIndex;
-                                spike.maxVoltage = frame.ac_uV[probe];
-                                spike.maxSampleIndex = halfLength;
-                                spike.acquisitionTimeHardware = frame.getAcquisitionTime();
-                                spike.acquisitionTimeHiResNs = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();
-                                spike.acquisitionTimeWallNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
-                                float* rawAcUv = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX - halfLength);
-                                std::memcpy(&spike.rawWaveform[0], &rawAcUv[0], sizeof(float) * settings.spikeWaveformLengthSamples);
-                                processSpike(spike);
-                            } else{
-                                spike.minVoltage = troughVoltage;
-                                spike.minSampleIndex = halfLength;
-                                spike.maxVoltage = frame.ac_uV[probe];
-                                spike.maxSampleIndex = halfLength + troughOffsetIndex;
-                                spike.acquisitionTimeHardware = frame.getAcquisitionTime();
-                                spike.acquisitionTimeHiResNs = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();
-                                spike.acquisitionTimeWallNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
-                                float* rawAcUv = denseBuffer.getAcuVFloatRaw(probe, centralSampleIDX - troughOffsetIndex - halfLength);
-                                std::memcpy(&spike.rawWaveform[0], &rawAcUv[0], sizeof(float) * settings.spikeWaveformLengthSamples);
-                                processSpike(spike);
-                            }
+    }
 
-                            frame.spikes[probe] = true;
+    // detects chunkNumSamples from chunkFrom across all the shards and waits for them to finish
+    inline void detectChunk(){
+        workerPool.run(shards.size(), [this](const size_t& s){ detectShard(*shards[s]); });
+    }
 
-                            // cache this spike detection buffer count (so we can suppress re-detecting the same spike)
-                            nextPeekDetectBufferCount[probe] = bufferCount + settings.spikeWaveformLengthSamples;//+ halfLength; // is this reasonable?
-                            //burstSpikeCounts[probe]++;
+    inline void detectShard(DetectionShard& shard){
 
-                        }
+        ONI::FrameBuffer& denseBuffer = bufferProcessor->denseBuffer;
 
-                    }
+        for(size_t i = 0; i < chunkNumSamples; ++i) shard.chunkSpikes[i].reset();
 
-                }
+        using ONI::Settings::SpikeEdgeDetectionType;
+        const bool bDetectFalling = settings.spikeEdgeDetectionType != SpikeEdgeDetectionType::RISING;
+        const bool bDetectRising = settings.spikeEdgeDetectionType != SpikeEdgeDetectionType::FALLING;
 
-                spikeMutex.lock();
-                spikeFrameBuffer.push(frame);
-                spikeMutex.unlock();
+        ONI::Processor::BufferProcessor::ProbeStatsSnapshot probeStats = bufferProcessor->getProbeStats(); // once for the whole chunk
+        ONI::Processor::BufferProcessor::ActiveProbesSnapshot activeProbes = bufferProcessor->getActiveProbesSnapshot();
+        const bool bHasActiveProbes = activeProbes != nullptr && activeProbes->size() == numProbes; // otherwise every probe is active
 
-            }
+        for(size_t probe = shard.firstProbe; probe < shard.endProbe; ++probe) {
+
+            if(bHasActiveProbes && !(*activeProbes)[probe]) continue;
+
+            float deviation = getNoiseDeviation(*probeStats, probe);
+            if(deviation <= 0) continue; // no stats yet, everything would be a spike
 
-            //bufferProcessor->dataMutex[SPARSE_MUTEX].unlock();
-            bufferProcessor->dataMutex[DENSE_MUTEX].unlock();
+            const float* acProbeVoltages = denseBuffer.getAcuVFloatRaw(probe, chunkFrom);
 
+            ONI::Simd::thresholdMask(acProbeVoltages, chunkNumSamples,
+                                     bDetectFalling ? -deviation * settings.negativeDeviationMultiplier : -INFINITY,
+                                     bDetectRising ? deviation * settings.positiveDeviationMultiplier : INFINITY,
+                                     shard.belowMask.data(), shard.aboveMask.data());
+
+            for(size_t word = 0; word < (chunkNumSamples + 63) / 64; ++word){
+                uint64_t hits = shard.belowMask[word] | shard.aboveMask[word];
+                while(hits){
+                    const size_t bit = ONI::Bits::countTrailingZeros(hits);
+                    hits &= hits - 1;
+                    const size_t i = word * 64 + bit;
+                    const bool bBelow = (shard.belowMask[word] >> bit) & 1;
+                    const bool bAbove = (shard.aboveMask[word] >> bit) & 1;
+                    detectSpike(denseBuffer, shard, probe, chunkFrom + (int)i, chunkScanCount + i, deviation, bBelow, bAbove, shard.chunkSpikes[i]);
+                }
+            }
 
         }
 
     }
 
-    inline void processSpike(Spike& spike){
+    // peak search and waveform capture around a threshold crossing at buffer index idx
+    inline void detectSpike(ONI::FrameBuffer& denseBuffer, DetectionShard& shard, const size_t& probe, const int& idx, const uint64_t& bufferCount,
+                            const float& deviation, const bool& bBelow, const bool& bAbove, std::bitset<MAX_NUM_MULTIPROBES>& spikes){
 
-        spikeMutex.lock();
-        spikeBuffer.push(spike);
-        if(!spike.bStimFrame) burstBuffer.push(spike);
-        
+        using namespace std::chrono;
+        using ONI::Settings::SpikeEdgeDetectionType;
+
+        // after we discover a spike on a probe channel we suppress detection till after the waveform capture TODO: what about overlapping spikes?
+        if(bufferCount < nextPeekDetectBufferCount[probe]) return;
+
+        const ONI::Frame::Rhs2116MultiFrame& frame = denseBuffer.getFrameAt(idx);
+        const int timeIdx = idx - (int)chunkFilterLatencySamples; // the frame the crossing's timing comes from, see processSpikes
+        const uint64_t crossingTime = denseBuffer.getFrameAt(timeIdx).getAcquisitionTime();
+        const float* acProbeVoltages = denseBuffer.getAcuVFloatRaw(probe, idx);
+        const float voltage = acProbeVoltages[0];
+        const size_t halfLength = std::floor(settings.spikeWaveformLengthSamples / 2);
+
+        if(bBelow){
+
+            // search forward for first peak index minSampleOffset forces the search to start a 
+            // //little bit after the initial detection to avoid false positive min/max post detection
+            size_t peakOffsetIndex = 0; float peakVoltage = 0;
+            for(size_t offset = settings.minSampleOffset + 1; offset < settings.spikeWaveformLengthSamples; ++offset){
+                float previous = acProbeVoltages[offset - 1];
+                float current = acProbeVoltages[offset];
+                if(previous > current){ // the next value is less than the last we are starting to fall
+                    peakOffsetIndex = offset - 1;
+                    peakVoltage = previous;
+                    break; // stop searching!
+                }
+            }
 
-        spikeEvent.notify(spike);
-        spikeMutex.unlock();
+            if((settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::FALLING || settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::EITHER) ||
+               (settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::BOTH && peakVoltage > deviation * settings.positiveDeviationMultiplier)){ // ...reject if max voltage is not over the threshold
+
+                ONI::Spike* slot = shard.spikeQueue.claim();
+                if(slot == nullptr) return; // queue's full, the ring counts it as an overflow
+
+                ONI::Spike& spike = *slot;
+                spike.probe = probe;
+                spike.rawWaveformLength = settings.spikeWaveformLengthSamples;
+                spike.bStimFrame = frame.stimulation;
+                spike.crossingTimeHardware = crossingTime;
+                spike.minVoltage = voltage;
+                spike.maxVoltage = peakVoltage;
+                spike.acquisitionTimeHiResNs = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();
+                spike.acquisitionTimeWallNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+
+                int waveformStart = 0;
+                if(settings.bFallingAlignMax){ // by default align to the peaks
+                    spike.minSampleIndex = halfLength - peakOffsetIndex;
+                    spike.maxSampleIndex = halfLength;
+                    spike.acquisitionTimeHardware = denseBuffer.getFrameAt(timeIdx + peakOffsetIndex).getAcquisitionTime();
+                    waveformStart = (int)peakOffsetIndex - (int)halfLength;
+                } else{
+                    spike.minSampleIndex = halfLength;
+                    spike.maxSampleIndex = halfLength + peakOffsetIndex;
+                    spike.acquisitionTimeHardware = crossingTime;
+                    waveformStart = -(int)halfLength;
+                }
 
-    }
+                std::memcpy(&spike.rawWaveform[0], &acProbeVoltages[waveformStart], sizeof(float) * settings.spikeWaveformLengthSamples);
+                shard.spikeQueue.publish();
 
-    void processSVD(){
+                spikes[probe] = true;
 
-        if(allSpikes.size() >= maxSpikeSampleSize){
+                // cache this spike detection buffer count (so we can suppress re-detecting the same spike)
+                nextPeekDetectBufferCount[probe] = bufferCount + settings.spikeWaveformLengthSamples;
 
-            LOGDEBUG("Let's analyse the spikes %i", allSpikes.size());
+            }
 
-            //using Eigen::MatrixXf;
-            fu::Timer svdTimer;
-            svdTimer.start();
-            Eigen::MatrixXf mat(allWaveforms.size(), allWaveforms[0].size());
+        }
 
-            for(size_t i = 0; i < allWaveforms.size(); ++i){
-                mat.row(i) = Eigen::Map<Eigen::VectorXf>(allWaveforms[i].data(), allWaveforms[i].size());
+        if(bAbove){
+
+            // search backward for first trough index
+            size_t troughOffsetIndex = 0; float troughVoltage = 0;
+            for(size_t offset = settings.minSampleOffset + 1; offset < settings.spikeWaveformLengthSamples; ++offset){
+                float previous = acProbeVoltages[-(int)offset - 1];
+                float current = acProbeVoltages[-(int)offset];
+                if(previous > current){ // the next value is less than the last we are starting to rise
+                    troughOffsetIndex = offset - 1;
+                    troughVoltage = current;
+                    break; // stop searching!
+                }
             }
 
-            //mat.conservativeResize(maxSpikeSampleSize, maxSpikeSampleSize);
-            //mat.normalize();
+            if((settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::RISING || settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::EITHER) ||
+               (settings.spikeEdgeDetectionType == SpikeEdgeDetectionType::BOTH && troughVoltage < -deviation * settings.negativeDeviationMultiplier)){ // ...reject if min voltage is not under the threshold
+
+                ONI::Spike* slot = shard.spikeQueue.claim();
+                if(slot == nullptr) return; // queue's full, the ring counts it as an overflow
+
+                ONI::Spike& spike = *slot;
+                spike.probe = probe;
+                spike.rawWaveformLength = settings.spikeWaveformLengthSamples;
+                spike.bStimFrame = frame.stimulation;
+                spike.crossingTimeHardware = crossingTime;
+                spike.minVoltage = troughVoltage;
+                spike.maxVoltage = voltage;
+                spike.acquisitionTimeHardware = crossingTime;
+                spike.acquisitionTimeHiResNs = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count();
+                spike.acquisitionTimeWallNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+
+                int waveformStart = 0;
+                if(!settings.bRisingAlignMin){ // by default align to the peaks
+                    spike.minSampleIndex = halfLength - troughOffsetIndex;
+                    spike.maxSampleIndex = halfLength;
+                    waveformStart = -(int)halfLength;
+                } else{
+                    spike.minSampleIndex = halfLength;
+                    spike.maxSampleIndex = halfLength + troughOffsetIndex;
+                    waveformStart = -(int)troughOffsetIndex - (int)halfLength;
+                }
+
+                std::memcpy(&spike.rawWaveform[0], &acProbeVoltages[waveformStart], sizeof(float) * settings.spikeWaveformLengthSamples);
+                shard.spikeQueue.publish();
 
-            Eigen::JacobiSVD<Eigen::MatrixXf> svd(mat, Eigen::ComputeFullU | Eigen::ComputeFullV);
+                spikes[probe] = true;
 
-            auto PCA = mat * svd.matrixV();
+                // cache this spike detection buffer count (so we can suppress re-detecting the same spike)
+                nextPeekDetectBufferCount[probe] = bufferCount + settings.spikeWaveformLengthSamples;
 
-            Eigen::MatrixXf U =svd.matrixU();
-            Eigen::MatrixXf V =svd.matrixV();
-            Eigen::MatrixXf sigma = Eigen::MatrixXf::Zero(U.cols(), svd.singularValues().size());// = svd.singularValues().asDiagonal().toDenseMatrix();
-            for(int i = 0; i < svd.singularValues().size(); ++i){
-                sigma(i, i) = svd.singularValues()(i);
             }
 
+        }
 
+    }
 
-            int N = 15;
-            Eigen::MatrixXf sigma_NN = sigma;
-            sigma_NN.conservativeResize(N, N);
-            Eigen::MatrixXf U_NN =svd.matrixU();
-            U_NN.conservativeResize(U_NN.rows(), N);
-            Eigen::MatrixXf V_NN =svd.matrixV();
-            V_NN.conservativeResize(V_NN.rows(), N);
+    // called from the detection thread while it drains the shard queues, nothing here
+    // takes spikeMutex (the spike goes into the spikeBuffer after, in one go with the rest)
+    inline void processSpike(Spike& spike){
 
-            Eigen::MatrixXf recovered = U * sigma * V.transpose();
-            Eigen::MatrixXf reduced = U_NN * sigma_NN * V_NN.transpose();
+        spikeFeatures.process(spike);
+        for(ONI::Processor::BaseProcessor* processor : getPostProcessorList()) processor->process(spike);
+        if(!spike.bStimFrame) burstBuffer.push(spike); // lock free
+        spikeBroadcast.push(spike); // never waits on a subscriber
 
+    }
 
+    // spikeEvent listeners run on this thread, so however slow they are they only
+    // hold up each other and not detection or the gui
+    void notifySpikes(){
 
-            LOGDEBUG("S: %i %i || U: %i %i || V: %i %i", sigma_NN.rows(), sigma_NN.cols(), U_NN.rows(), U_NN.cols(), V_NN.rows(), V_NN.cols());
-            LOGDEBUG("SVD Time: %0.3f [%i, %i]", svdTimer.stop<fu::millis>(), mat.rows(), mat.cols());
+        using namespace std::chrono;
 
-            int idx = 2;
-            for(int i = 0; i < recovered.cols(); ++i){
-                LOGDEBUG("%0.6f => %0.6f == %0.6f =~ %0.6f", allWaveforms[idx][i], mat(idx, i), recovered(idx, i), reduced(idx, i));
-            }
-            idx = 42;
-            for(int i = 0; i < recovered.cols(); ++i){
-                LOGDEBUG("%0.6f => %0.6f == %0.6f =~ %0.6f", allWaveforms[idx][i], mat(idx, i), recovered(idx, i), reduced(idx, i));
+        while(bEventThread){
+            bool bIdle = true;
+            while(spikeBroadcast.pop(spikeEventSubscriber, eventSpike)){
+                if(clockSync.isSynced() && eventSpike.probe < latencyHistograms.size()){
+                    latencyHistograms[eventSpike.probe]->record(ONI::ClockSync::getHostNs() - clockSync.toHostNs(eventSpike.acquisitionTimeHardware));
+                }
+                spikeEvent.notify(eventSpike);
+                bIdle = false;
             }
+            if(bIdle) std::this_thread::sleep_for(milliseconds(1));
+        }
 
-            std::cout << "sigma\n" << svd.singularValues() << std::endl;
-            Eigen::VectorXf  wtf = svd.singularValues();
-            wtf.normalize();
-            std::cout << "sigma norm\n" << wtf << std::endl;
+    }
 
-            Eigen::VectorXf cum = wtf;
+    // Times detection of the same chunk of the dense buffer with 1 to maxShards shards
+    // and logs the throughput and speed up over one shard. The detection thread is
+    // stopped while it runs and reset after. It needs noise statistics from a running
+    // acquisition, otherwise every probe is skipped and there's nothing to time
+    void benchmarkDetectionShards(size_t maxShards = std::thread::hardware_concurrency(), const size_t& numRepeats = 100){
 
-            for(int i = 0; i < wtf.size(); ++i){
-                if(i > 0) cum[i] = cum[i - 1] + wtf[i];
-            }
+        bThread = false;
+        if(thread.joinable()) thread.join();
 
-            std::cout << "cum \n" << cum << std::endl;
+        maxShards = std::clamp(maxShards, (size_t)1, std::max((size_t)numProbes, (size_t)1));
 
-            Eigen::VectorXf sigsq = wtf;
-            Eigen::VectorXf cumsq = wtf;
-            cumsq[0] = wtf[0] * wtf[0];
+        {
+            std::shared_lock<std::shared_mutex> lock(bufferProcessor->bufferMutex);
 
-            for(int i = 0; i < wtf.size(); ++i){
-                sigsq[i] = wtf[i] * wtf[i];
-                if(i > 0) cumsq[i] = cumsq[i - 1] + sigsq[i];
-            }
+            ONI::FrameBuffer& denseBuffer = bufferProcessor->denseBuffer;
+            const uint64_t publishedCount = denseBuffer.beginRead();
+            const size_t numSamples = std::min(maxDetectionChunkSamples, denseBuffer.size() / 2);
 
-            std::cout << "nsig2\n" << sigsq << std::endl;
-            //std::cout << "NSIG\n" << wtf * wtf << std::endl;
-            std::cout << "cims2\n" << cumsq << std::endl;
-
-            Eigen::VectorXf nexp = sigsq;
-            Eigen::VectorXf cexp = sigsq;
-            cexp[0] = sigsq[0] / cumsq[cumsq.size() - 1];
-            int idx95 = -1;
-            for(int i = 0; i < wtf.size(); ++i){
-                nexp[i] = sigsq[i] / cumsq[cumsq.size() - 1];
-                if(i > 0) cexp[i] = cexp[i - 1] + nexp[i];
-                if(cexp[i] > 0.95 && idx95 == -1) idx95 = i;
-            }
+            if(numSamples == 0 || publishedCount < numSamples + 2 * detectionLagSamples){
+                LOGALERT("Not enough samples in the dense buffer to benchmark spike detection");
+            }else{
+
+                chunkScanCount = publishedCount - detectionLagSamples - numSamples;
+                chunkFrom = (int)(chunkScanCount % denseBuffer.size());
+                chunkNumSamples = numSamples;
 
-            std::cout << "idx95: " << idx95 << std::endl;
-            std::cout << "nexp\n" << nexp << std::endl;
-            std::cout << "cexp\n" << cexp << std::endl;
+                fu::Timer timer;
+                double singleShardNanos = 0;
 
+                for(size_t numShards = 1; numShards <= maxShards; ++numShards){
+
+                    configureShards(numShards);
+
+                    size_t numSpikes = 0;
+                    timer.start();
+                    for(size_t i = 0; i < numRepeats; ++i){
+                        std::fill(nextPeekDetectBufferCount.begin(), nextPeekDetectBufferCount.end(), 0);
+                        detectChunk();
+                        for(std::unique_ptr<DetectionShard>& shard : shards){
+                            while(shard->spikeQueue.front() != nullptr){
+                                shard->spikeQueue.pop();
+                                ++numSpikes;
+                            }
+                        }
+                    }
+                    double nanos = timer.stop();
+                    if(numShards == 1) singleShardNanos = nanos;
 
+                    LOGINFO("Spike detection %i shards: %0.3f ns/sample %0.2fx (%i spikes per chunk)",
+                            numShards, nanos / (numRepeats * numSamples), singleShardNanos / nanos, numSpikes / numRepeats);
 
-            allSpikes.clear();
-            allWaveforms.clear();
+                }
 
+            }
         }
 
+        reset();
+
     }
 
     ONI::BurstBuffer& getBurstBuffer(){
@@ -440,19 +584,116 @@ public:
     }
 
     inline float getPosStDevMultiplied(const size_t& probe){
-        return bufferProcessor->getProbeStats()[probe].deviation * settings.positiveDeviationMultiplier;
+        return getNoiseDeviation(probe) * settings.positiveDeviationMultiplier;
     }
 
 
     inline float getNegStDevMultiplied(const size_t& probe){
-        return -bufferProcessor->getProbeStats()[probe].deviation * settings.negativeDeviationMultiplier;
+        return -getNoiseDeviation(probe) * settings.negativeDeviationMultiplier;
+    }
+
+    // the deviation the thresholds are multiples of, depending on the estimator in the settings
+    inline float getNoiseDeviation(const size_t& probe){
+        return getNoiseDeviation(*bufferProcessor->getProbeStats(), probe);
+    }
+
+    inline float getNoiseDeviation(const std::vector<ONI::Frame::ProbeStatistics>& probeStats, const size_t& probe){
+        if(probe >= probeStats.size()) return 0; // not published yet
+        const ONI::Frame::ProbeStatistics& stats = probeStats[probe];
+        if(settings.spikeNoiseEstimatorType == ONI::Settings::SpikeNoiseEstimatorType::MEDIAN_ABSOLUTE_DEVIATION) return stats.robustDeviation;
+        return stats.deviation;
+    }
+
+    // samples the detector has looked at vs samples acquired since it was reset (less
+    // the ones still inside the detection lag), skipped ones we fell too far behind to
+    // scan and lapped ones were scanned but overwritten before we were done with them
+    inline uint64_t getSamplesScanned(){
+        return samplesScanned.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t getSamplesSkipped(){
+        return samplesSkipped.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t getSamplesLapped(){
+        return samplesLapped.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t getSamplesAcquired(){
+        const uint64_t publishedCount = bufferProcessor->denseBuffer.beginRead();
+        const uint64_t startCount = scanStartCount.load(std::memory_order_relaxed);
+        return publishedCount > startCount + detectionLagSamples ? publishedCount - startCount - detectionLagSamples : 0;
+    }
+
+    inline ONI::SpikeFeatureExtractor& getSpikeFeatures(){
+        return spikeFeatures;
+    }
+
+    // subscribe to read every detected spike from your own thread at your own pace
+    inline ONI::BroadcastRing<ONI::Spike>& getSpikeBroadcast(){
+        return spikeBroadcast;
+    }
+
+    inline size_t getDetectionLagSamples(){
+        return detectionLagSamples;
+    }
+
+    // how late the filters in front of us put their samples out, on top of the detection lag
+    inline size_t getFilterLatencySamples(){
+        ONI::Processor::FilterProcessor* filterProcessor = ONI::Global::model.getFilterProcessor();
+        return filterProcessor == nullptr ? 0 : filterProcessor->getLatencySamples();
+    }
+
+    inline ONI::ClockSync& getClockSync(){
+        return clockSync;
+    }
+
+    // hardware sample (the spike peak) to spike event latency for one probe
+    inline ONI::LatencyHistogram& getLatencyHistogram(const size_t& probe){
+        return *latencyHistograms[probe];
+    }
+
+    // all probes together, rebuilt on every call
+    inline ONI::LatencyHistogram& getTotalLatencyHistogram(){
+        totalLatencyHistogram.reset();
+        for(std::unique_ptr<ONI::LatencyHistogram>& histogram : latencyHistograms) totalLatencyHistogram.add(*histogram);
+        return totalLatencyHistogram;
+    }
+
+    void resetLatencyHistograms(){
+        for(std::unique_ptr<ONI::LatencyHistogram>& histogram : latencyHistograms) histogram->reset();
+    }
+
+    bool saveLatencyHistograms(const std::string& filePath = "spike_latency.txt"){
+        std::ofstream os(filePath);
+        if(!os.is_open()){
+            LOGERROR("Could not save spike latency: %s", filePath.c_str());
+            return false;
+        }
+        os << "# detection lag " << detectionLagSamples << " samples, filter latency " << getFilterLatencySamples() << " samples, waveform " << settings.spikeWaveformLengthSamples << " samples\n";
+        getTotalLatencyHistogram().write(os, "all probes");
+        for(size_t probe = 0; probe < latencyHistograms.size(); ++probe) latencyHistograms[probe]->write(os, "probe " + std::to_string(probe));
+        LOGINFO("Saved spike latency: %s", filePath.c_str());
+        return true;
+    }
+
+    inline size_t getNumDetectionShards(){
+        return shards.size();
+    }
+
+    // spikes found but lost because a shard queue was full
+    inline uint64_t getDroppedSpikeCount(){
+        uint64_t count = 0;
+        for(std::unique_ptr<DetectionShard>& shard : shards) count += shard->spikeQueue.getOverflowCount();
+        return count;
     }
 
     inline float getStDev(const size_t& probe){
-        return bufferProcessor->getProbeStats()[probe].deviation;
+        ONI::Processor::BufferProcessor::ProbeStatsSnapshot probeStats = bufferProcessor->getProbeStats();
+        return probe < probeStats->size() ? (*probeStats)[probe].deviation : 0;
     }
 
-    fu::Event<ONI::Spike> spikeEvent;
+    fu::Event<ONI::Spike> spikeEvent; // notified from the event thread, a little behind detection
      
 protected:
 
@@ -460,14 +701,40 @@ protected:
     ONI::Settings::SpikeSettings settings;
 
     std::vector<size_t> nextPeekDetectBufferCount;
+    std::vector< std::unique_ptr<DetectionShard> > shards;
+    ONI::WorkerPool workerPool;
+
+    int chunkFrom = 0;                              // the chunk the shards are working on
+    uint64_t chunkScanCount = 0;
+    size_t chunkNumSamples = 0;
+
+    const size_t maxDetectionChunkSamples = 4096;
+    const size_t maxQueuedSpikesPerShard = 4096;    // spikes carry their waveform inline so cap what very short waveforms would ask for
+    size_t detectionLagSamples = 0;                 // how far behind the write head we look for spikes
+    size_t chunkFilterLatencySamples = 0;           // the filter latency for the chunk being detected, see processSpikes
+
+    uint64_t scanCount = 0;                         // dense buffer count of the next sample to scan
+    uint64_t lastPublishedCount = 0;
+    std::atomic<uint64_t> scanStartCount = 0;
+    std::atomic<uint64_t> samplesScanned = 0;
+    std::atomic<uint64_t> samplesSkipped = 0;
+    std::atomic<uint64_t> samplesLapped = 0;
     
 
-    size_t maxSpikeSampleSize = 200;
-    std::vector< ONI::Spike > allSpikes;
-    std::vector< std::vector<float> > allWaveforms;
+    ONI::SpikeFeatureExtractor spikeFeatures;
 
     ONI::BurstBuffer burstBuffer;
-    ONI::SpikeBuffer spikeBuffer;
+    ONI::SpikeBuffer spikeBuffer;                   // and the spikeFrameBuffer, under spikeMutex
+    std::vector<ONI::Spike> drainedSpikes;          // detection thread, a chunk's spikes on their way to the spikeBuffer
+
+    const size_t spikeBroadcastSize = 4096;
+    ONI::BroadcastRing<ONI::Spike> spikeBroadcast;
+    ONI::BroadcastRing<ONI::Spike>::Subscriber* spikeEventSubscriber = nullptr;
+    ONI::Spike eventSpike;                          // event thread only
+
+    ONI::ClockSync clockSync;                       // updated from the frame thread
+    std::vector<std::unique_ptr<ONI::LatencyHistogram>> latencyHistograms;
+    ONI::LatencyHistogram totalLatencyHistogram;
 
     size_t burstWindowTimeUs = 1000000;
 
@@ -477,6 +744,9 @@ protected:
     std::thread thread;
     std::mutex spikeMutex;
 
+    std::atomic_bool bEventThread = false;
+    std::thread eventThread;
+
 };
 
 
@@ -0,0 +1,412 @@
+//
+//  SpikeSorterProcessor.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <mutex>
+#include <atomic>
+#include <limits>
+
+#include "../Type/Log.h"
+#include "../Type/SettingTypes.h"
+#include "../Type/GlobalTypes.h"
+#include "../Type/SimdTypes.h"
+#include "../Type/Snapshot.h"
+
+#include "../Processor/BaseProcessor.h"
+#include "../Processor/SpikeProcessor.h"
+
+#pragma once
+
+namespace ONI{
+
+namespace Interface{
+class SpikeSorterInterface;
+};
+
+namespace Processor{
+
+// Sorts each spike into a unit by matching its waveform against a handful of templates
+// per probe (sum of squared differences, SIMD). Templates are learnt online by leader
+// clustering: a spike close enough to a template nudges it toward the spike, one that
+// isn't starts a new template. Spikes only get a unitID once their template has seen
+// minUnitSpikes matches, so noise doesn't turn into units.
+//
+// It runs inline on the spike detection thread (subscribed as a post processor to the
+// SpikeProcessor) so the unitID is set before the spike reaches the SpikeBuffer, the
+// BurstBuffer, the spike broadcast (eg., the RecordProcessor) and anything subscribed
+// to this processor (eg., the ClosedLoopProcessor).
+// Matching a spike gives up after latencyBudgetNs and leaves it unsorted.
+
+class SpikeSorterProcessor : public BaseProcessor{
+
+public:
+
+    friend class ONI::Interface::SpikeSorterInterface;
+
+    // templates for every probe, waveforms laid out [probe][unit][sample]
+    struct SpikeTemplates{
+        size_t waveformLength = 0;
+        std::vector<float> waveforms;
+        std::vector<uint64_t> spikeCounts;   // [probe][unit]
+        std::vector<int> numUnits;           // [probe]
+    };
+
+    typedef ONI::Snapshot<SpikeTemplates>::Pointer TemplatesSnapshot;
+
+    SpikeSorterProcessor(){
+        BaseProcessor::processorTypeID = ONI::Processor::TypeID::SPIKE_SORTER_PROCESSOR;
+        BaseProcessor::processorName = toString(processorTypeID);
+    }
+
+    ~SpikeSorterProcessor(){
+        LOGDEBUG("SpikeSorterProcessor DTOR");
+    };
+
+    void setup(ONI::Processor::SpikeProcessor* source){
+
+        LOGDEBUG("Setting up SpikeSorterProcessor Processor");
+
+        assert(source != nullptr);
+
+        spikeProcessor = source;
+        spikeProcessor->subscribeProcessor("SpikeSorterProcessor", ONI::Processor::SubscriptionType::POST_PROCESSOR, this);
+
+        BaseProcessor::numProbes = spikeProcessor->getNumProbes();
+
+        reset();
+
+    }
+
+    void reset(){
+
+        LOGINFO("SpikeSorterProcessor RESET");
+
+        settings.maxUnitsPerProbe = std::clamp(settings.maxUnitsPerProbe, 1, (int)ONI::MAX_SPIKE_UNITS);
+
+        resizeTemplates(templates, spikeProcessor->getSettings().spikeWaveformLengthSamples);
+        publishedTemplates.publish(templates);
+        lastPublishTime = std::chrono::steady_clock::now();
+
+        sortedCount = 0;
+        unsortedCount = 0;
+        overrunCount = 0;
+        totalLatencyNs = 0;
+        maxLatencyNs = 0;
+
+    };
+
+    inline void process(oni_frame_t* frame){};
+    inline void process(ONI::Frame::BaseFrame& frame){};
+
+    // called from the spike detection thread for every spike, in order
+    inline void process(ONI::Spike& spike){
+
+        using namespace std::chrono;
+
+        const steady_clock::time_point start = steady_clock::now();
+
+        // templates loaded or cleared from the gui get picked up between spikes, if we can't get the lock now we'll get it next spike
+        if(bStagedTemplates.load(std::memory_order_acquire) && stageMutex.try_lock()){
+            std::swap(templates, stagedTemplates);
+            bStagedTemplates = false;
+            stageMutex.unlock();
+        }
+
+        if(spike.rawWaveformLength != templates.waveformLength) resizeTemplates(templates, spike.rawWaveformLength); // only when the waveform length setting changes
+
+        spike.unitID = -1;
+        if(spike.probe < numProbes){
+            const float deviation = spikeProcessor->getNoiseDeviation(spike.probe);
+            if(deviation > 0) assignUnit(spike, templates, deviation, settings.bLearnTemplates, start, overrunCount);
+        }
+
+        const uint64_t latencyNs = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+        totalLatencyNs.fetch_add(latencyNs, std::memory_order_relaxed);
+        if(latencyNs > maxLatencyNs.load(std::memory_order_relaxed)) maxLatencyNs.store(latencyNs, std::memory_order_relaxed);
+        if(spike.unitID == -1){
+            unsortedCount.fetch_add(1, std::memory_order_relaxed);
+        }else{
+            sortedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if(start - lastPublishTime > milliseconds(publishIntervalMs)) publishTemplates();
+
+        for(ONI::Processor::BaseProcessor* processor : getPostProcessorList()) processor->process(spike);
+
+    }
+
+    // Times assignment of synthetic spikes against 1 to MAX_SPIKE_UNITS templates per
+    // probe and logs assignments per second. Uses its own templates and overrun count
+    // so it's safe to run while acquiring, the latency budget still applies to it
+    void benchmarkAssignments(const size_t& numSpikes = 100000){
+
+        if(numProbes == 0 || numSpikes == 0){
+            LOGALERT("Nothing to benchmark spike sorting with");
+            return;
+        }
+
+        const size_t waveformLength = std::max(publishedTemplates.get()->waveformLength, (size_t)1); // templates is the detection thread's
+        const float deviation = 1.0f;
+
+        std::mt19937 rng(42);
+        std::normal_distribution<float> noise(0.0f, deviation);
+
+        SpikeTemplates benchTemplates;
+        resizeTemplates(benchTemplates, waveformLength);
+
+        std::vector<ONI::Spike> spikes(std::min(numSpikes, (size_t)1024)); // cycled through so they stay in cache like real spikes would
+        std::atomic<uint64_t> benchmarkOverruns = 0;
+
+        fu::Timer timer;
+
+        for(size_t numTemplates = 1; numTemplates <= ONI::MAX_SPIKE_UNITS; ++numTemplates){
+
+            for(size_t unit = 0; unit < ONI::MAX_SPIKE_UNITS; ++unit){
+                float* waveform = &benchTemplates.waveforms[unit * waveformLength];
+                for(size_t i = 0; i < waveformLength; ++i) waveform[i] = 10.0f * (unit + 1) * std::sin(6.2832f * i / waveformLength);
+                benchTemplates.spikeCounts[unit] = settings.minUnitSpikes;
+            }
+            benchTemplates.numUnits[0] = numTemplates;
+
+            // spikes near the last template so every template gets compared
+            for(ONI::Spike& spike : spikes){
+                spike.probe = 0;
+                spike.rawWaveformLength = waveformLength;
+                const float* waveform = &benchTemplates.waveforms[(numTemplates - 1) * waveformLength];
+                for(size_t i = 0; i < waveformLength; ++i) spike.rawWaveform[i] = waveform[i] + noise(rng);
+            }
+
+            size_t numSorted = 0;
+            timer.start();
+            for(size_t i = 0; i < numSpikes; ++i){
+                ONI::Spike& spike = spikes[i % spikes.size()];
+                spike.unitID = -1;
+                assignUnit(spike, benchTemplates, deviation, false, std::chrono::steady_clock::now(), benchmarkOverruns);
+                if(spike.unitID != -1) ++numSorted;
+            }
+            double nanos = timer.stop();
+
+            LOGINFO("Spike sorting %i templates: %0.0f assignments/sec %0.1f ns/spike (%i sorted)",
+                    numTemplates, numSpikes / (nanos / 1000000000.0), nanos / numSpikes, numSorted);
+
+        }
+
+        LOGINFO("Spike sorting benchmark overran the latency budget %i times", benchmarkOverruns.load());
+
+    }
+
+    // save whatever was last published, so it's a copy at most publishIntervalMs old
+    bool saveTemplates(const std::string& filePath = "spikeTemplates.conf"){
+        const std::lock_guard<std::mutex> lock(stageMutex); // loadTemplates archives through the same pointer
+        SpikeTemplates published = *publishedTemplates.get(); // a copy, so anything staged and not swapped in yet is left alone
+        archiveTemplates = &published;
+        const bool bSaved = fu::Serializer.saveClass(filePath, *this, ARCHIVE_TEXT);
+        archiveTemplates = &stagedTemplates;
+        return bSaved;
+    }
+
+    // only templates for the current probes and waveform length, the detection thread would just clear anything else
+    bool loadTemplates(const std::string& filePath = "spikeTemplates.conf"){
+        const std::lock_guard<std::mutex> lock(stageMutex);
+        SpikeTemplates previous = stagedTemplates; // the file loads straight into stagedTemplates, put it back if it doesn't fit
+        if(!fu::Serializer.loadClass(filePath, *this, ARCHIVE_TEXT)){
+            LOGERROR("Could not load spike templates: %s", filePath.c_str());
+            stagedTemplates = std::move(previous);
+            return false;
+        }
+        const size_t numTemplates = numProbes * ONI::MAX_SPIKE_UNITS;
+        if(stagedTemplates.numUnits.size() != numProbes || stagedTemplates.spikeCounts.size() != numTemplates ||
+           stagedTemplates.waveforms.size() != numTemplates * stagedTemplates.waveformLength){
+            LOGERROR("Spike templates don't match this probe configuration: %s", filePath.c_str());
+            stagedTemplates = std::move(previous);
+            return false;
+        }
+        const size_t waveformLength = spikeProcessor->getSettings().spikeWaveformLengthSamples;
+        if(stagedTemplates.waveformLength != waveformLength){
+            LOGERROR("Spike templates are %i samples long, spikes are %i: %s", (int)stagedTemplates.waveformLength, (int)waveformLength, filePath.c_str());
+            stagedTemplates = std::move(previous);
+            return false;
+        }
+        bStagedTemplates = true;
+        return true;
+    }
+
+    void clearTemplates(){
+        const std::lock_guard<std::mutex> lock(stageMutex);
+        resizeTemplates(stagedTemplates, publishedTemplates.get()->waveformLength);
+        bStagedTemplates = true;
+    }
+
+    // the templates as of the last publish, they don't change while held
+    inline TemplatesSnapshot getTemplates(){
+        return publishedTemplates.get();
+    }
+
+    const ONI::Settings::SpikeSorterSettings& getSettings(){
+        return settings;
+    }
+
+    inline uint64_t getSortedCount(){
+        return sortedCount.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t getUnsortedCount(){
+        return unsortedCount.load(std::memory_order_relaxed);
+    }
+
+    // spikes left unsorted because matching ran past the latency budget
+    inline uint64_t getOverrunCount(){
+        return overrunCount.load(std::memory_order_relaxed);
+    }
+
+    inline float getMeanLatencyNs(){
+        const uint64_t count = sortedCount.load(std::memory_order_relaxed) + unsortedCount.load(std::memory_order_relaxed);
+        return count == 0 ? 0.0f : totalLatencyNs.load(std::memory_order_relaxed) / (float)count;
+    }
+
+    inline uint64_t getMaxLatencyNs(){
+        return maxLatencyNs.load(std::memory_order_relaxed);
+    }
+
+    size_t publishIntervalMs = 500;
+
+protected:
+
+    inline void resizeTemplates(SpikeTemplates& t, const size_t& waveformLength){
+        t.waveformLength = waveformLength;
+        t.waveforms.assign(numProbes * ONI::MAX_SPIKE_UNITS * waveformLength, 0.0f);
+        t.spikeCounts.assign(numProbes * ONI::MAX_SPIKE_UNITS, 0);
+        t.numUnits.assign(numProbes, 0);
+    }
+
+    // match the spike to the nearest template within maxResidualDeviations rms, then
+    // (if learning) move that template toward it or start a new one if nothing matched
+    inline void assignUnit(ONI::Spike& spike, SpikeTemplates& t, const float& deviation, const bool& bLearn,
+                           const std::chrono::steady_clock::time_point& start, std::atomic<uint64_t>& overruns){
+
+        using namespace std::chrono;
+
+        const size_t& L = t.waveformLength;
+        const size_t firstTemplate = spike.probe * ONI::MAX_SPIKE_UNITS;
+        const int numUnits = t.numUnits[spike.probe]; // lowering maxUnitsPerProbe only stops new templates
+
+        const float maxResidual = settings.maxResidualDeviations * deviation;
+        const float maxSSD = maxResidual * maxResidual * L;
+
+        int bestUnit = -1;
+        float bestSSD = maxSSD;
+
+        for(int unit = 0; unit < numUnits; ++unit){
+
+            // checking the clock costs about as much as a short template so only do it every few
+            if(unit > 0 && unit % 4 == 0 && duration_cast<nanoseconds>(steady_clock::now() - start).count() > settings.latencyBudgetNs){
+                overruns.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            const float ssd = ONI::Simd::sumSquaredDifference(spike.rawWaveform, &t.waveforms[(firstTemplate + unit) * L], L);
+            if(ssd < bestSSD){
+                bestSSD = ssd;
+                bestUnit = unit;
+            }
+
+        }
+
+        if(bestUnit != -1){
+
+            uint64_t& count = t.spikeCounts[firstTemplate + bestUnit];
+            ++count;
+
+            if(bLearn){
+                // running mean until the template is established, then an exponential one so it can drift with the electrode
+                const float alpha = std::max(1.0f / count, settings.learningRate);
+                float* waveform = &t.waveforms[(firstTemplate + bestUnit) * L];
+                for(size_t i = 0; i < L; ++i) waveform[i] += alpha * (spike.rawWaveform[i] - waveform[i]);
+            }
+
+            if(count >= (uint64_t)settings.minUnitSpikes) spike.unitID = bestUnit;
+            return;
+
+        }
+
+        if(!bLearn) return;
+
+        // nothing matched, start a new template or replace the weakest one that isn't a unit yet
+        int newUnit = -1;
+        if(numUnits < settings.maxUnitsPerProbe){
+            newUnit = numUnits;
+            t.numUnits[spike.probe] = numUnits + 1;
+        }else{
+            uint64_t fewestSpikes = (uint64_t)settings.minUnitSpikes;
+            for(int unit = 0; unit < numUnits; ++unit){
+                if(t.spikeCounts[firstTemplate + unit] < fewestSpikes){
+                    fewestSpikes = t.spikeCounts[firstTemplate + unit];
+                    newUnit = unit;
+                }
+            }
+        }
+
+        if(newUnit == -1) return;
+
+        std::memcpy(&t.waveforms[(firstTemplate + newUnit) * L], spike.rawWaveform, sizeof(float) * L);
+        t.spikeCounts[firstTemplate + newUnit] = 1;
+
+    }
+
+    // into a snapshot nobody holds with the same sizes unless the waveform length changed, so usually no allocation
+    inline void publishTemplates(){
+        publishedTemplates.publish(templates);
+        lastPublishTime = std::chrono::steady_clock::now();
+    }
+
+    ONI::Processor::SpikeProcessor* spikeProcessor = nullptr;
+
+    ONI::Settings::SpikeSorterSettings settings;
+
+    // detection thread only
+    SpikeTemplates templates;
+    std::chrono::steady_clock::time_point lastPublishTime;
+
+    ONI::Snapshot<SpikeTemplates> publishedTemplates; // written by the detection thread (and reset before it starts)
+
+    // loaded/cleared templates waiting for the detection thread to swap them in
+    SpikeTemplates stagedTemplates;
+    std::atomic_bool bStagedTemplates = false;
+    std::mutex stageMutex;
+
+    // what serialize reads and writes, stagedTemplates apart from while saveTemplates writes out its copy
+    SpikeTemplates* archiveTemplates = &stagedTemplates;
+
+    std::atomic<uint64_t> sortedCount = 0;
+    std::atomic<uint64_t> unsortedCount = 0;
+    std::atomic<uint64_t> overrunCount = 0;
+    std::atomic<uint64_t> totalLatencyNs = 0;
+    std::atomic<uint64_t> maxLatencyNs = 0;
+
+    friend class boost::serialization::access;
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version){
+        ar& boost::serialization::make_nvp("stagedTemplates.waveformLength", archiveTemplates->waveformLength);
+        ar& boost::serialization::make_nvp("stagedTemplates.numUnits", archiveTemplates->numUnits);
+        ar& boost::serialization::make_nvp("stagedTemplates.spikeCounts", archiveTemplates->spikeCounts);
+        ar& boost::serialization::make_nvp("stagedTemplates.waveforms", archiveTemplates->waveforms);
+    }
+
+};
+
+
+} // namespace Processor
+} // namespace ONI
@@ -0,0 +1,344 @@
+//
+//  BiquadCascade.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <array>
+#include <memory>
+#include <complex>
+#include <mutex>
+#include <atomic>
+
+#include "../Type/Log.h"
+#include "../Type/SimdTypes.h"
+
+#include "../DSPFilters/Dsp.h"
+
+#pragma once
+
+namespace ONI{
+
+// Multichannel biquad cascade
+//
+// One set of second order sections shared by every channel, with the filter state for
+// all of them interleaved so Simd::biquadCascade can run each section over 4/8/16
+// channels at a time. Sections come from a DSPFilters design (getStages) so the
+// response is the one DSPFilters would give, just run in float as transposed direct
+// form II rather than double direct form II.
+//
+// setStages can be called from any thread. Sections go through a triple buffer: the
+// writer fills its own set and swaps it into the middle, the processing thread swaps
+// the middle set out at the start of its next process(), so it never takes a lock and
+// never sees a half written set. Sets written in between are dropped, only the latest
+// is used. Give sections an id and their state follows them when the cascade is
+// rearranged (eg., a filter in front of them switched off) instead of staying put.
+// With a transition the coefficients ramp from the old set to the new one a few
+// samples at a time (for sets with the same sections, eg., while a setting is dragged).
+
+class BiquadCascade{
+
+public:
+
+	struct Stage{
+		double b0 = 1;
+		double b1 = 0;
+		double b2 = 0;
+		double a1 = 0;
+		double a2 = 0;
+		int id = -1; // -1 keeps the state of whatever section was at this position before
+	};
+
+	// sections of a DSPFilters design (eg., Dsp::Butterworth::Design::BandPass<4>) with a0 normalised
+	// out, numbered id * MAX_BIQUAD_STAGES + section when given an id so designs don't share ids
+	static std::vector<Stage> getStages(Dsp::Cascade& cascade, const int& id = -1){
+		std::vector<Stage> stages(cascade.getNumStages());
+		for(int i = 0; i < cascade.getNumStages(); ++i){
+			const Dsp::Cascade::Stage& s = cascade[i];
+			const double a0 = s.getA0();
+			stages[i].b0 = s.getB0() / a0;
+			stages[i].b1 = s.getB1() / a0;
+			stages[i].b2 = s.getB2() / a0;
+			stages[i].a1 = s.getA1() / a0;
+			stages[i].a2 = s.getA2() / a0;
+			stages[i].id = id < 0 ? -1 : id * (int)Simd::MAX_BIQUAD_STAGES + i;
+		}
+		return stages;
+	}
+
+	// |H| of the sections end to end at numPoints evenly spaced frequencies from 0 to Nyquist inclusive
+	static std::vector<float> getMagnitudeResponse(const std::vector<Stage>& stages, const size_t& numPoints){
+		std::vector<float> magnitude(numPoints, 1.0f);
+		for(size_t k = 0; k < numPoints; ++k){
+			const double w = numPoints > 1 ? 3.14159265358979323846 * k / (numPoints - 1) : 0;
+			const std::complex<double> z1 = std::polar(1.0, -w);	// z^-1
+			const std::complex<double> z2 = z1 * z1;				// z^-2
+			double m = 1;
+			for(const Stage& s : stages) m *= std::abs(s.b0 + s.b1 * z1 + s.b2 * z2) / std::abs(1.0 + s.a1 * z1 + s.a2 * z2);
+			magnitude[k] = m;
+		}
+		return magnitude;
+	}
+
+	void setup(const size_t& numChannels){
+		this->numChannels = numChannels;
+		stateStride = (numChannels + 15) & ~(size_t)15; // whole 16 channel groups
+		state.assign(Simd::MAX_BIQUAD_STAGES * 2 * stateStride, 0.0f);
+		scratchState.assign(state.size(), 0.0f);
+		heldState.assign(state.size(), 0.0f);
+		numStages = 0;
+	}
+
+	// transitionSamples ramps the change in over that many samples when only the coefficients change
+	bool setStages(const std::vector<Stage>& stages, const size_t& transitionSamples = 0){
+		if(stages.size() > Simd::MAX_BIQUAD_STAGES){
+			LOGERROR("Biquad cascades are limited to %i stages", Simd::MAX_BIQUAD_STAGES);
+			return false;
+		}
+		const std::lock_guard<std::mutex> lock(writerMutex); // only between writers
+		StageSet& set = stageSets[backIDX];
+		for(size_t i = 0; i < stages.size(); ++i){
+			set.coefficients[i * 5 + 0] = stages[i].b0;
+			set.coefficients[i * 5 + 1] = stages[i].b1;
+			set.coefficients[i * 5 + 2] = stages[i].b2;
+			set.coefficients[i * 5 + 3] = stages[i].a1;
+			set.coefficients[i * 5 + 4] = stages[i].a2;
+			set.ids[i] = stages[i].id;
+		}
+		set.numStages = stages.size();
+		set.transitionSamples = transitionSamples;
+		backIDX = middleIDX.exchange(backIDX | NEW_SET, std::memory_order_acq_rel) & ~NEW_SET;
+		return true;
+	}
+
+	// processing thread: filters numSamples of every channel in place, channel c's
+	// samples start at samples + c * stride (use a stride of 1 and one sample for a frame)
+	inline void process(float* samples, const size_t& stride, const size_t& numSamples, const Simd::InstructionSet& instructionSet = Simd::getInstructionSet()){
+
+		if(middleIDX.load(std::memory_order_relaxed) & NEW_SET) swapStages();
+
+		if(numStages == 0 || numSamples == 0) return;
+
+#ifdef ONI_SIMD_X86
+		// a decaying IIR would otherwise spend most of its time in denormals
+		const unsigned int csr = _mm_getcsr();
+		_mm_setcsr(csr | 0x8040); // flush to zero and denormals are zero
+#endif
+
+		size_t offset = 0;
+
+		// a step at a time with coefficients part way from the last set to this one
+		while(transitionRemaining > 0 && offset < numSamples){
+			const size_t step = std::min(std::min(TRANSITION_STEP, transitionRemaining), numSamples - offset);
+			transitionRemaining -= step;
+			const float t = 1.0f - (float)transitionRemaining / transitionLength;
+			const float* to = stageSets[frontIDX].coefficients;
+			for(size_t i = 0; i < numStages * 5; ++i) rampCoefficients[i] = fromCoefficients[i] + (to[i] - fromCoefficients[i]) * t;
+			Simd::biquadCascade(rampCoefficients, numStages, state.data(), stateStride, samples + offset, stride, numChannels, step, instructionSet);
+			offset += step;
+		}
+
+		if(offset < numSamples){
+			Simd::biquadCascade(stageSets[frontIDX].coefficients, numStages, state.data(), stateStride, samples + offset, stride, numChannels, numSamples - offset, instructionSet);
+		}
+
+#ifdef ONI_SIMD_X86
+		_mm_setcsr(csr);
+#endif
+
+	}
+
+	// processing thread
+	inline void reset(){
+		std::fill(state.begin(), state.end(), 0.0f);
+	}
+
+	inline void reset(const size_t& channel){
+		assert(channel < numChannels);
+		for(size_t i = 0; i < Simd::MAX_BIQUAD_STAGES * 2; ++i) state[i * stateStride + channel] = 0.0f;
+	}
+
+	// processing thread: keeps a copy of the state as it is now for restoreState() to put
+	// back, so whatever is filtered in between leaves nothing behind
+	inline void holdState(){
+		std::copy(state.begin(), state.end(), heldState.begin());
+		heldLayoutCount = layoutCount;
+	}
+
+	// processing thread: if the sections were rearranged since holdState() the copy no
+	// longer lines up with them, so they start from rest instead
+	inline void restoreState(){
+		if(heldLayoutCount == layoutCount){
+			std::copy(heldState.begin(), heldState.end(), state.begin());
+		}else{
+			reset();
+		}
+	}
+
+	inline size_t getNumStages(){
+		return numStages;
+	}
+
+	inline size_t getNumChannels(){
+		return numChannels;
+	}
+
+protected:
+
+	// processing thread: takes the latest set and moves each section's state to where it now is
+	inline void swapStages(){
+
+		// whatever we're running now is where a transition starts from, the set goes back to the writer with the exchange
+		const float* current = transitionRemaining > 0 ? rampCoefficients : stageSets[frontIDX].coefficients;
+		std::copy(current, current + numStages * 5, fromCoefficients);
+
+		frontIDX = middleIDX.exchange(frontIDX, std::memory_order_acq_rel) & ~NEW_SET;
+
+		const StageSet& set = stageSets[frontIDX];
+
+		bool bSameLayout = set.numStages == numStages;
+		for(size_t i = 0; i < set.numStages && bSameLayout; ++i) bSameLayout = set.ids[i] == -1 || set.ids[i] == ids[i];
+
+		if(!bSameLayout){
+			for(size_t i = 0; i < set.numStages; ++i){
+				size_t from = Simd::MAX_BIQUAD_STAGES; // from rest
+				if(set.ids[i] == -1){
+					if(i < numStages) from = i;
+				}else{
+					for(size_t j = 0; j < numStages; ++j) if(ids[j] == set.ids[i]) from = j;
+				}
+				float* to = scratchState.data() + (i * 2) * stateStride;
+				if(from == Simd::MAX_BIQUAD_STAGES){
+					std::fill(to, to + 2 * stateStride, 0.0f);
+				}else{
+					std::copy(state.begin() + (from * 2) * stateStride, state.begin() + (from * 2 + 2) * stateStride, to);
+				}
+			}
+			std::swap(state, scratchState);
+			++layoutCount;
+		}
+
+		// only ramp between sets with the same sections, anything else just swaps
+		transitionLength = bSameLayout && set.numStages == numStages ? set.transitionSamples : 0;
+		transitionRemaining = transitionLength;
+
+		for(size_t i = 0; i < set.numStages; ++i) ids[i] = set.ids[i] == -1 ? (i < numStages ? ids[i] : -1) : set.ids[i];
+		numStages = set.numStages;
+
+	}
+
+	struct StageSet{
+		float coefficients[Simd::MAX_BIQUAD_STAGES * 5];
+		int ids[Simd::MAX_BIQUAD_STAGES];
+		size_t numStages = 0;
+		size_t transitionSamples = 0;
+	};
+
+	static constexpr size_t NEW_SET = 4;
+	static constexpr size_t TRANSITION_STEP = 16; // samples per coefficient step while ramping
+
+	size_t numChannels = 0;
+	size_t stateStride = 0;
+
+	StageSet stageSets[3];
+	std::atomic<size_t> middleIDX = 1;	// plus NEW_SET when the writer has put a set there the processing thread hasn't taken
+	size_t backIDX = 2;					// writers, under writerMutex
+	std::mutex writerMutex;
+
+	// processing thread
+	size_t frontIDX = 0;
+	size_t numStages = 0;
+	int ids[Simd::MAX_BIQUAD_STAGES];	// of the sections the state is currently laid out for
+	std::vector<float> state;
+	std::vector<float> scratchState;
+	std::vector<float> heldState;
+	size_t layoutCount = 0;				// state rearrangements, so a held state knows if it's still laid out right
+	size_t heldLayoutCount = 0;
+	float fromCoefficients[Simd::MAX_BIQUAD_STAGES * 5];
+	float rampCoefficients[Simd::MAX_BIQUAD_STAGES * 5];
+	size_t transitionLength = 0;
+	size_t transitionRemaining = 0;
+
+};
+
+// Biquad Design Cache
+//
+// Sections of DSPFilters designs keyed on the design (an id the caller picks per design
+// type, which also numbers the sections, see BiquadCascade::getStages) and its params,
+// which take in the order and sample rate. Each design is only worked out once however
+// many times it's asked for, and is handed out by pointer. Holds the last maxDesigns
+// designs or so; starts again from empty when it's full.
+
+class BiquadDesignCache{
+
+public:
+
+	typedef std::shared_ptr<const std::vector<BiquadCascade::Stage>> Stages;
+
+	template<typename DesignType>
+	Stages getStages(const int& designID, const Dsp::Params& params){
+
+		Key key;
+		key.first = designID;
+		for(int i = 0; i < Dsp::maxParameters; ++i) key.second[i] = params[i];
+
+		const std::lock_guard<std::mutex> lock(mutex);
+
+		auto it = designs.find(key);
+		if(it != designs.end()){
+			++hitCount;
+			return it->second;
+		}
+
+		++missCount;
+
+		DesignType design;
+		design.setParams(params);
+		Stages stages = std::make_shared<const std::vector<BiquadCascade::Stage>>(BiquadCascade::getStages(design, designID));
+
+		if(designs.size() >= maxDesigns) designs.clear();
+		designs[key] = stages;
+
+		return stages;
+
+	}
+
+	void clear(){
+		const std::lock_guard<std::mutex> lock(mutex);
+		designs.clear();
+	}
+
+	inline size_t size(){
+		const std::lock_guard<std::mutex> lock(mutex);
+		return designs.size();
+	}
+
+	inline uint64_t getHitCount(){
+		return hitCount;
+	}
+
+	inline uint64_t getMissCount(){
+		return missCount;
+	}
+
+protected:
+
+	typedef std::pair<int, std::array<double, Dsp::maxParameters>> Key;
+
+	std::map<Key, Stages> designs;
+	std::mutex mutex;
+
+	size_t maxDesigns = 1024;
+
+	std::atomic<uint64_t> hitCount = 0;
+	std::atomic<uint64_t> missCount = 0;
+
+};
+
+
+} // namespace ONI
@@ -0,0 +1,56 @@
+//
+//  BitTypes.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#pragma once
+
+namespace ONI{
+namespace Bits{
+
+// <bit> is C++20 and the addon builds as C++17, so these go straight to the compiler's
+// intrinsics (with a plain loop for anything else). value mustn't be 0
+
+// index of the lowest set bit
+static inline size_t countTrailingZeros(const uint64_t& value){
+	assert(value != 0);
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index = 0;
+	_BitScanForward64(&index, value);
+	return (size_t)index;
+#elif defined(__GNUC__) || defined(__clang__)
+	return (size_t)__builtin_ctzll(value);
+#else
+	size_t count = 0;
+	for(uint64_t v = value; (v & 1) == 0; v >>= 1) ++count;
+	return count;
+#endif
+}
+
+// number of zero bits above the highest set bit
+static inline size_t countLeadingZeros(const uint64_t& value){
+	assert(value != 0);
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index = 0;
+	_BitScanReverse64(&index, value);
+	return (size_t)(63 - index);
+#elif defined(__GNUC__) || defined(__clang__)
+	return (size_t)__builtin_clzll(value);
+#else
+	size_t count = 0;
+	for(uint64_t v = value; (v & (1ull << 63)) == 0; v <<= 1) ++count;
+	return count;
+#endif
+}
+
+} // namespace Bits
+} // namespace ONI
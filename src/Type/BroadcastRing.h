@@ -0,0 +1,186 @@
+//
+//  BroadcastRing.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+
+// what a subscriber loses when the producer laps it
+enum BroadcastDropPolicy{
+	DROP_OVERWRITTEN = 0,	// only what was overwritten, carry on from the oldest item still in the ring
+	DROP_BACKLOG			// everything behind the head, carry on from the newest item (for readers that only want what's current)
+};
+
+// Single producer multi consumer lock free broadcast ring
+//
+// Every subscriber sees every item from the moment it subscribed, reading from its
+// own cursor at its own pace. The producer never looks at the subscribers: it just
+// overwrites the oldest slot, so one slow subscriber can't hold up the producer or
+// any of the others. A subscriber that gets lapped skips ahead according to its drop
+// policy and counts what it lost. Each slot carries the sequence it was written with
+// and readers check it after copying, so a copy torn by the producer is thrown away.
+//
+// Each subscriber should only be read from one thread.
+
+template<typename T>
+class BroadcastRing{
+
+public:
+
+	struct Subscriber{
+		std::string name;
+		BroadcastDropPolicy dropPolicy = DROP_OVERWRITTEN;
+		std::atomic<uint64_t> cursor = 0;		// next sequence this subscriber will read
+		std::atomic<uint64_t> droppedCount = 0;
+		std::atomic<uint64_t> maxLag = 0;
+	};
+
+	~BroadcastRing(){
+		slots.reset();
+	};
+
+	// only resize with no producer or subscribers running, subscribers are moved to the new head
+	size_t resize(const size_t& size){
+		size_t capacity = 1;
+		while(capacity < size) capacity <<= 1; // power of two so we can mask instead of mod
+		slots.reset(new Slot[capacity]);
+		numSlots = capacity;
+		mask = capacity - 1;
+		head = 0;
+		const std::lock_guard<std::mutex> lock(subscriberMutex);
+		for(std::unique_ptr<Subscriber>& subscriber : subscribers) subscriber->cursor = 0;
+		return capacity;
+	}
+
+	// producer side
+
+	inline void push(const T& t){
+		const uint64_t sequence = head.load(std::memory_order_relaxed);
+		Slot& slot = slots[sequence & mask];
+		slot.sequence.store(WRITING, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.value = t;
+		slot.sequence.store(sequence + 1, std::memory_order_release);
+		head.store(sequence + 1, std::memory_order_release);
+	}
+
+	// subscriber side
+
+	Subscriber* subscribe(const std::string& name, const BroadcastDropPolicy& dropPolicy = DROP_OVERWRITTEN){
+		const std::lock_guard<std::mutex> lock(subscriberMutex);
+		for(std::unique_ptr<Subscriber>& subscriber : subscribers){
+			if(subscriber->name == name){
+				LOGALERT("Broadcast subscriber already exists: %s", name.c_str());
+				return subscriber.get();
+			}
+		}
+		subscribers.push_back(std::make_unique<Subscriber>());
+		Subscriber* subscriber = subscribers.back().get();
+		subscriber->name = name;
+		subscriber->dropPolicy = dropPolicy;
+		subscriber->cursor = head.load(std::memory_order_acquire);
+		return subscriber;
+	}
+
+	// the subscriber mustn't be read from again after this
+	void unsubscribe(Subscriber* subscriber){
+		const std::lock_guard<std::mutex> lock(subscriberMutex);
+		subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+										 [subscriber](const std::unique_ptr<Subscriber>& s){ return s.get() == subscriber; }), subscribers.end());
+	}
+
+	// copies the subscriber's next item into t, false if it's caught up
+	inline bool pop(Subscriber* subscriber, T& t){
+
+		uint64_t cursor = subscriber->cursor.load(std::memory_order_relaxed);
+
+		while(true){
+
+			const uint64_t h = head.load(std::memory_order_acquire);
+			if(cursor == h) return false;
+
+			const uint64_t lag = h - cursor;
+			if(lag > subscriber->maxLag.load(std::memory_order_relaxed)) subscriber->maxLag.store(lag, std::memory_order_relaxed);
+
+			// lapped (or about to be, the producer may be writing the oldest slot right now)
+			if(lag >= numSlots){
+				const uint64_t next = subscriber->dropPolicy == DROP_BACKLOG ? h - 1 : h - numSlots + 1;
+				subscriber->droppedCount.fetch_add(next - cursor, std::memory_order_relaxed);
+				cursor = next;
+			}
+
+			Slot& slot = slots[cursor & mask];
+			if(slot.sequence.load(std::memory_order_acquire) == cursor + 1){
+				t = slot.value;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if(slot.sequence.load(std::memory_order_relaxed) == cursor + 1){
+					subscriber->cursor.store(cursor + 1, std::memory_order_release);
+					return true;
+				}
+			}
+
+			// overwritten under us, go round and skip ahead
+			subscriber->droppedCount.fetch_add(1, std::memory_order_relaxed);
+			cursor = cursor + 1;
+
+		}
+
+	}
+
+	// stats
+
+	inline uint64_t getHead(){
+		return head.load(std::memory_order_acquire);
+	}
+
+	inline uint64_t getLag(Subscriber* subscriber){
+		return head.load(std::memory_order_acquire) - subscriber->cursor.load(std::memory_order_acquire);
+	}
+
+	inline size_t capacity(){
+		return numSlots;
+	}
+
+	// only the pointers are copied, the stats in them are live
+	inline std::vector<Subscriber*> getSubscribers(){
+		const std::lock_guard<std::mutex> lock(subscriberMutex);
+		std::vector<Subscriber*> list;
+		for(std::unique_ptr<Subscriber>& subscriber : subscribers) list.push_back(subscriber.get());
+		return list;
+	}
+
+protected:
+
+	static constexpr uint64_t WRITING = ~(uint64_t)0;
+
+	struct Slot{
+		std::atomic<uint64_t> sequence = 0; // sequence + 1 once written, WRITING while the producer is in it
+		T value;
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	size_t numSlots = 0;
+	size_t mask = 0;
+
+	alignas(64) std::atomic<uint64_t> head = 0;
+
+	std::vector<std::unique_ptr<Subscriber>> subscribers;
+	std::mutex subscriberMutex;
+
+};
+
+
+} // namespace ONI
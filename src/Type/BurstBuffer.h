@@ -19,6 +19,8 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <syncstream>
 
 #include "../Type/SettingTypes.h"
@@ -32,40 +34,53 @@
 namespace ONI{
 
 
+// Spike counts per burst interval, as rates over any window in O(1)
+//
+// Every probe (and sorted unit) keeps a running total of its spikes, and at each
+// interval boundary the totals are written into a ring of prefix sums. The count over
+// the last N intervals is then just the newest prefix less the one N back, so a rate
+// costs the same for a 100 ms window as a 10 s one and any number of windows can be
+// read at once. Spikes are pushed from the detection thread, the clock runs on the
+// frame thread and rates can be read from anywhere, all without locks: the totals and
+// prefixes are atomics and the interval count is published after its prefixes.
+//
+// The counters are only allocated when the sizes change, which only happens when the
+// owning processor is set up, before anything pushes or runs the clock. Resizing to
+// the same sizes (every SpikeProcessor::reset) and clear() zero them in place, and ask
+// the clock to zero them again before its next boundary so a snapshot it was halfway
+// through can't leave a stale prefix behind.
+
 class BurstBuffer{
 
 public:
 
-	virtual ~BurstBuffer(){
-		rawBurstBuffer.clear();
-	}
+	virtual ~BurstBuffer(){};
 
 	size_t _resize(){
 		const std::lock_guard<std::mutex> lock(mutex);
 
-
-		
+		bufferSize = std::max(bufferSize, (size_t)3); // a window needs two prefixes and a slot the clock can write
 		currentBufferIndex = 0;
 		bufferSampleCount = 0;
 
-		rawBurstBuffer.clear();
-		rawSPSABuffer.clear();
+		numCounters = numProbes * (1 + MAX_SPIKE_UNITS) + 1; // probes, then units, then the total over all probes
 
-		rawBurstBuffer.resize(numProbes);
-		rawSPSABuffer.assign(bufferSize * 3, 0);
+		unitBufferSize = std::clamp((size_t)(ONI::rhs2116MillisToSamples(unitBufferDurationMs) / burstIntervalTimeSamples), (size_t)3, bufferSize);
 
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			rawBurstBuffer[probe].assign(bufferSize * 3, 0);
-		}
+		spikeCounts.reset(new std::atomic<uint64_t>[numCounters]);
+		probePrefixes.reset(new std::atomic<uint64_t>[(numProbes + 1) * bufferSize]);
+		unitPrefixes.reset(new std::atomic<uint64_t>[numProbes * MAX_SPIKE_UNITS * unitBufferSize]);
+
+		zeroCounts();
+
+		rawSPSABuffer.assign(bufferSize * 3, 0);
 
 		bIsFrameNew = false;
+		bClearPending = false;
 
 		frameCounter = 0;
 
-		//burstIntervalTimer.start<fu::millis>(burstIntervalTimeMs);
-		
 		LOGDEBUG("BurstBuffer timer: %d %d %0.3f", burstIntervalTimeMs, burstIntervalTimeSamples, ONI::rhs2116SamplesToMillis(burstIntervalTimeSamples));
-		
 
 		timeStamps.resize(bufferSize);
 		for(size_t i = 0; i < bufferSize; ++i){
@@ -79,55 +94,88 @@ public:
 	}
 	std::vector<float> timeStamps;
 	size_t resizeByMillis(const int& bufferDurationMs, const int& intervalTimeMs, const size_t& numProbes){
-		this->burstIntervalTimeSamples = ONI::rhs2116MillisToSamples(burstIntervalTimeMs);
+
+		const uint64_t intervalTimeSamples = ONI::rhs2116MillisToSamples(burstIntervalTimeMs);
+		const size_t size = std::max((size_t)(ONI::rhs2116MillisToSamples(bufferDurationMs) / intervalTimeSamples), (size_t)3);
+
+		// the clock may be running, so don't touch the arrays (or the sizes it reads) unless we have to
+		if(spikeCounts != nullptr && intervalTimeSamples == burstIntervalTimeSamples && size == bufferSize && numProbes == this->numProbes){
+			clear();
+			return bufferSize;
+		}
+
+		this->burstIntervalTimeSamples = intervalTimeSamples;
 		this->burstIntervalTimeMs = ONI::rhs2116SamplesToMillis(burstIntervalTimeSamples);
-		this->bufferSize = ONI::rhs2116MillisToSamples(bufferDurationMs) / burstIntervalTimeSamples;
+		this->bufferSize = size;
 		this->numProbes = numProbes;
 
 		return _resize();
 	}
 
+	// any thread, the counts read as zero straight away and the clock zeroes them
+	// again (and the SPSA plot) before it next closes an interval
 	void clear(){
 		const std::lock_guard<std::mutex> lock(mutex);
-		rawBurstBuffer.clear();
+		zeroCounts();
+		currentBufferIndex.store(0, std::memory_order_relaxed);
+		bufferSampleCount.store(0, std::memory_order_relaxed);
+		bClearPending.store(true, std::memory_order_release);
 	}
 
+	// detection thread
 	inline void push(const ONI::Spike& spike){
-		const std::lock_guard<std::mutex> lock(mutex);
-		
+
 		const size_t& probe = spike.probe;
-		rawBurstBuffer[probe][currentBufferIndex] = rawBurstBuffer[probe][currentBufferIndex + bufferSize] = rawBurstBuffer[probe][currentBufferIndex + bufferSize * 2] = rawBurstBuffer[probe][currentBufferIndex] + 1;
+		spikeCounts[probe].fetch_add(1, std::memory_order_relaxed);
+		spikeCounts[numCounters - 1].fetch_add(1, std::memory_order_relaxed);
+
+		if(spike.unitID >= 0 && (size_t)spike.unitID < MAX_SPIKE_UNITS){
+			spikeCounts[numProbes + probe * MAX_SPIKE_UNITS + spike.unitID].fetch_add(1, std::memory_order_relaxed);
+		}
 
 	}
 
 	uint64_t burstIntervalTimeSamples = 0;
 	uint64_t frameCounter = 0;
+
+	// frame thread, once per sample
 	inline void updateClock(){
-		const std::lock_guard<std::mutex> lock(mutex);
-		//if(burstIntervalTimer.finished()){
-		//	burstIntervalTimer.restart();
-		if(frameCounter % burstIntervalTimeSamples == 0){
-			double totes = 0;
-			for(int probe = 0; probe < numProbes; ++probe){
-				totes += getCurrentBurstRatePSANoLocks(probe, 1000);
+		if(bClearPending.load(std::memory_order_relaxed) && bClearPending.exchange(false, std::memory_order_acquire)){
+			zeroCounts();
+			std::fill(rawSPSABuffer.begin(), rawSPSABuffer.end(), 0);
+			currentBufferIndex.store(0, std::memory_order_relaxed);
+			bufferSampleCount.store(0, std::memory_order_release);
+		}
+		if(frameCounter % burstIntervalTimeSamples == 0 && frameCounter > 0){
+
+			// close the interval: snapshot every running total as the prefix for this boundary
+			const size_t interval = bufferSampleCount.load(std::memory_order_relaxed) + 1;
+
+			const size_t probeSlot = interval % bufferSize;
+			for(size_t probe = 0; probe <= numProbes; ++probe){ // the extra one is the total
+				const size_t counter = probe == numProbes ? numCounters - 1 : probe;
+				probePrefixes[probe * bufferSize + probeSlot].store(spikeCounts[counter].load(std::memory_order_relaxed), std::memory_order_relaxed);
 			}
-			rawSPSABuffer[currentBufferIndex] = rawSPSABuffer[currentBufferIndex + bufferSize] = rawSPSABuffer[currentBufferIndex + bufferSize * 2] = totes;
-			++bufferSampleCount;
-			currentBufferIndex = (currentBufferIndex + 1) % bufferSize;
-			for(int probe = 0; probe < numProbes; ++probe){
-				rawBurstBuffer[probe][currentBufferIndex] = rawBurstBuffer[probe][currentBufferIndex + bufferSize] = rawBurstBuffer[probe][currentBufferIndex + bufferSize * 2] = 0;
+
+			const size_t unitSlot = interval % unitBufferSize;
+			for(size_t ring = 0; ring < numProbes * MAX_SPIKE_UNITS; ++ring){
+				unitPrefixes[ring * unitBufferSize + unitSlot].store(spikeCounts[numProbes + ring].load(std::memory_order_relaxed), std::memory_order_relaxed);
 			}
+
+			bufferSampleCount.store(interval, std::memory_order_release);
+
+			const size_t index = currentBufferIndex.load(std::memory_order_relaxed);
+			rawSPSABuffer[index] = rawSPSABuffer[index + bufferSize] = rawSPSABuffer[index + bufferSize * 2] = getTotalBurstRatePSA(1000);
+			currentBufferIndex.store((index + 1) % bufferSize, std::memory_order_release);
+
+			bIsFrameNew = true;
+
 		}
 		++frameCounter;
 	}
 
 	inline bool isFrameNew(const bool& reset = true){ // should I really auto reset? means it can only be called once per cycle
-		const std::lock_guard<std::mutex> lock(mutex);
-		if(bIsFrameNew){
-			if(reset) bIsFrameNew = false;
-			return true;
-		}
-		return false;
+		return reset ? bIsFrameNew.exchange(false) : bIsFrameNew.load();
 	}
 
 	inline void copySortedBuffer(std::vector<ONI::Frame::Rhs2116MultiFrame>& to){
@@ -136,105 +184,120 @@ public:
 	}
 
 	inline float* getRawSPSA(const int& from){
-		const std::lock_guard<std::mutex> lock(mutex);
 		return &rawSPSABuffer[from + bufferSize]; // allow negative values by wrapping 
 	}
 
-	inline std::vector<std::vector<float>>& getUnderlyingBuffer(){ // this actually returns the whole buffer which is 3 times larger than needed
-		const std::lock_guard<std::mutex> lock(mutex);
-		return rawBurstBuffer;
-	}
-
-	inline float& getBurstCountAt(const size_t& probe, const int& idx){
-		const std::lock_guard<std::mutex> lock(mutex);
-		//assert(idx > 0 && idx < bufferSize);
-		return rawBurstBuffer[probe][idx + bufferSize];
+	// spikes on a probe in the interval at ring index idx (negative values wrap), the current index is the one still counting
+	inline float getBurstCountAt(const size_t& probe, const int& idx){
+		const size_t intervals = bufferSampleCount.load(std::memory_order_acquire);
+		const size_t back = ((int64_t)currentBufferIndex.load(std::memory_order_acquire) - idx + (int64_t)bufferSize * 2) % bufferSize; // intervals back from the newest boundary
+		if(back == 0) return spikeCounts[probe].load(std::memory_order_relaxed) - probePrefixes[probe * bufferSize + intervals % bufferSize].load(std::memory_order_relaxed);
+		if(back > std::min(intervals, bufferSize - 2)) return 0;
+		return getProbeCount(probe, intervals - back + 1, intervals - back);
 	}
 
 	inline float getTotalBurstRatePSA(const size_t& windowIntervalMs){
-		const std::lock_guard<std::mutex> lock(mutex);
-		float totes = 0;
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			totes += getCurrentBurstRatePSANoLocks(probe, windowIntervalMs);
-		}
-		return totes;
+		return getBurstRatePSA(numProbes, windowIntervalMs);
 	}
 
+	// kept for code written against the locked version, nothing here locks any more
 	inline float getCurrentBurstRatePSANoLocks(const size_t& probe, const size_t& windowIntervalMs){
-		//const std::lock_guard<std::mutex> lock(mutex);
-		//assert(windowIntervalMs % burstIntervalTimeMs == 0);
-		size_t steps = std::min((size_t)std::floor(windowIntervalMs / burstIntervalTimeMs), bufferSampleCount); // make sure we actually have enough sample windows
-		if(steps == 0) return 0;
-		// 30000/100 =     100 * 100 = 10000;
-		size_t sum = 0;
-		for(size_t i = 0; i < steps; ++i){
-			sum += rawBurstBuffer[probe][(currentBufferIndex - 1) % bufferSize - i + bufferSize]; // no need to worry about -ve index!
-		}
-		double totalTimeMs = steps * burstIntervalTimeMs;
-		double rateMs = sum / totalTimeMs;
-		double ratePS = rateMs * 1000;
-		return ratePS;
+		return getBurstRatePSA(probe, windowIntervalMs);
 	}
 
 	inline float getCurrentBurstRatePSA(const size_t& probe, const size_t& windowIntervalMs){
-		const std::lock_guard<std::mutex> lock(mutex);
-		//assert(windowIntervalMs % burstIntervalTimeMs == 0);
-		size_t steps = std::min((size_t)std::floor(windowIntervalMs / burstIntervalTimeMs), bufferSampleCount); // make sure we actually have enough sample windows
+		return getBurstRatePSA(probe, windowIntervalMs);
+	}
+
+	// spikes per second on a probe over the last windowIntervalMs (at most the buffer duration)
+	inline float getBurstRatePSA(const size_t& probe, const size_t& windowIntervalMs){
+		const size_t intervals = bufferSampleCount.load(std::memory_order_acquire);
+		const size_t steps = std::min({windowIntervalMs / burstIntervalTimeMs, intervals, bufferSize - 2}); // make sure we actually have enough sample windows, and the oldest slot isn't being rewritten
 		if(steps == 0) return 0;
-		// 30000/100 =     100 * 100 = 10000;
-		size_t sum = 0;
-		for(size_t i = 0; i < steps; ++i){
-			sum += rawBurstBuffer[probe][(currentBufferIndex - 1) % bufferSize - i + bufferSize]; // no need to worry about -ve index!
+		const double totalTimeMs = steps * burstIntervalTimeMs;
+		return getProbeCount(probe, intervals, intervals - steps) / totalTimeMs * 1000;
+	}
+
+	// all probes at once for the same window, rates must hold numProbes
+	inline void getBurstRatesPSA(const size_t& windowIntervalMs, float* rates){
+		const size_t intervals = bufferSampleCount.load(std::memory_order_acquire);
+		const size_t steps = std::min({windowIntervalMs / burstIntervalTimeMs, intervals, bufferSize - 2});
+		const double totalTimeMs = steps * burstIntervalTimeMs;
+		for(size_t probe = 0; probe < numProbes; ++probe){
+			rates[probe] = steps == 0 ? 0 : getProbeCount(probe, intervals, intervals - steps) / totalTimeMs * 1000;
 		}
-		double totalTimeMs = steps * burstIntervalTimeMs;
-		double rateMs = sum / totalTimeMs;
-		double ratePS = rateMs * 1000;
-		return ratePS;
 	}
 
-	inline float& getLastBurstCount(const size_t& probe){
-		const std::lock_guard<std::mutex> lock(mutex);
-		return rawBurstBuffer[probe][(currentBufferIndex - 1) % bufferSize];
+	// same as above for one sorted unit on a probe, over at most unitBufferDurationMs
+	inline float getCurrentUnitBurstRatePSA(const size_t& probe, const size_t& unit, const size_t& windowIntervalMs){
+		const size_t intervals = bufferSampleCount.load(std::memory_order_acquire);
+		const size_t steps = std::min({windowIntervalMs / burstIntervalTimeMs, intervals, unitBufferSize - 2});
+		if(steps == 0) return 0;
+		const std::atomic<uint64_t>* prefixes = &unitPrefixes[(probe * MAX_SPIKE_UNITS + unit) * unitBufferSize];
+		const uint64_t sum = prefixes[intervals % unitBufferSize].load(std::memory_order_relaxed) - prefixes[(intervals - steps) % unitBufferSize].load(std::memory_order_relaxed);
+		const double totalTimeMs = steps * burstIntervalTimeMs;
+		return sum / totalTimeMs * 1000;
+	}
+
+	inline float getLastBurstCount(const size_t& probe){
+		return getBurstCountAt(probe, getLastIndex());
 	}
 
 	const inline size_t getLastIndex(){
-		const std::lock_guard<std::mutex> lock(mutex);
-		return (currentBufferIndex - 1) % bufferSize;
+		return (currentBufferIndex.load(std::memory_order_acquire) + bufferSize - 1) % bufferSize;
 	}
 
-	const inline size_t& getCurrentIndex(){
-		const std::lock_guard<std::mutex> lock(mutex);
-		return currentBufferIndex;
+	const inline size_t getCurrentIndex(){
+		return currentBufferIndex.load(std::memory_order_acquire);
 	}
 
 	const inline size_t& getWindowSizeMs(){
-		const std::lock_guard<std::mutex> lock(mutex);
 		return burstIntervalTimeMs;
 	}
 
-	const inline size_t& getBufferCount(){
-		const std::lock_guard<std::mutex> lock(mutex);
-		return bufferSampleCount;
+	const inline size_t getBufferCount(){
+		return bufferSampleCount.load(std::memory_order_acquire);
 	}
 
 	const inline size_t& interval(){
-		const std::lock_guard<std::mutex> lock(mutex);
 		return burstIntervalTimeMs;
 	}
 
 	const inline size_t& size(){
-		const std::lock_guard<std::mutex> lock(mutex);
 		return bufferSize;//buffer.size();
 	}
 
 protected:
 
+	// spikes on a probe (numProbes for all of them) between two interval boundaries
+	inline uint64_t getProbeCount(const size_t& probe, const size_t& to, const size_t& from){
+		const std::atomic<uint64_t>* prefixes = &probePrefixes[probe * bufferSize];
+		return prefixes[to % bufferSize].load(std::memory_order_relaxed) - prefixes[from % bufferSize].load(std::memory_order_relaxed);
+	}
+
+	void zeroCounts(){
+		for(size_t i = 0; i < numCounters; ++i) spikeCounts[i].store(0, std::memory_order_relaxed);
+		for(size_t i = 0; i < (numProbes + 1) * bufferSize; ++i) probePrefixes[i].store(0, std::memory_order_relaxed);
+		for(size_t i = 0; i < numProbes * MAX_SPIKE_UNITS * unitBufferSize; ++i) unitPrefixes[i].store(0, std::memory_order_relaxed);
+	}
+
+	// running totals [probe], [numProbes + probe * MAX_SPIKE_UNITS + unit], [total]
+	std::unique_ptr<std::atomic<uint64_t>[]> spikeCounts;
+	size_t numCounters = 0;
+
+	// prefix rings [probe (or numProbes for the total)][interval % bufferSize]
+	std::unique_ptr<std::atomic<uint64_t>[]> probePrefixes;
+
+	// per sorted unit prefix rings [probe * MAX_SPIKE_UNITS + unit][interval % unitBufferSize], only
+	// kept for the last unitBufferDurationMs since there are a lot of them and they aren't plotted
+	std::unique_ptr<std::atomic<uint64_t>[]> unitPrefixes;
+	size_t unitBufferDurationMs = 10000;
+	size_t unitBufferSize = 0;
 
-	std::vector<std::vector<float>> rawBurstBuffer;
 	std::vector<float> rawSPSABuffer;
 
-	size_t currentBufferIndex = 0;
-	size_t bufferSampleCount = 0;
+	std::atomic<size_t> currentBufferIndex = 0;
+	std::atomic<size_t> bufferSampleCount = 0;	// completed intervals
 
 	fu::Timer burstIntervalTimer;
 	size_t burstIntervalTimeMs = 100;
@@ -242,7 +305,8 @@ protected:
 	size_t bufferSize = 0;
 	size_t numProbes = 0;
 
-	bool bIsFrameNew = false;
+	std::atomic_bool bIsFrameNew = false;
+	std::atomic_bool bClearPending = false;	// set by clear(), taken by the clock
 
 	std::mutex mutex;
 
@@ -0,0 +1,126 @@
+//
+//  ClockSync.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <limits>
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+
+// Maps the hardware acquisition clock onto the host's steady clock
+//
+// Feed it (hardware ticks, host time) pairs as frames arrive. Every arrival is the
+// sample time plus however long the transport took, so the smallest host - sample
+// offset seen is the best estimate of the true offset (the NTP minimum filter). The
+// minimum is kept per window and the oldest window is dropped as each new one starts,
+// so drift between the two clocks is followed within numWindows * windowMs.
+//
+// Host times it gives back are therefore when a sample could first have reached the
+// host, latencies measured against them leave out the fixed part of the transport.
+
+class ClockSync{
+
+public:
+
+	void setup(const uint64_t& ticksPerSecond, const size_t& windowMs = 1000, const size_t& numWindows = 8){
+		this->ticksPerSecond = std::max(ticksPerSecond, (uint64_t)1);
+		nsPerTick = 1000000000.0 / this->ticksPerSecond;
+		windowNs = windowMs * 1000000;
+		windowMinimums.assign(std::max(numWindows, (size_t)1), std::numeric_limits<int64_t>::max());
+		reset();
+	}
+
+	void reset(){
+		std::fill(windowMinimums.begin(), windowMinimums.end(), std::numeric_limits<int64_t>::max());
+		currentWindow = 0;
+		windowStartNs = 0;
+		lastTicks = 0;
+		firstTicks = 0;
+		bHasFirstTicks = false;
+		offsetNs = std::numeric_limits<int64_t>::max();
+		numObservations = 0;
+	}
+
+	// one thread only
+	inline void update(const uint64_t& ticks, const int64_t& hostNs){
+
+		if(!bHasFirstTicks || ticks < lastTicks){ // first frame, or the acquisition counter was reset
+			reset();
+			firstTicks = ticks;
+			bHasFirstTicks = true;
+			windowStartNs = hostNs;
+		}
+		lastTicks = ticks;
+
+		if(hostNs - windowStartNs > windowNs){
+			currentWindow = (currentWindow + 1) % windowMinimums.size();
+			windowMinimums[currentWindow] = std::numeric_limits<int64_t>::max();
+			windowStartNs = hostNs;
+		}
+
+		const int64_t offset = hostNs - ticksToNs(ticks);
+		if(offset < windowMinimums[currentWindow]) windowMinimums[currentWindow] = offset;
+
+		offsetNs.store(*std::min_element(windowMinimums.begin(), windowMinimums.end()), std::memory_order_release);
+		++numObservations;
+
+	}
+
+	inline bool isSynced(){
+		return offsetNs.load(std::memory_order_acquire) != std::numeric_limits<int64_t>::max();
+	}
+
+	// host steady clock ns for a hardware time, only meaningful once synced
+	inline int64_t toHostNs(const uint64_t& ticks){
+		return ticksToNs(ticks) + offsetNs.load(std::memory_order_acquire);
+	}
+
+	static inline int64_t getHostNs(){
+		using namespace std::chrono;
+		return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	inline uint64_t getTicksPerSecond(){
+		return ticksPerSecond;
+	}
+
+	inline uint64_t getNumObservations(){
+		return numObservations;
+	}
+
+protected:
+
+	inline int64_t ticksToNs(const uint64_t& ticks){
+		return (int64_t)((int64_t)(ticks - firstTicks.load(std::memory_order_relaxed)) * nsPerTick);
+	}
+
+	uint64_t ticksPerSecond = 250000000;
+	double nsPerTick = 4.0;
+	int64_t windowNs = 1000000000;
+
+	std::vector<int64_t> windowMinimums;
+	size_t currentWindow = 0;
+	int64_t windowStartNs = 0;
+
+	std::atomic<uint64_t> firstTicks = 0;	// keeps the doubles small
+	uint64_t lastTicks = 0;
+	bool bHasFirstTicks = false;
+
+	std::atomic<int64_t> offsetNs = std::numeric_limits<int64_t>::max();
+	uint64_t numObservations = 0;
+
+};
+
+
+} // namespace ONI
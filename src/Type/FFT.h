@@ -0,0 +1,133 @@
+//
+//  FFT.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+
+// Radix-2 complex FFT plan
+//
+// Header only so there's nothing to link. setup() works out the bit reversed order
+// and the twiddles for one power of two size once, forward() and inverse() then run
+// in place without allocating and can be called from any number of threads at once
+// on different data. inverse() isn't scaled, fold the 1 / size in elsewhere (eg., into
+// a kernel spectrum) or use inverseScaled().
+
+class FFT{
+
+public:
+
+	typedef std::complex<float> Complex;
+
+	static inline bool isPowerOfTwo(const size_t& n){
+		return n != 0 && (n & (n - 1)) == 0;
+	}
+
+	static inline size_t nextPowerOfTwo(const size_t& n){
+		size_t p = 1;
+		while(p < n) p <<= 1;
+		return p;
+	}
+
+	void setup(const size_t& size){
+
+		assert(isPowerOfTwo(size), "FFT size must be a power of two");
+		if(!isPowerOfTwo(size)){
+			LOGERROR("FFT size must be a power of two: %i", size);
+			return;
+		}
+
+		this->size = size;
+
+		size_t bits = 0;
+		while(((size_t)1 << bits) < size) ++bits;
+
+		bitReverse.resize(size);
+		for(size_t i = 0; i < size; ++i){
+			size_t r = 0;
+			for(size_t b = 0; b < bits; ++b) if(i & ((size_t)1 << b)) r |= (size_t)1 << (bits - 1 - b);
+			bitReverse[i] = r;
+		}
+
+		// e^(-2 pi i k / size) for k < size / 2, worked out in double so big sizes don't drift
+		twiddles.resize(size / 2);
+		for(size_t k = 0; k < size / 2; ++k){
+			const double angle = -2.0 * 3.14159265358979323846 * k / size;
+			twiddles[k] = Complex((float)std::cos(angle), (float)std::sin(angle));
+		}
+
+	}
+
+	inline void forward(Complex* data) const{
+		transform(data, false);
+	}
+
+	inline void inverse(Complex* data) const{
+		transform(data, true);
+	}
+
+	inline void inverseScaled(Complex* data) const{
+		transform(data, true);
+		const float scale = 1.0f / size;
+		for(size_t i = 0; i < size; ++i) data[i] *= scale;
+	}
+
+	inline size_t getSize() const{
+		return size;
+	}
+
+protected:
+
+	inline void transform(Complex* data, const bool& bInverse) const{
+
+		for(size_t i = 0; i < size; ++i){
+			const size_t j = bitReverse[i];
+			if(i < j) std::swap(data[i], data[j]);
+		}
+
+		// plain float arithmetic rather than std::complex's operator*, which has to check for infs and nans
+		float* d = reinterpret_cast<float*>(data);
+		const float* w = reinterpret_cast<const float*>(twiddles.data());
+		const float sign = bInverse ? -1.0f : 1.0f; // conjugate twiddles for the inverse
+
+		for(size_t length = 2; length <= size; length <<= 1){
+			const size_t half = length / 2;
+			const size_t step = size / length;
+			for(size_t start = 0; start < size; start += length){
+				for(size_t k = 0; k < half; ++k){
+					const float wr = w[2 * k * step];
+					const float wi = sign * w[2 * k * step + 1];
+					float* a = d + 2 * (start + k);
+					float* b = d + 2 * (start + k + half);
+					const float tr = b[0] * wr - b[1] * wi;
+					const float ti = b[0] * wi + b[1] * wr;
+					b[0] = a[0] - tr;
+					b[1] = a[1] - ti;
+					a[0] += tr;
+					a[1] += ti;
+				}
+			}
+		}
+
+	}
+
+	size_t size = 0;
+	std::vector<size_t> bitReverse;
+	std::vector<Complex> twiddles;
+
+};
+
+
+} // namespace ONI
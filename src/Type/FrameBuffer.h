@@ -19,16 +19,25 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <syncstream>
 
 #include "../Type/SettingTypes.h"
 #include "../Type/FrameTypes.h"
+#include "../Type/MirroredBuffer.h"
 #include "../Type/Log.h"
 
 #pragma once
 
 namespace ONI{
 
+// Ring of frames with one writer (the processor thread) and any number of readers.
+//
+// Readers never lock: the writer bumps claimedCount before it overwrites slots and
+// publishedCount once they're written. A reader notes publishedCount, copies what it
+// needs, then checks with endRead that the writer hasn't since claimed any of the
+// slots it copied from. If it has, the copy may be torn and the reader should retry
+// or drop it; read() wraps that loop. Resizing still needs the owner to stop both sides
 
 class FrameBuffer{
 
@@ -38,40 +47,60 @@ public:
 		rawSpikeBuffer.clear();
 	}
 
-	size_t resizeBySamples(const size_t& size, const size_t& step, const size_t& numProbes){
+	// Returns the size the buffer actually got, which is what size() gives from then on.
+	// With bAllowRounding that can be up to 2% more than asked for: if rounding up to
+	// whole pages only costs a few samples it's done, so the buffers can be mirrored and
+	// each sample written once instead of three times. Work out indexes and windows from
+	// size(), not the size asked for, or pass bAllowRounding false to get exactly that
+	size_t resizeBySamples(const size_t& size, const size_t& step, const size_t& numProbes, const bool& bAllowRounding = true){
 
 		rawSpikeBuffer.clear();
 		bufferSize = size;
 		this->numProbes = numProbes;
-		rawSpikeBuffer.resize(bufferSize * 3);
+
+		const size_t granularity = std::lcm(ONI::MirroredBuffer<float>::getGranularity(), ONI::MirroredBuffer<ONI::Frame::Rhs2116MultiFrame>::getGranularity());
+		const size_t mirroredSize = (size + granularity - 1) / granularity * granularity;
+		if(bAllowRounding && ONI::MirroredBuffer<float>::canMirror(mirroredSize) && mirroredSize - size <= size / 50) bufferSize = mirroredSize;
+		if(bufferSize != size) LOGDEBUG("FrameBuffer of %i samples rounded up to %i so it can be mirrored", (int)size, (int)bufferSize);
+
+		rawSpikeBuffer.resize(bufferSize);
 
 		acProbeVoltages.resize(numProbes);
 		dcProbeVoltages.resize(numProbes);
 		stimProbeData.resize(numProbes);
 		spikeProbeData.resize(numProbes);
 
+		runningMean.assign(numProbes, 0.0);
+		runningM2.assign(numProbes, 0.0);
+		noiseHistogram.assign(numProbes * NOISE_HISTOGRAM_BINS, 0);
+
 		for(size_t probe = 0; probe < numProbes; ++probe) {
-			acProbeVoltages[probe].resize(bufferSize * 3);
-			dcProbeVoltages[probe].resize(bufferSize * 3);
-			stimProbeData[probe].resize(bufferSize * 3);
-			spikeProbeData[probe].assign(bufferSize * 3, -10);
+			acProbeVoltages[probe].resize(bufferSize);
+			dcProbeVoltages[probe].resize(bufferSize);
+			stimProbeData[probe].resize(bufferSize);
+			spikeProbeData[probe].assign(bufferSize, -10);
 		}
 
 		this->bufferSampleRateStep = step;
 		currentBufferIndex = 0;
 		bufferSampleCount = 0;
+		claimedCount = 0;
+		publishedCount = 0;
+		readCount = 0;
+		readRetryCount = 0;
 		bIsFrameNew = false;
 		millisPerStep = step * framesPerMillis;
 		return bufferSize;
 
 	}
 
-	size_t resizeByMillis(const int& bufferSizeMillis, const int& bufferStepMillis,const size_t& numProbes){
+	// as resizeBySamples, so the size may be rounded up too
+	size_t resizeByMillis(const int& bufferSizeMillis, const int& bufferStepMillis,const size_t& numProbes, const bool& bAllowRounding = true){
 
 		size_t bufferStepFrameSize = bufferStepMillis / framesPerMillis;
 		if(bufferStepMillis == 0) bufferStepFrameSize = 1;
 		size_t bufferFrameSizeRequired = bufferSizeMillis / framesPerMillis / bufferStepFrameSize;
-		return resizeBySamples(bufferFrameSizeRequired, bufferStepFrameSize, numProbes);
+		return resizeBySamples(bufferFrameSizeRequired, bufferStepFrameSize, numProbes, bAllowRounding);
 	}
 
 	void clear(){
@@ -83,57 +112,170 @@ public:
 	}
 
 	inline bool push(const ONI::Frame::Rhs2116MultiFrame& dataFrame){
-		//const std::lock_guard<std::mutex> lock(mutex);
+		const size_t sampleCount = bufferSampleCount.load(std::memory_order_relaxed);
+		bufferSampleCount.store(sampleCount + 1, std::memory_order_relaxed);
 
-		if(bufferSampleCount % bufferSampleRateStep == 0){
+		if(sampleCount % bufferSampleRateStep == 0){
 
-			rawSpikeBuffer[currentBufferIndex] = rawSpikeBuffer[currentBufferIndex + bufferSize] = rawSpikeBuffer[currentBufferIndex + bufferSize * 2] = dataFrame;
+			const uint64_t count = publishedCount.load(std::memory_order_relaxed) + 1;
+			claim(count);
 
-			for (size_t probe = 0; probe < numProbes; ++probe) {
-
-				acProbeVoltages[probe][currentBufferIndex] = dataFrame.ac_uV[probe]; //0.195f * (frames1[frame].ac[probe     ] - 32768) / 1000.0f; // 0.195 uV  (ADC result  32768) divide by 1000 for mV?
-				dcProbeVoltages[probe][currentBufferIndex] = dataFrame.dc_mV[probe]; //-19.23 * (frames1[frame].dc[probe     ] - 512) / 1000.0f;   // -19.23 mV  (ADC result  512) divide by 1000 for V?
-				stimProbeData[probe][currentBufferIndex] = (float)dataFrame.stimulation; //frameBuffer[frame].stim ? 8.0f : 0.0f;
-				//spikeProbeData[probe][currentBufferIndex] = -10;// (float)(64 - probe) * 10.0;// dataFrame.spikes[probe] ? (float)(64 - probe) * 10.0 : -10.0f;
-				//if(spikeProbeData[probe][currentBufferIndex] && currentBufferIndex > 0) spikeProbeData[probe][currentBufferIndex - 1] = spikeProbeData[probe][currentBufferIndex];
+			rawSpikeBuffer.write(currentBufferIndex, dataFrame);
 
-				acProbeVoltages[probe][currentBufferIndex + bufferSize] = acProbeVoltages[probe][currentBufferIndex + bufferSize * 2] = acProbeVoltages[probe][currentBufferIndex];
-				dcProbeVoltages[probe][currentBufferIndex + bufferSize] = dcProbeVoltages[probe][currentBufferIndex + bufferSize * 2] = dcProbeVoltages[probe][currentBufferIndex];
-				stimProbeData[probe][currentBufferIndex + bufferSize] = stimProbeData[probe][currentBufferIndex + bufferSize * 2] = stimProbeData[probe][currentBufferIndex];
-				//spikeProbeData[probe][currentBufferIndex + bufferSize] = spikeProbeData[probe][currentBufferIndex + bufferSize * 2] = spikeProbeData[probe][currentBufferIndex];
+			if(bTrackStatistics) for(size_t probe = 0; probe < numProbes; ++probe) updateStatistics(probe, count, dataFrame.ac_uV[probe]);
 
+			for (size_t probe = 0; probe < numProbes; ++probe) {
+				acProbeVoltages[probe].write(currentBufferIndex, dataFrame.ac_uV[probe]);
+				dcProbeVoltages[probe].write(currentBufferIndex, dataFrame.dc_mV[probe]);
+				stimProbeData[probe].write(currentBufferIndex, (float)dataFrame.stimulation);
 			}
 
 			currentBufferIndex = (currentBufferIndex + 1) % bufferSize;
 
+			publishedCount.store(count, std::memory_order_release);
 			bIsFrameNew = true;
-			++bufferSampleCount;
 			return true;
 		}
-		++bufferSampleCount;
 		return false;
 	}
 
+	// pushes every bufferSampleRateStep'th sample of the block, same as calling push per frame
+	inline size_t push(const ONI::Frame::MultiFrameBlock& block){
+
+		size_t sampleCount = bufferSampleCount.load(std::memory_order_relaxed);
+		bufferSampleCount.store(sampleCount + block.size(), std::memory_order_relaxed);
+
+		// claim every slot this block is going to write up front
+		const size_t first = (sampleCount + bufferSampleRateStep - 1) / bufferSampleRateStep;
+		const size_t last = (sampleCount + block.size() + bufferSampleRateStep - 1) / bufferSampleRateStep;
+		if(last == first) return 0;
+
+		const uint64_t count = publishedCount.load(std::memory_order_relaxed) + (last - first);
+		claim(count);
+
+		size_t numPushed = 0;
+
+		for(size_t i = 0; i < block.size(); ++i){
+
+			if(sampleCount % bufferSampleRateStep == 0){
+
+				block.getFrame(i, rawSpikeBuffer[currentBufferIndex]);
+				if(!rawSpikeBuffer.isMirrored()) rawSpikeBuffer.write(currentBufferIndex, rawSpikeBuffer[currentBufferIndex]);
+
+				const float stim = (float)block.stimulation[i];
+
+				if(bTrackStatistics){
+					const uint64_t slotCount = count - (last - first) + numPushed + 1;
+					for(size_t probe = 0; probe < numProbes; ++probe) updateStatistics(probe, slotCount, block.ac(probe)[i]);
+				}
+
+				for(size_t probe = 0; probe < numProbes; ++probe){
+					acProbeVoltages[probe].write(currentBufferIndex, block.ac(probe)[i]);
+					dcProbeVoltages[probe].write(currentBufferIndex, block.dc(probe)[i]);
+					stimProbeData[probe].write(currentBufferIndex, stim);
+				}
+
+				currentBufferIndex = (currentBufferIndex + 1) % bufferSize;
+				++numPushed;
+
+			}
+
+			++sampleCount;
+
+		}
+
+		publishedCount.store(count, std::memory_order_release);
+		bIsFrameNew = true;
+
+		return numPushed;
+	}
+
 	inline void setSpike(const size_t& idx, const size_t& probe, const bool& b){
-		spikeProbeData[probe][idx] = b ? (float)(64 - probe) * 10.0 : -10.0f;
-		spikeProbeData[probe][idx + bufferSize] = spikeProbeData[probe][idx + bufferSize * 2] = spikeProbeData[probe][idx];
+		spikeProbeData[probe].write(idx, b ? (float)(64 - probe) * 10.0 : -10.0f);
 	}
 
 	inline bool isFrameNew(const bool& reset = true){ // should I really auto reset? means it can only be called once per cycle
-		//const std::lock_guard<std::mutex> lock(mutex);
-		if(bIsFrameNew){
-			if(reset) bIsFrameNew = false;
-			return true;
+		if(reset) return bIsFrameNew.exchange(false, std::memory_order_acq_rel);
+		return bIsFrameNew.load(std::memory_order_acquire);
+	}
+
+	// number of slots written and visible to readers, the write head is this % size()
+	inline uint64_t beginRead() const {
+		return publishedCount.load(std::memory_order_acquire);
+	}
+
+	// true if nothing from samplesBack slots behind the head noted in beginRead
+	// up to that head has been overwritten while we were reading it
+	inline bool endRead(const uint64_t& fromPublishedCount, const size_t& samplesBack){
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t claimed = claimedCount.load(std::memory_order_relaxed);
+		readCount.fetch_add(1, std::memory_order_relaxed);
+		if(claimed - fromPublishedCount + samplesBack > bufferSize){
+			readRetryCount.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	// calls readFunc(from) with the index of the sample samplesBack behind the
+	// head (the get*Raw functions take negative indices) until it reads cleanly
+	template<typename ReadFunc>
+	inline bool read(const size_t& samplesBack, ReadFunc&& readFunc, const size_t& maxAttempts = 4){
+		if(bufferSize == 0 || samplesBack > bufferSize) return false;
+		for(size_t attempt = 0; attempt < maxAttempts; ++attempt){
+			const uint64_t fromPublishedCount = beginRead();
+			readFunc((int)(fromPublishedCount % bufferSize) - (int)samplesBack);
+			if(endRead(fromPublishedCount, samplesBack)) return true;
 		}
 		return false;
 	}
 
+	// keep a running mean and variance of the ac voltages over whatever is in the
+	// buffer, updated as samples go in and out rather than recomputed from scratch.
+	// bTrackRobust also keeps a histogram of |voltage| so we can read off the median
+	inline void setTrackStatistics(const bool& bTrack, const bool& bTrackRobust = true){
+		bTrackStatistics = bTrack;
+		bTrackRobustStatistics = bTrack && bTrackRobust;
+		noiseHistogram.assign(numProbes * NOISE_HISTOGRAM_BINS, 0);
+		if(bTrackRobustStatistics){ // catch up with whatever is in the buffer already
+			const size_t N = std::min((size_t)publishedCount.load(std::memory_order_relaxed), bufferSize);
+			for(size_t probe = 0; probe < numProbes; ++probe){
+				for(size_t i = 0; i < N; ++i) ++noiseHistogram[probe * NOISE_HISTOGRAM_BINS + getNoiseBin(acProbeVoltages[probe][i])];
+			}
+		}
+	}
+
+	// writer thread only (call it between pushes), O(1) per probe
+	inline void getStatistics(std::vector<ONI::Frame::ProbeStatistics>& stats){
+		if(stats.size() != numProbes) stats.resize(numProbes);
+		const double N = (double)std::min((size_t)publishedCount.load(std::memory_order_relaxed), bufferSize);
+		for(size_t probe = 0; probe < numProbes; ++probe){
+			stats[probe].mean = runningMean[probe];
+			stats[probe].sum = runningMean[probe] * N;
+			stats[probe].std = runningM2[probe];
+			stats[probe].variance = N > 0 ? runningM2[probe] / N : 0; // population deviation, same as the old full recompute
+			stats[probe].deviation = std::sqrt(stats[probe].variance);
+			if(bTrackRobustStatistics){
+				stats[probe].mad = getNoiseMedian(probe, N);
+				stats[probe].robustDeviation = stats[probe].mad / 0.6745f;
+			}
+		}
+	}
+
+	inline uint64_t getReadCount() const {
+		return readCount.load(std::memory_order_relaxed);
+	}
+
+	inline uint64_t getReadRetryCount() const {
+		return readRetryCount.load(std::memory_order_relaxed);
+	}
+
 	inline void copySortedBuffer(std::vector<ONI::Frame::Rhs2116MultiFrame>& to){
 		if (to.size() != bufferSize) to.resize(bufferSize);
-		std::memcpy(&to[0], &rawSpikeBuffer[currentBufferIndex], sizeof(ONI::Frame::Rhs2116MultiFrame) * bufferSize);
+		std::memcpy(&to[0], &rawSpikeBuffer[getCurrentIndex()], sizeof(ONI::Frame::Rhs2116MultiFrame) * bufferSize);
 	}
 
-	inline std::vector<ONI::Frame::Rhs2116MultiFrame>& getUnderlyingBuffer(){ // this actually returns the whole buffer which is 3 times larger than needed
+	inline ONI::MirroredBuffer<ONI::Frame::Rhs2116MultiFrame>& getUnderlyingBuffer(){ // this actually returns the whole buffer which is 3 times larger than needed
 		//const std::lock_guard<std::mutex> lock(mutex);
 		return rawSpikeBuffer;
 	}
@@ -172,13 +314,12 @@ public:
 	}
 
 	const inline size_t getLastIndex(){
-	//const std::lock_guard<std::mutex> lock(mutex);
-		return (currentBufferIndex - 1) % bufferSize;
+		return (getCurrentIndex() + bufferSize - 1) % bufferSize;
 	}
 
-	const inline size_t& getCurrentIndex(){
-		//const std::lock_guard<std::mutex> lock(mutex);
-		return currentBufferIndex;
+	const inline size_t getCurrentIndex(){
+		if(bufferSize == 0) return 0;
+		return beginRead() % bufferSize;
 	}
 
 	const inline size_t& getStep(){
@@ -186,11 +327,11 @@ public:
 		return bufferSampleRateStep;
 	}
 
-	const inline size_t& getBufferCount(){
-		//const std::lock_guard<std::mutex> lock(mutex);
-		return bufferSampleCount;
+	const inline size_t getBufferCount(){
+		return bufferSampleCount.load(std::memory_order_relaxed);
 	}
 
+	// slots in the ring as resized, which may be a little more than asked for (see resizeBySamples)
 	const inline size_t& size(){
 		//const std::lock_guard<std::mutex> lock(mutex);
 		return bufferSize;//buffer.size();
@@ -200,24 +341,110 @@ public:
 		return millisPerStep;
 	}
 
+	inline bool isMirrored(){
+		return rawSpikeBuffer.isMirrored() && (numProbes == 0 || acProbeVoltages[0].isMirrored());
+	}
+
 protected:
 
-	std::vector< std::vector<float> > acProbeVoltages;
-	std::vector< std::vector<float> > dcProbeVoltages;
-	std::vector< std::vector<float> > stimProbeData;
-	std::vector< std::vector<float> > spikeProbeData;
+	// sliding Welford: while the buffer fills it's the usual running update, once
+	// it's full the incoming sample replaces the one in the slot it overwrites
+	inline void updateStatistics(const size_t& probe, const uint64_t& slotCount, const float& sample){
+
+		double& mean = runningMean[probe];
+		double& M2 = runningM2[probe];
+		const double x = sample;
+
+		if(slotCount <= bufferSize){
+			const double delta = x - mean;
+			mean += delta / (double)slotCount;
+			M2 += delta * (x - mean);
+			if(bTrackRobustStatistics) ++noiseHistogram[probe * NOISE_HISTOGRAM_BINS + getNoiseBin(sample)];
+		}else{
+			const float oldSample = acProbeVoltages[probe][currentBufferIndex];
+			const double old = oldSample;
+			const double oldMean = mean;
+			mean += (x - old) / (double)bufferSize;
+			M2 += (x - old) * (x - mean + old - oldMean);
+			if(M2 < 0) M2 = 0;
+			if(bTrackRobustStatistics){
+				--noiseHistogram[probe * NOISE_HISTOGRAM_BINS + getNoiseBin(oldSample)];
+				++noiseHistogram[probe * NOISE_HISTOGRAM_BINS + getNoiseBin(sample)];
+			}
+		}
+
+	}
+
+	// |voltage| histogram bins are the float exponent plus the top 4 mantissa bits, so
+	// 16 log spaced bins per octave (~4.4% wide) from 2^-22 to 2^10 without calling log
+	static constexpr size_t NOISE_HISTOGRAM_BINS = 512;
+	static constexpr int NOISE_HISTOGRAM_BIN_OFFSET = (127 - 22) << 4;
+
+	static inline size_t getNoiseBin(const float& sample){
+		const float a = std::fabs(sample);
+		uint32_t bits; std::memcpy(&bits, &a, sizeof(float));
+		const int bin = (int)(bits >> 19) - NOISE_HISTOGRAM_BIN_OFFSET;
+		return (size_t)std::clamp(bin, 0, (int)NOISE_HISTOGRAM_BINS - 1);
+	}
+
+	static inline float getNoiseBinEdge(const size_t& bin){
+		if(bin == 0) return 0.0f;
+		const uint32_t bits = (uint32_t)(bin + NOISE_HISTOGRAM_BIN_OFFSET) << 19;
+		float edge; std::memcpy(&edge, &bits, sizeof(float));
+		return edge;
+	}
+
+	// walk the histogram to the middle sample and interpolate inside its bin
+	inline float getNoiseMedian(const size_t& probe, const double& N){
+		if(N <= 0) return 0.0f;
+		const uint32_t* histogram = &noiseHistogram[probe * NOISE_HISTOGRAM_BINS];
+		const double half = N / 2.0;
+		double count = 0;
+		for(size_t bin = 0; bin < NOISE_HISTOGRAM_BINS; ++bin){
+			if(histogram[bin] == 0) continue;
+			if(count + histogram[bin] >= half){
+				const float lo = getNoiseBinEdge(bin);
+				const float hi = getNoiseBinEdge(bin + 1);
+				return lo + (hi - lo) * (float)((half - count) / histogram[bin]);
+			}
+			count += histogram[bin];
+		}
+		return getNoiseBinEdge(NOISE_HISTOGRAM_BINS);
+	}
+
+	inline void claim(const uint64_t& count){
+		claimedCount.store(count, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release); // readers that see our writes must see the claim
+	}
 
-	std::vector<ONI::Frame::Rhs2116MultiFrame> rawSpikeBuffer;
+	std::vector< ONI::MirroredBuffer<float> > acProbeVoltages;
+	std::vector< ONI::MirroredBuffer<float> > dcProbeVoltages;
+	std::vector< ONI::MirroredBuffer<float> > stimProbeData;
+	std::vector< ONI::MirroredBuffer<float> > spikeProbeData;
 
-	size_t currentBufferIndex = 0;
-	size_t bufferSampleCount = 0;
+	ONI::MirroredBuffer<ONI::Frame::Rhs2116MultiFrame> rawSpikeBuffer;
+
+	size_t currentBufferIndex = 0; // writer only, readers use getCurrentIndex
+	std::atomic<size_t> bufferSampleCount = 0;
 	size_t bufferSampleRateStep = 0;
 
+	std::atomic<uint64_t> claimedCount = 0;
+	std::atomic<uint64_t> publishedCount = 0;
+
+	std::atomic<uint64_t> readCount = 0;
+	std::atomic<uint64_t> readRetryCount = 0;
+
+	bool bTrackStatistics = false;
+	bool bTrackRobustStatistics = false;
+	std::vector<double> runningMean;
+	std::vector<double> runningM2;
+	std::vector<uint32_t> noiseHistogram;
+
 	size_t bufferSize = 0;
 	size_t numProbes = 0;
 	float millisPerStep = 0;
 
-	bool bIsFrameNew = false;
+	std::atomic<bool> bIsFrameNew = false;
 
 };
 
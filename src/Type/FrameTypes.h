@@ -22,9 +22,11 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <bitset>
 #include <syncstream>
 
 #include "../Type/Log.h"
+#include "../Type/SimdTypes.h"
 
 #pragma once
 
@@ -72,6 +74,8 @@ struct ProbeStatistics{
 	float std = 0;
 	float variance = 0;
 	float deviation = 0;
+	float mad = 0;				// median absolute voltage
+	float robustDeviation = 0;	// mad / 0.6745, the deviation gaussian noise with that mad would have
 };
 
 
@@ -106,6 +110,21 @@ struct Rhs2116DataRaw{
 };
 #pragma pack(pop)
 
+// byte offsets used to gather samples straight out of packed device frames
+constexpr int32_t RHS2116_AC_BYTE_OFFSET = offsetof(Rhs2116DataExtended, ac);
+constexpr int32_t RHS2116_DC_BYTE_OFFSET = offsetof(Rhs2116DataExtended, dc) - offsetof(Rhs2116DataExtended, ac); // relative to the ac sample
+
+#define ONI_RING_FRAME_MAX_DATA 128
+
+// same leading layout as oni_frame_t so a slot can be handed straight to device->process
+struct RingFrame{
+	uint64_t time;
+	uint32_t dev_idx;
+	uint32_t data_sz;
+	char* data;
+	char payload[ONI_RING_FRAME_MAX_DATA];
+};
+
 
 class Rhs2116Frame : public ONI::Frame::BaseFrame{
 
@@ -164,10 +183,14 @@ public:
 
 
 
+class MultiFrameBlock;
+
 class Rhs2116MultiFrame : public ONI::Frame::BaseFrame{
 
 public:
 
+	friend class ONI::Frame::MultiFrameBlock;
+
 	Rhs2116MultiFrame(){ 
 		numProbes = 0;
 		for(size_t i = 0; i < MAX_NUM_MULTIPROBES; ++i){
@@ -207,6 +230,7 @@ public:
 		this->deviceTableID = 999;
 	}
 
+	// scalar reference path, kept for the conversion benchmark in Rhs2116MultiProcessor
 	inline void convert(const std::vector<ONI::Frame::Rhs2116DataExtended>& frames, const std::vector<size_t>& channelMap){
 
 		numProbes = frames.size() * 16;
@@ -232,26 +256,29 @@ public:
 		this->acqTime = frames[0].acqTime;					 // copy the acquisition clock from the first device?? maybe set sync time?
 		this->deltaTime = frames[0].deltaTime;
 		this->deviceTableID = frames[0].devIdx;
+		this->stimulation = false; // frames get re-used in blocks so clear anything left by the stim processor
+
+	}
+
+	// converts and channel maps in one pass; gatherOffsets come from ChannelMapProcessor::getGatherOffsets
+	inline void convert(const ONI::Frame::Rhs2116DataExtended* frames, const size_t& numFrames, const std::vector<int32_t>& gatherOffsets, const ONI::Simd::InstructionSet& instructionSet = ONI::Simd::getInstructionSet()){
+
+		numProbes = numFrames * 16;
+		assert(gatherOffsets.size() >= numProbes, "Gather offsets don't match the number of probes");
+
+		ONI::Simd::gatherRhs2116(reinterpret_cast<const uint8_t*>(frames), gatherOffsets.data(), RHS2116_DC_BYTE_OFFSET, numProbes, ac_uV, dc_mV, instructionSet);
+
+		this->acqTime = frames[0].acqTime;
+		this->deltaTime = frames[0].deltaTime;
+		this->deviceTableID = frames[0].devIdx;
+		this->stimulation = false;
 
 	}
 
 	float ac_uV[MAX_NUM_MULTIPROBES];
 	float dc_mV[MAX_NUM_MULTIPROBES];
 	bool stimulation = false;
-	std::vector<bool> spikes;
-
-	// copy assignment (copy-and-swap idiom)
-	Rhs2116MultiFrame& Rhs2116MultiFrame::operator=(Rhs2116MultiFrame other) noexcept{
-		std::swap(deltaTime, other.deltaTime);
-		std::swap(acqTime, other.acqTime);
-		std::swap(deviceTableID, other.deviceTableID);
-		std::swap(numProbes, other.numProbes);
-		std::swap(ac_uV, other.ac_uV);
-		std::swap(dc_mV, other.dc_mV);
-		std::swap(stimulation, other.stimulation);
-		std::swap(spikes, other.spikes);
-		return *this;
-	}
+	std::bitset<MAX_NUM_MULTIPROBES> spikes; // fixed size so the frame stays plain data and copies without allocating
 
 	inline bool operator==(const ONI::Frame::Rhs2116MultiFrame& other){ 
 		for(size_t probe = 0; probe < numProbes; ++probe){
@@ -268,6 +295,136 @@ public:
 
 
 
+// Structure of arrays block of multi frames
+//
+// Holds numSamples x numProbes stored channel major: each probe's ac and dc
+// samples sit in their own contiguous, 32 byte aligned lane (probe * stride),
+// with timestamps, stim flags and spike bits in parallel per sample arrays.
+// This is what flows down the processor chain from Rhs2116MultiProcessor;
+// getFrame/setFrame exist for code that still wants one Rhs2116MultiFrame at a time
+
+class MultiFrameBlock{
+
+public:
+
+	MultiFrameBlock(){};
+	MultiFrameBlock(const size_t& capacity, const size_t& numProbes){ resize(capacity, numProbes); };
+
+	// lanes are addressed through an alignment offset into the storage, so copying
+	// would need re-aligning; blocks are only ever moved or worked on in place
+	MultiFrameBlock(const MultiFrameBlock&) = delete;
+	MultiFrameBlock& operator=(const MultiFrameBlock&) = delete;
+	MultiFrameBlock(MultiFrameBlock&&) = default;
+	MultiFrameBlock& operator=(MultiFrameBlock&&) = default;
+
+	void resize(const size_t& capacity, const size_t& numProbes){
+		this->blockCapacity = capacity;
+		this->numProbes = numProbes;
+		this->stride = (capacity + 7) & ~(size_t)7; // whole 8 float lanes so every probe starts 32 byte aligned
+		acStorage.assign(stride * numProbes + 8, 0.0f);
+		dcStorage.assign(stride * numProbes + 8, 0.0f);
+		acAlign = alignOffset(acStorage.data());
+		dcAlign = alignOffset(dcStorage.data());
+		acqTime.assign(capacity, 0);
+		deltaTime.assign(capacity, 0);
+		stimulation.assign(capacity, 0);
+		spikes.assign(capacity, std::bitset<MAX_NUM_MULTIPROBES>());
+		numSamples = 0;
+	}
+
+	inline float* ac(const size_t& probe){ return acStorage.data() + acAlign + probe * stride; };
+	inline float* dc(const size_t& probe){ return dcStorage.data() + dcAlign + probe * stride; };
+	inline const float* ac(const size_t& probe) const { return acStorage.data() + acAlign + probe * stride; };
+	inline const float* dc(const size_t& probe) const { return dcStorage.data() + dcAlign + probe * stride; };
+
+	inline const size_t& size() const { return numSamples; };
+	inline const size_t& capacity() const { return blockCapacity; };
+	inline const size_t& getNumProbes() const { return numProbes; };
+	inline const size_t& getStride() const { return stride; };
+	inline bool isFull() const { return numSamples == blockCapacity; };
+	inline const uint64_t& getAcquisitionTime(const size_t& i) const { return acqTime[i]; };
+
+	inline void clear(){ numSamples = 0; };
+
+	// converts numSamples rows of numDevices ordered device frames in one go; gatherOffsets
+	// come from ChannelMapProcessor::getGatherOffsets (see Rhs2116MultiFrame::convert)
+	inline void convert(const ONI::Frame::Rhs2116DataExtended* frames, const size_t& numDevices, const size_t& numSamples, const std::vector<int32_t>& gatherOffsets, const ONI::Simd::InstructionSet& instructionSet = ONI::Simd::getInstructionSet()){
+
+		assert(numSamples <= blockCapacity && numDevices * 16 <= numProbes, "Block too small for frames");
+
+		ONI::Simd::gatherRhs2116Block(reinterpret_cast<const uint8_t*>(frames), sizeof(ONI::Frame::Rhs2116DataExtended) * numDevices, numSamples, gatherOffsets.data(), RHS2116_DC_BYTE_OFFSET, numDevices * 16, stride, ac(0), dc(0), instructionSet);
+
+		for(size_t i = 0; i < numSamples; ++i){
+			const ONI::Frame::Rhs2116DataExtended& frame = frames[i * numDevices]; // clocks from the first device like Rhs2116MultiFrame
+			acqTime[i] = frame.acqTime;
+			deltaTime[i] = frame.deltaTime;
+			stimulation[i] = 0;
+			spikes[i].reset();
+		}
+
+		this->deviceTableID = frames[0].devIdx;
+		this->numSamples = numSamples;
+
+	}
+
+	inline void getFrame(const size_t& i, ONI::Frame::Rhs2116MultiFrame& frame) const {
+		for(size_t probe = 0; probe < numProbes; ++probe){
+			frame.ac_uV[probe] = ac(probe)[i];
+			frame.dc_mV[probe] = dc(probe)[i];
+		}
+		frame.stimulation = stimulation[i];
+		frame.spikes = spikes[i];
+		frame.numProbes = numProbes;
+		frame.acqTime = acqTime[i];
+		frame.deltaTime = deltaTime[i];
+		frame.deviceTableID = deviceTableID;
+	}
+
+	inline void setFrame(const size_t& i, const ONI::Frame::Rhs2116MultiFrame& frame){
+		for(size_t probe = 0; probe < numProbes; ++probe){
+			ac(probe)[i] = frame.ac_uV[probe];
+			dc(probe)[i] = frame.dc_mV[probe];
+		}
+		stimulation[i] = frame.stimulation;
+		spikes[i] = frame.spikes;
+		acqTime[i] = frame.getAcquisitionTime();
+		deltaTime[i] = frame.getDeltaTime();
+	}
+
+	inline bool push(const ONI::Frame::Rhs2116MultiFrame& frame){
+		if(numSamples == blockCapacity) return false;
+		setFrame(numSamples, frame);
+		deviceTableID = frame.deviceTableID;
+		++numSamples;
+		return true;
+	}
+
+	std::vector<uint64_t> acqTime;
+	std::vector<uint64_t> deltaTime;
+	std::vector<uint8_t> stimulation;
+	std::vector< std::bitset<MAX_NUM_MULTIPROBES> > spikes;
+	uint32_t deviceTableID = 0;
+
+protected:
+
+	static inline size_t alignOffset(const float* ptr){
+		return ((32 - (reinterpret_cast<uintptr_t>(ptr) & 31)) & 31) / sizeof(float);
+	}
+
+	std::vector<float> acStorage;
+	std::vector<float> dcStorage;
+	size_t acAlign = 0;
+	size_t dcAlign = 0;
+
+	size_t numSamples = 0;
+	size_t blockCapacity = 0;
+	size_t numProbes = 0;
+	size_t stride = 0;
+
+};
+
+
+
 class HeartBeatFrame : public ONI::Frame::BaseFrame{
 
 public:
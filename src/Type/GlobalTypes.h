@@ -17,11 +17,17 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <syncstream>
 #include <filesystem>
-#include <timeapi.h>
 #include <limits.h>
+#ifdef _WIN32
+#include <timeapi.h>
 #include <windows.h>     ////GetModuleFileNameW
+#else
+#include <unistd.h>      ////readlink
+#endif
 
 //#include "../Processor/BaseProcessor.h"
 //#include "../Device/BaseDevice.h"
@@ -52,11 +58,22 @@ inline double rhs2116SamplesToMillis(const uint64_t& samples){
 	return std::floor(RHS2116_MS_PER_SAMPLE * samples);
 }
 
+// Longest spike waveform we can capture, it's stored inline in each Spike so
+// spikes are plain records that can be copied around without allocating
+constexpr size_t MAX_SPIKE_WAVEFORM_SAMPLES = 256; // ~8.5 ms
+constexpr size_t MAX_SPIKE_FEATURES = 8;
+constexpr size_t MAX_SPIKE_UNITS = 8; // templates the spike sorter keeps per probe
+constexpr size_t MAX_CLOSED_LOOP_RULES = 8;
+constexpr size_t MAX_CLOSED_LOOP_SPIKES = 64; // most spikes a closed loop rule can count
+constexpr size_t MAX_ARTIFACT_TEMPLATE_SAMPLES = 3072; // ~100 ms of stim artifact template per probe
+
 struct Spike{
 
 	size_t probe = 0;
-	std::vector<float> rawWaveform;
+	float rawWaveform[MAX_SPIKE_WAVEFORM_SAMPLES] = {};
+	size_t rawWaveformLength = 0;
 	size_t acquisitionTimeHardware = 0;
+	uint64_t crossingTimeHardware = 0; // acquisition time of the sample that crossed the threshold
 	uint64_t acquisitionTimeWallNs = 0;
 	uint64_t acquisitionTimeHiResNs = 0;
 	size_t maxSampleIndex = 0;
@@ -64,38 +81,39 @@ struct Spike{
 	float minVoltage = INFINITY;
 	float maxVoltage = -INFINITY;
 	bool bStimFrame = false;
-
-		// copy assignment (copy-and-swap idiom)
-	Spike& Spike::operator=(Spike other) noexcept{
-		std::swap(probe, other.probe);
-		std::swap(rawWaveform, other.rawWaveform);
-		std::swap(acquisitionTimeHardware, other.acquisitionTimeHardware);
-		std::swap(acquisitionTimeWallNs, other.acquisitionTimeWallNs);
-		std::swap(acquisitionTimeHiResNs, other.acquisitionTimeHiResNs);
-		std::swap(maxSampleIndex, other.maxSampleIndex);
-		std::swap(minSampleIndex, other.minSampleIndex);
-		std::swap(minVoltage, other.minVoltage);
-		std::swap(maxVoltage, other.maxVoltage);
-		std::swap(bStimFrame, other.bStimFrame);
-		return *this;
-	}
+	float features[MAX_SPIKE_FEATURES] = {}; // principal component scores, see SpikeFeatureExtractor
+	size_t numFeatures = 0;
+	int unitID = -1; // template the SpikeSorterProcessor matched on this probe, -1 if unsorted
 
 };
 
 inline bool operator==(const Spike& lhs, const Spike& rhs){
 	return (lhs.probe == rhs.probe &&
-			lhs.rawWaveform == rhs.rawWaveform &&
+			lhs.rawWaveformLength == rhs.rawWaveformLength &&
+			std::equal(lhs.rawWaveform, lhs.rawWaveform + lhs.rawWaveformLength, rhs.rawWaveform) &&
 			lhs.acquisitionTimeHardware == rhs.acquisitionTimeHardware &&
+			lhs.crossingTimeHardware == rhs.crossingTimeHardware &&
 			lhs.acquisitionTimeWallNs == rhs.acquisitionTimeWallNs &&
 			lhs.acquisitionTimeHiResNs == rhs.acquisitionTimeHiResNs &&
 			lhs.maxSampleIndex == rhs.maxSampleIndex &&
 			lhs.minSampleIndex == rhs.minSampleIndex &&
 			lhs.minVoltage == rhs.minVoltage &&
 			lhs.maxVoltage == rhs.maxVoltage &&
-			lhs.bStimFrame == rhs.bStimFrame);
+			lhs.bStimFrame == rhs.bStimFrame &&
+			lhs.numFeatures == rhs.numFeatures &&
+			std::equal(lhs.features, lhs.features + lhs.numFeatures, rhs.features) &&
+			lhs.unitID == rhs.unitID);
 }
 inline bool operator!=(const Spike& lhs, const Spike& rhs) { return !(lhs == rhs); }
 
+// fixed size entry written to the spike stream of a recording
+struct SpikeRecord{
+	uint64_t acquisitionTimeHardware = 0;
+	uint64_t acquisitionTimeWallNs = 0;
+	uint32_t probe = 0;
+	int32_t unitID = -1;
+};
+
 
 class Context; // predeclare for friend access
 
@@ -121,11 +139,18 @@ static std::string GetTimeStamp(){
 
 // see: https://stackoverflow.com/questions/1528298/get-path-of-executable
 static std::string GetExecutableDataPath(){
+#ifdef _WIN32
 	wchar_t path[MAX_PATH] = {0};
 	GetModuleFileNameW(NULL, path, MAX_PATH);
 	std::wstring ws(path);
 	std::string path_string(ws.begin(), ws.end());
 	size_t slash = path_string.find_last_of("\\");
+#else
+	char path[PATH_MAX] = {0};
+	ssize_t length = readlink("/proc/self/exe", path, PATH_MAX - 1);
+	std::string path_string(path, length > 0 ? length : 0);
+	size_t slash = path_string.find_last_of("/");
+#endif
 	path_string = path_string.substr(0, slash);
 	return path_string;
 }
@@ -155,6 +180,10 @@ class BufferProcessor;
 class ChannelMapProcessor;
 class RecordProcessor;
 class SpikeProcessor;
+class SpikeSorterProcessor;
+class ClosedLoopProcessor;
+class ArtifactProcessor;
+class ReferenceProcessor;
 class Rhs2116MultiProcessor;
 class Rhs2116StimProcessor;
 class FilterProcessor;
@@ -173,6 +202,10 @@ enum TypeID{
 	SPIKE_PROCESSOR			= 603,
 	FILTER_PROCESSOR		= 604,
 	AUDIO_PROCESSOR		= 605,
+	SPIKE_SORTER_PROCESSOR	= 606,
+	CLOSED_LOOP_PROCESSOR	= 607,
+	ARTIFACT_PROCESSOR		= 608,
+	REFERENCE_PROCESSOR		= 609,
 	RHS2116_MULTI_PROCESSOR	= 666,
 	RHS2116_STIM_PROCESSOR	= 667,
 };
@@ -190,6 +223,10 @@ static std::string toString(const ONI::Processor::TypeID& typeID){
 	case SPIKE_PROCESSOR: {return "SPIKE Processor"; break;}
 	case FILTER_PROCESSOR: { return "FILTER Processor"; break; }
 	case AUDIO_PROCESSOR: { return "AUDIO Processor"; break; }
+	case SPIKE_SORTER_PROCESSOR: { return "SPIKESORTER Processor"; break; }
+	case CLOSED_LOOP_PROCESSOR: { return "CLOSEDLOOP Processor"; break; }
+	case ARTIFACT_PROCESSOR: { return "ARTIFACT Processor"; break; }
+	case REFERENCE_PROCESSOR: { return "REFERENCE Processor"; break; }
 	case RHS2116_MULTI_PROCESSOR: {return "RHS2116MULTI Processor"; break;}
 	case RHS2116_STIM_PROCESSOR: {return "RHS2116STIM Processor"; break;}
 	default: {assert(false, "UNKNOWN TYPE"); return "UNKNOWN Processor"; break; }
@@ -237,6 +274,24 @@ private:
 };
 template <class T> T* Singleton<T>::m_pInstance=nullptr;
 
+// Flat device lookup compiled from the device map by the Context. Device table
+// indices are hub.device bytes (eg., 0, 1, 2, 256, 257, 258, 512...), so they get
+// compacted to hub * hubStride + device to keep the table small and dense
+struct DeviceTable{
+
+	std::vector<ONI::Device::BaseDevice*> devices;
+	uint32_t numHubs = 0;
+	uint32_t hubStride = 0;
+
+	inline ONI::Device::BaseDevice* find(const uint32_t& idx) const{
+		const uint32_t hub = idx >> 8;
+		const uint32_t device = idx & 0xFF;
+		if(hub >= numHubs || device >= hubStride) return nullptr;
+		return devices[hub * hubStride + device];
+	}
+
+};
+
 class Model{
 
 	friend class ONI::Context;
@@ -282,6 +337,42 @@ public:
 		return processors;
 	}
 
+	inline ONI::Device::BaseDevice* findDevice(const uint32_t& idx){ // lock free lookup for the frame dispatch path
+		deviceTableReaders.fetch_add(1, std::memory_order_seq_cst);
+		ONI::Device::BaseDevice* device = deviceTable.load(std::memory_order_seq_cst)->find(idx);
+		deviceTableReaders.fetch_sub(1, std::memory_order_release);
+		return device;
+	}
+
+	inline void rebuildDeviceTable(){
+
+		DeviceTable* nextTable = new DeviceTable;
+
+		for(auto& it : devices){
+			nextTable->numHubs = std::max(nextTable->numHubs, (it.first >> 8) + 1);
+			nextTable->hubStride = std::max(nextTable->hubStride, (it.first & 0xFF) + 1);
+		}
+
+		nextTable->devices.assign(nextTable->numHubs * nextTable->hubStride, nullptr);
+		for(auto& it : devices){
+			nextTable->devices[(it.first >> 8) * nextTable->hubStride + (it.first & 0xFF)] = it.second;
+		}
+
+		DeviceTable* lastTable = deviceTable.exchange(nextTable, std::memory_order_seq_cst);
+		if(lastTable != &emptyDeviceTable) retiredDeviceTables.push_back(std::unique_ptr<DeviceTable>(lastTable)); // readers may still hold it
+
+		// lookups that came in after the exchange got the new table, so once there's a moment
+		// with none in flight the retired ones can go (otherwise they wait for the next rebuild)
+		for(size_t i = 0; i < 1000 && retiredDeviceTables.size() > 0; ++i){
+			if(deviceTableReaders.load(std::memory_order_seq_cst) == 0){
+				retiredDeviceTables.clear();
+				break;
+			}
+			std::this_thread::yield();
+		}
+
+	}
+
 	inline void resetAcquireTimeStart(){
 		firstAcquireTimeMicros = -1;
 	}
@@ -323,6 +414,22 @@ public:
 		return audioProcessor;
 	}
 
+	ONI::Processor::SpikeSorterProcessor* getSpikeSorterProcessor(){
+		return spikeSorterProcessor;
+	}
+
+	ONI::Processor::ClosedLoopProcessor* getClosedLoopProcessor(){
+		return closedLoopProcessor;
+	}
+
+	ONI::Processor::ArtifactProcessor* getArtifactProcessor(){
+		return artifactProcessor;
+	}
+
+	ONI::Processor::ReferenceProcessor* getReferenceProcessor(){
+		return referenceProcessor;
+	}
+
 	ONI::Processor::Rhs2116MultiProcessor* getRhs2116MultiProcessor(){
 		return rhs2116MultiProcessor;
 	}
@@ -375,6 +482,11 @@ private:
 
 	std::map<uint32_t, ONI::Device::BaseDevice*> devices;
 	std::map<ONI::Processor::TypeID, ONI::Processor::BaseProcessor*> processors; // for now just one instance of each?!
+
+	DeviceTable emptyDeviceTable;
+	std::atomic<DeviceTable*> deviceTable = &emptyDeviceTable;
+	std::atomic<size_t> deviceTableReaders = 0;
+	std::vector<std::unique_ptr<DeviceTable>> retiredDeviceTables;
 	//std::map<uint32_t, ONI::Device::BaseInterface*> interfaces; //?
 
 	long double firstAcquireTimeMicros = -1;
@@ -392,6 +504,10 @@ private:
 	ONI::Processor::Rhs2116StimProcessor * rhs2116StimProcessor = nullptr;
 	ONI::Processor::FilterProcessor* filterProcessor = nullptr;
 	ONI::Processor::AudioProcessor* audioProcessor = nullptr;
+	ONI::Processor::SpikeSorterProcessor* spikeSorterProcessor = nullptr;
+	ONI::Processor::ClosedLoopProcessor* closedLoopProcessor = nullptr;
+	ONI::Processor::ArtifactProcessor* artifactProcessor = nullptr;
+	ONI::Processor::ReferenceProcessor* referenceProcessor = nullptr;
 
 };
 
@@ -0,0 +1,146 @@
+//
+//  LatencyHistogram.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "../Type/Log.h"
+#include "../Type/BitTypes.h"
+
+#pragma once
+
+namespace ONI{
+
+// HDR style histogram of nanosecond latencies
+//
+// Values are bucketed by their power of two and then linearly into SUB_BUCKETS within
+// it, so every value is held to within 1 / SUB_BUCKETS (about 3%) from a few ns up to
+// hours, in a fixed array that never allocates after construction. One thread records,
+// any thread can read (counts are relaxed atomics so a read mid record can be one off).
+
+class LatencyHistogram{
+
+public:
+
+	static constexpr size_t SUB_BUCKET_BITS = 5;
+	static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static constexpr size_t MAGNITUDES = 64 - SUB_BUCKET_BITS + 1;
+	static constexpr size_t NUM_BUCKETS = MAGNITUDES * SUB_BUCKETS;
+
+	LatencyHistogram(){
+		reset();
+	}
+
+	void reset(){
+		for(std::atomic<uint64_t>& count : counts) count.store(0, std::memory_order_relaxed);
+		totalCount = 0;
+		totalNs = 0;
+		minNs = std::numeric_limits<uint64_t>::max();
+		maxNs = 0;
+	}
+
+	inline void record(const int64_t& ns){
+		const uint64_t value = ns > 0 ? ns : 0; // clock sync can put early samples a hair before the host saw them
+		counts[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+		totalCount.fetch_add(1, std::memory_order_relaxed);
+		totalNs.fetch_add(value, std::memory_order_relaxed);
+		if(value < minNs.load(std::memory_order_relaxed)) minNs.store(value, std::memory_order_relaxed);
+		if(value > maxNs.load(std::memory_order_relaxed)) maxNs.store(value, std::memory_order_relaxed);
+	}
+
+	inline uint64_t getCount(){
+		return totalCount.load(std::memory_order_relaxed);
+	}
+
+	inline uint64_t getMinNs(){
+		return getCount() == 0 ? 0 : minNs.load(std::memory_order_relaxed);
+	}
+
+	inline uint64_t getMaxNs(){
+		return maxNs.load(std::memory_order_relaxed);
+	}
+
+	inline double getMeanNs(){
+		const uint64_t count = getCount();
+		return count == 0 ? 0.0 : totalNs.load(std::memory_order_relaxed) / (double)count;
+	}
+
+	// upper edge of the bucket holding the percentile (0-100), so never under the true value
+	inline uint64_t getPercentileNs(const double& percentile){
+		const uint64_t count = getCount();
+		if(count == 0) return 0;
+		const uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(std::clamp(percentile, 0.0, 100.0) / 100.0 * count));
+		uint64_t cumulative = 0;
+		for(size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket){
+			cumulative += counts[bucket].load(std::memory_order_relaxed);
+			if(cumulative >= rank) return std::min(getBucketUpperNs(bucket), getMaxNs());
+		}
+		return getMaxNs();
+	}
+
+	// counts add up, eg., to combine per channel histograms into one
+	void add(LatencyHistogram& other){
+		for(size_t bucket = 0; bucket < NUM_BUCKETS; ++bucket){
+			counts[bucket].fetch_add(other.counts[bucket].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+		totalCount.fetch_add(other.getCount(), std::memory_order_relaxed);
+		totalNs.fetch_add(other.totalNs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		if(other.getCount() > 0 && other.getMinNs() < minNs.load(std::memory_order_relaxed)) minNs.store(other.getMinNs(), std::memory_order_relaxed);
+		if(other.getMaxNs() > getMaxNs()) maxNs.store(other.getMaxNs(), std::memory_order_relaxed);
+	}
+
+	// percentile distribution in the same layout HdrHistogram prints, so the usual plotters read it
+	void write(std::ostream& os, const std::string& name){
+		const uint64_t count = getCount();
+		os << "# " << name << " count: " << count << " mean(ns): " << getMeanNs() << " min(ns): " << getMinNs() << " max(ns): " << getMaxNs() << "\n";
+		os << "       Value     Percentile TotalCount 1/(1-Percentile)\n";
+		uint64_t cumulative = 0;
+		for(size_t bucket = 0; bucket < NUM_BUCKETS && count > 0; ++bucket){
+			const uint64_t bucketCount = counts[bucket].load(std::memory_order_relaxed);
+			if(bucketCount == 0) continue;
+			cumulative += bucketCount;
+			const double fraction = (double)cumulative / count;
+			char line[128];
+			std::snprintf(line, sizeof(line), "%12llu %14.12f %10llu %14.2f\n", (unsigned long long)getBucketUpperNs(bucket), fraction,
+						  (unsigned long long)cumulative, fraction < 1.0 ? 1.0 / (1.0 - fraction) : std::numeric_limits<double>::infinity());
+			os << line;
+		}
+		os << "\n";
+	}
+
+protected:
+
+	static inline size_t getBucket(const uint64_t& value){
+		if(value < SUB_BUCKETS) return (size_t)value; // exact below SUB_BUCKETS
+		const size_t magnitude = 64 - ONI::Bits::countLeadingZeros(value) - SUB_BUCKET_BITS; // >= 1
+		const size_t subBucket = (size_t)(value >> (magnitude - 1)) - SUB_BUCKETS; // the SUB_BUCKET_BITS under the leading bit
+		return magnitude * SUB_BUCKETS + subBucket;
+	}
+
+	static inline uint64_t getBucketUpperNs(const size_t& bucket){
+		const size_t magnitude = bucket / SUB_BUCKETS;
+		const size_t subBucket = bucket % SUB_BUCKETS;
+		if(magnitude == 0) return subBucket;
+		return ((uint64_t)(SUB_BUCKETS + subBucket + 1) << (magnitude - 1)) - 1;
+	}
+
+	std::atomic<uint64_t> counts[NUM_BUCKETS];
+	std::atomic<uint64_t> totalCount = 0;
+	std::atomic<uint64_t> totalNs = 0;
+	std::atomic<uint64_t> minNs = std::numeric_limits<uint64_t>::max();
+	std::atomic<uint64_t> maxNs = 0;
+
+};
+
+
+} // namespace ONI
@@ -0,0 +1,211 @@
+//
+//  MirroredBuffer.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <numeric>
+#include <new>
+#include <syncstream>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+
+// Ring storage that can be indexed from 0 to 3 x size, where [i], [i + size] and
+// [i + size * 2] are the same element
+//
+// That's what lets the frame buffers hand out windows starting at negative
+// offsets or running past the write head as plain contiguous pointers. Where the
+// os lets us (linux memfd) the same physical pages are mapped three times in a
+// row, so a sample is written once and shows up in all three copies; otherwise
+// it falls back to a 3 x size array and write() stores each sample three times.
+// Mirroring needs size * sizeof(T) to be a whole number of pages, see getGranularity
+
+template<typename T>
+class MirroredBuffer{
+
+public:
+
+	MirroredBuffer(){};
+	MirroredBuffer(const MirroredBuffer&) = delete;
+	MirroredBuffer& operator=(const MirroredBuffer&) = delete;
+
+	MirroredBuffer(MirroredBuffer&& other) noexcept{
+		*this = std::move(other);
+	}
+
+	MirroredBuffer& operator=(MirroredBuffer&& other) noexcept{
+		if(this != &other){
+			release();
+			std::swap(buffer, other.buffer);
+			std::swap(fallback, other.fallback);
+			std::swap(mapping, other.mapping);
+			std::swap(mappingBytes, other.mappingBytes);
+			std::swap(bufferSize, other.bufferSize);
+			std::swap(bMirrored, other.bMirrored);
+		}
+		return *this;
+	}
+
+	~MirroredBuffer(){
+		release();
+	}
+
+	// smallest number of elements that fills whole pages
+	static size_t getGranularity(){
+#ifdef __linux__
+		const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		return pageSize / std::gcd(pageSize, sizeof(T));
+#else
+		return 1;
+#endif
+	}
+
+	// true if a buffer of this size would be mirrored rather than triple written
+	static bool canMirror(const size_t& size){
+#ifdef __linux__
+		return size > 0 && size % getGranularity() == 0;
+#else
+		return false;
+#endif
+	}
+
+	void resize(const size_t& size, const bool& bTryMirror = true){
+
+		release();
+		bufferSize = size;
+		if(bufferSize == 0) return;
+
+		if(bTryMirror && canMirror(bufferSize) && mirror()){
+			bMirrored = true;
+		}else{
+			fallback.resize(bufferSize * 3);
+			buffer = fallback.data();
+			bMirrored = false;
+		}
+
+	}
+
+	void assign(const size_t& size, const T& value, const bool& bTryMirror = true){
+		resize(size, bTryMirror);
+		for(size_t i = 0; i < bufferSize; ++i) write(i, value);
+	}
+
+	void clear(){
+		release();
+	}
+
+	inline void write(const size_t& idx, const T& value){
+		buffer[idx] = value;
+		if(!bMirrored) buffer[idx + bufferSize] = buffer[idx + bufferSize * 2] = value;
+	}
+
+	inline T& operator[](const size_t& idx){
+		return buffer[idx];
+	}
+
+	inline const T& operator[](const size_t& idx) const {
+		return buffer[idx];
+	}
+
+	inline T* data(){
+		return buffer;
+	}
+
+	inline const size_t& size() const {
+		return bufferSize;
+	}
+
+	inline const bool& isMirrored() const {
+		return bMirrored;
+	}
+
+protected:
+
+	bool mirror(){
+#ifdef __linux__
+		const size_t bytes = bufferSize * sizeof(T);
+
+		int fd = memfd_create("oni_mirrored_buffer", MFD_CLOEXEC);
+		if(fd == -1) return false;
+		if(ftruncate(fd, bytes) != 0){
+			close(fd);
+			return false;
+		}
+
+		// reserve 3 x bytes of address space and map the same file over each third
+		char* region = (char*)mmap(nullptr, bytes * 3, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(region == MAP_FAILED){
+			close(fd);
+			return false;
+		}
+
+		for(size_t i = 0; i < 3; ++i){
+			void* view = mmap(region + bytes * i, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+			if(view == MAP_FAILED){
+				LOGALERT("Could not mirror buffer of %i bytes, falling back to triple writes", bytes);
+				munmap(region, bytes * 3);
+				close(fd);
+				return false;
+			}
+		}
+
+		close(fd); // the mappings keep the memory alive
+
+		mapping = region;
+		mappingBytes = bytes * 3;
+		buffer = reinterpret_cast<T*>(region);
+		for(size_t i = 0; i < bufferSize; ++i) new (&buffer[i]) T(); // construct once, the other two views alias these
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void release(){
+#ifdef __linux__
+		if(mapping != nullptr){
+			for(size_t i = 0; i < bufferSize; ++i) buffer[i].~T();
+			munmap(mapping, mappingBytes);
+		}
+#endif
+		mapping = nullptr;
+		mappingBytes = 0;
+		fallback.clear();
+		buffer = nullptr;
+		bufferSize = 0;
+		bMirrored = false;
+	}
+
+	T* buffer = nullptr;
+	std::vector<T> fallback;
+
+	void* mapping = nullptr;
+	size_t mappingBytes = 0;
+
+	size_t bufferSize = 0;
+	bool bMirrored = false;
+
+};
+
+} // namespace ONI
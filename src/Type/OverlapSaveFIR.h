@@ -0,0 +1,218 @@
+//
+//  OverlapSaveFIR.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+#include "../Type/Log.h"
+#include "../Type/FFT.h"
+#include "../Type/WorkerPool.h"
+
+#pragma once
+
+namespace ONI{
+
+// Multichannel FIR filter by overlap-save FFT convolution
+//
+// One set of taps for every channel. The kernel is transformed once in setup() and
+// every fftSize - numTaps + 1 (hop) samples each channel's last fftSize samples are
+// transformed, multiplied by it and transformed back, which gives hop samples of the
+// straight convolution. Channels go through the FFT two at a time (one as the real
+// part and one as the imaginary, the taps are real so they come back out the same
+// way), with the pairs shared out on a WorkerPool when there is one.
+//
+// Samples come out hop samples after they go in, plus the (numTaps - 1) / 2 group
+// delay of a linear phase filter, so a bigger fftSize costs latency and saves work.
+
+class OverlapSaveFIR{
+
+public:
+
+	typedef std::complex<float> Complex;
+
+	// fftSize is raised to at least twice the taps rounded up to a power of two
+	void setup(const size_t& numChannels, const std::vector<float>& taps, const size_t& fftSize){
+
+		assert(taps.size() > 0);
+
+		this->numChannels = numChannels;
+		numTaps = taps.size();
+		this->fftSize = std::max(FFT::nextPowerOfTwo(fftSize), FFT::nextPowerOfTwo(numTaps) * 2);
+		hop = this->fftSize - numTaps + 1;
+		numPairs = (numChannels + 1) / 2;
+
+		fft.setup(this->fftSize);
+
+		// kernel spectrum with the inverse transform's 1 / fftSize folded in
+		kernel.assign(this->fftSize, Complex(0, 0));
+		for(size_t i = 0; i < numTaps; ++i) kernel[i] = Complex(taps[i] / this->fftSize, 0);
+		fft.forward(kernel.data());
+
+		inputs.assign(numChannels * this->fftSize, 0.0f);
+		outputs.assign(numChannels * hop, 0.0f);
+		work.assign(numPairs * this->fftSize, Complex(0, 0));
+		position = 0;
+
+	}
+
+	// processing thread: filters numSamples of every channel in place, channel c's
+	// samples start at samples + c * stride (use a stride of 1 and one sample for a frame)
+	inline void process(float* samples, const size_t& stride, const size_t& numSamples, ONI::WorkerPool* workerPool = nullptr){
+
+		size_t done = 0;
+
+		while(done < numSamples){
+
+			const size_t chunk = std::min(numSamples - done, hop - position);
+
+			for(size_t channel = 0; channel < numChannels; ++channel){
+				float* lane = samples + channel * stride + done;
+				std::copy(lane, lane + chunk, inputs.begin() + channel * fftSize + numTaps - 1 + position);
+				std::copy(outputs.begin() + channel * hop + position, outputs.begin() + channel * hop + position + chunk, lane);
+			}
+
+			position += chunk;
+			done += chunk;
+
+			if(position == hop){
+				if(workerPool != nullptr){
+					workerPool->run(numPairs, [this](const size_t& pair){ convolvePair(pair); });
+				}else{
+					for(size_t pair = 0; pair < numPairs; ++pair) convolvePair(pair);
+				}
+				// the last numTaps - 1 samples are the history for the next hop
+				for(size_t channel = 0; channel < numChannels; ++channel){
+					std::copy(inputs.begin() + channel * fftSize + hop, inputs.begin() + (channel + 1) * fftSize, inputs.begin() + channel * fftSize);
+				}
+				position = 0;
+			}
+
+		}
+
+	}
+
+	// processing thread
+	inline void reset(){
+		std::fill(inputs.begin(), inputs.end(), 0.0f);
+		std::fill(outputs.begin(), outputs.end(), 0.0f);
+		position = 0;
+	}
+
+	// carries on from where another filter of the same shape is up to, so new taps don't start from silence
+	inline bool adoptState(const OverlapSaveFIR& other){
+		if(other.numChannels != numChannels || other.numTaps != numTaps || other.fftSize != fftSize) return false;
+		inputs = other.inputs;
+		outputs = other.outputs;
+		position = other.position;
+		return true;
+	}
+
+	inline size_t getNumChannels() const{
+		return numChannels;
+	}
+
+	inline size_t getNumTaps() const{
+		return numTaps;
+	}
+
+	inline size_t getFFTSize() const{
+		return fftSize;
+	}
+
+	// samples between one going in and its filtered value coming out, not counting the group delay
+	inline size_t getBlockLatencySamples() const{
+		return hop;
+	}
+
+	inline size_t getGroupDelaySamples() const{
+		return (numTaps - 1) / 2;
+	}
+
+	// Linear phase taps with the given magnitude response, by frequency sampling: the
+	// magnitude as a zero phase spectrum is transformed back to an impulse response,
+	// which is centred on the middle tap, cut to numTaps and Hamming windowed. magnitude
+	// holds evenly spaced points from 0 to Nyquist inclusive, a power of two plus one of
+	// them, and wants to be a good few times numTaps long so the impulse doesn't wrap
+	static std::vector<float> designLinearPhase(const std::vector<float>& magnitude, const size_t& numTaps){
+
+		const size_t designSize = (magnitude.size() - 1) * 2;
+		assert(FFT::isPowerOfTwo(designSize), "Magnitude response should have 2^n + 1 points");
+
+		FFT designFFT;
+		designFFT.setup(designSize);
+
+		std::vector<Complex> spectrum(designSize);
+		for(size_t k = 0; k <= designSize / 2; ++k){
+			spectrum[k] = Complex(magnitude[k], 0);
+			if(k > 0 && k < designSize / 2) spectrum[designSize - k] = Complex(magnitude[k], 0);
+		}
+		designFFT.inverseScaled(spectrum.data());
+
+		std::vector<float> taps(numTaps);
+		const int centre = (numTaps - 1) / 2;
+		for(size_t i = 0; i < numTaps; ++i){
+			const int n = (int)i - centre;
+			const float window = numTaps > 1 ? 0.54f - 0.46f * std::cos(2.0 * 3.14159265358979323846 * i / (numTaps - 1)) : 1.0f;
+			taps[i] = spectrum[(n + (int)designSize) % designSize].real() * window;
+		}
+
+		return taps;
+
+	}
+
+protected:
+
+	// any thread, each pair has its own work buffer
+	inline void convolvePair(const size_t& pair){
+
+		Complex* buffer = work.data() + pair * fftSize;
+		const size_t a = pair * 2;
+		const size_t b = a + 1;
+		const float* inA = inputs.data() + a * fftSize;
+		const float* inB = b < numChannels ? inputs.data() + b * fftSize : nullptr;
+
+		for(size_t i = 0; i < fftSize; ++i) buffer[i] = Complex(inA[i], inB != nullptr ? inB[i] : 0.0f);
+
+		fft.forward(buffer);
+		for(size_t i = 0; i < fftSize; ++i){
+			const float re = buffer[i].real() * kernel[i].real() - buffer[i].imag() * kernel[i].imag();
+			const float im = buffer[i].real() * kernel[i].imag() + buffer[i].imag() * kernel[i].real();
+			buffer[i] = Complex(re, im);
+		}
+		fft.inverse(buffer);
+
+		float* outA = outputs.data() + a * hop;
+		for(size_t i = 0; i < hop; ++i) outA[i] = buffer[numTaps - 1 + i].real();
+		if(inB != nullptr){
+			float* outB = outputs.data() + b * hop;
+			for(size_t i = 0; i < hop; ++i) outB[i] = buffer[numTaps - 1 + i].imag();
+		}
+
+	}
+
+	size_t numChannels = 0;
+	size_t numTaps = 0;
+	size_t fftSize = 0;
+	size_t hop = 0;
+	size_t numPairs = 0;
+
+	FFT fft;
+	std::vector<Complex> kernel;
+
+	// processing thread (and the workers it hands pairs to)
+	std::vector<float> inputs;		// numChannels x fftSize, numTaps - 1 samples of history then the hop being filled
+	std::vector<float> outputs;		// numChannels x hop, the last hop's results going out
+	std::vector<Complex> work;		// numPairs x fftSize
+	size_t position = 0;			// how far into the hop we are
+
+};
+
+
+} // namespace ONI
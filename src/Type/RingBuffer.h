@@ -0,0 +1,154 @@
+//
+//  RingBuffer.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include "oni.h"
+#include "onix.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <syncstream>
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+
+// Single producer single consumer lock free ring
+//
+// The producer claims a slot, fills it in place and publishes it; the consumer
+// peeks the front slot, uses it in place and pops it. Nothing is allocated once
+// the ring has been resized, and neither side ever waits on the other: if the
+// consumer falls behind the producer's claim fails and the overflow is counted
+
+template<typename T>
+class SpscRingBuffer{
+
+public:
+
+	~SpscRingBuffer(){
+		buffer.clear();
+	};
+
+	size_t resize(const size_t& size){
+		size_t capacity = 1;
+		while(capacity < size) capacity <<= 1; // power of two so we can mask instead of mod
+		buffer.clear();
+		buffer.resize(capacity);
+		mask = capacity - 1;
+		head = 0;
+		tail = 0;
+		resetStats();
+		return capacity;
+	}
+
+	// producer side
+
+	inline T* claim(){
+		const size_t h = head.load(std::memory_order_relaxed);
+		const size_t t = tail.load(std::memory_order_acquire);
+		if(h - t > mask){
+			overflowCount.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		return &buffer[h & mask];
+	}
+
+	inline void publish(){
+		const size_t h = head.load(std::memory_order_relaxed) + 1;
+		head.store(h, std::memory_order_release);
+		pushCount.fetch_add(1, std::memory_order_relaxed);
+		const size_t depth = h - tail.load(std::memory_order_relaxed);
+		if(depth > highWaterMark.load(std::memory_order_relaxed)) highWaterMark.store(depth, std::memory_order_relaxed);
+	}
+
+	inline bool push(const T& t){
+		T* slot = claim();
+		if(slot == nullptr) return false;
+		*slot = t;
+		publish();
+		return true;
+	}
+
+	// consumer side
+
+	inline T* front(){
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if(t == head.load(std::memory_order_acquire)) return nullptr;
+		return &buffer[t & mask];
+	}
+
+	inline void pop(){
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	inline bool pop(T& t){
+		T* slot = front();
+		if(slot == nullptr) return false;
+		t = *slot;
+		pop();
+		return true;
+	}
+
+	// stats
+
+	inline void resetStats(){
+		highWaterMark = 0;
+		overflowCount = 0;
+		pushCount = 0;
+	}
+
+	inline size_t size(){
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	inline size_t capacity(){
+		return buffer.size();
+	}
+
+	inline size_t getHighWaterMark(){
+		return highWaterMark.load(std::memory_order_relaxed);
+	}
+
+	inline size_t getOverflowCount(){
+		return overflowCount.load(std::memory_order_relaxed);
+	}
+
+	inline size_t getPushCount(){
+		return pushCount.load(std::memory_order_relaxed);
+	}
+
+	inline T* getSlots(){ // direct slot access for one-off initialisation before producer/consumer start
+		return buffer.data();
+	}
+
+protected:
+
+	std::vector<T> buffer;
+	size_t mask = 0;
+
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+
+	alignas(64) std::atomic<size_t> highWaterMark = 0;
+	std::atomic<size_t> overflowCount = 0;
+	std::atomic<size_t> pushCount = 0;
+
+};
+
+
+} // namespace ONI
@@ -705,9 +705,15 @@ enum SpikeEdgeDetectionType{
 	EITHER
 };
 
+enum SpikeNoiseEstimatorType{
+	STANDARD_DEVIATION = 0,
+	MEDIAN_ABSOLUTE_DEVIATION	// median(|v|) / 0.6745, isn't dragged up by the spikes and artifacts themselves
+};
+
 struct SpikeSettings{
 
 	SpikeEdgeDetectionType spikeEdgeDetectionType = FALLING;
+	SpikeNoiseEstimatorType spikeNoiseEstimatorType = STANDARD_DEVIATION;
 
 	float positiveDeviationMultiplier = 3.0f;
 	float negativeDeviationMultiplier = 3.0f;
@@ -721,9 +727,14 @@ struct SpikeSettings{
 	bool bFallingAlignMax = true;
 	bool bRisingAlignMin = false;
 
+	int numDetectionShards = 1; // probes are split into this many shards, each detected on its own worker thread
+	int numSpikeFeatures = 3; // principal components scored for each spike
+	int detectionLagSamples = 0; // how far behind the write head to scan, 0 (or anything shorter than the waveform needs) for the shortest lag
+
 	// copy assignment (copy-and-swap idiom)
 	SpikeSettings& SpikeSettings::operator=(SpikeSettings other) noexcept{
 		std::swap(spikeEdgeDetectionType, other.spikeEdgeDetectionType);
+		std::swap(spikeNoiseEstimatorType, other.spikeNoiseEstimatorType);
 		std::swap(positiveDeviationMultiplier, other.positiveDeviationMultiplier);
 		std::swap(negativeDeviationMultiplier, other.negativeDeviationMultiplier);
 		std::swap(spikeWaveformLengthMs, other.spikeWaveformLengthMs);
@@ -733,6 +744,9 @@ struct SpikeSettings{
 		std::swap(minSampleOffset, other.minSampleOffset);
 		std::swap(bFallingAlignMax, other.bFallingAlignMax);
 		std::swap(bRisingAlignMin, other.bRisingAlignMin);
+		std::swap(numDetectionShards, other.numDetectionShards);
+		std::swap(numSpikeFeatures, other.numSpikeFeatures);
+		std::swap(detectionLagSamples, other.detectionLagSamples);
 		return *this;
 	}
 
@@ -741,6 +755,7 @@ struct SpikeSettings{
 
 inline bool operator==(const SpikeSettings& lhs, const SpikeSettings& rhs){
 	return (lhs.spikeEdgeDetectionType == rhs.spikeEdgeDetectionType &&
+			lhs.spikeNoiseEstimatorType == rhs.spikeNoiseEstimatorType &&
 			lhs.positiveDeviationMultiplier == rhs.positiveDeviationMultiplier &&
 			lhs.negativeDeviationMultiplier == rhs.negativeDeviationMultiplier &&
 			lhs.spikeWaveformLengthMs == rhs.spikeWaveformLengthMs &&
@@ -749,11 +764,183 @@ inline bool operator==(const SpikeSettings& lhs, const SpikeSettings& rhs){
 			lhs.longSpikeBufferSize == rhs.longSpikeBufferSize &&
 			lhs.minSampleOffset == rhs.minSampleOffset &&
 			lhs.bFallingAlignMax == rhs.bFallingAlignMax &&
-			lhs.bRisingAlignMin == rhs.bRisingAlignMin);
+			lhs.bRisingAlignMin == rhs.bRisingAlignMin &&
+			lhs.numDetectionShards == rhs.numDetectionShards &&
+			lhs.numSpikeFeatures == rhs.numSpikeFeatures &&
+			lhs.detectionLagSamples == rhs.detectionLagSamples);
 }
 inline bool operator!=(const SpikeSettings& lhs, const SpikeSettings& rhs) { return !(lhs == rhs); }
 
 
+struct SpikeSorterSettings{
+
+	bool bLearnTemplates = true;			// grow and refine templates from the spikes as they come in
+	int maxUnitsPerProbe = 4;				// up to MAX_SPIKE_UNITS
+	float maxResidualDeviations = 2.5f;		// a match's rms residual must be under this many noise deviations
+	float learningRate = 0.02f;				// how far a matched template moves toward the spike
+	int minUnitSpikes = 20;					// matches a template needs before its spikes get a unit id
+	int latencyBudgetNs = 5000;				// stop matching a spike after this long and leave it unsorted
+
+	// copy assignment (copy-and-swap idiom)
+	SpikeSorterSettings& SpikeSorterSettings::operator=(SpikeSorterSettings other) noexcept{
+		std::swap(bLearnTemplates, other.bLearnTemplates);
+		std::swap(maxUnitsPerProbe, other.maxUnitsPerProbe);
+		std::swap(maxResidualDeviations, other.maxResidualDeviations);
+		std::swap(learningRate, other.learningRate);
+		std::swap(minUnitSpikes, other.minUnitSpikes);
+		std::swap(latencyBudgetNs, other.latencyBudgetNs);
+		return *this;
+	}
+
+};
+
+inline bool operator==(const SpikeSorterSettings& lhs, const SpikeSorterSettings& rhs){
+	return (lhs.bLearnTemplates == rhs.bLearnTemplates &&
+			lhs.maxUnitsPerProbe == rhs.maxUnitsPerProbe &&
+			lhs.maxResidualDeviations == rhs.maxResidualDeviations &&
+			lhs.learningRate == rhs.learningRate &&
+			lhs.minUnitSpikes == rhs.minUnitSpikes &&
+			lhs.latencyBudgetNs == rhs.latencyBudgetNs);
+}
+inline bool operator!=(const SpikeSorterSettings& lhs, const SpikeSorterSettings& rhs) { return !(lhs == rhs); }
+
+// if minSpikes spikes on any of the probes land within windowMs, trigger a stimulus
+struct ClosedLoopRule{
+
+	bool bEnabled = true;
+	std::vector<int> probes;				// spikes on any of these count toward the rule
+	int unitID = -1;						// only count spikes sorted into this unit, -1 for any spike
+	int minSpikes = 3;						// up to MAX_CLOSED_LOOP_SPIKES
+	float windowMs = 10.0f;
+	float refractoryMs = 500.0f;			// ignore the rule for this long after it fires
+	int stimDeviceIDX = -1;					// only trigger this stim device's loaded sequence, -1 for all of them
+	bool bIgnoreStimSpikes = true;			// don't count spikes detected during a stimulus (they're mostly artifact)
+
+	// copy assignment (copy-and-swap idiom)
+	ClosedLoopRule& ClosedLoopRule::operator=(ClosedLoopRule other) noexcept{
+		std::swap(bEnabled, other.bEnabled);
+		std::swap(probes, other.probes);
+		std::swap(unitID, other.unitID);
+		std::swap(minSpikes, other.minSpikes);
+		std::swap(windowMs, other.windowMs);
+		std::swap(refractoryMs, other.refractoryMs);
+		std::swap(stimDeviceIDX, other.stimDeviceIDX);
+		std::swap(bIgnoreStimSpikes, other.bIgnoreStimSpikes);
+		return *this;
+	}
+
+};
+
+inline bool operator==(const ClosedLoopRule& lhs, const ClosedLoopRule& rhs){
+	return (lhs.bEnabled == rhs.bEnabled &&
+			lhs.probes == rhs.probes &&
+			lhs.unitID == rhs.unitID &&
+			lhs.minSpikes == rhs.minSpikes &&
+			lhs.windowMs == rhs.windowMs &&
+			lhs.refractoryMs == rhs.refractoryMs &&
+			lhs.stimDeviceIDX == rhs.stimDeviceIDX &&
+			lhs.bIgnoreStimSpikes == rhs.bIgnoreStimSpikes);
+}
+inline bool operator!=(const ClosedLoopRule& lhs, const ClosedLoopRule& rhs) { return !(lhs == rhs); }
+
+struct ClosedLoopSettings{
+
+	bool bArmed = false;					// nothing is triggered until the rules are armed
+	std::vector<ClosedLoopRule> rules;		// up to MAX_CLOSED_LOOP_RULES
+
+	// copy assignment (copy-and-swap idiom)
+	ClosedLoopSettings& ClosedLoopSettings::operator=(ClosedLoopSettings other) noexcept{
+		std::swap(bArmed, other.bArmed);
+		std::swap(rules, other.rules);
+		return *this;
+	}
+
+};
+
+inline bool operator==(const ClosedLoopSettings& lhs, const ClosedLoopSettings& rhs){
+	return (lhs.bArmed == rhs.bArmed &&
+			lhs.rules == rhs.rules);
+}
+inline bool operator!=(const ClosedLoopSettings& lhs, const ClosedLoopSettings& rhs) { return !(lhs == rhs); }
+
+
+enum ArtifactSuppressionType{
+	ARTIFACT_NONE = 0,
+	ARTIFACT_BLANK,			// zero the window
+	ARTIFACT_HOLD,			// hold the last sample before the window
+	ARTIFACT_INTERPOLATE,	// ramp from the last sample before the window to the first after it
+	ARTIFACT_TEMPLATE		// subtract a running average of the artifact
+};
+
+struct ArtifactSettings{
+
+	ArtifactSuppressionType suppressionType = ARTIFACT_HOLD;
+
+	float templateMs = 20.0f;				// how far into each window the template reaches, the rest is held
+	float templateLearningRate = 0.2f;		// how much each new window moves the template
+
+	// copy assignment (copy-and-swap idiom)
+	ArtifactSettings& ArtifactSettings::operator=(ArtifactSettings other) noexcept{
+		std::swap(suppressionType, other.suppressionType);
+		std::swap(templateMs, other.templateMs);
+		std::swap(templateLearningRate, other.templateLearningRate);
+		return *this;
+	}
+
+};
+
+inline bool operator==(const ArtifactSettings& lhs, const ArtifactSettings& rhs){
+	return (lhs.suppressionType == rhs.suppressionType &&
+			lhs.templateMs == rhs.templateMs &&
+			lhs.templateLearningRate == rhs.templateLearningRate);
+}
+inline bool operator!=(const ArtifactSettings& lhs, const ArtifactSettings& rhs) { return !(lhs == rhs); }
+
+
+enum ReferenceType{
+	REFERENCE_NONE = 0,
+	REFERENCE_COMMON_AVERAGE,	// subtract the mean of the active probes
+	REFERENCE_COMMON_MEDIAN,	// subtract the median of the active probes, isn't dragged about by one noisy probe
+	REFERENCE_LAPLACIAN_4,		// subtract the mean of each probe's active up/down/left/right neighbours on the grid
+	REFERENCE_LAPLACIAN_8		// as above plus the diagonals
+};
+
+struct ReferenceSettings{
+
+	ReferenceType referenceType = REFERENCE_COMMON_AVERAGE;
+
+	int gridColumns = 8;					// probes are laid out row by row in channel map order, eg., an 8 x 8 MEA
+	bool bUseActiveProbes = true;			// leave out probes switched off in the BufferProcessor (dead electrodes)
+
+	// copy assignment (copy-and-swap idiom)
+	ReferenceSettings& ReferenceSettings::operator=(ReferenceSettings other) noexcept{
+		std::swap(referenceType, other.referenceType);
+		std::swap(gridColumns, other.gridColumns);
+		std::swap(bUseActiveProbes, other.bUseActiveProbes);
+		return *this;
+	}
+
+};
+
+inline bool operator==(const ReferenceSettings& lhs, const ReferenceSettings& rhs){
+	return (lhs.referenceType == rhs.referenceType &&
+			lhs.gridColumns == rhs.gridColumns &&
+			lhs.bUseActiveProbes == rhs.bUseActiveProbes);
+}
+inline bool operator!=(const ReferenceSettings& lhs, const ReferenceSettings& rhs) { return !(lhs == rhs); }
+
+
+enum StimFilterStateType{
+	STIM_FILTER_CONTINUE = 0,	// filter straight through stim windows
+	STIM_FILTER_HOLD,			// filter through the window, then put the filter state back as it was before it
+	STIM_FILTER_RESET			// filter through the window, then clear the filter state
+};
+
+enum FilterModeType{
+	FILTER_IIR = 0,				// the Butterworth sections as they are, least latency but not linear phase
+	FILTER_FIR					// a linear phase FIR with the same magnitude response, run by overlap-save FFT convolution
+};
+
 struct FilterSettings{
 
 	bool bUseBandStopFilter = false;
@@ -775,6 +962,12 @@ struct FilterSettings{
 	float highShelfGain = -12;
 	float highShelfRipple = 0.1;
 
+	StimFilterStateType stimFilterState = STIM_FILTER_CONTINUE;
+
+	FilterModeType filterMode = FILTER_IIR;
+	int firTaps = 511;					// odd, more taps follow the IIR response closer at the low corners
+	int firBlockSize = 1024;			// fft size, samples come out firBlockSize - firTaps + 1 samples late plus the group delay
+
 	// copy assignment (copy-and-swap idiom)
 	FilterSettings& FilterSettings::operator=(FilterSettings other) noexcept{
 		std::swap(highBandPassFrequency, other.highBandPassFrequency);
@@ -791,6 +984,10 @@ struct FilterSettings{
 		std::swap(highShelfRipple, other.highShelfRipple);
 		std::swap(bUseLowShelf, other.bUseLowShelf);
 		std::swap(bUseHighShelf, other.bUseHighShelf);
+		std::swap(stimFilterState, other.stimFilterState);
+		std::swap(filterMode, other.filterMode);
+		std::swap(firTaps, other.firTaps);
+		std::swap(firBlockSize, other.firBlockSize);
 		return *this;
 	}
 
@@ -811,7 +1008,11 @@ inline bool operator==(const FilterSettings& lhs, const FilterSettings& rhs){
 			lhs.highShelfRipple == rhs.highShelfRipple &&
 			lhs.lowShelfFrequency == rhs.lowShelfFrequency &&
 			lhs.lowShelfGain == rhs.lowShelfGain &&
-			lhs.lowShelfRipple == rhs.lowShelfRipple);
+			lhs.lowShelfRipple == rhs.lowShelfRipple &&
+			lhs.stimFilterState == rhs.stimFilterState &&
+			lhs.filterMode == rhs.filterMode &&
+			lhs.firTaps == rhs.firTaps &&
+			lhs.firBlockSize == rhs.firBlockSize);
 }
 inline bool operator!=(const FilterSettings& lhs, const FilterSettings& rhs) { return !(lhs == rhs); }
 
@@ -827,6 +1028,7 @@ struct RecordSettings{
 	std::string timeFileName = "";
 	std::string stimTypesFileName = "";
 	std::string stimFileName = "";
+	std::string spikeFileName = "";
 	std::string infoFileName = "";
 	std::string timeStamp = "";      // "normal"
 	std::string version = "";
@@ -854,6 +1056,7 @@ struct RecordSettings{
 		std::swap(fileTimeStamp, other.fileTimeStamp);
 		std::swap(stimTypesFileName, other.stimTypesFileName);
 		std::swap(stimFileName, other.stimFileName);
+		std::swap(spikeFileName, other.spikeFileName);
 		std::swap(description, other.description);
 		std::swap(info, other.info);
 		std::swap(heartBeatRateHz, other.heartBeatRateHz);
@@ -878,6 +1081,7 @@ inline bool operator==(const RecordSettings& lhs, const RecordSettings& rhs){
 			lhs.fileTimeStamp == rhs.fileTimeStamp &&
 			lhs.stimTypesFileName == rhs.stimTypesFileName &&
 			lhs.stimFileName == rhs.stimFileName &&
+			lhs.spikeFileName == rhs.spikeFileName &&
 			lhs.description == rhs.description &&
 			lhs.info == rhs.info &&
 			lhs.heartBeatRateHz == rhs.heartBeatRateHz &&
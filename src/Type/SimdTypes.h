@@ -0,0 +1,798 @@
+//
+//  SimdTypes.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <syncstream>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ONI_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets us use any intrinsic in any function; gcc/clang need the function
+// compiled for the target, so the kernels are tagged and only called after the
+// runtime check says the cpu can run them
+#if defined(ONI_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ONI_SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define ONI_SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#define ONI_SIMD_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define ONI_SIMD_TARGET_SSE41
+#define ONI_SIMD_TARGET_AVX2
+#define ONI_SIMD_TARGET_AVX512
+#endif
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+namespace Simd{
+
+enum InstructionSet{
+	SCALAR = 0,
+	SSE41,
+	AVX2,
+	AVX512,		// only the kernels that gain from 16 lanes have their own, the rest run as AVX2
+	INSTRUCTION_SET_COUNT
+};
+
+static std::string toString(const InstructionSet& instructionSet){
+	switch(instructionSet){
+	case SCALAR: {return "SCALAR"; break;}
+	case SSE41: {return "SSE4.1"; break;}
+	case AVX2: {return "AVX2"; break;}
+	case AVX512: {return "AVX-512"; break;}
+	case INSTRUCTION_SET_COUNT: {return "INSTRUCTION_SET_COUNT"; break;}
+	}
+	return "UNKNOWN";
+};
+
+// best instruction set the cpu (and os, for the ymm registers) supports
+static InstructionSet detectInstructionSet(){
+#if defined(ONI_SIMD_X86) && defined(_MSC_VER)
+	int info[4] = {0};
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+	__cpuid(info, 1);
+	const bool bSse41 = (info[2] & (1 << 19)) != 0;
+	const bool bOsxsave = (info[2] & (1 << 27)) != 0;
+	const bool bAvx = (info[2] & (1 << 28)) != 0;
+	bool bAvx2 = false;
+	bool bAvx512 = false;
+	if(maxLeaf >= 7 && bOsxsave && bAvx && (_xgetbv(0) & 0x6) == 0x6){
+		__cpuidex(info, 7, 0);
+		bAvx2 = (info[1] & (1 << 5)) != 0;
+		bAvx512 = (info[1] & (1 << 16)) != 0 && (_xgetbv(0) & 0xE6) == 0xE6; // and the os saves the zmm and mask registers
+	}
+	if(bAvx512) return AVX512;
+	if(bAvx2) return AVX2;
+	if(bSse41) return SSE41;
+	return SCALAR;
+#elif defined(ONI_SIMD_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return AVX512;
+	if(__builtin_cpu_supports("avx2")) return AVX2;
+	if(__builtin_cpu_supports("sse4.1")) return SSE41;
+	return SCALAR;
+#else
+	return SCALAR;
+#endif
+}
+
+static inline std::atomic<int>& activeInstructionSet(){
+	static std::atomic<int> instructionSet = (int)detectInstructionSet();
+	return instructionSet;
+}
+
+static inline InstructionSet getInstructionSet(){
+	return (InstructionSet)activeInstructionSet().load(std::memory_order_relaxed);
+}
+
+// force a lower instruction set for everything (eg., to rule the SIMD kernels out while
+// debugging); asking for more than the cpu has is clamped. Benchmarks and checks that
+// compare kernels pass the instruction set to the kernel instead so live data never
+// switches kernels under them
+static inline InstructionSet setInstructionSet(const InstructionSet& instructionSet){
+	InstructionSet supported = detectInstructionSet();
+	InstructionSet selected = std::min(instructionSet, supported);
+	if(selected != instructionSet) LOGALERT("%s not supported, using %s", toString(instructionSet).c_str(), toString(selected).c_str());
+	activeInstructionSet().store((int)selected, std::memory_order_relaxed);
+	return selected;
+}
+
+
+// RHS2116 ADC conversion
+//
+// ac: 0.195 uV * (ADC - 32768), dc: -19.23 mV * (ADC - 512), both divided by 1000
+// the same way the frames have always done it, but kept in float the whole way
+//
+// The gather variant reads samples straight out of an array of packed device
+// frames using per output channel byte offsets (see ChannelMapProcessor), so
+// the channel map permutation happens in the same pass as the conversion
+
+constexpr float RHS2116_AC_SCALE = 0.195f;
+constexpr float RHS2116_DC_SCALE = -19.23f;
+constexpr float RHS2116_AC_OFFSET = 32768.0f;
+constexpr float RHS2116_DC_OFFSET = 512.0f;
+constexpr float RHS2116_DIVISOR = 1000.0f;
+
+static inline void convertRhs2116Scalar(const uint16_t* ac, const uint16_t* dc, const size_t& count, float* acOut, float* dcOut){
+	for(size_t i = 0; i < count; ++i){
+		acOut[i] = RHS2116_AC_SCALE * ((float)ac[i] - RHS2116_AC_OFFSET) / RHS2116_DIVISOR;
+		dcOut[i] = RHS2116_DC_SCALE * ((float)dc[i] - RHS2116_DC_OFFSET) / RHS2116_DIVISOR;
+	}
+}
+
+static inline void gatherRhs2116Scalar(const uint8_t* base, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& count, float* acOut, float* dcOut){
+	for(size_t i = 0; i < count; ++i){
+		uint16_t ac, dc;
+		std::memcpy(&ac, base + acOffsets[i], sizeof(uint16_t));
+		std::memcpy(&dc, base + acOffsets[i] + dcByteOffset, sizeof(uint16_t));
+		acOut[i] = RHS2116_AC_SCALE * ((float)ac - RHS2116_AC_OFFSET) / RHS2116_DIVISOR;
+		dcOut[i] = RHS2116_DC_SCALE * ((float)dc - RHS2116_DC_OFFSET) / RHS2116_DIVISOR;
+	}
+}
+
+// block variant: numSamples rows of packed device frames rowBytes apart, written
+// channel major so acOut[probe * stride + sample] (the MultiFrameBlock layout)
+static inline void gatherRhs2116BlockScalar(const uint8_t* base, const size_t& rowBytes, const size_t& numSamples, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& numProbes, const size_t& stride, float* acOut, float* dcOut){
+	for(size_t probe = 0; probe < numProbes; ++probe){
+		const uint8_t* src = base + acOffsets[probe];
+		float* ac = acOut + probe * stride;
+		float* dc = dcOut + probe * stride;
+		for(size_t i = 0; i < numSamples; ++i){
+			uint16_t a, d;
+			std::memcpy(&a, src + i * rowBytes, sizeof(uint16_t));
+			std::memcpy(&d, src + i * rowBytes + dcByteOffset, sizeof(uint16_t));
+			ac[i] = RHS2116_AC_SCALE * ((float)a - RHS2116_AC_OFFSET) / RHS2116_DIVISOR;
+			dc[i] = RHS2116_DC_SCALE * ((float)d - RHS2116_DC_OFFSET) / RHS2116_DIVISOR;
+		}
+	}
+}
+
+#ifdef ONI_SIMD_X86
+
+ONI_SIMD_TARGET_SSE41 static inline void convertRhs2116Sse41(const uint16_t* ac, const uint16_t* dc, const size_t& count, float* acOut, float* dcOut){
+	const __m128 acScale = _mm_set1_ps(RHS2116_AC_SCALE);
+	const __m128 dcScale = _mm_set1_ps(RHS2116_DC_SCALE);
+	const __m128 acOffset = _mm_set1_ps(RHS2116_AC_OFFSET);
+	const __m128 dcOffset = _mm_set1_ps(RHS2116_DC_OFFSET);
+	const __m128 divisor = _mm_set1_ps(RHS2116_DIVISOR);
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4){
+		__m128 a = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(ac + i))));
+		__m128 d = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(dc + i))));
+		_mm_storeu_ps(acOut + i, _mm_div_ps(_mm_mul_ps(acScale, _mm_sub_ps(a, acOffset)), divisor));
+		_mm_storeu_ps(dcOut + i, _mm_div_ps(_mm_mul_ps(dcScale, _mm_sub_ps(d, dcOffset)), divisor));
+	}
+	convertRhs2116Scalar(ac + i, dc + i, count - i, acOut + i, dcOut + i);
+}
+
+ONI_SIMD_TARGET_SSE41 static inline void gatherRhs2116Sse41(const uint8_t* base, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& count, float* acOut, float* dcOut){
+	// no hardware gather before avx2, so pick the four lanes by hand and convert together
+	const __m128 acScale = _mm_set1_ps(RHS2116_AC_SCALE);
+	const __m128 dcScale = _mm_set1_ps(RHS2116_DC_SCALE);
+	const __m128 acOffset = _mm_set1_ps(RHS2116_AC_OFFSET);
+	const __m128 dcOffset = _mm_set1_ps(RHS2116_DC_OFFSET);
+	const __m128 divisor = _mm_set1_ps(RHS2116_DIVISOR);
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4){
+		const int32_t* o = acOffsets + i;
+		__m128i a = _mm_setr_epi32(*(const uint16_t*)(base + o[0]), *(const uint16_t*)(base + o[1]), *(const uint16_t*)(base + o[2]), *(const uint16_t*)(base + o[3]));
+		__m128i d = _mm_setr_epi32(*(const uint16_t*)(base + o[0] + dcByteOffset), *(const uint16_t*)(base + o[1] + dcByteOffset), *(const uint16_t*)(base + o[2] + dcByteOffset), *(const uint16_t*)(base + o[3] + dcByteOffset));
+		_mm_storeu_ps(acOut + i, _mm_div_ps(_mm_mul_ps(acScale, _mm_sub_ps(_mm_cvtepi32_ps(a), acOffset)), divisor));
+		_mm_storeu_ps(dcOut + i, _mm_div_ps(_mm_mul_ps(dcScale, _mm_sub_ps(_mm_cvtepi32_ps(d), dcOffset)), divisor));
+	}
+	gatherRhs2116Scalar(base, acOffsets + i, dcByteOffset, count - i, acOut + i, dcOut + i);
+}
+
+ONI_SIMD_TARGET_AVX2 static inline void convertRhs2116Avx2(const uint16_t* ac, const uint16_t* dc, const size_t& count, float* acOut, float* dcOut){
+	const __m256 acScale = _mm256_set1_ps(RHS2116_AC_SCALE);
+	const __m256 dcScale = _mm256_set1_ps(RHS2116_DC_SCALE);
+	const __m256 acOffset = _mm256_set1_ps(RHS2116_AC_OFFSET);
+	const __m256 dcOffset = _mm256_set1_ps(RHS2116_DC_OFFSET);
+	const __m256 divisor = _mm256_set1_ps(RHS2116_DIVISOR);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8){
+		__m256 a = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(ac + i))));
+		__m256 d = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(dc + i))));
+		_mm256_storeu_ps(acOut + i, _mm256_div_ps(_mm256_mul_ps(acScale, _mm256_sub_ps(a, acOffset)), divisor));
+		_mm256_storeu_ps(dcOut + i, _mm256_div_ps(_mm256_mul_ps(dcScale, _mm256_sub_ps(d, dcOffset)), divisor));
+	}
+	convertRhs2116Scalar(ac + i, dc + i, count - i, acOut + i, dcOut + i);
+}
+
+ONI_SIMD_TARGET_AVX2 static inline void gatherRhs2116Avx2(const uint8_t* base, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& count, float* acOut, float* dcOut){
+	// 32 bit gathers at byte offsets pick up the wanted uint16 in the low half
+	// (little endian) and whatever follows it in the frame in the high half, which
+	// gets masked off; the offsets always leave at least 2 bytes of frame after the sample
+	const __m256 acScale = _mm256_set1_ps(RHS2116_AC_SCALE);
+	const __m256 dcScale = _mm256_set1_ps(RHS2116_DC_SCALE);
+	const __m256 acOffset = _mm256_set1_ps(RHS2116_AC_OFFSET);
+	const __m256 dcOffset = _mm256_set1_ps(RHS2116_DC_OFFSET);
+	const __m256 divisor = _mm256_set1_ps(RHS2116_DIVISOR);
+	const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+	const __m256i dcShift = _mm256_set1_epi32(dcByteOffset);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8){
+		__m256i idx = _mm256_loadu_si256((const __m256i*)(acOffsets + i));
+		__m256i a = _mm256_and_si256(_mm256_i32gather_epi32((const int*)base, idx, 1), lowMask);
+		__m256i d = _mm256_and_si256(_mm256_i32gather_epi32((const int*)base, _mm256_add_epi32(idx, dcShift), 1), lowMask);
+		_mm256_storeu_ps(acOut + i, _mm256_div_ps(_mm256_mul_ps(acScale, _mm256_sub_ps(_mm256_cvtepi32_ps(a), acOffset)), divisor));
+		_mm256_storeu_ps(dcOut + i, _mm256_div_ps(_mm256_mul_ps(dcScale, _mm256_sub_ps(_mm256_cvtepi32_ps(d), dcOffset)), divisor));
+	}
+	gatherRhs2116Scalar(base, acOffsets + i, dcByteOffset, count - i, acOut + i, dcOut + i);
+}
+
+ONI_SIMD_TARGET_SSE41 static inline void gatherRhs2116BlockSse41(const uint8_t* base, const size_t& rowBytes, const size_t& numSamples, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& numProbes, const size_t& stride, float* acOut, float* dcOut){
+	const __m128 acScale = _mm_set1_ps(RHS2116_AC_SCALE);
+	const __m128 dcScale = _mm_set1_ps(RHS2116_DC_SCALE);
+	const __m128 acOffset = _mm_set1_ps(RHS2116_AC_OFFSET);
+	const __m128 dcOffset = _mm_set1_ps(RHS2116_DC_OFFSET);
+	const __m128 divisor = _mm_set1_ps(RHS2116_DIVISOR);
+	for(size_t probe = 0; probe < numProbes; ++probe){
+		const uint8_t* src = base + acOffsets[probe];
+		float* ac = acOut + probe * stride;
+		float* dc = dcOut + probe * stride;
+		size_t i = 0;
+		for(; i + 4 <= numSamples; i += 4){
+			const uint8_t* r = src + i * rowBytes;
+			__m128i a = _mm_setr_epi32(*(const uint16_t*)(r), *(const uint16_t*)(r + rowBytes), *(const uint16_t*)(r + rowBytes * 2), *(const uint16_t*)(r + rowBytes * 3));
+			r += dcByteOffset;
+			__m128i d = _mm_setr_epi32(*(const uint16_t*)(r), *(const uint16_t*)(r + rowBytes), *(const uint16_t*)(r + rowBytes * 2), *(const uint16_t*)(r + rowBytes * 3));
+			_mm_storeu_ps(ac + i, _mm_div_ps(_mm_mul_ps(acScale, _mm_sub_ps(_mm_cvtepi32_ps(a), acOffset)), divisor));
+			_mm_storeu_ps(dc + i, _mm_div_ps(_mm_mul_ps(dcScale, _mm_sub_ps(_mm_cvtepi32_ps(d), dcOffset)), divisor));
+		}
+		if(i < numSamples) gatherRhs2116BlockScalar(base + i * rowBytes, rowBytes, numSamples - i, acOffsets + probe, dcByteOffset, 1, stride, ac + i, dc + i);
+	}
+}
+
+ONI_SIMD_TARGET_AVX2 static inline void gatherRhs2116BlockAvx2(const uint8_t* base, const size_t& rowBytes, const size_t& numSamples, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& numProbes, const size_t& stride, float* acOut, float* dcOut){
+	// same masked 32 bit gather as gatherRhs2116Avx2 but walking down one probe's
+	// samples, so each probe's lane comes out contiguous
+	const __m256 acScale = _mm256_set1_ps(RHS2116_AC_SCALE);
+	const __m256 dcScale = _mm256_set1_ps(RHS2116_DC_SCALE);
+	const __m256 acOffset = _mm256_set1_ps(RHS2116_AC_OFFSET);
+	const __m256 dcOffset = _mm256_set1_ps(RHS2116_DC_OFFSET);
+	const __m256 divisor = _mm256_set1_ps(RHS2116_DIVISOR);
+	const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+	const __m256i rows = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)rowBytes));
+	const __m256i rowStep = _mm256_set1_epi32((int)(rowBytes * 8));
+	for(size_t probe = 0; probe < numProbes; ++probe){
+		float* ac = acOut + probe * stride;
+		float* dc = dcOut + probe * stride;
+		__m256i acIdx = _mm256_add_epi32(rows, _mm256_set1_epi32(acOffsets[probe]));
+		__m256i dcIdx = _mm256_add_epi32(acIdx, _mm256_set1_epi32(dcByteOffset));
+		size_t i = 0;
+		for(; i + 8 <= numSamples; i += 8){
+			__m256i a = _mm256_and_si256(_mm256_i32gather_epi32((const int*)base, acIdx, 1), lowMask);
+			__m256i d = _mm256_and_si256(_mm256_i32gather_epi32((const int*)base, dcIdx, 1), lowMask);
+			_mm256_storeu_ps(ac + i, _mm256_div_ps(_mm256_mul_ps(acScale, _mm256_sub_ps(_mm256_cvtepi32_ps(a), acOffset)), divisor));
+			_mm256_storeu_ps(dc + i, _mm256_div_ps(_mm256_mul_ps(dcScale, _mm256_sub_ps(_mm256_cvtepi32_ps(d), dcOffset)), divisor));
+			acIdx = _mm256_add_epi32(acIdx, rowStep);
+			dcIdx = _mm256_add_epi32(dcIdx, rowStep);
+		}
+		if(i < numSamples) gatherRhs2116BlockScalar(base + i * rowBytes, rowBytes, numSamples - i, acOffsets + probe, dcByteOffset, 1, stride, ac + i, dc + i);
+	}
+}
+
+#endif
+
+// contiguous ac/dc arrays (one device, no channel map)
+static inline void convertRhs2116(const uint16_t* ac, const uint16_t* dc, const size_t& count, float* acOut, float* dcOut, const InstructionSet& instructionSet = getInstructionSet()){
+#ifdef ONI_SIMD_X86
+	switch(instructionSet){
+	case AVX512:
+	case AVX2: {convertRhs2116Avx2(ac, dc, count, acOut, dcOut); return;}
+	case SSE41: {convertRhs2116Sse41(ac, dc, count, acOut, dcOut); return;}
+	default: break;
+	}
+#endif
+	convertRhs2116Scalar(ac, dc, count, acOut, dcOut);
+}
+
+// gathered from packed device frames: acOut[i] comes from base + acOffsets[i], dcOut[i] from there + dcByteOffset
+static inline void gatherRhs2116(const uint8_t* base, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& count, float* acOut, float* dcOut, const InstructionSet& instructionSet = getInstructionSet()){
+#ifdef ONI_SIMD_X86
+	switch(instructionSet){
+	case AVX512:
+	case AVX2: {gatherRhs2116Avx2(base, acOffsets, dcByteOffset, count, acOut, dcOut); return;}
+	case SSE41: {gatherRhs2116Sse41(base, acOffsets, dcByteOffset, count, acOut, dcOut); return;}
+	default: break;
+	}
+#endif
+	gatherRhs2116Scalar(base, acOffsets, dcByteOffset, count, acOut, dcOut);
+}
+
+// a whole block of device frames into channel major lanes: acOut[probe * stride + sample]
+static inline void gatherRhs2116Block(const uint8_t* base, const size_t& rowBytes, const size_t& numSamples, const int32_t* acOffsets, const int32_t& dcByteOffset, const size_t& numProbes, const size_t& stride, float* acOut, float* dcOut, const InstructionSet& instructionSet = getInstructionSet()){
+#ifdef ONI_SIMD_X86
+	switch(instructionSet){
+	case AVX512:
+	case AVX2: {gatherRhs2116BlockAvx2(base, rowBytes, numSamples, acOffsets, dcByteOffset, numProbes, stride, acOut, dcOut); return;}
+	case SSE41: {gatherRhs2116BlockSse41(base, rowBytes, numSamples, acOffsets, dcByteOffset, numProbes, stride, acOut, dcOut); return;}
+	default: break;
+	}
+#endif
+	gatherRhs2116BlockScalar(base, rowBytes, numSamples, acOffsets, dcByteOffset, numProbes, stride, acOut, dcOut);
+}
+
+
+// Threshold crossings
+//
+// sets bit i of belowMask where samples[i] < lo and of aboveMask where samples[i] > hi,
+// packed 64 samples to a word, so the spike detector can skip straight to the hits
+
+static inline void thresholdMaskScalar(const float* samples, const size_t& count, const float& lo, const float& hi, uint64_t* belowMask, uint64_t* aboveMask){
+	std::memset(belowMask, 0, sizeof(uint64_t) * ((count + 63) / 64));
+	std::memset(aboveMask, 0, sizeof(uint64_t) * ((count + 63) / 64));
+	for(size_t i = 0; i < count; ++i){
+		if(samples[i] < lo) belowMask[i / 64] |= uint64_t(1) << (i % 64);
+		if(samples[i] > hi) aboveMask[i / 64] |= uint64_t(1) << (i % 64);
+	}
+}
+
+#ifdef ONI_SIMD_X86
+
+ONI_SIMD_TARGET_SSE41 static inline void thresholdMaskSse41(const float* samples, const size_t& count, const float& lo, const float& hi, uint64_t* belowMask, uint64_t* aboveMask){
+	const __m128 vlo = _mm_set1_ps(lo);
+	const __m128 vhi = _mm_set1_ps(hi);
+	size_t i = 0;
+	for(; i + 64 <= count; i += 64){
+		uint64_t below = 0, above = 0;
+		for(size_t j = 0; j < 64; j += 4){
+			const __m128 v = _mm_loadu_ps(samples + i + j);
+			below |= (uint64_t)_mm_movemask_ps(_mm_cmplt_ps(v, vlo)) << j;
+			above |= (uint64_t)_mm_movemask_ps(_mm_cmpgt_ps(v, vhi)) << j;
+		}
+		belowMask[i / 64] = below;
+		aboveMask[i / 64] = above;
+	}
+	if(i < count) thresholdMaskScalar(samples + i, count - i, lo, hi, belowMask + i / 64, aboveMask + i / 64);
+}
+
+ONI_SIMD_TARGET_AVX2 static inline void thresholdMaskAvx2(const float* samples, const size_t& count, const float& lo, const float& hi, uint64_t* belowMask, uint64_t* aboveMask){
+	const __m256 vlo = _mm256_set1_ps(lo);
+	const __m256 vhi = _mm256_set1_ps(hi);
+	size_t i = 0;
+	for(; i + 64 <= count; i += 64){
+		uint64_t below = 0, above = 0;
+		for(size_t j = 0; j < 64; j += 8){
+			const __m256 v = _mm256_loadu_ps(samples + i + j);
+			below |= (uint64_t)_mm256_movemask_ps(_mm256_cmp_ps(v, vlo, _CMP_LT_OQ)) << j;
+			above |= (uint64_t)_mm256_movemask_ps(_mm256_cmp_ps(v, vhi, _CMP_GT_OQ)) << j;
+		}
+		belowMask[i / 64] = below;
+		aboveMask[i / 64] = above;
+	}
+	if(i < count) thresholdMaskScalar(samples + i, count - i, lo, hi, belowMask + i / 64, aboveMask + i / 64);
+}
+
+#endif
+
+static inline void thresholdMask(const float* samples, const size_t& count, const float& lo, const float& hi, uint64_t* belowMask, uint64_t* aboveMask){
+#ifdef ONI_SIMD_X86
+	switch(getInstructionSet()){
+	case AVX512:
+	case AVX2: {thresholdMaskAvx2(samples, count, lo, hi, belowMask, aboveMask); return;}
+	case SSE41: {thresholdMaskSse41(samples, count, lo, hi, belowMask, aboveMask); return;}
+	default: break;
+	}
+#endif
+	thresholdMaskScalar(samples, count, lo, hi, belowMask, aboveMask);
+}
+
+
+// Sum of squared differences
+//
+// between two equal length float arrays, the kernel the spike sorter matches
+// waveforms to templates with
+
+static inline float sumSquaredDifferenceScalar(const float* a, const float* b, const size_t& count){
+	float sum = 0;
+	for(size_t i = 0; i < count; ++i){
+		const float d = a[i] - b[i];
+		sum += d * d;
+	}
+	return sum;
+}
+
+#ifdef ONI_SIMD_X86
+
+ONI_SIMD_TARGET_SSE41 static inline float sumSquaredDifferenceSse41(const float* a, const float* b, const size_t& count){
+	__m128 acc = _mm_setzero_ps();
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4){
+		const __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+		acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+	}
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc) + sumSquaredDifferenceScalar(a + i, b + i, count - i);
+}
+
+ONI_SIMD_TARGET_AVX2 static inline float sumSquaredDifferenceAvx2(const float* a, const float* b, const size_t& count){
+	__m256 acc = _mm256_setzero_ps();
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8){
+		const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+	}
+	__m128 acc4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	acc4 = _mm_add_ps(acc4, _mm_movehl_ps(acc4, acc4));
+	acc4 = _mm_add_ss(acc4, _mm_shuffle_ps(acc4, acc4, 1));
+	return _mm_cvtss_f32(acc4) + sumSquaredDifferenceScalar(a + i, b + i, count - i);
+}
+
+#endif
+
+static inline float sumSquaredDifference(const float* a, const float* b, const size_t& count){
+#ifdef ONI_SIMD_X86
+	switch(getInstructionSet()){
+	case AVX512:
+	case AVX2: {return sumSquaredDifferenceAvx2(a, b, count);}
+	case SSE41: {return sumSquaredDifferenceSse41(a, b, count);}
+	default: break;
+	}
+#endif
+	return sumSquaredDifferenceScalar(a, b, count);
+}
+
+
+// Scale and add
+//
+// dst[i] += scale * src[i], what the ReferenceProcessor builds its references from and
+// takes them off the probes with
+
+static inline void scaleAddScalar(float* dst, const float* src, const float& scale, const size_t& count){
+	for(size_t i = 0; i < count; ++i) dst[i] += scale * src[i];
+}
+
+#ifdef ONI_SIMD_X86
+
+ONI_SIMD_TARGET_SSE41 static inline void scaleAddSse41(float* dst, const float* src, const float& scale, const size_t& count){
+	const __m128 s = _mm_set1_ps(scale);
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4){
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(s, _mm_loadu_ps(src + i))));
+	}
+	scaleAddScalar(dst + i, src + i, scale, count - i);
+}
+
+ONI_SIMD_TARGET_AVX2 static inline void scaleAddAvx2(float* dst, const float* src, const float& scale, const size_t& count){
+	const __m256 s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8){
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(s, _mm256_loadu_ps(src + i))));
+	}
+	scaleAddScalar(dst + i, src + i, scale, count - i);
+}
+
+#endif
+
+static inline void scaleAdd(float* dst, const float* src, const float& scale, const size_t& count){
+#ifdef ONI_SIMD_X86
+	switch(getInstructionSet()){
+	case AVX512:
+	case AVX2: {scaleAddAvx2(dst, src, scale, count); return;}
+	case SSE41: {scaleAddSse41(dst, src, scale, count); return;}
+	default: break;
+	}
+#endif
+	scaleAddScalar(dst, src, scale, count);
+}
+
+
+// Biquad cascade (transposed direct form II)
+//
+// Runs numStages second order sections over numChannels channel major lanes in
+// place (channel c's sample i at samples[c * stride + i], the MultiFrameBlock layout;
+// a single frame is stride 1 and one sample). coefficients are b0 b1 b2 a1 a2 per
+// stage with a0 normalised out. state keeps s1 and s2 per stage with the channels
+// side by side, state[(stage * 2 + k) * stateStride + channel], so the SIMD kernels
+// run one stage across 4/8/16 channels per instruction. They transpose tiles of
+// samples into that layout, run every stage over the tile and transpose back
+
+static constexpr size_t MAX_BIQUAD_STAGES = 16;
+
+static inline void biquadCascadeScalar(const float* coefficients, const size_t& numStages, float* state, const size_t& stateStride,
+									   float* samples, const size_t& stride, const size_t& numChannels, const size_t& numSamples){
+	for(size_t channel = 0; channel < numChannels; ++channel){
+		float* lane = samples + channel * stride;
+		for(size_t stage = 0; stage < numStages; ++stage){
+			const float* c = coefficients + stage * 5;
+			float s1 = state[(stage * 2) * stateStride + channel]; // locals so they stay in registers, the lane could alias them
+			float s2 = state[(stage * 2 + 1) * stateStride + channel];
+			const float b0 = c[0], b1 = c[1], b2 = c[2], a1 = c[3], a2 = c[4];
+			for(size_t i = 0; i < numSamples; ++i){
+				const float x = lane[i];
+				const float y = b0 * x + s1;
+				s1 = b1 * x - a1 * y + s2;
+				s2 = b2 * x - a2 * y;
+				lane[i] = y;
+			}
+			state[(stage * 2) * stateStride + channel] = s1;
+			state[(stage * 2 + 1) * stateStride + channel] = s2;
+		}
+	}
+}
+
+#ifdef ONI_SIMD_X86
+
+ONI_SIMD_TARGET_SSE41 static inline void biquadCascadeSse41(const float* coefficients, const size_t& numStages, float* state, const size_t& stateStride,
+															float* samples, const size_t& stride, const size_t& numChannels, const size_t& numSamples){
+
+	const size_t numGroups = numChannels / 4;
+
+	__m128 b0[MAX_BIQUAD_STAGES], b1[MAX_BIQUAD_STAGES], b2[MAX_BIQUAD_STAGES], a1[MAX_BIQUAD_STAGES], a2[MAX_BIQUAD_STAGES];
+	for(size_t stage = 0; stage < numStages; ++stage){
+		b0[stage] = _mm_set1_ps(coefficients[stage * 5 + 0]);
+		b1[stage] = _mm_set1_ps(coefficients[stage * 5 + 1]);
+		b2[stage] = _mm_set1_ps(coefficients[stage * 5 + 2]);
+		a1[stage] = _mm_set1_ps(coefficients[stage * 5 + 3]);
+		a2[stage] = _mm_set1_ps(coefficients[stage * 5 + 4]);
+	}
+
+	for(size_t group = 0; group < numGroups; ++group){
+
+		float* lanes = samples + group * 4 * stride;
+		float* groupState = state + group * 4;
+
+		__m128 s1[MAX_BIQUAD_STAGES], s2[MAX_BIQUAD_STAGES];
+		for(size_t stage = 0; stage < numStages; ++stage){
+			s1[stage] = _mm_loadu_ps(groupState + (stage * 2) * stateStride);
+			s2[stage] = _mm_loadu_ps(groupState + (stage * 2 + 1) * stateStride);
+		}
+
+		size_t i = 0;
+		for(; i + 4 <= numSamples; i += 4){
+			__m128 r0 = _mm_loadu_ps(lanes + i), r1 = _mm_loadu_ps(lanes + stride + i), r2 = _mm_loadu_ps(lanes + stride * 2 + i), r3 = _mm_loadu_ps(lanes + stride * 3 + i);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			__m128 r[4] = {r0, r1, r2, r3};
+			for(size_t j = 0; j < 4; ++j){
+				__m128 x = r[j];
+				for(size_t stage = 0; stage < numStages; ++stage){
+					const __m128 y = _mm_add_ps(_mm_mul_ps(b0[stage], x), s1[stage]);
+					s1[stage] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1[stage], x), _mm_mul_ps(a1[stage], y)), s2[stage]);
+					s2[stage] = _mm_sub_ps(_mm_mul_ps(b2[stage], x), _mm_mul_ps(a2[stage], y));
+					x = y;
+				}
+				r[j] = x;
+			}
+			_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+			_mm_storeu_ps(lanes + i, r[0]);
+			_mm_storeu_ps(lanes + stride + i, r[1]);
+			_mm_storeu_ps(lanes + stride * 2 + i, r[2]);
+			_mm_storeu_ps(lanes + stride * 3 + i, r[3]);
+		}
+
+		for(; i < numSamples; ++i){ // what's left of the block (or a single frame) a sample at a time
+			__m128 x = _mm_setr_ps(lanes[i], lanes[stride + i], lanes[stride * 2 + i], lanes[stride * 3 + i]);
+			for(size_t stage = 0; stage < numStages; ++stage){
+				const __m128 y = _mm_add_ps(_mm_mul_ps(b0[stage], x), s1[stage]);
+				s1[stage] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1[stage], x), _mm_mul_ps(a1[stage], y)), s2[stage]);
+				s2[stage] = _mm_sub_ps(_mm_mul_ps(b2[stage], x), _mm_mul_ps(a2[stage], y));
+				x = y;
+			}
+			alignas(16) float out[4];
+			_mm_store_ps(out, x);
+			for(size_t c = 0; c < 4; ++c) lanes[stride * c + i] = out[c];
+		}
+
+		for(size_t stage = 0; stage < numStages; ++stage){
+			_mm_storeu_ps(groupState + (stage * 2) * stateStride, s1[stage]);
+			_mm_storeu_ps(groupState + (stage * 2 + 1) * stateStride, s2[stage]);
+		}
+
+	}
+
+	const size_t done = numGroups * 4;
+	if(done < numChannels) biquadCascadeScalar(coefficients, numStages, state + done, stateStride, samples + done * stride, stride, numChannels - done, numSamples);
+
+}
+
+// r[j] = column j of the 8 x 8 tile held in rows r[0..7]
+ONI_SIMD_TARGET_AVX2 static inline void transpose8x8(__m256* r){
+	const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+	const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+	const __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+	const __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+	const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+	const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+	r[0] = _mm256_permute2f128_ps(u0, u4, 0x20); r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+	r[2] = _mm256_permute2f128_ps(u2, u6, 0x20); r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+	r[4] = _mm256_permute2f128_ps(u0, u4, 0x31); r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+	r[6] = _mm256_permute2f128_ps(u2, u6, 0x31); r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+ONI_SIMD_TARGET_AVX2 static inline void biquadCascadeAvx2(const float* coefficients, const size_t& numStages, float* state, const size_t& stateStride,
+														  float* samples, const size_t& stride, const size_t& numChannels, const size_t& numSamples){
+
+	const size_t numGroups = numChannels / 8;
+
+	__m256 b0[MAX_BIQUAD_STAGES], b1[MAX_BIQUAD_STAGES], b2[MAX_BIQUAD_STAGES], a1[MAX_BIQUAD_STAGES], a2[MAX_BIQUAD_STAGES];
+	for(size_t stage = 0; stage < numStages; ++stage){
+		b0[stage] = _mm256_set1_ps(coefficients[stage * 5 + 0]);
+		b1[stage] = _mm256_set1_ps(coefficients[stage * 5 + 1]);
+		b2[stage] = _mm256_set1_ps(coefficients[stage * 5 + 2]);
+		a1[stage] = _mm256_set1_ps(coefficients[stage * 5 + 3]);
+		a2[stage] = _mm256_set1_ps(coefficients[stage * 5 + 4]);
+	}
+
+	for(size_t group = 0; group < numGroups; ++group){
+
+		float* lanes = samples + group * 8 * stride;
+		float* groupState = state + group * 8;
+
+		__m256 s1[MAX_BIQUAD_STAGES], s2[MAX_BIQUAD_STAGES];
+		for(size_t stage = 0; stage < numStages; ++stage){
+			s1[stage] = _mm256_loadu_ps(groupState + (stage * 2) * stateStride);
+			s2[stage] = _mm256_loadu_ps(groupState + (stage * 2 + 1) * stateStride);
+		}
+
+		size_t i = 0;
+		for(; i + 8 <= numSamples; i += 8){
+			__m256 r[8];
+			for(size_t c = 0; c < 8; ++c) r[c] = _mm256_loadu_ps(lanes + stride * c + i);
+			transpose8x8(r);
+			for(size_t j = 0; j < 8; ++j){
+				__m256 x = r[j];
+				for(size_t stage = 0; stage < numStages; ++stage){
+					const __m256 y = _mm256_add_ps(_mm256_mul_ps(b0[stage], x), s1[stage]);
+					s1[stage] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1[stage], x), _mm256_mul_ps(a1[stage], y)), s2[stage]);
+					s2[stage] = _mm256_sub_ps(_mm256_mul_ps(b2[stage], x), _mm256_mul_ps(a2[stage], y));
+					x = y;
+				}
+				r[j] = x;
+			}
+			transpose8x8(r);
+			for(size_t c = 0; c < 8; ++c) _mm256_storeu_ps(lanes + stride * c + i, r[c]);
+		}
+
+		for(; i < numSamples; ++i){ // what's left of the block (or a single frame) a sample at a time
+			alignas(32) float in[8];
+			for(size_t c = 0; c < 8; ++c) in[c] = lanes[stride * c + i];
+			__m256 x = _mm256_load_ps(in);
+			for(size_t stage = 0; stage < numStages; ++stage){
+				const __m256 y = _mm256_add_ps(_mm256_mul_ps(b0[stage], x), s1[stage]);
+				s1[stage] = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1[stage], x), _mm256_mul_ps(a1[stage], y)), s2[stage]);
+				s2[stage] = _mm256_sub_ps(_mm256_mul_ps(b2[stage], x), _mm256_mul_ps(a2[stage], y));
+				x = y;
+			}
+			_mm256_store_ps(in, x);
+			for(size_t c = 0; c < 8; ++c) lanes[stride * c + i] = in[c];
+		}
+
+		for(size_t stage = 0; stage < numStages; ++stage){
+			_mm256_storeu_ps(groupState + (stage * 2) * stateStride, s1[stage]);
+			_mm256_storeu_ps(groupState + (stage * 2 + 1) * stateStride, s2[stage]);
+		}
+
+	}
+
+	const size_t done = numGroups * 8;
+	if(done < numChannels) biquadCascadeSse41(coefficients, numStages, state + done, stateStride, samples + done * stride, stride, numChannels - done, numSamples);
+
+}
+
+// 16 channels at a time as two 8 x 8 tiles, joined into one register for the stages
+ONI_SIMD_TARGET_AVX512 static inline void biquadCascadeAvx512(const float* coefficients, const size_t& numStages, float* state, const size_t& stateStride,
+															  float* samples, const size_t& stride, const size_t& numChannels, const size_t& numSamples){
+
+	const size_t numGroups = numChannels / 16;
+
+	__m512 b0[MAX_BIQUAD_STAGES], b1[MAX_BIQUAD_STAGES], b2[MAX_BIQUAD_STAGES], a1[MAX_BIQUAD_STAGES], a2[MAX_BIQUAD_STAGES];
+	for(size_t stage = 0; stage < numStages; ++stage){
+		b0[stage] = _mm512_set1_ps(coefficients[stage * 5 + 0]);
+		b1[stage] = _mm512_set1_ps(coefficients[stage * 5 + 1]);
+		b2[stage] = _mm512_set1_ps(coefficients[stage * 5 + 2]);
+		a1[stage] = _mm512_set1_ps(coefficients[stage * 5 + 3]);
+		a2[stage] = _mm512_set1_ps(coefficients[stage * 5 + 4]);
+	}
+
+	for(size_t group = 0; group < numGroups; ++group){
+
+		float* lanes = samples + group * 16 * stride;
+		float* groupState = state + group * 16;
+
+		__m512 s1[MAX_BIQUAD_STAGES], s2[MAX_BIQUAD_STAGES];
+		for(size_t stage = 0; stage < numStages; ++stage){
+			s1[stage] = _mm512_loadu_ps(groupState + (stage * 2) * stateStride);
+			s2[stage] = _mm512_loadu_ps(groupState + (stage * 2 + 1) * stateStride);
+		}
+
+		size_t i = 0;
+		for(; i + 8 <= numSamples; i += 8){
+			__m256 lo[8], hi[8];
+			for(size_t c = 0; c < 8; ++c){
+				lo[c] = _mm256_loadu_ps(lanes + stride * c + i);
+				hi[c] = _mm256_loadu_ps(lanes + stride * (c + 8) + i);
+			}
+			transpose8x8(lo);
+			transpose8x8(hi);
+			for(size_t j = 0; j < 8; ++j){
+				__m512 x = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(lo[j])), _mm256_castps_pd(hi[j]), 1));
+				for(size_t stage = 0; stage < numStages; ++stage){
+					const __m512 y = _mm512_add_ps(_mm512_mul_ps(b0[stage], x), s1[stage]);
+					s1[stage] = _mm512_add_ps(_mm512_sub_ps(_mm512_mul_ps(b1[stage], x), _mm512_mul_ps(a1[stage], y)), s2[stage]);
+					s2[stage] = _mm512_sub_ps(_mm512_mul_ps(b2[stage], x), _mm512_mul_ps(a2[stage], y));
+					x = y;
+				}
+				lo[j] = _mm512_castps512_ps256(x);
+				hi[j] = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1));
+			}
+			transpose8x8(lo);
+			transpose8x8(hi);
+			for(size_t c = 0; c < 8; ++c){
+				_mm256_storeu_ps(lanes + stride * c + i, lo[c]);
+				_mm256_storeu_ps(lanes + stride * (c + 8) + i, hi[c]);
+			}
+		}
+
+		for(; i < numSamples; ++i){ // what's left of the block (or a single frame) a sample at a time
+			alignas(64) float in[16];
+			for(size_t c = 0; c < 16; ++c) in[c] = lanes[stride * c + i];
+			__m512 x = _mm512_load_ps(in);
+			for(size_t stage = 0; stage < numStages; ++stage){
+				const __m512 y = _mm512_add_ps(_mm512_mul_ps(b0[stage], x), s1[stage]);
+				s1[stage] = _mm512_add_ps(_mm512_sub_ps(_mm512_mul_ps(b1[stage], x), _mm512_mul_ps(a1[stage], y)), s2[stage]);
+				s2[stage] = _mm512_sub_ps(_mm512_mul_ps(b2[stage], x), _mm512_mul_ps(a2[stage], y));
+				x = y;
+			}
+			_mm512_store_ps(in, x);
+			for(size_t c = 0; c < 16; ++c) lanes[stride * c + i] = in[c];
+		}
+
+		for(size_t stage = 0; stage < numStages; ++stage){
+			_mm512_storeu_ps(groupState + (stage * 2) * stateStride, s1[stage]);
+			_mm512_storeu_ps(groupState + (stage * 2 + 1) * stateStride, s2[stage]);
+		}
+
+	}
+
+	const size_t done = numGroups * 16;
+	if(done < numChannels) biquadCascadeAvx2(coefficients, numStages, state + done, stateStride, samples + done * stride, stride, numChannels - done, numSamples);
+
+}
+
+#endif
+
+static inline void biquadCascade(const float* coefficients, const size_t& numStages, float* state, const size_t& stateStride,
+								 float* samples, const size_t& stride, const size_t& numChannels, const size_t& numSamples,
+								 const InstructionSet& instructionSet = getInstructionSet()){
+	assert(numStages <= MAX_BIQUAD_STAGES);
+#ifdef ONI_SIMD_X86
+	switch(instructionSet){
+	case AVX512: {biquadCascadeAvx512(coefficients, numStages, state, stateStride, samples, stride, numChannels, numSamples); return;}
+	case AVX2: {biquadCascadeAvx2(coefficients, numStages, state, stateStride, samples, stride, numChannels, numSamples); return;}
+	case SSE41: {biquadCascadeSse41(coefficients, numStages, state, stateStride, samples, stride, numChannels, numSamples); return;}
+	default: break;
+	}
+#endif
+	biquadCascadeScalar(coefficients, numStages, state, stateStride, samples, stride, numChannels, numSamples);
+}
+
+} // namespace Simd
+} // namespace ONI
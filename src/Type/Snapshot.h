@@ -0,0 +1,101 @@
+//
+//  Snapshot.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <memory>
+#include <atomic>
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+
+// Immutable snapshots published by one writer to any number of readers
+//
+// get() hands out a reference counted pointer to the latest snapshot, which stays as
+// it is for as long as the reader holds on to it however many publishes go by, so
+// nothing a reader is looking at is ever written to. The writer fills in back() and
+// publish() swaps it in. back() reuses an old snapshot once no reader holds it (only
+// the writer can still get at one that isn't published), so a steady publisher with
+// readers that let go doesn't allocate. Only one thread may write at a time.
+//
+// A reader that looks every sample can hold on to its snapshot and only get() a new
+// one when getGeneration() has moved on from the one it had.
+
+template<typename T>
+class Snapshot{
+
+public:
+
+	typedef std::shared_ptr<const T> Pointer;
+
+	Snapshot(){
+		store(std::make_shared<T>());
+	}
+
+	// any thread
+	inline Pointer get() const{
+#if defined(__cpp_lib_atomic_shared_ptr)
+		return current.load(std::memory_order_acquire);
+#else
+		return std::atomic_load_explicit(&current, std::memory_order_acquire);
+#endif
+	}
+
+	// any thread, counts publishes
+	inline uint64_t getGeneration() const{
+		return generation.load(std::memory_order_acquire);
+	}
+
+	// writer: the snapshot the next publish() will hand out, holding whatever it held
+	// when it was last published if it's being reused, default constructed if it isn't
+	inline T& back(){
+		if(spare == nullptr || spare.use_count() != 1){
+			spare = std::make_shared<T>();
+		}else{
+			std::atomic_thread_fence(std::memory_order_acquire); // after the last reader let go of it
+		}
+		return *spare;
+	}
+
+	// writer
+	inline void publish(){
+		if(spare == nullptr) back();
+		spare = store(std::move(spare));
+		generation.fetch_add(1, std::memory_order_release);
+	}
+
+	// writer
+	inline void publish(const T& value){
+		back() = value;
+		publish();
+	}
+
+protected:
+
+	// swaps next in and hands back what it replaced, which only the writer can still get at
+	inline std::shared_ptr<T> store(std::shared_ptr<const T> next){
+#if defined(__cpp_lib_atomic_shared_ptr)
+		return std::const_pointer_cast<T>(current.exchange(std::move(next), std::memory_order_acq_rel));
+#else
+		return std::const_pointer_cast<T>(std::atomic_exchange_explicit(&current, std::move(next), std::memory_order_acq_rel));
+#endif
+	}
+
+#if defined(__cpp_lib_atomic_shared_ptr)
+	std::atomic<std::shared_ptr<const T>> current;
+#else
+	std::shared_ptr<const T> current;
+#endif
+
+	std::shared_ptr<T> spare; // writer
+	std::atomic<uint64_t> generation = 0;
+
+};
+
+
+} // namespace ONI
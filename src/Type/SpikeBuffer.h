@@ -30,12 +30,18 @@
 namespace ONI{
 
 
+// Per probe rings of the most recent spikes
+//
+// The spikes live in one slab allocated on resize, each probe owning bufferSize
+// slots of it as its ring, so a push writes the spike once into the slot it
+// evicts and nothing is allocated after resize
+
 class SpikeBuffer{
 
 public:
 
 	virtual ~SpikeBuffer(){
-		rawSpikeBuffer.clear();
+		clear();
 	}
 
 	size_t resizeByNSpikes(const size_t& maxNumSpikes, const size_t& numProbes){
@@ -43,17 +49,11 @@ public:
 		bufferSize = maxNumSpikes;
 		this->numProbes = numProbes;
 
-		rawSpikeBuffer.clear();
-		currentBufferIDXs.clear();
-		bufferSampleCounts.clear();
+		clear();
 
-		rawSpikeBuffer.resize(numProbes);
+		spikeArena.resize(numProbes * bufferSize);
 		currentBufferIDXs.assign(numProbes, 0);
 		bufferSampleCounts.assign(numProbes, 0);
-		
-		for(size_t probe = 0; probe < numProbes; ++probe){
-			rawSpikeBuffer[probe].resize(bufferSize * 3);
-		}
 
 		bIsFrameNew = false;
 
@@ -67,7 +67,7 @@ public:
 	//}
 
 	void clear(){
-		rawSpikeBuffer.clear();
+		spikeArena.clear();
 		currentBufferIDXs.clear();
 		bufferSampleCounts.clear();
 	}
@@ -78,7 +78,7 @@ public:
 		const size_t& probe = spike.probe;
 		const size_t& currentBufferIndex = currentBufferIDXs[probe];
 
-		rawSpikeBuffer[probe][currentBufferIndex] = rawSpikeBuffer[probe][currentBufferIndex + bufferSize] = rawSpikeBuffer[probe][currentBufferIndex + bufferSize * 2] = spike;
+		spikeArena[probe * bufferSize + currentBufferIndex] = spike; // the slot under the write index holds the oldest spike
 
 		currentBufferIDXs[probe] = (currentBufferIndex + 1) % bufferSize;
 		bIsFrameNew = true;
@@ -100,22 +100,22 @@ public:
 		//std::memcpy(&to[0], &rawSpikeBuffer[currentBufferIndex], sizeof(ONI::Frame::Rhs2116MultiFrame) * bufferSize);
 	}
 
-	inline std::vector<std::vector<ONI::Spike>>& getUnderlyingBuffer(){ // this actually returns the whole buffer which is 3 times larger than needed
+	inline std::vector<ONI::Spike>& getUnderlyingBuffer(){ // the whole slab, in no particular order
 		//const std::lock_guard<std::mutex> lock(mutex);
-		return rawSpikeBuffer;
+		return spikeArena;
 	}
 
 	inline ONI::Spike& getSpikeAt(const size_t& probe, const int& idx){
 		//assert(idx > 0 && idx < bufferSize);
-		return rawSpikeBuffer[probe][idx + bufferSize];
+		return spikeArena[probe * bufferSize + (idx + bufferSize) % bufferSize]; // allow negative values by wrapping
 	}
 
-	inline std::vector<float>& getSpikeWaveAt(const size_t& probe, const int& idx){
-		return rawSpikeBuffer[probe][idx + bufferSize].rawWaveform;
+	inline float* getSpikeWaveAt(const size_t& probe, const int& idx){
+		return getSpikeAt(probe, idx).rawWaveform;
 	}
 
 	inline float* getRawSpikeWaveAt(const size_t& probe, const int& idx){
-		return rawSpikeBuffer[probe][idx + bufferSize].rawWaveform.data(); // allow negative values by wrapping 
+		return getSpikeAt(probe, idx).rawWaveform; // allow negative values by wrapping 
 	}
 
 	inline ONI::Spike& getCentralSpike(const size_t& probe){
@@ -123,7 +123,7 @@ public:
 	}
 
 	inline ONI::Spike& getLastSpike(const size_t& probe) {
-		return rawSpikeBuffer[probe][getLastIndex(probe)];
+		return getSpikeAt(probe, getLastIndex(probe));
 	}
 
 	const inline size_t getLastIndex(const size_t& probe){
@@ -153,7 +153,7 @@ public:
 protected:
 
 
-	std::vector<std::vector<ONI::Spike>> rawSpikeBuffer;
+	std::vector<ONI::Spike> spikeArena;	// numProbes x bufferSize
 
 	std::vector<size_t> currentBufferIDXs;
 	std::vector<size_t> bufferSampleCounts;
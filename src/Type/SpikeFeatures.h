@@ -0,0 +1,270 @@
+//
+//  SpikeFeatures.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <Eigen/Dense>
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <limits>
+
+#include "../Type/Log.h"
+#include "../Type/GlobalTypes.h"
+#include "../Type/RingBuffer.h"
+#include "../Type/Snapshot.h"
+
+#pragma once
+
+namespace ONI{
+
+struct SpikeComponents{
+	Eigen::VectorXf mean;
+	Eigen::MatrixXf components;			// numComponents x waveformLength, first row is the first principal component
+	Eigen::VectorXf explainedVariance;	// fraction of the total variance each component explains
+	uint64_t numSpikes = 0;				// spikes seen when these were solved, 0 until the first solve
+};
+
+// Per probe principal components of spike waveforms, kept up to date online
+//
+// The detection thread scores each spike against the current components (a small
+// matrix-vector product) and queues the waveform for a background thread. That
+// thread folds waveforms into an exponentially weighted mean and covariance per
+// probe (a rank one update each) and every refreshIntervalMs re-solves the eigen
+// vectors of the probes that changed. Solved components are published as immutable
+// snapshots (see Snapshot) that scoring holds on to between refreshes, so it never
+// waits on a solve and a solve never writes to components being scored against
+
+class SpikeFeatureExtractor{
+
+public:
+
+	typedef ONI::Snapshot<std::vector<SpikeComponents>>::Pointer ComponentsSnapshot;
+
+	~SpikeFeatureExtractor(){
+		stop();
+	}
+
+	// windowSpikes is roughly how many recent spikes the covariance remembers
+	void setup(const size_t& numProbes, const size_t& waveformLength, const size_t& numComponents, const size_t& windowSpikes = 2000){
+
+		stop();
+
+		this->numProbes = numProbes;
+		this->waveformLength = std::max(waveformLength, (size_t)1);
+		this->numComponents = std::clamp(numComponents, (size_t)1, std::min(MAX_SPIKE_FEATURES, this->waveformLength));
+		this->windowSpikes = std::max(windowSpikes, (size_t)1);
+
+		means.assign(numProbes, Eigen::VectorXf::Zero(this->waveformLength));
+		covariances.assign(numProbes, Eigen::MatrixXf::Zero(this->waveformLength, this->waveformLength));
+		spikeCounts.assign(numProbes, 0);
+		bChanged.assign(numProbes, false);
+
+		std::vector<SpikeComponents>& initial = published.back();
+		initial.resize(numProbes);
+		for(SpikeComponents& c : initial){
+			c.mean = Eigen::VectorXf::Zero(this->waveformLength);
+			c.components = Eigen::MatrixXf::Zero(this->numComponents, this->waveformLength);
+			c.explainedVariance = Eigen::VectorXf::Zero(this->numComponents);
+			c.numSpikes = 0;
+		}
+		published.publish(); // moves the generation on, so project() picks these up
+
+		centered = Eigen::VectorXf::Zero(this->waveformLength);
+		delta = Eigen::VectorXf::Zero(this->waveformLength);
+		feedQueue.resize(4096);
+
+		bThread = true;
+		thread = std::thread(&ONI::SpikeFeatureExtractor::update, this);
+
+	}
+
+	void stop(){
+		bThread = false;
+		if(thread.joinable()) thread.join();
+	}
+
+	// detection thread: score the spike and queue it to update the components
+	inline void process(ONI::Spike& spike){
+		project(spike);
+		feedQueue.push(spike); // if the background falls behind the ring counts the overflow
+	}
+
+	// fills in spike.features from the published components, leaves numFeatures at 0
+	// if the probe hasn't been solved yet. Only call from one thread (uses scratch)
+	inline void project(ONI::Spike& spike){
+
+		spike.numFeatures = 0;
+		if(spike.probe >= numProbes || spike.rawWaveformLength != waveformLength) return;
+
+		const uint64_t generation = published.getGeneration();
+		if(generation != projectGeneration){
+			projectComponents = published.get();
+			projectGeneration = generation;
+		}
+
+		const SpikeComponents& c = (*projectComponents)[spike.probe];
+		if(c.numSpikes == 0) return;
+
+		centered = Eigen::Map<const Eigen::VectorXf>(spike.rawWaveform, waveformLength) - c.mean;
+		Eigen::Map<Eigen::VectorXf>(spike.features, numComponents).noalias() = c.components * centered;
+		spike.numFeatures = numComponents;
+
+	}
+
+	// every probe's components as of the last refresh, they don't change while held
+	inline ComponentsSnapshot getComponents(){
+		return published.get();
+	}
+
+	inline size_t getNumComponents(){
+		return numComponents;
+	}
+
+	inline size_t getWaveformLength(){
+		return waveformLength;
+	}
+
+	// waveforms the background thread didn't get to before the queue filled up
+	inline size_t getDroppedSpikeCount(){
+		return feedQueue.getOverflowCount();
+	}
+
+	inline float getLastRefreshMs(){
+		return lastRefreshMs.load(std::memory_order_relaxed);
+	}
+
+	size_t refreshIntervalMs = 1000;
+	size_t minSpikesToSolve = 100;
+
+protected:
+
+	void update(){
+
+		using namespace std::chrono;
+
+		steady_clock::time_point nextRefresh = steady_clock::now() + milliseconds(refreshIntervalMs);
+
+		while(bThread){
+
+			bool bIdle = true;
+			for(ONI::Spike* spike = feedQueue.front(); spike != nullptr; spike = feedQueue.front()){
+				accumulate(*spike);
+				feedQueue.pop();
+				bIdle = false;
+			}
+
+			if(steady_clock::now() >= nextRefresh){
+				refresh();
+				nextRefresh = steady_clock::now() + milliseconds(refreshIntervalMs);
+			}
+
+			if(bIdle) std::this_thread::sleep_for(milliseconds(1));
+
+		}
+
+	}
+
+	// exponentially weighted mean and covariance, an exact running average until
+	// we've seen windowSpikes spikes and a sliding one after that
+	inline void accumulate(const ONI::Spike& spike){
+
+		if(spike.probe >= numProbes || spike.rawWaveformLength != waveformLength) return;
+
+		const size_t& probe = spike.probe;
+		++spikeCounts[probe];
+		const float alpha = 1.0f / std::min(spikeCounts[probe], (uint64_t)windowSpikes);
+
+		delta = Eigen::Map<const Eigen::VectorXf>(spike.rawWaveform, waveformLength) - means[probe];
+		means[probe] += alpha * delta;
+		covariances[probe] *= (1.0f - alpha);
+		covariances[probe].selfadjointView<Eigen::Lower>().rankUpdate(delta, alpha * (1.0f - alpha)); // only the lower half is kept
+
+		bChanged[probe] = true;
+
+	}
+
+	void refresh(){
+
+		using namespace std::chrono;
+		const steady_clock::time_point start = steady_clock::now();
+
+		const ComponentsSnapshot last = published.get();
+		std::vector<SpikeComponents>& nextComponents = published.back();
+		if(nextComponents.size() != numProbes) nextComponents.resize(numProbes);
+
+		for(size_t probe = 0; probe < numProbes; ++probe){
+
+			const SpikeComponents& current = (*last)[probe];
+			SpikeComponents& next = nextComponents[probe];
+
+			if(!bChanged[probe] || spikeCounts[probe] < minSpikesToSolve){
+				next = current; // same sizes when the snapshot is being reused, so no allocation
+				continue;
+			}
+
+			if(next.components.rows() != (Eigen::Index)numComponents || next.components.cols() != (Eigen::Index)waveformLength){
+				next.components.resize(numComponents, waveformLength);
+				next.explainedVariance.resize(numComponents);
+			}
+
+			solver.compute(covariances[probe]); // reads the lower half, eigen values come out ascending
+			const Eigen::VectorXf& values = solver.eigenvalues();
+			const float totalVariance = std::max(values.sum(), std::numeric_limits<float>::min());
+
+			for(size_t k = 0; k < numComponents; ++k){
+				const size_t column = waveformLength - 1 - k;
+				next.components.row(k) = solver.eigenvectors().col(column).transpose();
+				// eigen vectors only come out right up to sign, keep it steady so scores don't jump between solves
+				const float sign = current.numSpikes > 0 ? current.components.row(k).dot(next.components.row(k)) : next.components.row(k).sum();
+				if(sign < 0) next.components.row(k) *= -1.0f;
+				next.explainedVariance[k] = std::max(values[column], 0.0f) / totalVariance;
+			}
+
+			next.mean = means[probe];
+			next.numSpikes = spikeCounts[probe];
+			bChanged[probe] = false;
+
+		}
+
+		published.publish();
+		lastRefreshMs.store(duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0f, std::memory_order_relaxed);
+
+	}
+
+	size_t numProbes = 0;
+	size_t waveformLength = 0;
+	size_t numComponents = 0;
+	size_t windowSpikes = 0;
+
+	// background thread only
+	std::vector<Eigen::VectorXf> means;
+	std::vector<Eigen::MatrixXf> covariances;
+	std::vector<uint64_t> spikeCounts;
+	std::vector<bool> bChanged;
+	Eigen::VectorXf delta;
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> solver;
+
+	// detection thread only
+	Eigen::VectorXf centered;
+	ComponentsSnapshot projectComponents;	// held between refreshes
+	uint64_t projectGeneration = 0;
+
+	ONI::Snapshot<std::vector<SpikeComponents>> published; // written by setup (with the thread stopped) and refresh
+	std::atomic<float> lastRefreshMs = 0;
+
+	ONI::SpscRingBuffer<ONI::Spike> feedQueue;
+
+	std::atomic_bool bThread = false;
+	std::thread thread;
+
+};
+
+} // namespace ONI
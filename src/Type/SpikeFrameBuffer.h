@@ -70,6 +70,10 @@ public:
 	}
 
 	inline bool push(const ONI::Frame::Rhs2116MultiFrame& dataFrame){
+		return push(dataFrame.spikes);
+	}
+
+	inline bool push(const std::bitset<MAX_NUM_MULTIPROBES>& spikes){
 
 		//const std::lock_guard<std::mutex> lock(mutex);
 		bool bForceSpike = false;
@@ -80,9 +84,9 @@ public:
 		}
 
 		for(size_t probe = 0; probe < numProbes; ++probe) {
-			if(dataFrame.spikes[probe]){
+			if(spikes[probe]){
 				bForceSpike = true;
-				spikeProbeData[probe][t] = dataFrame.spikes[probe] ? (float)(64 - probe) * 10.0 : -10.0f;
+				spikeProbeData[probe][t] = spikes[probe] ? (float)(64 - probe) * 10.0 : -10.0f;
 				spikeProbeData[probe][t + bufferSize] = spikeProbeData[probe][t + bufferSize * 2] = spikeProbeData[probe][t];
 			}
 		}
@@ -94,7 +98,7 @@ public:
 			for (size_t probe = 0; probe < numProbes; ++probe) {
 
 
-				spikeProbeData[probe][currentBufferIndex] = dataFrame.spikes[probe] ? (float)(64 - probe) * 10.0 : -10.0f;
+				spikeProbeData[probe][currentBufferIndex] = spikes[probe] ? (float)(64 - probe) * 10.0 : -10.0f;
 				spikeProbeData[probe][currentBufferIndex + bufferSize] = spikeProbeData[probe][currentBufferIndex + bufferSize * 2] = spikeProbeData[probe][currentBufferIndex];
 
 			}
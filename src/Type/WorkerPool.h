@@ -0,0 +1,151 @@
+//
+//  WorkerPool.h
+//
+//  Created by Matt Gingold on 17.10.2026.
+//
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "../Type/Log.h"
+
+#pragma once
+
+namespace ONI{
+
+// Fixed pool of worker threads for fork/join style jobs
+//
+// run(numJobs, job) calls job(0) ... job(numJobs - 1) spread across the workers
+// and the calling thread and returns once they're all done. Jobs are handed out
+// from a shared counter rather than a fixed split, so a worker that finishes its
+// job early just takes the next one. Only one thread should call run() at a time
+
+class WorkerPool{
+
+public:
+
+	~WorkerPool(){
+		stop();
+	}
+
+	// numWorkers extra threads, the thread calling run() always does jobs too
+	void start(const size_t& numWorkers){
+
+		stop();
+
+		bStop = false;
+		generation = 0;
+		activeWorkers = 0;
+
+		for(size_t i = 0; i < numWorkers; ++i){
+			workers.emplace_back(&ONI::WorkerPool::work, this);
+		}
+
+	}
+
+	void stop(){
+
+		{
+			const std::lock_guard<std::mutex> lock(mutex);
+			bStop = true;
+		}
+		wakeCondition.notify_all();
+
+		for(std::thread& worker : workers){
+			if(worker.joinable()) worker.join();
+		}
+		workers.clear();
+
+	}
+
+	void run(const size_t& numJobs, const std::function<void(const size_t&)>& job){
+
+		if(workers.size() == 0 || numJobs < 2){ // nothing to share, skip the wake ups
+			for(size_t i = 0; i < numJobs; ++i) job(i);
+			return;
+		}
+
+		{
+			const std::lock_guard<std::mutex> lock(mutex);
+			currentJob = &job;
+			jobCount = numJobs;
+			nextJob = 0;
+			activeWorkers = workers.size();
+			++generation;
+		}
+		wakeCondition.notify_all();
+
+		drain(job, numJobs);
+
+		// every worker has to check out of this generation before the next run resets the job counter
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [&]{ return activeWorkers == 0; });
+
+	}
+
+	inline size_t size(){
+		return workers.size();
+	}
+
+protected:
+
+	void work(){
+
+		uint64_t lastGeneration = 0;
+
+		while(true){
+
+			const std::function<void(const size_t&)>* job = nullptr;
+			size_t numJobs = 0;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeCondition.wait(lock, [&]{ return bStop || generation != lastGeneration; });
+				if(bStop) return;
+				lastGeneration = generation;
+				job = currentJob;
+				numJobs = jobCount;
+			}
+
+			drain(*job, numJobs);
+
+			{
+				const std::lock_guard<std::mutex> lock(mutex);
+				if(--activeWorkers == 0) doneCondition.notify_one();
+			}
+
+		}
+
+	}
+
+	inline void drain(const std::function<void(const size_t&)>& job, const size_t& numJobs){
+		for(size_t i = nextJob.fetch_add(1, std::memory_order_relaxed); i < numJobs; i = nextJob.fetch_add(1, std::memory_order_relaxed)){
+			job(i);
+		}
+	}
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+
+	const std::function<void(const size_t&)>* currentJob = nullptr;
+	size_t jobCount = 0;
+	size_t activeWorkers = 0;
+	uint64_t generation = 0;
+	bool bStop = false;
+
+	std::atomic<size_t> nextJob = 0;
+
+};
+
+} // namespace ONI